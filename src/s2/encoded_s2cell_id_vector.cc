@@ -150,9 +150,69 @@ bool EncodedS2CellIdVector::Init(Decoder* decoder) {
   } else {
     shift_ = 2 * shift_code;
   }
+  search_keys_.clear();
+  search_blocks_.clear();
   return deltas_.Init(decoder);
 }
 
+constexpr int EncodedS2CellIdVector::kSearchBlockSize;
+
+void EncodedS2CellIdVector::BuildSearchIndex() {
+  // Element 0 of the Eytzinger layout is unused, so that the children of
+  // entry k are simply 2k and 2k+1.
+  const size_t num_blocks = (size() + kSearchBlockSize - 1) / kSearchBlockSize;
+  search_keys_.assign(num_blocks + 1, 0);
+  search_blocks_.assign(num_blocks + 1, 0);
+  if (num_blocks == 0) return;
+
+  // An in-order traversal of the implicit tree visits the blocks in sorted
+  // order.  We use an explicit stack rather than recursion.
+  vector<size_t> stack;
+  size_t block = 0;
+  for (size_t k = 1; k <= num_blocks || !stack.empty(); ) {
+    if (k <= num_blocks) {
+      stack.push_back(k);
+      k = 2 * k;
+    } else {
+      k = stack.back();
+      stack.pop_back();
+      search_keys_[k] = deltas_[block * kSearchBlockSize];
+      search_blocks_[k] = block++;
+      k = 2 * k + 1;
+    }
+  }
+  S2_DCHECK_EQ(block, num_blocks);
+}
+
+size_t EncodedS2CellIdVector::search_index_bytes() const {
+  return search_keys_.capacity() * sizeof(uint64) +
+         search_blocks_.capacity() * sizeof(uint32);
+}
+
+size_t EncodedS2CellIdVector::SearchIndexLowerBound(uint64 target) const {
+  // Find the first block whose first element is >= target.  The loop below
+  // descends the implicit tree without any data-dependent branches; the
+  // result is encoded in the bits of "k" (see Khuong and Morin, "Array
+  // Layouts for Comparison-Based Searching").
+  const size_t num_blocks = search_keys_.size() - 1;
+  const uint64* keys = search_keys_.data();
+  size_t k = 1;
+  while (k <= num_blocks) {
+    k = 2 * k + (keys[k] < target);
+  }
+  // Cancel the trailing right turns (and the final left turn) to find the
+  // entry where the search last went left, if any.
+  k >>= Bits::FindLSBSetNonZero64(~static_cast<uint64>(k)) + 1;
+  size_t block = (k == 0) ? num_blocks : search_blocks_[k];
+
+  // All elements up to and including the first element of the previous block
+  // are < target, and the first element of "block" (if any) is >= target.
+  if (block == 0) return 0;
+  size_t lo = (block - 1) * kSearchBlockSize + 1;
+  size_t hi = min(block * kSearchBlockSize, size());
+  return deltas_.lower_bound(target, lo, hi);
+}
+
 vector<S2CellId> EncodedS2CellIdVector::Decode() const {
   vector<S2CellId> result(size());
   for (int i = 0; i < size(); ++i) {
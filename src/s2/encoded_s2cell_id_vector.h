@@ -18,6 +18,7 @@
 #ifndef S2_ENCODED_S2CELL_ID_VECTOR_H_
 #define S2_ENCODED_S2CELL_ID_VECTOR_H_
 
+#include <vector>
 #include "s2/third_party/absl/types/span.h"
 #include "s2/encoded_uint_vector.h"
 #include "s2/s2cell_id.h"
@@ -70,14 +71,46 @@ class EncodedS2CellIdVector {
   // REQUIRES: The vector elements are sorted in non-decreasing order.
   size_t lower_bound(S2CellId target) const;
 
+  // Builds an auxiliary structure that speeds up lower_bound() on large
+  // vectors.  Every kSearchBlockSize-th value is copied into a small array
+  // stored in Eytzinger (breadth-first) order, which keeps the top levels of
+  // the search in a few cache lines and makes the memory access pattern
+  // predictable.  The final search is then restricted to a single block.
+  //
+  // This costs one decoded value and 12 bytes per block (i.e., less than
+  // half a byte per element), and is only worthwhile for vectors that are
+  // searched many times.  The results of lower_bound() are unchanged.
+  // Calling Init() discards the search structure.
+  void BuildSearchIndex();
+
+  // Returns true if BuildSearchIndex() has been called since Init().
+  bool has_search_index() const { return !search_keys_.empty(); }
+
+  // Returns the number of bytes used by the auxiliary search structure.
+  size_t search_index_bytes() const;
+
   // Decodes and returns the entire original vector.
   std::vector<S2CellId> Decode() const;
 
+  // The number of consecutive elements represented by each entry of the
+  // auxiliary search structure.
+  static constexpr int kSearchBlockSize = 32;
+
  private:
+  size_t SearchIndexLowerBound(uint64 target) const;
+
   // Values are decoded as (base_ + (deltas_[i] << shift_)).
   EncodedUintVector<uint64> deltas_;
   uint64 base_;
   uint8 shift_;
+
+  // The auxiliary search structure (see BuildSearchIndex).  search_keys_[k]
+  // (for k >= 1) is the delta of the first element of block search_blocks_[k],
+  // where the blocks are arranged in Eytzinger order: the children of entry k
+  // are entries 2k and 2k+1.  Both vectors are empty if there is no search
+  // index.
+  std::vector<uint64> search_keys_;
+  std::vector<uint32> search_blocks_;
 };
 
 
@@ -101,8 +134,9 @@ inline size_t EncodedS2CellIdVector::lower_bound(S2CellId target) const {
   // ensure that "target" doesn't wrap around past zero when we do this.
   if (target.id() <= base_) return 0;
   if (target >= S2CellId::End(S2CellId::kMaxLevel)) return size();
-  return deltas_.lower_bound(
-      (target.id() - base_ + (1ULL << shift_) - 1) >> shift_);
+  uint64 delta = (target.id() - base_ + (1ULL << shift_) - 1) >> shift_;
+  if (has_search_index()) return SearchIndexLowerBound(delta);
+  return deltas_.lower_bound(delta);
 }
 
 }  // namespace s2coding
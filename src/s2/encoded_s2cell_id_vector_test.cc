@@ -17,9 +17,11 @@
 
 #include "s2/encoded_s2cell_id_vector.h"
 
+#include <algorithm>
 #include <vector>
 #include <gtest/gtest.h>
 #include "s2/third_party/absl/memory/memory.h"
+#include "s2/third_party/absl/strings/str_cat.h"
 #include "s2/s2loop.h"
 #include "s2/s2pointutil.h"
 #include "s2/s2shape_index.h"
@@ -229,4 +231,40 @@ TEST(EncodedS2CellIdVector, LowerBoundLimits) {
   EXPECT_EQ(2, cell_ids.lower_bound(S2CellId::Sentinel()));
 }
 
+TEST(EncodedS2CellIdVector, SearchIndexLowerBound) {
+  // Check that the auxiliary search structure does not change the results of
+  // lower_bound(), including for vectors whose size is not a multiple of the
+  // block size and for targets that fall between the sampled elements.
+  const int kBlockSize = EncodedS2CellIdVector::kSearchBlockSize;
+  for (int n : {0, 1, kBlockSize - 1, kBlockSize, kBlockSize + 1,
+                7 * kBlockSize + 3, 100 * kBlockSize}) {
+    SCOPED_TRACE(absl::StrCat("n = ", n));
+    vector<S2CellId> ids;
+    for (int i = 0; i < n; ++i) {
+      ids.push_back(S2Testing::GetRandomCellId(S2Testing::rnd.Uniform(31)));
+    }
+    std::sort(ids.begin(), ids.end());
+    Encoder encoder;
+    EncodedS2CellIdVector plain = MakeEncodedS2CellIdVector(ids, &encoder);
+    EncodedS2CellIdVector indexed = plain;
+    indexed.BuildSearchIndex();
+    EXPECT_TRUE(indexed.has_search_index());
+    vector<S2CellId> targets = {S2CellId::None(), S2CellId::Sentinel()};
+    for (S2CellId id : ids) {
+      targets.push_back(id);
+      targets.push_back(id.range_min());
+      targets.push_back(id.next());
+    }
+    for (int i = 0; i < 200; ++i) {
+      targets.push_back(S2Testing::GetRandomCellId());
+    }
+    for (S2CellId target : targets) {
+      size_t expected = std::lower_bound(ids.begin(), ids.end(), target) -
+                        ids.begin();
+      EXPECT_EQ(expected, plain.lower_bound(target));
+      EXPECT_EQ(expected, indexed.lower_bound(target));
+    }
+  }
+}
+
 }  // namespace s2coding
@@ -0,0 +1,71 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/encoded_s2cell_index.h"
+
+#include <algorithm>
+
+using std::vector;
+
+using Label = EncodedS2CellIndex::Label;
+
+EncodedS2CellIndex::EncodedS2CellIndex() {
+}
+
+bool EncodedS2CellIndex::Init(Decoder* decoder) {
+  uint64 num_range_cells_version;
+  if (!decoder->get_varint64(&num_range_cells_version)) return false;
+  int version = num_range_cells_version & 3;
+  if (version != S2CellIndex::kCurrentEncodingVersionNumber) return false;
+  num_range_cells_ = num_range_cells_version >> 2;
+
+  if (!cell_ids_.Init(decoder)) return false;
+  if (!cell_labels_.Init(decoder)) return false;
+  if (!cell_parents_.Init(decoder)) return false;
+  if (!range_start_ids_.Init(decoder)) return false;
+  if (!range_contents_.Init(decoder)) return false;
+  if (!range_labels_.Init(decoder)) return false;
+  return (cell_labels_.size() == cell_ids_.size() &&
+          cell_parents_.size() == cell_ids_.size() &&
+          range_start_ids_.size() > 0 &&
+          range_contents_.size() == range_start_ids_.size() &&
+          range_labels_.size() == range_start_ids_.size());
+}
+
+size_t EncodedS2CellIndex::SpaceUsed() const {
+  return sizeof(*this);
+}
+
+int EncodedS2CellIndex::SeekRange(S2CellId target) const {
+  // Find the last range whose start_id is <= target.
+  return range_start_ids_.lower_bound(S2CellId(target.id() + 1)) - 1;
+}
+
+bool EncodedS2CellIndex::VisitIntersectingCells(
+    const S2CellUnion& target, const CellVisitor& visitor) const {
+  return s2internal::VisitIntersectingCells(*this, target, visitor);
+}
+
+vector<Label> EncodedS2CellIndex::GetIntersectingLabels(
+    const S2CellUnion& target) const {
+  vector<Label> labels;
+  GetIntersectingLabels(target, &labels);
+  return labels;
+}
+
+void EncodedS2CellIndex::GetIntersectingLabels(const S2CellUnion& target,
+                                               vector<Label>* labels) const {
+  s2internal::GetIntersectingLabels(*this, target, labels);
+}
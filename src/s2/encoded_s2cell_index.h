@@ -0,0 +1,177 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef S2_ENCODED_S2CELL_INDEX_H_
+#define S2_ENCODED_S2CELL_INDEX_H_
+
+#include <vector>
+
+#include "s2/encoded_s2cell_id_vector.h"
+#include "s2/encoded_uint_vector.h"
+#include "s2/s2cell_index.h"
+
+// EncodedS2CellIndex is a read-only S2CellIndex that is initialized directly
+// from the output of S2CellIndex::Encode().  Initialization takes constant
+// time and the encoded data is not copied; instead values are decoded only
+// when they are accessed.  This makes it possible to query a large index
+// immediately after mapping it into memory, e.g.:
+//
+//   S2CellIndex index;
+//   ... add cells ...
+//   index.Build();
+//   Encoder encoder;
+//   index.Encode(&encoder);
+//   ... write the encoded data to a file ...
+//
+//   Decoder decoder(data, size);  // e.g., a memory-mapped file
+//   EncodedS2CellIndex encoded_index;
+//   if (!encoded_index.Init(&decoder)) ...
+//   vector<Label> labels = encoded_index.GetIntersectingLabels(target);
+//
+// The interface is the same as S2CellIndex, except that there are no methods
+// for adding cells.  Note that decoding values on demand makes queries
+// somewhat slower than with S2CellIndex (typically less than 2x), so
+// S2CellIndex is still preferable for indexes that are built once and then
+// queried many times within the same process.
+//
+// This class is thread-safe for concurrent readers.
+class EncodedS2CellIndex {
+ public:
+  using Label = S2CellIndex::Label;
+  using LabelledCell = S2CellIndex::LabelledCell;
+  using CellVisitor = S2CellIndex::CellVisitor;
+
+  // Creates an index that must be initialized by calling Init().
+  EncodedS2CellIndex();
+
+  // Initializes the EncodedS2CellIndex from data that was encoded using
+  // S2CellIndex::Encode(), returning true on success.
+  //
+  // REQUIRES: The Decoder data buffer must outlive this object.
+  bool Init(Decoder* decoder);
+
+  // Returns the number of (cell_id, label) pairs in the index.
+  int num_cells() const;
+
+  // Returns the approximate amount of memory used by this object (in bytes),
+  // not including the encoded data.
+  size_t SpaceUsed() const;
+
+  // Visits all (cell_id, label) pairs in the given index that intersect the
+  // given S2CellUnion "target", terminating early if the given CellVisitor
+  // function returns false (in which case VisitIntersectingCells returns false
+  // as well).  See S2CellIndex::VisitIntersectingCells for details.
+  bool VisitIntersectingCells(const S2CellUnion& target,
+                              const CellVisitor& visitor) const;
+
+  // Convenience function that returns the labels of all indexed cells that
+  // intersect the given S2CellUnion "target".  The output contains each label
+  // at most once, but is not sorted.
+  std::vector<Label> GetIntersectingLabels(const S2CellUnion& target) const;
+
+  // This version can be more efficient when it is called many times, since
+  // it does not require allocating a new vector on each call.
+  void GetIntersectingLabels(const S2CellUnion& target,
+                             std::vector<Label>* labels) const;
+
+  // The iterator types have the same interface as those of S2CellIndex.
+  using CellIterator = s2internal::S2CellIndexCellIterator<EncodedS2CellIndex>;
+  using RangeIterator =
+      s2internal::S2CellIndexRangeIterator<EncodedS2CellIndex>;
+  using NonEmptyRangeIterator =
+      s2internal::S2CellIndexNonEmptyRangeIterator<EncodedS2CellIndex>;
+  using ContentsIterator =
+      s2internal::S2CellIndexContentsIterator<EncodedS2CellIndex>;
+
+ private:
+  template <class Index> friend class s2internal::S2CellIndexCellIterator;
+  template <class Index> friend class s2internal::S2CellIndexRangeIterator;
+  template <class Index>
+  friend class s2internal::S2CellIndexContentsIterator;
+
+  // The methods used by the iterators (see S2CellIndex).
+  int num_tree_nodes() const;
+  S2CellId tree_cell_id(int i) const;
+  Label tree_label(int i) const;
+  int32 tree_parent(int i) const;
+  int num_ranges() const;
+  S2CellId range_start_id(int i) const;
+  int32 range_contents(int i) const;
+  Label range_label(int i) const;
+  int SeekRange(S2CellId target) const;
+
+  // The cell tree nodes that have children (see S2CellIndex), in preorder.
+  // Labels are stored directly, and parents are stored as (parent + 1).
+  s2coding::EncodedS2CellIdVector cell_ids_;
+  s2coding::EncodedUintVector<uint32> cell_labels_;
+  s2coding::EncodedUintVector<uint32> cell_parents_;
+
+  // The leaf cell ranges (including the final sentinel).  Contents and
+  // labels are stored as (value + 1), so that zero represents -1 (i.e., no
+  // contents and no leaf node respectively).
+  s2coding::EncodedS2CellIdVector range_start_ids_;
+  s2coding::EncodedUintVector<uint32> range_contents_;
+  s2coding::EncodedUintVector<uint32> range_labels_;
+
+  // The number of cell tree leaf nodes that are stored in the ranges.
+  int num_range_cells_ = 0;
+
+  EncodedS2CellIndex(const EncodedS2CellIndex&) = delete;
+  void operator=(const EncodedS2CellIndex&) = delete;
+};
+
+
+//////////////////   Implementation details follow   ////////////////////
+
+
+inline int EncodedS2CellIndex::num_cells() const {
+  return cell_ids_.size() + num_range_cells_;
+}
+
+inline int EncodedS2CellIndex::num_tree_nodes() const {
+  return cell_ids_.size();
+}
+
+inline int EncodedS2CellIndex::num_ranges() const {
+  // Note that the last range is a sentinel value.
+  return static_cast<int>(range_start_ids_.size()) - 1;
+}
+
+inline S2CellId EncodedS2CellIndex::tree_cell_id(int i) const {
+  return cell_ids_[i];
+}
+
+inline EncodedS2CellIndex::Label EncodedS2CellIndex::tree_label(int i) const {
+  return cell_labels_[i];
+}
+
+inline int32 EncodedS2CellIndex::tree_parent(int i) const {
+  return static_cast<int32>(cell_parents_[i]) - 1;
+}
+
+inline S2CellId EncodedS2CellIndex::range_start_id(int i) const {
+  return range_start_ids_[i];
+}
+
+inline int32 EncodedS2CellIndex::range_contents(int i) const {
+  return static_cast<int32>(range_contents_[i]) - 1;
+}
+
+inline EncodedS2CellIndex::Label EncodedS2CellIndex::range_label(int i)
+    const {
+  return static_cast<Label>(range_labels_[i]) - 1;
+}
+
+#endif  // S2_ENCODED_S2CELL_INDEX_H_
@@ -0,0 +1,186 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/encoded_s2cell_index.h"
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "s2/s2cell_id.h"
+#include "s2/s2cell_union.h"
+#include "s2/s2testing.h"
+
+using std::string;
+using std::vector;
+
+using Label = S2CellIndex::Label;
+using LabelledCell = S2CellIndex::LabelledCell;
+
+namespace {
+
+S2CellUnion GetRandomCellUnion() {
+  vector<S2CellId> ids;
+  for (int j = 0; j < 10; ++j) {
+    ids.push_back(S2Testing::GetRandomCellId());
+  }
+  return S2CellUnion(std::move(ids));
+}
+
+// Verifies that every method of "encoded_index" returns the same results as
+// the corresponding S2CellIndex method.
+void ExpectIndexesEqual(const S2CellIndex& index,
+                        const EncodedS2CellIndex& encoded_index) {
+  EXPECT_EQ(index.num_cells(), encoded_index.num_cells());
+
+  vector<LabelledCell> expected, actual;
+  for (S2CellIndex::CellIterator it(&index); !it.done(); it.Next()) {
+    expected.push_back(it.labelled_cell());
+  }
+  for (EncodedS2CellIndex::CellIterator it(&encoded_index); !it.done();
+       it.Next()) {
+    actual.push_back(it.labelled_cell());
+  }
+  EXPECT_EQ(expected, actual);
+
+  // Visit the ranges in order using a single ContentsIterator (which
+  // exercises duplicate elimination), and also visit each range separately.
+  S2CellIndex::RangeIterator range(&index);
+  EncodedS2CellIndex::RangeIterator encoded_range(&encoded_index);
+  S2CellIndex::ContentsIterator contents(&index);
+  EncodedS2CellIndex::ContentsIterator encoded_contents(&encoded_index);
+  range.Begin();
+  encoded_range.Begin();
+  for (; !range.done(); range.Next(), encoded_range.Next()) {
+    ASSERT_FALSE(encoded_range.done());
+    ASSERT_EQ(range.start_id(), encoded_range.start_id());
+    ASSERT_EQ(range.limit_id(), encoded_range.limit_id());
+    EXPECT_EQ(range.is_empty(), encoded_range.is_empty());
+    for (int clear = 0; clear < 2; ++clear) {
+      if (clear) {
+        contents.Clear();
+        encoded_contents.Clear();
+      }
+      expected.clear();
+      actual.clear();
+      for (contents.StartUnion(range); !contents.done(); contents.Next()) {
+        expected.push_back(contents.labelled_cell());
+      }
+      for (encoded_contents.StartUnion(encoded_range);
+           !encoded_contents.done(); encoded_contents.Next()) {
+        actual.push_back(encoded_contents.labelled_cell());
+      }
+      EXPECT_EQ(expected, actual);
+    }
+  }
+  EXPECT_TRUE(encoded_range.done());
+  EXPECT_EQ(range.start_id(), encoded_range.start_id());
+
+  S2CellIndex::NonEmptyRangeIterator non_empty(&index);
+  EncodedS2CellIndex::NonEmptyRangeIterator encoded_non_empty(&encoded_index);
+  non_empty.Begin();
+  encoded_non_empty.Begin();
+  for (; !non_empty.done(); non_empty.Next(), encoded_non_empty.Next()) {
+    ASSERT_EQ(non_empty.start_id(), encoded_non_empty.start_id());
+  }
+  EXPECT_TRUE(encoded_non_empty.done());
+  while (non_empty.Prev()) {
+    ASSERT_TRUE(encoded_non_empty.Prev());
+    ASSERT_EQ(non_empty.start_id(), encoded_non_empty.start_id());
+  }
+  EXPECT_FALSE(encoded_non_empty.Prev());
+
+  for (int i = 0; i < 100; ++i) {
+    S2CellId target = S2Testing::GetRandomCellId(S2CellId::kMaxLevel);
+    range.Seek(target);
+    encoded_range.Seek(target);
+    EXPECT_EQ(range.start_id(), encoded_range.start_id());
+    non_empty.Seek(target);
+    encoded_non_empty.Seek(target);
+    EXPECT_EQ(non_empty.start_id(), encoded_non_empty.start_id());
+    int n = S2Testing::rnd.Uniform(5);
+    EXPECT_EQ(range.Advance(n), encoded_range.Advance(n));
+    EXPECT_EQ(range.start_id(), encoded_range.start_id());
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    S2CellUnion target = GetRandomCellUnion();
+    EXPECT_EQ(index.GetIntersectingLabels(target),
+              encoded_index.GetIntersectingLabels(target));
+  }
+}
+
+// Encodes "index", initializes "encoded_index" from "encoder", and verifies
+// that the two indexes are equivalent.
+void TestEncodedIndex(const S2CellIndex& index, Encoder* encoder,
+                      EncodedS2CellIndex* encoded_index) {
+  index.Encode(encoder);
+  Decoder decoder(encoder->base(), encoder->length());
+  ASSERT_TRUE(encoded_index->Init(&decoder));
+  EXPECT_EQ(0, decoder.avail());
+  ExpectIndexesEqual(index, *encoded_index);
+}
+
+TEST(EncodedS2CellIndex, Empty) {
+  S2CellIndex index;
+  index.Build();
+  Encoder encoder;
+  EncodedS2CellIndex encoded_index;
+  TestEncodedIndex(index, &encoder, &encoded_index);
+  EXPECT_EQ(0, encoded_index.num_cells());
+  EXPECT_TRUE(EncodedS2CellIndex::CellIterator(&encoded_index).done());
+}
+
+TEST(EncodedS2CellIndex, OverlappingCells) {
+  S2CellIndex index;
+  vector<string> strs = {"0/", "0/1", "0/12", "0/123", "0/2", "0/2",
+                         "3/0120", "3/013", "5/33333333"};
+  for (int i = 0; i < strs.size(); ++i) {
+    index.Add(S2CellId::FromDebugString(strs[i]), i);
+  }
+  index.Build();
+  Encoder encoder;
+  EncodedS2CellIndex encoded_index;
+  TestEncodedIndex(index, &encoder, &encoded_index);
+}
+
+TEST(EncodedS2CellIndex, RandomCellUnions) {
+  for (int iter = 0; iter < 10; ++iter) {
+    S2CellIndex index;
+    for (int i = 0; i < 100; ++i) {
+      index.Add(GetRandomCellUnion(), i);
+    }
+    index.Build();
+    Encoder encoder;
+    EncodedS2CellIndex encoded_index;
+    TestEncodedIndex(index, &encoder, &encoded_index);
+  }
+}
+
+TEST(EncodedS2CellIndex, TruncatedData) {
+  S2CellIndex index;
+  for (int i = 0; i < 20; ++i) {
+    index.Add(GetRandomCellUnion(), i);
+  }
+  index.Build();
+  Encoder encoder;
+  index.Encode(&encoder);
+  for (size_t len = 0; len < encoder.length(); ++len) {
+    Decoder decoder(encoder.base(), len);
+    EncodedS2CellIndex encoded_index;
+    EXPECT_FALSE(encoded_index.Init(&decoder)) << len;
+  }
+}
+
+}  // namespace
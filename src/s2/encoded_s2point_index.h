@@ -0,0 +1,431 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef S2_ENCODED_S2POINT_INDEX_H_
+#define S2_ENCODED_S2POINT_INDEX_H_
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "s2/base/spinlock.h"
+#include "s2/encoded_s2cell_id_vector.h"
+#include "s2/encoded_s2point_vector.h"
+#include "s2/encoded_string_vector.h"
+#include "s2/encoded_uint_vector.h"
+#include "s2/s2coords.h"
+#include "s2/s2point_index.h"
+#include "s2/util/bits/bits.h"
+#include "s2/util/coding/coder.h"
+#include "s2/util/coding/varint.h"
+
+namespace s2coding {
+
+// A DataCoder specifies how the Data values of an S2PointIndex are encoded.
+// It must provide the following methods:
+//
+//   // Appends the encoding of "data" to "encoder".
+//   void Encode(const Data& data, Encoder* encoder) const;
+//
+//   // Decodes a value previously written by Encode().  Returns false if the
+//   // encoded data is invalid.
+//   bool Decode(Decoder* decoder, Data* data) const;
+//
+// EmptyDataCoder is used for indexes with no auxiliary data (i.e., the
+// default Data type of S2PointIndex), and VarintDataCoder encodes integral
+// types as varints.
+class EmptyDataCoder {
+ public:
+  void Encode(const std::tuple<>& data, Encoder* encoder) const {}
+  bool Decode(Decoder* decoder, std::tuple<>* data) const { return true; }
+};
+
+// Encodes integral values (such as array indices) as varints.  Note that
+// negative values always use the maximum length encoding.
+template <class T>
+class VarintDataCoder {
+ public:
+  void Encode(const T& data, Encoder* encoder) const {
+    encoder->Ensure(Varint::kMax64);
+    encoder->put_varint64(static_cast<uint64>(data));
+  }
+  bool Decode(Decoder* decoder, T* data) const {
+    uint64 value;
+    if (!decoder->get_varint64(&value)) return false;
+    *data = static_cast<T>(value);
+    return true;
+  }
+};
+
+}  // namespace s2coding
+
+// Encodes the contents of an S2PointIndex in a format that can later be
+// decoded as an EncodedS2PointIndex.  The points are stored in the order
+// they are visited by S2PointIndex::Iterator, and the Data values are
+// encoded using "data_coder".  Points that are S2CellId centers (e.g.,
+// points that have been snapped) are not stored at all; instead they are
+// reconstructed from the leaf S2CellId of the point, which the index needs
+// anyway, together with the level of the cell whose center they are.
+//
+// REQUIRES: "encoder" uses the default constructor, so that its buffer
+//           can be enlarged as necessary by calling Ensure(int).
+template <class Data, class DataCoder>
+void EncodeS2PointIndex(const S2PointIndex<Data>& index,
+                        const DataCoder& data_coder, Encoder* encoder);
+
+// EncodedS2PointIndex is a read-only S2PointIndex that can be initialized
+// directly from the output of EncodeS2PointIndex() (for example, from a
+// memory-mapped file) in constant time.  Points and their associated data
+// are decoded only when they are accessed by an iterator.
+//
+// The Iterator class has the same interface as S2PointIndex::Iterator, so
+// an EncodedS2PointIndex can be searched using S2ClosestPointQueryBase by
+// specifying it as the IndexType template argument:
+//
+//   using Index = EncodedS2PointIndex<int, s2coding::VarintDataCoder<int>>;
+//   Decoder decoder(data, length);
+//   Index index;
+//   if (!index.Init(&decoder)) ...
+//   S2ClosestPointQueryBase<S2MinDistance, int, Index> query(&index);
+//
+// Each point that is accessed is decoded once and then cached, so that the
+// references returned by Iterator::point_data() remain valid for the
+// lifetime of the index.  The cache is a single array that is allocated by
+// Init() but not initialized, so the memory used is proportional to the
+// number of points accessed.  This class is thread-safe for concurrent
+// readers.
+template <class Data = std::tuple<> /*empty class*/,
+          class DataCoder = s2coding::EmptyDataCoder>
+class EncodedS2PointIndex {
+ public:
+  using PointData = typename S2PointIndex<Data>::PointData;
+
+  // Constructs an uninitialized object; requires Init() to be called.
+  EncodedS2PointIndex() {}
+  ~EncodedS2PointIndex();
+
+  // Initializes the EncodedS2PointIndex, returning false on errors.
+  //
+  // REQUIRES: The Decoder data buffer must outlive this object.
+  bool Init(Decoder* decoder, const DataCoder& data_coder = DataCoder());
+
+  // Returns the number of points in the index.
+  int num_points() const { return ids_.size(); }
+
+  // Returns the number of bytes of memory used by this object, not counting
+  // the encoded data.
+  size_t SpaceUsed() const;
+
+  // An iterator with the same interface as S2PointIndex::Iterator.
+  class Iterator {
+   public:
+    // Default constructor; must be followed by a call to Init().
+    Iterator() : index_(nullptr), pos_(0) {}
+
+    // Convenience constructor that calls Init().
+    explicit Iterator(const EncodedS2PointIndex* index) { Init(index); }
+
+    // Initializes an iterator for the given EncodedS2PointIndex.  If the
+    // index is non-empty, the iterator is positioned at the first point.
+    void Init(const EncodedS2PointIndex* index) {
+      index_ = index;
+      pos_ = 0;
+    }
+
+    // The S2CellId for the current index entry.
+    // REQUIRES: !done()
+    S2CellId id() const { return index_->ids_[pos_]; }
+
+    // The point associated with the current index entry.
+    // REQUIRES: !done()
+    const S2Point& point() const { return point_data().point(); }
+
+    // The client-supplied data associated with the current index entry.
+    // REQUIRES: !done()
+    const Data& data() const { return point_data().data(); }
+
+    // The (S2Point, data) pair associated with the current index entry.
+    // REQUIRES: !done()
+    const PointData& point_data() const {
+      S2_DCHECK(!done());
+      return index_->GetPointData(pos_);
+    }
+
+    // Returns true if the iterator is positioned past the last index entry.
+    bool done() const { return pos_ == index_->num_points(); }
+
+    // Positions the iterator at the first index entry (if any).
+    void Begin() { pos_ = 0; }
+
+    // Positions the iterator so that done() is true.
+    void Finish() { pos_ = index_->num_points(); }
+
+    // Advances the iterator to the next index entry.
+    // REQUIRES: !done()
+    void Next() {
+      S2_DCHECK(!done());
+      ++pos_;
+    }
+
+    // If the iterator is already positioned at the beginning, returns false.
+    // Otherwise positions the iterator at the previous entry and returns
+    // true.
+    bool Prev() {
+      if (pos_ == 0) return false;
+      --pos_;
+      return true;
+    }
+
+    // Positions the iterator at the first entry with id() >= target, or at
+    // the end of the index if no such entry exists.
+    void Seek(S2CellId target) { pos_ = index_->ids_.lower_bound(target); }
+
+   private:
+    const EncodedS2PointIndex* index_;
+    int pos_;
+  };
+
+ private:
+  friend class Iterator;
+  template <class D, class C>
+  friend void EncodeS2PointIndex(const S2PointIndex<D>&, const C&, Encoder*);
+
+  static const unsigned char kCurrentEncodingVersionNumber = 0;
+
+  // Values of the per-point level byte other than valid S2CellId levels.
+  // kExplicitPoint means that the point is stored in points_, and
+  // kMixedLevels (which is only used as the value of uniform_level_) means
+  // that the level of each point is stored in levels_.
+  static const uint8 kExplicitPoint = 0xff;
+  static const uint8 kMixedLevels = 0xfe;
+
+  using PointDataStorage =
+      typename std::aligned_storage<sizeof(PointData),
+                                    alignof(PointData)>::type;
+
+  // Returns the PointData for the given point, decoding it if necessary.
+  const PointData& GetPointData(int i) const;
+  const PointData& DecodePointData(int i) const;
+  S2Point DecodePoint(int i) const;
+
+  bool point_decoded(int i) const {
+    uint64 group_bits = decoded_[i >> 6].load(std::memory_order_acquire);
+    return (group_bits & (1ULL << (i & 63))) != 0;
+  }
+
+  const PointData& point_data(int i) const {
+    return *reinterpret_cast<const PointData*>(&point_data_[i]);
+  }
+
+  DataCoder data_coder_;
+
+  // The leaf S2CellId of each point, in sorted order.
+  s2coding::EncodedS2CellIdVector ids_;
+
+  // If every point is the center of ids_[i].parent(level) for the same
+  // "level", that level; kExplicitPoint if every point is stored in points_;
+  // and otherwise kMixedLevels, in which case levels_ contains one byte per
+  // point (either a level or kExplicitPoint) and explicit_ids_ contains the
+  // indices of the points that are stored in points_.
+  uint8 uniform_level_ = kExplicitPoint;
+  const uint8* levels_ = nullptr;
+  s2coding::EncodedUintVector<uint32> explicit_ids_;
+
+  // The points that are not S2CellId centers, and the encoded Data values of
+  // all points (in the same order as ids_).
+  s2coding::EncodedS2PointVector points_;
+  s2coding::EncodedStringVector data_;
+
+  // A raw array containing the decoded PointData of each point.  Initially
+  // all values are *uninitialized memory*; the decoded_ bit vector keeps
+  // track of which elements have been constructed.
+  mutable std::unique_ptr<PointDataStorage[]> point_data_;
+  mutable std::vector<std::atomic<uint64>> decoded_;
+
+  // Protects all updates to point_data_ and decoded_.
+  mutable SpinLock lock_;
+
+  EncodedS2PointIndex(const EncodedS2PointIndex&) = delete;
+  void operator=(const EncodedS2PointIndex&) = delete;
+};
+
+
+//////////////////   Implementation details follow   ////////////////////
+
+
+template <class Data, class DataCoder>
+void EncodeS2PointIndex(const S2PointIndex<Data>& index,
+                        const DataCoder& data_coder, Encoder* encoder) {
+  using EncodedIndex = EncodedS2PointIndex<Data, DataCoder>;
+  std::vector<S2CellId> ids;
+  std::vector<uint8> levels;
+  std::vector<uint32> explicit_ids;
+  std::vector<S2Point> explicit_points;
+  s2coding::StringVectorEncoder data;
+  ids.reserve(index.num_points());
+  levels.reserve(index.num_points());
+  for (typename S2PointIndex<Data>::Iterator it(&index); !it.done();
+       it.Next()) {
+    int face;
+    unsigned int si, ti;
+    int level = S2::XYZtoFaceSiTi(it.point(), &face, &si, &ti);
+    if (level < 0 || it.id().parent(level).ToPoint() != it.point()) {
+      explicit_ids.push_back(ids.size());
+      explicit_points.push_back(it.point());
+      level = EncodedIndex::kExplicitPoint;
+    }
+    ids.push_back(it.id());
+    levels.push_back(level);
+    data_coder.Encode(it.data(), data.AddViaEncoder());
+  }
+  uint8 uniform_level = levels.empty() ? EncodedIndex::kExplicitPoint
+                                       : levels[0];
+  for (uint8 level : levels) {
+    if (level != uniform_level) {
+      uniform_level = EncodedIndex::kMixedLevels;
+      break;
+    }
+  }
+  encoder->Ensure(Varint::kMax64);
+  encoder->put_varint64(EncodedIndex::kCurrentEncodingVersionNumber);
+  s2coding::EncodeS2CellIdVector(ids, encoder);
+  encoder->Ensure(1);
+  encoder->put8(uniform_level);
+  if (uniform_level == EncodedIndex::kMixedLevels) {
+    encoder->Ensure(levels.size());
+    encoder->putn(levels.data(), levels.size());
+    s2coding::EncodeUintVector<uint32>(explicit_ids, encoder);
+  }
+  s2coding::EncodeS2PointVector(explicit_points,
+                                s2coding::CodingHint::COMPACT, encoder);
+  data.Encode(encoder);
+}
+
+template <class Data, class DataCoder>
+const uint8 EncodedS2PointIndex<Data, DataCoder>::kExplicitPoint;
+
+template <class Data, class DataCoder>
+const uint8 EncodedS2PointIndex<Data, DataCoder>::kMixedLevels;
+
+template <class Data, class DataCoder>
+EncodedS2PointIndex<Data, DataCoder>::~EncodedS2PointIndex() {
+  for (size_t i = 0; i < decoded_.size(); ++i) {
+    uint64 group_bits = decoded_[i].load(std::memory_order_relaxed);
+    for (; group_bits != 0; group_bits &= group_bits - 1) {
+      int offset = Bits::FindLSBSetNonZero64(group_bits);
+      point_data((i << 6) + offset).~PointData();
+    }
+  }
+}
+
+template <class Data, class DataCoder>
+bool EncodedS2PointIndex<Data, DataCoder>::Init(Decoder* decoder,
+                                                const DataCoder& data_coder) {
+  // Init() may only be called once.
+  S2_DCHECK(point_data_ == nullptr);
+  uint64 version;
+  if (!decoder->get_varint64(&version)) return false;
+  if (version != kCurrentEncodingVersionNumber) return false;
+  if (!ids_.Init(decoder)) return false;
+  if (decoder->avail() < 1) return false;
+  uniform_level_ = decoder->get8();
+  size_t num_explicit;
+  if (uniform_level_ == kMixedLevels) {
+    if (decoder->avail() < ids_.size()) return false;
+    levels_ = decoder->ptr();
+    decoder->skip(ids_.size());
+    if (!explicit_ids_.Init(decoder)) return false;
+    num_explicit = explicit_ids_.size();
+  } else if (uniform_level_ == kExplicitPoint) {
+    num_explicit = ids_.size();
+  } else if (uniform_level_ <= S2CellId::kMaxLevel) {
+    num_explicit = 0;
+  } else {
+    return false;
+  }
+  if (!points_.Init(decoder)) return false;
+  if (!data_.Init(decoder)) return false;
+  if (points_.size() != num_explicit || data_.size() != ids_.size()) {
+    return false;
+  }
+  data_coder_ = data_coder;
+
+  // As with EncodedS2ShapeIndex, point_data_ is deliberately left
+  // uninitialized so that Init() takes constant time.
+  point_data_.reset(new PointDataStorage[ids_.size()]);
+  decoded_ = std::vector<std::atomic<uint64>>((ids_.size() + 63) >> 6);
+  return true;
+}
+
+template <class Data, class DataCoder>
+size_t EncodedS2PointIndex<Data, DataCoder>::SpaceUsed() const {
+  size_t size = sizeof(*this);
+  size += decoded_.capacity() * sizeof(std::atomic<uint64>);
+  for (size_t i = 0; i < decoded_.size(); ++i) {
+    size += sizeof(PointData) *
+            Bits::CountOnes64(decoded_[i].load(std::memory_order_relaxed));
+  }
+  return size;
+}
+
+template <class Data, class DataCoder>
+inline const typename EncodedS2PointIndex<Data, DataCoder>::PointData&
+EncodedS2PointIndex<Data, DataCoder>::GetPointData(int i) const {
+  if (point_decoded(i)) return point_data(i);
+  return DecodePointData(i);
+}
+
+template <class Data, class DataCoder>
+S2Point EncodedS2PointIndex<Data, DataCoder>::DecodePoint(int i) const {
+  int level = (uniform_level_ != kMixedLevels) ? uniform_level_ : levels_[i];
+  if (level <= S2CellId::kMaxLevel) return ids_[i].parent(level).ToPoint();
+  if (uniform_level_ == kExplicitPoint) return points_[i];
+  size_t j = explicit_ids_.lower_bound(i);
+  if (level != kExplicitPoint || j == explicit_ids_.size() ||
+      explicit_ids_[j] != static_cast<uint32>(i)) {
+    S2_LOG(DFATAL) << "Invalid encoded point " << i;
+    return ids_[i].ToPoint();
+  }
+  return points_[j];
+}
+
+template <class Data, class DataCoder>
+const typename EncodedS2PointIndex<Data, DataCoder>::PointData&
+EncodedS2PointIndex<Data, DataCoder>::DecodePointData(int i) const {
+  // We decode the point before acquiring the spinlock in order to minimize
+  // the time that the lock is held.
+  Data data;
+  Decoder decoder = data_.GetDecoder(i);
+  if (!data_coder_.Decode(&decoder, &data)) {
+    S2_LOG(DFATAL) << "Invalid encoded data for point " << i;
+  }
+  S2Point point = DecodePoint(i);
+  SpinLockHolder l(&lock_);
+  if (point_decoded(i)) {
+    // This point has already been decoded by another thread.
+    return point_data(i);
+  }
+  new (&point_data_[i]) PointData(point, data);
+  // The release store ensures that readers who observe the bit also observe
+  // the PointData constructed above.
+  std::atomic<uint64>* group = &decoded_[i >> 6];
+  group->store(group->load(std::memory_order_relaxed) | (1ULL << (i & 63)),
+               std::memory_order_release);
+  return point_data(i);
+}
+
+#endif  // S2_ENCODED_S2POINT_INDEX_H_
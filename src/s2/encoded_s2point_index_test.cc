@@ -0,0 +1,201 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/encoded_s2point_index.h"
+
+#include <vector>
+#include <gtest/gtest.h>
+#include "s2/s1angle.h"
+#include "s2/s2cell_id.h"
+#include "s2/s2closest_point_query_base.h"
+#include "s2/s2closest_point_query.h"
+#include "s2/s2testing.h"
+
+using std::vector;
+
+namespace {
+
+using Index = S2PointIndex<int>;
+using PointData = Index::PointData;
+using EncodedIndex = EncodedS2PointIndex<int, s2coding::VarintDataCoder<int>>;
+
+// Returns an index of random points.  If "snapped" is true, the points are
+// snapped to S2CellId centers so that the compact CELL_IDS format is used.
+void BuildIndex(int num_points, bool snapped, Index* index) {
+  for (int i = 0; i < num_points; ++i) {
+    S2Point point = S2Testing::RandomPoint();
+    if (snapped) point = S2CellId(point).parent(20).ToPoint();
+    index->Add(point, S2Testing::rnd.Uniform(1000) - 500);
+  }
+}
+
+// Verifies that the iterators of "index" and "encoded_index" visit the same
+// points in the same order and that Seek() and Prev() are equivalent.
+void ExpectIndexesEqual(const Index& index, const EncodedIndex& encoded_index) {
+  EXPECT_EQ(index.num_points(), encoded_index.num_points());
+  vector<PointData> expected, actual;
+  for (Index::Iterator it(&index); !it.done(); it.Next()) {
+    expected.push_back(it.point_data());
+  }
+  for (EncodedIndex::Iterator it(&encoded_index); !it.done(); it.Next()) {
+    EXPECT_EQ(S2CellId(it.point()), it.id());
+    actual.push_back(it.point_data());
+  }
+  EXPECT_EQ(expected, actual);
+
+  Index::Iterator it(&index);
+  EncodedIndex::Iterator encoded_it(&encoded_index);
+  for (int i = 0; i < 100; ++i) {
+    S2CellId target = S2Testing::GetRandomCellId();
+    it.Seek(target);
+    encoded_it.Seek(target);
+    ASSERT_EQ(it.done(), encoded_it.done());
+    if (!it.done()) {
+      EXPECT_EQ(it.point_data(), encoded_it.point_data());
+    }
+    ASSERT_EQ(it.Prev(), encoded_it.Prev());
+    EXPECT_EQ(it.id(), encoded_it.id());
+  }
+}
+
+// Verifies that S2ClosestPointQueryBase returns the same results for
+// "index" and "encoded_index".
+void ExpectQueriesEqual(const Index& index,
+                        const EncodedIndex& encoded_index) {
+  S2ClosestPointQueryBase<S2MinDistance, int> query(&index);
+  S2ClosestPointQueryBase<S2MinDistance, int, EncodedIndex> encoded_query(
+      &encoded_index);
+  S2ClosestPointQueryBase<S2MinDistance, int>::Options options;
+  options.set_max_results(5);
+  options.set_max_distance(S2MinDistance(S1Angle::Degrees(10)));
+  for (int i = 0; i < 50; ++i) {
+    S2ClosestPointQueryPointTarget target(S2Testing::RandomPoint());
+    auto expected = query.FindClosestPoints(&target, options);
+    auto actual = encoded_query.FindClosestPoints(&target, options);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int j = 0; j < expected.size(); ++j) {
+      EXPECT_EQ(expected[j].distance(), actual[j].distance());
+      EXPECT_EQ(expected[j].point(), actual[j].point());
+      EXPECT_EQ(expected[j].data(), actual[j].data());
+    }
+  }
+}
+
+TEST(EncodedS2PointIndex, Empty) {
+  Index index;
+  Encoder encoder;
+  EncodeS2PointIndex(index, s2coding::VarintDataCoder<int>(), &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedIndex encoded_index;
+  ASSERT_TRUE(encoded_index.Init(&decoder));
+  EXPECT_EQ(0, decoder.avail());
+  EXPECT_EQ(0, encoded_index.num_points());
+  EncodedIndex::Iterator it(&encoded_index);
+  EXPECT_TRUE(it.done());
+  EXPECT_FALSE(it.Prev());
+}
+
+TEST(EncodedS2PointIndex, RandomPoints) {
+  for (bool snapped : {false, true}) {
+    Index index;
+    BuildIndex(1000, snapped, &index);
+    // Also add some duplicate points with different data.
+    vector<S2Point> duplicates;
+    Index::Iterator it(&index);
+    for (int i = 0; i < 10; ++i, it.Next()) duplicates.push_back(it.point());
+    for (int i = 0; i < 10; ++i) index.Add(duplicates[i], i);
+    Encoder encoder;
+    EncodeS2PointIndex(index, s2coding::VarintDataCoder<int>(), &encoder);
+    Decoder decoder(encoder.base(), encoder.length());
+    EncodedIndex encoded_index;
+    ASSERT_TRUE(encoded_index.Init(&decoder));
+    EXPECT_EQ(0, decoder.avail());
+    ExpectIndexesEqual(index, encoded_index);
+    ExpectQueriesEqual(index, encoded_index);
+  }
+}
+
+TEST(EncodedS2PointIndex, MixedLevels) {
+  // Points that are S2CellId centers at various levels, and points that are
+  // not S2CellId centers at all.
+  Index index;
+  for (int i = 0; i < 1000; ++i) {
+    S2Point point = S2Testing::RandomPoint();
+    if (!S2Testing::rnd.OneIn(4)) {
+      point = S2CellId(point).parent(S2Testing::rnd.Uniform(31)).ToPoint();
+    }
+    index.Add(point, i);
+  }
+  Encoder encoder;
+  EncodeS2PointIndex(index, s2coding::VarintDataCoder<int>(), &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedIndex encoded_index;
+  ASSERT_TRUE(encoded_index.Init(&decoder));
+  EXPECT_EQ(0, decoder.avail());
+  ExpectIndexesEqual(index, encoded_index);
+  ExpectQueriesEqual(index, encoded_index);
+}
+
+TEST(EncodedS2PointIndex, SnappedPointsAreNotStored) {
+  // Points snapped to S2CellId centers are reconstructed from their leaf
+  // S2CellIds, so the index takes no more space than the S2CellIds and the
+  // (empty) Data values.
+  S2PointIndex<> index;
+  for (int i = 0; i < 1000; ++i) {
+    index.Add(S2CellId(S2Testing::RandomPoint()).parent(20).ToPoint());
+  }
+  vector<S2CellId> ids;
+  s2coding::StringVectorEncoder data;
+  for (S2PointIndex<>::Iterator it(&index); !it.done(); it.Next()) {
+    ids.push_back(it.id());
+    data.Add("");
+  }
+  Encoder encoder, expected_encoder;
+  EncodeS2PointIndex(index, s2coding::EmptyDataCoder(), &encoder);
+  s2coding::EncodeS2CellIdVector(ids, &expected_encoder);
+  data.Encode(&expected_encoder);
+  EXPECT_LE(encoder.length(), expected_encoder.length() + 10);
+}
+
+TEST(EncodedS2PointIndex, EmptyData) {
+  S2PointIndex<> index;
+  for (int i = 0; i < 100; ++i) index.Add(S2Testing::RandomPoint());
+  Encoder encoder;
+  EncodeS2PointIndex(index, s2coding::EmptyDataCoder(), &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2PointIndex<> encoded_index;
+  ASSERT_TRUE(encoded_index.Init(&decoder));
+  S2PointIndex<>::Iterator it(&index);
+  EncodedS2PointIndex<>::Iterator encoded_it(&encoded_index);
+  for (; !it.done(); it.Next(), encoded_it.Next()) {
+    ASSERT_FALSE(encoded_it.done());
+    EXPECT_EQ(it.point(), encoded_it.point());
+  }
+  EXPECT_TRUE(encoded_it.done());
+}
+
+TEST(EncodedS2PointIndex, TruncatedData) {
+  Index index;
+  BuildIndex(50, true /*snapped*/, &index);
+  Encoder encoder;
+  EncodeS2PointIndex(index, s2coding::VarintDataCoder<int>(), &encoder);
+  for (size_t len = 0; len < encoder.length(); ++len) {
+    Decoder decoder(encoder.base(), len);
+    EncodedIndex encoded_index;
+    EXPECT_FALSE(encoded_index.Init(&decoder)) << len;
+  }
+}
+
+}  // namespace
@@ -17,6 +17,7 @@
 
 #include "s2/encoded_s2point_vector.h"
 
+#include <algorithm>
 #include "s2/third_party/absl/base/internal/unaligned_access.h"
 #include "s2/util/bits/bits.h"
 #include "s2/s2cell_id.h"
@@ -79,7 +80,7 @@ void EncodeS2PointVectorCompact(Span<const S2Point> points, Encoder* encoder);
 
 // To save space (especially for vectors of length 0, 1, and 2), the encoding
 // format is encoded in the low-order 3 bits of the vector size.  Up to 7
-// encoding formats are supported (only 2 are currently defined).  Additional
+// encoding formats are supported (only 3 are currently defined).  Additional
 // formats could be supported by using "7" as an overflow indicator and
 // encoding the actual format separately, but it seems unlikely we will ever
 // need to do that.
@@ -95,6 +96,19 @@ void EncodeS2PointVector(Span<const S2Point> points, CodingHint hint,
     case CodingHint::COMPACT:
       return EncodeS2PointVectorCompact(points, encoder);
 
+    case CodingHint::COMPACT_DELTAS: {
+      // The CELL_ID_DELTAS format is not always smaller (e.g. for point
+      // clouds), so we try both formats and keep the smaller one.
+      Encoder cell_ids, deltas;
+      EncodeS2PointVectorCompact(points, &cell_ids);
+      EncodeS2PointVectorDeltas(points, &deltas);
+      const Encoder& best =
+          (deltas.length() < cell_ids.length()) ? deltas : cell_ids;
+      encoder->Ensure(best.length());
+      encoder->putn(best.base(), best.length());
+      return;
+    }
+
     default:
       S2_LOG(DFATAL) << "Unknown CodingHint: " << static_cast<int>(hint);
   }
@@ -113,17 +127,17 @@ bool EncodedS2PointVector::Init(Decoder* decoder) {
     case CELL_IDS:
       return InitCellIdsFormat(decoder);
 
+    case CELL_ID_DELTAS:
+      return InitCellIdDeltasFormat(decoder);
+
     default:
       return false;
   }
 }
 
 vector<S2Point> EncodedS2PointVector::Decode() const {
-  vector<S2Point> points;
-  points.reserve(size_);
-  for (int i = 0; i < size_; ++i) {
-    points.push_back((*this)[i]);
-  }
+  vector<S2Point> points(size_);
+  DecodePoints(0, size_, points.data());
   return points;
 }
 
@@ -787,10 +801,48 @@ bool EncodedS2PointVector::InitCellIdsFormat(Decoder* decoder) {
 }
 
 S2Point EncodedS2PointVector::DecodeCellIdsFormat(int i) const {
+  S2Point p;
+  DecodeCellIdsBlock(i >> kBlockShift, i & (kBlockSize - 1),
+                     (i & (kBlockSize - 1)) + 1, &p);
+  return p;
+}
+
+// Extracts the deltas with indices [begin, end) of a CELL_IDS block, where
+// "ptr" points to the first delta.  The delta length in bytes is a template
+// argument so that the loop can be unrolled and vectorized.
+template <int delta_bytes>
+static void GetCellIdsDeltas(const char* ptr, int delta_nibbles, int begin,
+                             int end, uint64* deltas) {
+  uint64 mask = BitMask(delta_nibbles << 2);
+  for (int k = begin; k < end; ++k) {
+    int delta_nibble_offset = k * delta_nibbles;
+    uint64 delta = GetUintWithLength<uint64>(ptr + (delta_nibble_offset >> 1),
+                                             delta_bytes);
+    deltas[k] = (delta >> ((delta_nibble_offset & 1) << 2)) & mask;
+  }
+}
+
+// Converts a 64-bit value of the CELL_IDS format back to an S2Point.
+static S2Point CellIdsValueToPoint(uint64 value, int level) {
+  int shift = S2CellId::kMaxLevel - level;
+
+  // The S2CellId version of the following code is:
+  //   return S2CellId(((value << 1) | 1) << (2 * shift)).ToPoint();
+  uint32 sj, tj;
+  DeinterleaveUint32BitPairs(value, &sj, &tj);
+  int si = (((sj << 1) | 1) << shift) & 0x7fffffff;
+  int ti = (((tj << 1) | 1) << shift) & 0x7fffffff;
+  int face = ((sj << shift) >> 30) | (((tj << (shift + 1)) >> 29) & 4);
+  return S2::FaceUVtoXYZ(face, S2::STtoUV(S2::SiTitoST(si)),
+                         S2::STtoUV(S2::SiTitoST(ti))).Normalize();
+}
+
+void EncodedS2PointVector::DecodeCellIdsBlock(int block, int begin, int end,
+                                              S2Point* out) const {
   // This function inverts the encodings documented above.
 
   // First we decode the block header.
-  const char* ptr = cell_ids_.blocks.GetStart(i >> kBlockShift);
+  const char* ptr = cell_ids_.blocks.GetStart(block);
   uint8 header = *ptr++;
   int overlap_nibbles = (header >> 3) & 1;
   int offset_bytes = (header & 7) + overlap_nibbles;
@@ -801,38 +853,252 @@ S2Point EncodedS2PointVector::DecodeCellIdsFormat(int i) const {
   uint64 offset = GetUintWithLength<uint64>(ptr, offset_bytes) << offset_shift;
   ptr += offset_bytes;
 
-  // Decode the delta for the requested value.
-  int delta_nibble_offset = (i & (kBlockSize - 1)) * delta_nibbles;
-  int delta_bytes = (delta_nibbles + 1) >> 1;
-  const char* delta_ptr = ptr + (delta_nibble_offset >> 1);
-  uint64 delta = GetUintWithLength<uint64>(delta_ptr, delta_bytes);
-  delta >>= (delta_nibble_offset & 1) << 2;
-  delta &= BitMask(delta_nibbles << 2);
-
-  // Test whether this point is encoded as an exception.
-  if (cell_ids_.have_exceptions) {
-    if (delta < kBlockSize) {
-      int block_size = min(kBlockSize, size_ - (i & ~(kBlockSize - 1)));
-      ptr += (block_size * delta_nibbles + 1) >> 1;
-      ptr += delta * sizeof(S2Point);
-      return *reinterpret_cast<const S2Point*>(ptr);
+  // Decode the requested deltas.
+  uint64 deltas[kBlockSize];
+  switch ((delta_nibbles + 1) >> 1) {
+    case 1: GetCellIdsDeltas<1>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 2: GetCellIdsDeltas<2>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 3: GetCellIdsDeltas<3>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 4: GetCellIdsDeltas<4>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 5: GetCellIdsDeltas<5>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 6: GetCellIdsDeltas<6>(ptr, delta_nibbles, begin, end, deltas); break;
+    case 7: GetCellIdsDeltas<7>(ptr, delta_nibbles, begin, end, deltas); break;
+    default: GetCellIdsDeltas<8>(ptr, delta_nibbles, begin, end, deltas);
+  }
+
+  // Exceptions (if any) follow the deltas.
+  int block_size = min<int>(kBlockSize, size_ - block * kBlockSize);
+  const char* exceptions = ptr + ((block_size * delta_nibbles + 1) >> 1);
+  uint64 base = cell_ids_.base + offset;
+  for (int k = begin; k < end; ++k) {
+    uint64 delta = deltas[k];
+    if (cell_ids_.have_exceptions) {
+      if (delta < kBlockSize) {
+        *out++ = *reinterpret_cast<const S2Point*>(
+            exceptions + delta * sizeof(S2Point));
+        continue;
+      }
+      delta -= kBlockSize;
     }
-    delta -= kBlockSize;
+    *out++ = CellIdsValueToPoint(base + delta, cell_ids_.level);
   }
+}
 
-  // Otherwise convert the 64-bit value back to an S2Point.
-  uint64 value = cell_ids_.base + offset + delta;
-  int shift = S2CellId::kMaxLevel - cell_ids_.level;
 
-  // The S2CellId version of the following code is:
-  //   return S2CellId(((value << 1) | 1) << (2 * shift)).ToPoint();
-  uint32 sj, tj;
-  DeinterleaveUint32BitPairs(value, &sj, &tj);
-  int si = (((sj << 1) | 1) << shift) & 0x7fffffff;
-  int ti = (((tj << 1) | 1) << shift) & 0x7fffffff;
-  int face = ((sj << shift) >> 30) | (((tj << (shift + 1)) >> 29) & 4);
+//////////////////////////////////////////////////////////////////////////////
+//                    CELL_ID_DELTAS Encoding Format
+//////////////////////////////////////////////////////////////////////////////
+
+// Each entry of a CELL_ID_DELTAS block is a varint64 whose low bit is a tag:
+//
+//  - If the tag is 0, the remaining bits are the bit-pair interleaving of the
+//    zigzag-encoded differences (di, dj) between the (i, j) coordinates of
+//    this point and the previous point, which is on the same face.
+//  - Otherwise the remaining bits are kDeltaException if the point is stored
+//    as a 24-byte S2Point immediately following the entry, or (face + 1) if
+//    the point is stored as absolute coordinates: varint32 i, varint32 j.
+constexpr uint64 kDeltaException = 0;
+
+inline uint32 ZigZagEncode(int32 n) {
+  return (static_cast<uint32>(n) << 1) ^ static_cast<uint32>(n >> 31);
+}
+
+inline int32 ZigZagDecode(uint32 n) {
+  return static_cast<int32>(n >> 1) ^ -static_cast<int32>(n & 1);
+}
+
+// Encodes a vector of points as differences between consecutive points,
+// optimizing for space when consecutive points are close together.
+void EncodeS2PointVectorDeltas(Span<const S2Point> points, Encoder* encoder) {
+  // Like the CELL_IDS format, each point is represented as the center of an
+  // S2CellId at a single chosen level (with exceptions stored as raw
+  // S2Points).  However rather than encoding each cell independently, the
+  // (face, i, j) coordinates of each cell are encoded as the difference from
+  // the previous point.  The first point of each block of kBlockSize points is
+  // encoded with absolute coordinates, so that any point can be decoded after
+  // reading at most kBlockSize entries.
+  //
+  // There is a 2 byte header encoded as follows:
+  //
+  //  Byte 0, bits 0-2: encoding_format (CELL_ID_DELTAS)
+  //  Byte 0, bit  3:   unused (zero)
+  //  Byte 0, bits 4-7: (last_block_size - 1)
+  //  Byte 1, bits 0-2: unused (zero)
+  //  Byte 1, bits 3-7: level (0-30)
+  //
+  // This is followed by an EncodedStringVector containing the encoded blocks.
+  // Each block is a sequence of entries in the format described above.
+  vector<CellPoint> cell_points;
+  int level = ChooseBestLevel(points, &cell_points);
+  if (level < 0) {
+    return EncodeS2PointVectorFast(points, encoder);
+  }
+  int num_blocks = (points.size() + kBlockSize - 1) >> kBlockShift;
+  int last_block_count = points.size() - kBlockSize * (num_blocks - 1);
+  encoder->Ensure(2);
+  encoder->put8(EncodedS2PointVector::CELL_ID_DELTAS |
+                ((last_block_count - 1) << 4));
+  encoder->put8(level << 3);
+
+  const int shift = S2CellId::kMaxLevel + 1 - level;
+  StringVectorEncoder blocks;
+  Encoder* block = nullptr;
+  int face = -1;
+  uint32 i = 0, j = 0;
+  for (int k = 0; k < points.size(); ++k) {
+    if ((k & (kBlockSize - 1)) == 0) {
+      block = blocks.AddViaEncoder();
+      face = -1;  // The first point of each block is absolute.
+    }
+    block->Ensure(Varint::kMax64 + 2 * Varint::kMax32 + sizeof(S2Point));
+    const CellPoint& cp = cell_points[k];
+    if (cp.level != level) {
+      block->put_varint64(kDeltaException << 1 | 1);
+      block->putn(&points[k], sizeof(S2Point));
+      continue;
+    }
+    uint32 new_i = cp.si >> shift, new_j = cp.ti >> shift;
+    if (cp.face != face) {
+      face = cp.face;
+      block->put_varint64((face + 1) << 1 | 1);
+      block->put_varint32(new_i);
+      block->put_varint32(new_j);
+    } else {
+      uint64 delta = InterleaveUint32BitPairs(
+          ZigZagEncode(new_i - i), ZigZagEncode(new_j - j));
+      block->put_varint64(delta << 1);
+    }
+    i = new_i;
+    j = new_j;
+  }
+  blocks.Encode(encoder);
+}
+
+bool EncodedS2PointVector::InitCellIdDeltasFormat(Decoder* decoder) {
+  if (decoder->avail() < 2) return false;
+  uint8 header1 = decoder->get8();
+  uint8 header2 = decoder->get8();
+  S2_DCHECK_EQ(header1 & 7, CELL_ID_DELTAS);
+  if ((header1 & 8) != 0 || (header2 & 7) != 0) return false;
+  int last_block_count = (header1 >> 4) + 1;
+  cell_id_deltas_.level = header2 >> 3;
+  if (cell_id_deltas_.level > S2CellId::kMaxLevel) return false;
+  if (!cell_id_deltas_.blocks.Init(decoder)) return false;
+  if (cell_id_deltas_.blocks.size() == 0) return false;
+  size_ = kBlockSize * (cell_id_deltas_.blocks.size() - 1) + last_block_count;
+  return true;
+}
+
+// Decodes the next entry of a CELL_ID_DELTAS block, updating the current
+// (face, i, j) coordinates.  Returns false on error.  If the entry is an
+// exception, the point is returned in "exception" (if not nullptr) and the
+// coordinates are unchanged.
+static bool DecodeCellIdDeltaEntry(Decoder* decoder, int* face, uint32* i,
+                                   uint32* j, bool* is_exception,
+                                   S2Point* exception) {
+  uint64 entry;
+  if (!decoder->get_varint64(&entry)) return false;
+  *is_exception = false;
+  if ((entry & 1) == 0) {
+    if (*face < 0) return false;  // A delta must follow an absolute point.
+    uint32 di, dj;
+    DeinterleaveUint32BitPairs(entry >> 1, &di, &dj);
+    *i += ZigZagDecode(di);
+    *j += ZigZagDecode(dj);
+    return true;
+  }
+  entry >>= 1;
+  if (entry == kDeltaException) {
+    if (decoder->avail() < sizeof(S2Point)) return false;
+    *is_exception = true;
+    if (exception != nullptr) decoder->getn(exception, sizeof(S2Point));
+    else decoder->skip(sizeof(S2Point));
+    return true;
+  }
+  if (entry > 6) return false;
+  *face = entry - 1;
+  return decoder->get_varint32(i) && decoder->get_varint32(j);
+}
+
+// Converts the (i, j) coordinates of a cell at the given level to the point
+// at its center.  This is exactly the inverse of the conversion made by
+// S2::XYZtoFaceSiTi().
+static S2Point CellIdDeltasToPoint(int face, uint32 i, uint32 j, int level) {
+  int shift = S2CellId::kMaxLevel - level;
+  uint32 si = ((i << 1) | 1) << shift;
+  uint32 ti = ((j << 1) | 1) << shift;
   return S2::FaceUVtoXYZ(face, S2::STtoUV(S2::SiTitoST(si)),
                          S2::STtoUV(S2::SiTitoST(ti))).Normalize();
 }
 
+S2Point EncodedS2PointVector::DecodeCellIdDeltasFormat(int k) const {
+  S2Point p;
+  DecodeCellIdDeltasBlock(k >> kBlockShift, k & (kBlockSize - 1),
+                          (k & (kBlockSize - 1)) + 1, &p);
+  return p;
+}
+
+void EncodedS2PointVector::DecodeCellIdDeltasBlock(int block, int begin,
+                                                   int end,
+                                                   S2Point* out) const {
+  Decoder decoder = cell_id_deltas_.blocks.GetDecoder(block);
+  int face = -1;
+  uint32 i = 0, j = 0;
+  bool is_exception;
+  // The entries preceding "begin" only need to update the coordinates, and
+  // their exceptions (if any) are skipped rather than copied.  Since blocks
+  // are decoded lazily, corrupt entries are not detected by Init(); the
+  // points they affect are returned as S2Point() (see Init).
+  for (int n = 0; n < begin; ++n) {
+    if (!DecodeCellIdDeltaEntry(&decoder, &face, &i, &j, &is_exception,
+                                nullptr)) {
+      std::fill(out, out + (end - begin), S2Point());
+      return;
+    }
+  }
+  for (int n = begin; n < end; ++n, ++out) {
+    if (!DecodeCellIdDeltaEntry(&decoder, &face, &i, &j, &is_exception,
+                                out)) {
+      // The coordinates of the following entries are unknown.
+      std::fill(out, out + (end - n), S2Point());
+      return;
+    } else if (!is_exception) {
+      *out = CellIdDeltasToPoint(face, i, j, cell_id_deltas_.level);
+    }
+  }
+}
+
+void EncodedS2PointVector::DecodePoints(int start, int count,
+                                        S2Point* out) const {
+  S2_DCHECK(start >= 0 && count >= 0 && start + count <= size_);
+  if (format_ == UNCOMPRESSED) {
+    std::copy(uncompressed_.points + start,
+              uncompressed_.points + start + count, out);
+    return;
+  }
+  // The compressed formats are decoded one block at a time so that the
+  // block header (or the preceding deltas) are decoded only once.
+  for (int i = start, limit = start + count; i < limit;) {
+    int block = i >> kBlockShift;
+    int begin = i & (kBlockSize - 1);
+    int end = min<int>(kBlockSize, limit - (block << kBlockShift));
+    switch (format_) {
+      case CELL_IDS:
+        DecodeCellIdsBlock(block, begin, end, out);
+        break;
+
+      case CELL_ID_DELTAS:
+        DecodeCellIdDeltasBlock(block, begin, end, out);
+        break;
+
+      default:
+        S2_LOG(DFATAL) << "Unrecognized format";
+        std::fill(out, out + (end - begin), S2Point());
+    }
+    out += end - begin;
+    i += end - begin;
+  }
+}
+
+
 }  // namespace s2coding
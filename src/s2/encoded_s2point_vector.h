@@ -29,7 +29,14 @@ namespace s2coding {
 // Controls whether to optimize for speed or size when encoding points.  (Note
 // that encoding is always lossless, and that currently compact encodings are
 // only possible when points have been snapped to S2CellId centers.)
-enum class CodingHint : uint8 { FAST, COMPACT };
+//
+// COMPACT_DELTAS is like COMPACT, except that it also considers a format
+// where each point is encoded as the difference from the previous point.
+// This is often much smaller for polylines and loops whose vertices are
+// spatially adjacent (e.g. road networks and coastlines), but random access
+// is slower since up to 15 differences must be decoded to access a point.
+// The smaller of the two encodings is used.
+enum class CodingHint : uint8 { FAST, COMPACT, COMPACT_DELTAS };
 
 // Encodes a vector of S2Points in a format that can later be decoded as an
 // EncodedS2PointVector.
@@ -39,6 +46,13 @@ enum class CodingHint : uint8 { FAST, COMPACT };
 void EncodeS2PointVector(absl::Span<const S2Point> points, CodingHint hint,
                          Encoder* encoder);
 
+// Like EncodeS2PointVector(), except that the CELL_ID_DELTAS format is always
+// used rather than the smaller of the available compact formats (unless the
+// points are not snapped to S2CellId centers, in which case the FAST format
+// is used).  This is mainly useful for testing.
+void EncodeS2PointVectorDeltas(absl::Span<const S2Point> points,
+                               Encoder* encoder);
+
 // This class represents an encoded vector of S2Points.  Values are decoded
 // only when they are accessed.  This allows for very fast initialization and
 // no additional memory use beyond the encoded data.  The encoded data is not
@@ -54,7 +68,10 @@ class EncodedS2PointVector {
   // Constructs an uninitialized object; requires Init() to be called.
   EncodedS2PointVector() {}
 
-  // Initializes the EncodedS2PointVector.
+  // Initializes the EncodedS2PointVector.  Only the headers are validated,
+  // since the points are decoded lazily.  If the encoded points themselves
+  // are corrupt, the affected points are decoded as S2Point() (i.e., the
+  // zero vector) rather than causing an error.
   //
   // REQUIRES: The Decoder data buffer must outlive this object.
   bool Init(Decoder* decoder);
@@ -68,6 +85,14 @@ class EncodedS2PointVector {
   // Decodes and returns the entire original vector.
   std::vector<S2Point> Decode() const;
 
+  // Decodes the "count" points starting at index "start" into "out".  This
+  // is much faster than calling operator[] repeatedly, since the format is
+  // dispatched only once and each block of the compressed formats is
+  // decoded in a single pass.
+  //
+  // REQUIRES: 0 <= start && start + count <= size()
+  void DecodePoints(int start, int count, S2Point* out) const;
+
   // TODO(ericv): Consider adding a method that returns an adjacent pair of
   // points.  This would save some decoding overhead.
 
@@ -76,10 +101,16 @@ class EncodedS2PointVector {
                                   Encoder*);
   friend void EncodeS2PointVectorFast(absl::Span<const S2Point>, Encoder*);
   friend void EncodeS2PointVectorCompact(absl::Span<const S2Point>, Encoder*);
+  friend void EncodeS2PointVectorDeltas(absl::Span<const S2Point>, Encoder*);
 
   bool InitUncompressedFormat(Decoder* decoder);
   bool InitCellIdsFormat(Decoder* decoder);
   S2Point DecodeCellIdsFormat(int i) const;
+  void DecodeCellIdsBlock(int block, int begin, int end, S2Point* out) const;
+  bool InitCellIdDeltasFormat(Decoder* decoder);
+  S2Point DecodeCellIdDeltasFormat(int i) const;
+  void DecodeCellIdDeltasBlock(int block, int begin, int end,
+                               S2Point* out) const;
 
   // We use a tagged union to represent multiple formats, as opposed to an
   // abstract base class or templating.  This represents the best compromise
@@ -93,6 +124,7 @@ class EncodedS2PointVector {
   enum Format : uint8 {
     UNCOMPRESSED = 0,
     CELL_IDS = 1,
+    CELL_ID_DELTAS = 2,
   };
   Format format_;
   uint32 size_;
@@ -110,6 +142,11 @@ class EncodedS2PointVector {
       // a thread-safe way.  This reduces benchmark times for actual polygon
       // operations (e.g. S2ClosestEdgeQuery) by about 15%.
     } cell_ids_;
+
+    struct {
+      EncodedStringVector blocks;
+      uint8 level;
+    } cell_id_deltas_;
   };
 };
 
@@ -129,6 +166,9 @@ inline S2Point EncodedS2PointVector::operator[](int i) const {
     case Format::CELL_IDS:
       return DecodeCellIdsFormat(i);
 
+    case Format::CELL_ID_DELTAS:
+      return DecodeCellIdDeltasFormat(i);
+
     default:
       S2_LOG(DFATAL) << "Unrecognized format";
       return S2Point();
@@ -17,6 +17,7 @@
 
 #include "s2/encoded_s2point_vector.h"
 
+#include <chrono>
 #include <vector>
 #include <gtest/gtest.h>
 #include "s2/third_party/absl/strings/str_cat.h"
@@ -35,6 +36,23 @@ namespace s2coding {
 
 static int kBlockSize = 16;  // Number of deltas per block in implementation.
 
+// Checks that DecodePoints() returns the expected points for a variety of
+// ranges, including ranges that start and end in the middle of a block.
+void TestDecodePoints(const EncodedS2PointVector& actual,
+                      const vector<S2Point>& expected) {
+  int n = expected.size();
+  for (int start : {0, 1, kBlockSize - 1, kBlockSize, kBlockSize + 5, n}) {
+    if (start > n) continue;
+    for (int count : {0, 1, 2, kBlockSize, 2 * kBlockSize + 3, n - start}) {
+      if (start + count > n) continue;
+      vector<S2Point> range(count);
+      actual.DecodePoints(start, count, range.data());
+      EXPECT_EQ(vector<S2Point>(expected.begin() + start,
+                                expected.begin() + start + count), range);
+    }
+  }
+}
+
 size_t TestEncodedS2PointVector(const vector<S2Point>& expected,
                                 CodingHint hint, int64 expected_bytes) {
   Encoder encoder;
@@ -46,6 +64,7 @@ size_t TestEncodedS2PointVector(const vector<S2Point>& expected,
   EncodedS2PointVector actual;
   EXPECT_TRUE(actual.Init(&decoder));
   EXPECT_EQ(actual.Decode(), expected);
+  TestDecodePoints(actual, expected);
   return encoder.length();
 }
 
@@ -315,7 +334,6 @@ TEST(EncodedS2PointVectorTest, ManyDuplicatePointsAtAllLevels) {
 }
 
 TEST(EncodedS2PointVectorTest, SnappedFractalLoops) {
-  S2Testing::rnd.Reset(FLAGS_s2_random_seed);
   int kMaxPoints = 3 << (google::DEBUG_MODE ? 10 : 14);
   for (int num_points = 3; num_points <= kMaxPoints; num_points *= 4) {
     size_t s2polygon_size = 0, lax_polygon_size = 0;
@@ -341,4 +359,147 @@ TEST(EncodedS2PointVectorTest, SnappedFractalLoops) {
   }
 }
 
+// Returns the vertices of a snapped fractal polyline, similar to a road or a
+// coastline.  Every "exception_period"-th vertex is not snapped.
+static vector<S2Point> MakeSnappedFractalVertices(int num_points, int level,
+                                                  int exception_period = 0) {
+  S2Testing::Fractal fractal;
+  fractal.SetLevelForApproxMaxEdges(num_points);
+  auto loop = fractal.MakeLoop(S2Testing::GetRandomFrame(),
+                               S2Testing::KmToAngle(10));
+  vector<S2Point> points;
+  for (int i = 0; i < loop->num_vertices(); ++i) {
+    S2Point p = loop->vertex(i);
+    if (exception_period == 0 || i % exception_period != 0) {
+      p = S2CellId(p).parent(level).ToPoint();
+    }
+    points.push_back(p);
+  }
+  return points;
+}
+
+// Checks that "points" round-trips through the CELL_ID_DELTAS format, and
+// that every access method returns the original points.
+static void TestCellIdDeltas(const vector<S2Point>& points) {
+  Encoder encoder;
+  EncodeS2PointVectorDeltas(points, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2PointVector actual;
+  ASSERT_TRUE(actual.Init(&decoder));
+  EXPECT_EQ(0, decoder.avail());
+  ASSERT_EQ(points.size(), actual.size());
+  EXPECT_EQ(points, actual.Decode());
+  TestDecodePoints(actual, points);
+  for (int i = points.size() - 1; i >= 0; --i) {
+    EXPECT_EQ(points[i], actual[i]);
+  }
+}
+
+TEST(EncodedS2PointVectorTest, CellIdDeltasSmallVectors) {
+  TestCellIdDeltas({});
+  TestCellIdDeltas({MakeCellIdOrDie("3/0123").ToPoint()});
+  TestCellIdDeltas({MakeCellIdOrDie("3/0123").ToPoint(),
+                    MakeCellIdOrDie("3/0123").ToPoint()});
+  // Points on every face, which require absolute coordinates.
+  vector<S2Point> points;
+  for (int face = 0; face < 6; ++face) {
+    points.push_back(S2CellId::FromFace(face).child_begin(5).ToPoint());
+    points.push_back(S2CellId::FromFace(face).child_end(5).prev().ToPoint());
+  }
+  TestCellIdDeltas(points);
+}
+
+TEST(EncodedS2PointVectorTest, CellIdDeltasAtAllLevels) {
+  for (int level = 0; level <= S2CellId::kMaxLevel; ++level) {
+    SCOPED_TRACE(absl::StrCat("level = ", level));
+    TestCellIdDeltas(MakeSnappedFractalVertices(100, level));
+  }
+}
+
+TEST(EncodedS2PointVectorTest, CellIdDeltasWithExceptions) {
+  // Exceptions include the first point of some blocks, and blocks that
+  // consist entirely of exceptions.
+  TestCellIdDeltas(MakeSnappedFractalVertices(200, 20, 5));
+  TestCellIdDeltas(MakeSnappedFractalVertices(200, 20, 16));
+  vector<S2Point> points = MakeSnappedFractalVertices(100, 20, 1);
+  points.push_back(S2CellId(points[0]).parent(20).ToPoint());
+  TestCellIdDeltas(points);
+}
+
+TEST(EncodedS2PointVectorTest, CellIdDeltasCorruptBlock) {
+  vector<S2Point> points = MakeSnappedFractalVertices(10, 20);
+  Encoder encoder;
+  EncodeS2PointVectorDeltas(points, &encoder);
+
+  // Change the first entry of the block (which must be an absolute point)
+  // into a delta.  The blocks follow a 2 byte header.
+  string data(encoder.base(), encoder.length());
+  Decoder header_decoder(data.data() + 2, data.size() - 2);
+  EncodedStringVector blocks;
+  ASSERT_TRUE(blocks.Init(&header_decoder));
+  ASSERT_EQ(1, blocks.size());
+  Decoder block = blocks.GetDecoder(0);
+  data[reinterpret_cast<const char*>(block.ptr()) - data.data()] = 2;
+
+  // The points of the corrupt block are decoded as S2Point().
+  Decoder decoder(data.data(), data.size());
+  EncodedS2PointVector actual;
+  ASSERT_TRUE(actual.Init(&decoder));
+  EXPECT_EQ(S2Point(), actual[0]);
+  EXPECT_EQ(S2Point(), actual[actual.size() - 1]);
+  EXPECT_EQ(vector<S2Point>(actual.size(), S2Point()), actual.Decode());
+}
+
+TEST(EncodedS2PointVectorTest, CompactDeltasChoosesSmallerFormat) {
+  // Spatially coherent vertices should use the CELL_ID_DELTAS format.
+  vector<S2Point> polyline = MakeSnappedFractalVertices(1000, 20);
+  size_t compact_bytes = TestEncodedS2PointVector(
+      polyline, CodingHint::COMPACT, -1);
+  size_t delta_bytes = TestEncodedS2PointVector(
+      polyline, CodingHint::COMPACT_DELTAS, -1);
+  EXPECT_LT(delta_bytes, compact_bytes);
+
+  // A random point cloud should continue to use the CELL_IDS format.
+  vector<S2Point> cloud;
+  for (int i = 0; i < 1000; ++i) {
+    cloud.push_back(S2CellId(S2Testing::RandomPoint()).parent(20).ToPoint());
+  }
+  EXPECT_EQ(TestEncodedS2PointVector(cloud, CodingHint::COMPACT, -1),
+            TestEncodedS2PointVector(cloud, CodingHint::COMPACT_DELTAS, -1));
+}
+
+TEST(EncodedS2PointVectorTest, CellIdDeltasVersusCellIds) {
+  // Prints the encoded size and the time to access every point of snapped
+  // fractal polylines using the CELL_IDS and CELL_ID_DELTAS formats.
+  const int kNumPoints = google::DEBUG_MODE ? 3000 : 30000;
+  for (int level : {10, 15, 20, 25, 30}) {
+    vector<S2Point> points = MakeSnappedFractalVertices(kNumPoints, level);
+    string line = absl::StrCat("level=", level, " n=", points.size());
+    for (bool deltas : {false, true}) {
+      Encoder encoder;
+      if (deltas) {
+        EncodeS2PointVectorDeltas(points, &encoder);
+      } else {
+        EncodeS2PointVector(points, CodingHint::COMPACT, &encoder);
+      }
+      Decoder decoder(encoder.base(), encoder.length());
+      EncodedS2PointVector actual;
+      ASSERT_TRUE(actual.Init(&decoder));
+      auto start = std::chrono::steady_clock::now();
+      S2Point sum;
+      for (int i = 0; i < points.size(); ++i) {
+        sum += actual[i];
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      EXPECT_NE(sum, S2Point());
+      absl::StrAppend(&line, deltas ? "  deltas: " : "  cell_ids: ",
+                      encoder.length(), " bytes, ",
+                      static_cast<int>(1e9 * elapsed.count() / points.size()),
+                      " ns/point");
+    }
+    printf("%s\n", line.c_str());
+  }
+}
+
 }  // namespace s2coding
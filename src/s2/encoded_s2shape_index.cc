@@ -17,14 +17,99 @@
 
 #include "s2/encoded_s2shape_index.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <memory>
 #include "s2/third_party/absl/memory/memory.h"
 #include "s2/mutable_s2shape_index.h"
+#include "s2/s2shapeutil_coding.h"
 
 using absl::make_unique;
+using std::string;
 using std::unique_ptr;
 using std::vector;
 
+// A read-only private mapping of an entire file.  The file descriptor is
+// closed as soon as the mapping has been established.
+class EncodedS2ShapeIndex::MappedFile {
+ public:
+  // Returns nullptr if the file cannot be opened or mapped.  Empty files are
+  // rejected since they cannot contain a valid index.
+  static unique_ptr<MappedFile> Open(const string& filename,
+                                     const FileOptions& options);
+  ~MappedFile() { munmap(data_, size_); }
+
+  const char* data() const { return static_cast<const char*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(void* data, size_t size) : data_(data), size_(size) {}
+
+  void* data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&) = delete;
+  void operator=(const MappedFile&) = delete;
+};
+
+unique_ptr<EncodedS2ShapeIndex::MappedFile>
+EncodedS2ShapeIndex::MappedFile::Open(const string& filename,
+                                      const FileOptions& options) {
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);  // The mapping keeps its own reference to the file.
+  if (data == MAP_FAILED) return nullptr;
+
+  // The advice below is purely a performance hint, so errors are ignored.
+  switch (options.access_pattern()) {
+    case FileOptions::AccessPattern::NORMAL:
+      break;
+    case FileOptions::AccessPattern::RANDOM:
+      madvise(data, st.st_size, MADV_RANDOM);
+      break;
+    case FileOptions::AccessPattern::SEQUENTIAL:
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      break;
+  }
+  if (options.prefetch()) madvise(data, st.st_size, MADV_WILLNEED);
+  return unique_ptr<MappedFile>(new MappedFile(data, st.st_size));
+}
+
+EncodedS2ShapeIndex::FileOptions::FileOptions() {
+}
+
+void EncodedS2ShapeIndex::FileOptions::set_access_pattern(
+    AccessPattern access_pattern) {
+  access_pattern_ = access_pattern;
+}
+
+void EncodedS2ShapeIndex::FileOptions::set_prefetch(bool prefetch) {
+  prefetch_ = prefetch;
+}
+
+EncodedS2ShapeIndex::CellCacheOptions::CellCacheOptions() {
+}
+
+void EncodedS2ShapeIndex::CellCacheOptions::set_policy(Policy policy) {
+  policy_ = policy;
+}
+
+void EncodedS2ShapeIndex::CellCacheOptions::set_max_bytes(size_t max_bytes) {
+  max_bytes_ = max_bytes;
+}
+
+void EncodedS2ShapeIndex::CellCacheOptions::set_count_hits(bool count_hits) {
+  count_hits_ = count_hits;
+}
+
 bool EncodedS2ShapeIndex::Iterator::Locate(const S2Point& target) {
   return LocateImpl(target, this);
 }
@@ -55,11 +140,31 @@ S2Shape* EncodedS2ShapeIndex::GetShape(int id) const {
   return shapes_[id].load(std::memory_order_relaxed);
 }
 
+// Returns the approximate number of bytes of heap memory used by "cell".
+static size_t CellBytes(const S2ShapeIndexCell& cell) {
+  size_t bytes = sizeof(cell) + cell.num_clipped() * sizeof(S2ClippedShape);
+  for (int s = 0; s < cell.num_clipped(); ++s) {
+    int num_edges = cell.clipped(s).num_edges();
+    if (num_edges > 2) bytes += num_edges * sizeof(int32);
+  }
+  return bytes;
+}
+
 inline const S2ShapeIndexCell* EncodedS2ShapeIndex::GetCell(int i) const {
   if (cell_decoded(i)) {
     auto cell = cells_[i].load(std::memory_order_acquire);
-    if (cell != nullptr) return cell;
+    if (cell != nullptr) {
+      if (!cells_referenced_.empty()) mark_cell_referenced(i);
+      if (cache_options_.count_hits()) {
+        cache_hits_.fetch_add(1, std::memory_order_relaxed);
+      }
+      return cell;
+    }
   }
+  return DecodeCell(i);
+}
+
+const S2ShapeIndexCell* EncodedS2ShapeIndex::DecodeCell(int i) const {
   // We decode the cell before acquiring the spinlock in order to minimize the
   // time that the lock is held.
   auto cell = make_unique<S2ShapeIndexCell>();
@@ -67,22 +172,155 @@ inline const S2ShapeIndexCell* EncodedS2ShapeIndex::GetCell(int i) const {
   if (!cell->Decode(num_shape_ids(), &decoder)) {
     return nullptr;
   }
+  cache_misses_.fetch_add(1, std::memory_order_relaxed);
+  size_t bytes = CellBytes(*cell);
   SpinLockHolder l(&cells_lock_);
-  if (test_and_set_cell_decoded(i)) {
+  if (cell_decoded(i)) {
     // This cell has already been decoded.
     return cells_[i].load(std::memory_order_relaxed);
   }
+  if (!cells_referenced_.empty()) {
+    EvictCells(bytes);
+    ReclaimRetiredCells();
+    mark_cell_referenced(i);
+  }
   if (cell_cache_.size() < max_cell_cache_size()) {
     cell_cache_.push_back(i);
   }
+  // The cell pointer must be stored before the decoded bit is set, since
+  // readers test the bit before loading the pointer.
   cells_[i].store(cell.get(), std::memory_order_relaxed);
+  test_and_set_cell_decoded(i);
+  cached_bytes_ += bytes;
+  ++num_cached_cells_;
   return cell.release();  // Ownership has been transferred to cells_.
 }
 
+// Evicts unpinned cells using the CLOCK algorithm until there is room for
+// "new_bytes" more bytes of decoded cells.  The hand visits each group of 64
+// cells in turn; cells that have been referenced since the hand last passed
+// them lose their reference bit, and all other cells are evicted.  Evicted
+// cells are moved to retired_cells_ since other threads may still be using
+// them.
+//
+// REQUIRES: cells_lock_ is held.
+void EncodedS2ShapeIndex::EvictCells(size_t new_bytes) const {
+  const size_t max_bytes = cache_options_.max_bytes();
+  const int num_groups = cells_decoded_.size();
+  // Two full revolutions suffice to evict every unpinned cell.  The scan
+  // stops early once only pinned cells remain, since otherwise every cache
+  // miss would scan the whole index when the pinned cells alone exceed
+  // max_bytes().
+  for (int n = 2 * num_groups + 1;
+       cached_bytes_ + new_bytes > max_bytes &&
+       num_cached_cells_ > num_pinned_cells_ && --n > 0; ) {
+    const int g = clock_hand_;
+    uint64 bits = cells_decoded_[g].load(std::memory_order_relaxed);
+    if (!cells_pinned_.empty()) bits &= ~cells_pinned_[g];
+    uint64 referenced = cells_referenced_[g].load(std::memory_order_relaxed);
+    for (; bits != 0; bits &= bits - 1) {
+      if (cached_bytes_ + new_bytes <= max_bytes) return;
+      int offset = Bits::FindLSBSetNonZero64(bits);
+      uint64 bit = 1ULL << offset;
+      if (referenced & bit) {
+        cells_referenced_[g].fetch_and(~bit, std::memory_order_relaxed);
+      } else {
+        S2ShapeIndexCell* cell = ReleaseCell((g << 6) + offset);
+        retired_bytes_ += CellBytes(*cell);
+        retired_cells_.push_back(cell);
+        cache_evictions_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (++clock_hand_ == num_groups) clock_hand_ = 0;
+  }
+}
+
+// Deletes the evicted cells that can no longer be in use by any Iterator.
+// This is a simple form of epoch-based reclamation: each Iterator is counted
+// as a reader in the slot for the reader epoch that it observed when it first
+// accessed a cell.  Cells in prev_retired_cells_ were evicted before the current
+// epoch began, so once no readers from the previous epoch remain they can be
+// deleted.  The cells evicted during the current epoch then become
+// prev_retired_cells_, and a new epoch begins.
+//
+// REQUIRES: cells_lock_ is held.
+void EncodedS2ShapeIndex::ReclaimRetiredCells() const {
+  if (retired_cells_.empty() && prev_retired_cells_.empty()) return;
+
+  // The evicted cells were made inaccessible before this fence, so any
+  // reader that registers after the reader counts are loaded below cannot
+  // obtain them.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint32 epoch = reader_epoch_.load(std::memory_order_relaxed);
+  if (num_readers_[(epoch + 1) & 1].load(std::memory_order_acquire) != 0) {
+    return;
+  }
+  for (S2ShapeIndexCell* cell : prev_retired_cells_) {
+    retired_bytes_ -= CellBytes(*cell);
+    delete cell;
+  }
+  prev_retired_cells_.clear();
+  prev_retired_cells_.swap(retired_cells_);
+  reader_epoch_.store(epoch + 1, std::memory_order_seq_cst);
+}
+
+// Makes the given decoded cell inaccessible to future lookups and returns it.
+// The caller is responsible for deleting the cell once no readers can be
+// using it.
+//
+// REQUIRES: cells_lock_ is held (or no other threads are accessing the index).
+S2ShapeIndexCell* EncodedS2ShapeIndex::ReleaseCell(int i) const {
+  S2ShapeIndexCell* cell = cells_[i].load(std::memory_order_relaxed);
+  std::atomic<uint64>* group = &cells_decoded_[i >> 6];
+  group->store(group->load(std::memory_order_relaxed) & ~(1ULL << (i & 63)),
+               std::memory_order_relaxed);
+  cells_[i].store(nullptr, std::memory_order_relaxed);
+  cached_bytes_ -= CellBytes(*cell);
+  --num_cached_cells_;
+  return cell;
+}
+
+void EncodedS2ShapeIndex::DeleteRetiredCells() {
+  for (S2ShapeIndexCell* cell : retired_cells_) delete cell;
+  for (S2ShapeIndexCell* cell : prev_retired_cells_) delete cell;
+  retired_cells_.clear();
+  prev_retired_cells_.clear();
+  retired_bytes_ = 0;
+}
+
 const S2ShapeIndexCell* EncodedS2ShapeIndex::Iterator::GetCell() const {
+  // Readers only need to be tracked if cells can be evicted.  Registration
+  // must precede the cell lookup so that the cell cannot be freed while this
+  // iterator is using it.
+  if (!index_->cells_referenced_.empty() &&
+      reader_slot_.load(std::memory_order_relaxed) < 0) {
+    RegisterReader();
+  }
   return index_->GetCell(cell_pos_);
 }
 
+// Registers this iterator as a reader in the slot for the current reader
+// epoch.  If the epoch changes before the registration becomes visible, the
+// registration is retried so that the iterator is always counted in the
+// slot of an epoch that was current after it registered.
+void EncodedS2ShapeIndex::Iterator::RegisterReader() const {
+  for (;;) {
+    uint32 epoch = index_->reader_epoch_.load(std::memory_order_seq_cst);
+    int slot = epoch & 1;
+    index_->num_readers_[slot].fetch_add(1, std::memory_order_seq_cst);
+    if (index_->reader_epoch_.load(std::memory_order_seq_cst) == epoch) {
+      int32 expected = -1;
+      if (!reader_slot_.compare_exchange_strong(expected, slot,
+                                                std::memory_order_relaxed)) {
+        // Another thread registered this iterator concurrently.
+        index_->num_readers_[slot].fetch_sub(1, std::memory_order_relaxed);
+      }
+      return;
+    }
+    index_->num_readers_[slot].fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
 EncodedS2ShapeIndex::EncodedS2ShapeIndex() {
 }
 
@@ -96,6 +334,10 @@ EncodedS2ShapeIndex::~EncodedS2ShapeIndex() {
 bool EncodedS2ShapeIndex::Init(Decoder* decoder,
                                const ShapeFactory& shape_factory) {
   Minimize();
+  // Any previous mapping can be released now that all shapes and cells that
+  // might refer to it have been deleted.  (InitFromFile() installs its new
+  // mapping after this method returns.)
+  mapped_file_.reset();
   uint64 max_edges_version;
   if (!decoder->get_varint64(&max_edges_version)) return false;
   int version = max_edges_version & 3;
@@ -130,10 +372,38 @@ bool EncodedS2ShapeIndex::Init(Decoder* decoder,
   //                                NO NO NO
   cells_.reset(new std::atomic<S2ShapeIndexCell*>[cell_ids_.size()]);
   cells_decoded_ = vector<std::atomic<uint64>>((cell_ids_.size() + 63) >> 6);
+  cells_referenced_ =
+      vector<std::atomic<uint64>>(cache_options_.policy() ==
+                                  CellCacheOptions::Policy::CLOCK
+                                  ? cells_decoded_.size() : 0);
+  clock_hand_ = 0;
+  cache_hits_.store(0, std::memory_order_relaxed);
+  cache_misses_.store(0, std::memory_order_relaxed);
+  cache_evictions_.store(0, std::memory_order_relaxed);
 
   return encoded_cells_.Init(decoder);
 }
 
+bool EncodedS2ShapeIndex::InitFromFile(const string& filename,
+                                       const FileOptions& options) {
+  unique_ptr<MappedFile> file = MappedFile::Open(filename, options);
+  if (file == nullptr) return false;
+  Decoder decoder(file->data(), file->size());
+
+  // TaggedShapeFactory silently treats a malformed shape vector as empty, so
+  // we validate its header separately.
+  Decoder shapes_decoder = decoder;
+  s2coding::EncodedStringVector encoded_shapes;
+  if (!encoded_shapes.Init(&shapes_decoder)) return false;
+  s2shapeutil::TaggedShapeFactory shape_factory =
+      s2shapeutil::LazyDecodeShapeFactory(&decoder);
+  bool success = Init(&decoder, shape_factory) && decoder.avail() == 0;
+  // The mapping is retained even on failure since the shape factory and the
+  // encoded vectors may already point into it.
+  mapped_file_ = std::move(file);
+  return success;
+}
+
 void EncodedS2ShapeIndex::Minimize() {
   if (cells_ == nullptr) return;  // Not initialized yet.
 
@@ -149,9 +419,14 @@ void EncodedS2ShapeIndex::Minimize() {
     // those cells in cell_cache_ to avoid the cost of scanning the
     // cells_decoded_ vector.  (The cost is only about 1 cycle per 64 cells,
     // but for a huge polygon with 1 million cells that's still 16000 cycles.)
+    //
+    // Note that cells may have been evicted since they were added to
+    // cell_cache_, and may even appear more than once.
     for (int pos : cell_cache_) {
-      cells_decoded_[pos >> 6].store(0, std::memory_order_relaxed);
-      delete cells_[pos].load(std::memory_order_relaxed);
+      if (cell_decoded(pos)) delete ReleaseCell(pos);
+      if (!cells_referenced_.empty()) {
+        cells_referenced_[pos >> 6].store(0, std::memory_order_relaxed);
+      }
     }
   } else {
     // Scan the cells_decoded_ vector looking for cells that must be deleted.
@@ -165,8 +440,79 @@ void EncodedS2ShapeIndex::Minimize() {
       } while (bits != 0);
       cells_decoded_[i].store(0, std::memory_order_relaxed);
     }
+    for (auto& group : cells_referenced_) {
+      group.store(0, std::memory_order_relaxed);
+    }
   }
   cell_cache_.clear();
+  DeleteRetiredCells();
+  cells_pinned_.clear();
+  num_pinned_cells_ = 0;
+  cached_bytes_ = 0;
+  num_cached_cells_ = 0;
+}
+
+void EncodedS2ShapeIndex::set_cell_cache_options(
+    const CellCacheOptions& options) {
+  Minimize();
+  cache_options_ = options;
+  if (cells_ == nullptr) return;  // Not initialized yet.
+  cells_referenced_ =
+      vector<std::atomic<uint64>>(options.policy() ==
+                                  CellCacheOptions::Policy::CLOCK
+                                  ? cells_decoded_.size() : 0);
+  clock_hand_ = 0;
+}
+
+void EncodedS2ShapeIndex::PinCells(const vector<S2CellId>& ids) {
+  if (cells_ == nullptr) return;  // Not initialized yet.
+  if (cells_pinned_.empty()) cells_pinned_.resize(cells_decoded_.size());
+  Iterator it(this);
+  for (S2CellId id : ids) {
+    CellRelation r = it.Locate(id);
+    if (r == DISJOINT) continue;
+    int pos = cell_ids_.lower_bound(it.id());
+    int end = (r == INDEXED) ? pos + 1
+                             : cell_ids_.lower_bound(id.range_max().next());
+    for (; pos < end; ++pos) {
+      // The cell is pinned before it is decoded so that decoding it cannot
+      // evict any cell that was pinned earlier.
+      uint64 bit = 1ULL << (pos & 63);
+      if ((cells_pinned_[pos >> 6] & bit) == 0) {
+        cells_pinned_[pos >> 6] |= bit;
+        ++num_pinned_cells_;
+      }
+      GetCell(pos);
+    }
+  }
+}
+
+void EncodedS2ShapeIndex::TrimCellCache() {
+  DeleteRetiredCells();
+  if (cells_referenced_.empty()) return;
+  for (int g = 0; g < cells_decoded_.size(); ++g) {
+    uint64 bits = cells_decoded_[g].load(std::memory_order_relaxed);
+    bits &= ~cells_referenced_[g].load(std::memory_order_relaxed);
+    if (!cells_pinned_.empty()) bits &= ~cells_pinned_[g];
+    for (; bits != 0; bits &= bits - 1) {
+      delete ReleaseCell((g << 6) + Bits::FindLSBSetNonZero64(bits));
+    }
+    cells_referenced_[g].store(0, std::memory_order_relaxed);
+  }
+}
+
+EncodedS2ShapeIndex::CellCacheStats
+EncodedS2ShapeIndex::cell_cache_stats() const {
+  CellCacheStats stats;
+  stats.hits = cache_hits_.load(std::memory_order_relaxed);
+  stats.misses = cache_misses_.load(std::memory_order_relaxed);
+  stats.evictions = cache_evictions_.load(std::memory_order_relaxed);
+  SpinLockHolder l(&cells_lock_);
+  stats.num_cached_cells = num_cached_cells_;
+  stats.num_pinned_cells = num_pinned_cells_;
+  stats.cached_bytes = cached_bytes_;
+  stats.retired_bytes = retired_bytes_;
+  return stats;
 }
 
 size_t EncodedS2ShapeIndex::SpaceUsed() const {
@@ -177,5 +523,12 @@ size_t EncodedS2ShapeIndex::SpaceUsed() const {
   size += cell_ids_.size() * sizeof(std::atomic<S2ShapeIndexCell*>);  // cells_
   size += cells_decoded_.capacity() * sizeof(std::atomic<uint64>);
   size += cell_cache_.capacity() * sizeof(int);
+  size += cell_ids_.search_index_bytes();
+  size += cells_referenced_.capacity() * sizeof(std::atomic<uint64>);
+  size += cells_pinned_.capacity() * sizeof(uint64);
+  SpinLockHolder l(&cells_lock_);
+  size += (retired_cells_.capacity() + prev_retired_cells_.capacity()) *
+          sizeof(S2ShapeIndexCell*);
+  size += cached_bytes_ + retired_bytes_;
   return size;
 }
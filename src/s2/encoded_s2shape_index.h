@@ -18,6 +18,10 @@
 #ifndef S2_ENCODED_S2SHAPE_INDEX_H_
 #define S2_ENCODED_S2SHAPE_INDEX_H_
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "s2/encoded_s2cell_id_vector.h"
 #include "s2/encoded_string_vector.h"
 #include "s2/mutable_s2shape_index.h"
@@ -44,6 +48,54 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
   // in the Decoder's data buffer in this example.
   bool Init(Decoder* decoder, const ShapeFactory& shape_factory);
 
+  // Options that control how InitFromFile() maps its file into memory.
+  class FileOptions {
+   public:
+    // Hints passed to the kernel (via madvise) describing how the mapped
+    // pages will be accessed.  These only affect performance.
+    enum class AccessPattern {
+      NORMAL,      // No special treatment.
+      RANDOM,      // Disable read-ahead; best for point and edge queries.
+      SEQUENTIAL,  // Aggressive read-ahead; best for full scans.
+    };
+
+    FileOptions();
+
+    // DEFAULT: AccessPattern::NORMAL
+    AccessPattern access_pattern() const { return access_pattern_; }
+    void set_access_pattern(AccessPattern access_pattern);
+
+    // If true, the kernel is asked to start reading the whole file into the
+    // page cache immediately (MADV_WILLNEED) rather than on first access.
+    // This trades a larger up-front I/O cost for lower first-query latency.
+    //
+    // DEFAULT: false
+    bool prefetch() const { return prefetch_; }
+    void set_prefetch(bool prefetch);
+
+   private:
+    AccessPattern access_pattern_ = AccessPattern::NORMAL;
+    bool prefetch_ = false;
+  };
+
+  // Initializes the EncodedS2ShapeIndex from a file that is mapped read-only
+  // into memory, returning true on success.  The file must consist of a
+  // vector of tagged shapes followed by the encoded S2ShapeIndex, i.e.
+  //
+  //   s2shapeutil::CompactEncodeTaggedShapes(index, encoder);
+  //   index.Encode(encoder);
+  //
+  // Shapes are decoded lazily (see s2shapeutil::LazyDecodeShapeFactory) and
+  // both shapes and cells are served directly from the mapped pages, so
+  // initialization cost is independent of the file size and the pages are
+  // shared with any other process that maps the same file.  The mapping is
+  // released when the index is destroyed or re-initialized.
+  //
+  // Returns false if the file cannot be mapped, if either encoded section is
+  // malformed, or if the file contains trailing data after the index.
+  bool InitFromFile(const std::string& filename,
+                    const FileOptions& options = FileOptions());
+
   const Options& options() const { return options_; }
 
   // The number of distinct shape ids in the index.  This equals the number of
@@ -61,6 +113,106 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
   // Like all non-const methods, this method is not thread-safe.
   void Minimize() override;
 
+  // Builds an auxiliary structure that speeds up Seek() (and therefore most
+  // queries) on indexes with many cells, at a cost of less than half a byte
+  // per cell.  See EncodedS2CellIdVector::BuildSearchIndex() for details.
+  //
+  // Like all non-const methods, this method is not thread-safe.
+  void BuildSearchIndex() { cell_ids_.BuildSearchIndex(); }
+
+  // Options that control which decoded cells are retained in memory.
+  class CellCacheOptions {
+   public:
+    enum class Policy {
+      // Decoded cells are kept until Minimize() is called.  This is the
+      // cheapest policy for indexes that are small or used only briefly.
+      KEEP_ALL,
+
+      // Decoded cells are kept until their total size exceeds max_bytes(),
+      // at which point cells that have not been accessed recently are
+      // evicted using the CLOCK (second chance) algorithm.
+      //
+      // An iterator that has accessed cell contents prevents evicted cells
+      // from being freed until it is destroyed, re-initialized, or
+      // ReleaseCells() is called.  Long-lived iterators (such as those kept
+      // by query objects between queries) should therefore call
+      // ReleaseCells() once they no longer need the cells they returned.
+      CLOCK,
+    };
+
+    CellCacheOptions();
+
+    // DEFAULT: Policy::KEEP_ALL
+    Policy policy() const { return policy_; }
+    void set_policy(Policy policy);
+
+    // The approximate maximum number of bytes of decoded cells to keep when
+    // the CLOCK policy is used.  Pinned cells (see PinCells) are included in
+    // this total but are never evicted.
+    //
+    // DEFAULT: 64 MB
+    size_t max_bytes() const { return max_bytes_; }
+    void set_max_bytes(size_t max_bytes);
+
+    // If true, cache hits are counted in CellCacheStats.  This adds an atomic
+    // increment of a shared counter to every cell access, which can cause
+    // cache line contention when many threads query the same index.  (Misses
+    // and evictions are always counted.)
+    //
+    // DEFAULT: false
+    bool count_hits() const { return count_hits_; }
+    void set_count_hits(bool count_hits);
+
+   private:
+    Policy policy_ = Policy::KEEP_ALL;
+    size_t max_bytes_ = 64 << 20;
+    bool count_hits_ = false;
+  };
+
+  const CellCacheOptions& cell_cache_options() const { return cache_options_; }
+
+  // Sets the cell cache options.  This method calls Minimize(), and
+  // therefore invalidates all iterators and discards all pinned cells.
+  void set_cell_cache_options(const CellCacheOptions& options);
+
+  // Decodes every index cell that intersects one of the given S2CellIds and
+  // marks it as pinned, so that it is never evicted by the cache policy and
+  // is retained by TrimCellCache().  This is useful when the set of hot
+  // cells is known in advance.  Pinned cells are released by Minimize().
+  //
+  // Like all non-const methods, this method is not thread-safe.
+  void PinCells(const std::vector<S2CellId>& ids);
+
+  // Releases cached cells that are no longer useful while retaining the hot
+  // set.  This frees all cells evicted since the last call (see below),
+  // and when the CLOCK policy is used it also frees every unpinned cell that
+  // has not been accessed since the last call.  Unlike Minimize(), cells in
+  // active use therefore do not need to be decoded again.
+  //
+  // Evicted cells cannot be freed immediately because concurrent readers
+  // may still hold pointers to them; instead they are retained (and reported
+  // as "retired_bytes") until every Iterator that was using cells when they
+  // were evicted has been destroyed, re-initialized, or had ReleaseCells()
+  // called, at which point they are freed by a later cache miss.  This method and Minimize() free them
+  // immediately.
+  //
+  // This method invalidates all iterators and, like all non-const methods, is
+  // not thread-safe.
+  void TrimCellCache();
+
+  // Statistics about the decoded cell cache.  Counters are cumulative since
+  // the index was initialized.
+  struct CellCacheStats {
+    int64 hits = 0;       // Only counted if options.count_hits() is true.
+    int64 misses = 0;     // Cells that had to be decoded.
+    int64 evictions = 0;  // Cells evicted to stay within max_bytes().
+    int num_cached_cells = 0;
+    int num_pinned_cells = 0;
+    size_t cached_bytes = 0;   // Memory used by cells that can be accessed.
+    size_t retired_bytes = 0;  // Memory used by evicted cells.
+  };
+  CellCacheStats cell_cache_stats() const;
+
   class Iterator final : public IteratorBase {
    public:
     // Default constructor; must be followed by a call to Init().
@@ -78,6 +230,10 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
     explicit Iterator(const EncodedS2ShapeIndex* index,
                       InitialPosition pos = UNPOSITIONED);
 
+    Iterator(const Iterator& other);
+    Iterator& operator=(const Iterator& other);
+    ~Iterator() override;
+
     // Initializes an iterator for the given EncodedS2ShapeIndex.
     void Init(const EncodedS2ShapeIndex* index,
               InitialPosition pos = UNPOSITIONED);
@@ -96,6 +252,7 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
     void Seek(S2CellId target) override;
     bool Locate(const S2Point& target) override;
     CellRelation Locate(S2CellId target) override;
+    bool ReleaseCells() override;
 
    protected:
     const S2ShapeIndexCell* GetCell() const override;
@@ -104,9 +261,18 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
 
    private:
     void Refresh();  // Updates the IteratorBase fields.
+    void DropEvictableCell();
+    void RegisterReader() const;
+    void UnregisterReader() const;
     const EncodedS2ShapeIndex* index_;
     int32 cell_pos_;  // Current position in the vector of index cells.
     int32 num_cells_;
+
+    // The reader slot of index_ that this iterator is counted in, or -1 if
+    // it is not registered as a reader (see ReclaimRetiredCells).  Iterators
+    // register when they first access cell contents, which may happen
+    // concurrently since cell() is a const method.
+    mutable std::atomic<int32> reader_slot_;
   };
 
   // Returns the number of bytes currently occupied by the index (including any
@@ -133,10 +299,22 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
 
   S2Shape* GetShape(int id) const;
   const S2ShapeIndexCell* GetCell(int i) const;
+  const S2ShapeIndexCell* DecodeCell(int i) const;
+  void EvictCells(size_t new_bytes) const;
+  void ReclaimRetiredCells() const;
+  S2ShapeIndexCell* ReleaseCell(int i) const;
+  void DeleteRetiredCells();
   bool cell_decoded(int i) const;
   bool test_and_set_cell_decoded(int i) const;
+  void mark_cell_referenced(int i) const;
   int max_cell_cache_size() const;
 
+  // A read-only memory mapping of the file passed to InitFromFile(), or
+  // nullptr if the index was initialized from a client-owned Decoder.  This
+  // is declared first so that it outlives everything that points into it.
+  class MappedFile;
+  std::unique_ptr<MappedFile> mapped_file_;
+
   std::unique_ptr<ShapeFactory> shape_factory_;
 
   // The options specified for this index.
@@ -168,7 +346,46 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
   // vector when the number of cells decoded is very small.
   mutable std::vector<int> cell_cache_;
 
-  // Protects all updates to cells_ and cells_decoded_.
+  // The cell cache policy and the state needed to implement it.
+  CellCacheOptions cache_options_;
+
+  // A bit vector indicating which decoded cells have been accessed since the
+  // CLOCK hand last passed them.  Only allocated for the CLOCK policy.
+  mutable std::vector<std::atomic<uint64>> cells_referenced_;
+
+  // A bit vector indicating which cells are pinned (see PinCells).  Empty
+  // unless PinCells() has been called.
+  std::vector<uint64> cells_pinned_;
+
+  // Cells that have been evicted but may still be referenced by concurrent
+  // readers, during the current reader epoch and the previous one (see
+  // ReclaimRetiredCells).  They are also deleted by TrimCellCache() and
+  // Minimize().
+  mutable std::vector<S2ShapeIndexCell*> retired_cells_;
+  mutable std::vector<S2ShapeIndexCell*> prev_retired_cells_;
+
+  // When the CLOCK policy is used, Iterators that access cells register as
+  // readers by incrementing the slot of num_readers_ given by the parity of
+  // the reader epoch that they observe.
+  mutable std::atomic<uint32> reader_epoch_{0};
+  mutable std::atomic<int32> num_readers_[2] = {{0}, {0}};
+
+  // The current position of the CLOCK hand, as an index into cells_decoded_.
+  mutable int clock_hand_ = 0;
+
+  // The memory used by decoded cells that are accessible (cached_bytes_) and
+  // that have been evicted (retired_bytes_).
+  mutable size_t cached_bytes_ = 0;
+  mutable size_t retired_bytes_ = 0;
+  mutable int num_cached_cells_ = 0;
+  int num_pinned_cells_ = 0;
+
+  mutable std::atomic<int64> cache_hits_{0};
+  mutable std::atomic<int64> cache_misses_{0};
+  mutable std::atomic<int64> cache_evictions_{0};
+
+  // Protects all updates to cells_, cells_decoded_, cells_referenced_, and
+  // the cache bookkeeping fields above.
   mutable SpinLock cells_lock_;
 
   EncodedS2ShapeIndex(const EncodedS2ShapeIndex&) = delete;
@@ -179,22 +396,70 @@ class EncodedS2ShapeIndex final : public S2ShapeIndex {
 //////////////////   Implementation details follow   ////////////////////
 
 
-inline EncodedS2ShapeIndex::Iterator::Iterator() : index_(nullptr) {
+inline EncodedS2ShapeIndex::Iterator::Iterator()
+    : index_(nullptr), reader_slot_(-1) {
 }
 
 inline EncodedS2ShapeIndex::Iterator::Iterator(
-    const EncodedS2ShapeIndex* index, InitialPosition pos) {
+    const EncodedS2ShapeIndex* index, InitialPosition pos)
+    : reader_slot_(-1) {
   Init(index, pos);
 }
 
+inline EncodedS2ShapeIndex::Iterator::Iterator(const Iterator& other)
+    : IteratorBase(other), index_(other.index_), cell_pos_(other.cell_pos_),
+      num_cells_(other.num_cells_), reader_slot_(-1) {
+  DropEvictableCell();
+}
+
+inline EncodedS2ShapeIndex::Iterator&
+EncodedS2ShapeIndex::Iterator::operator=(const Iterator& other) {
+  if (this != &other) {
+    UnregisterReader();
+    IteratorBase::operator=(other);
+    index_ = other.index_;
+    cell_pos_ = other.cell_pos_;
+    num_cells_ = other.num_cells_;
+    DropEvictableCell();
+  }
+  return *this;
+}
+
+inline EncodedS2ShapeIndex::Iterator::~Iterator() {
+  UnregisterReader();
+}
+
 inline void EncodedS2ShapeIndex::Iterator::Init(
     const EncodedS2ShapeIndex* index, InitialPosition pos) {
+  UnregisterReader();
   index_ = index;
   num_cells_ = index->cell_ids_.size();
   cell_pos_ = (pos == BEGIN) ? 0 : num_cells_;
   Refresh();
 }
 
+// The cell that a copied iterator refers to is protected only by the
+// registration of the original iterator, so the copy looks it up again.
+inline void EncodedS2ShapeIndex::Iterator::DropEvictableCell() {
+  if (index_ != nullptr && !index_->cells_referenced_.empty()) Refresh();
+}
+
+inline bool EncodedS2ShapeIndex::Iterator::ReleaseCells() {
+  if (reader_slot_.load(std::memory_order_relaxed) < 0) return false;
+  UnregisterReader();
+  Refresh();  // The current cell may be evicted, so it must be looked up again.
+  return true;
+}
+
+inline void EncodedS2ShapeIndex::Iterator::UnregisterReader() const {
+  int32 slot = reader_slot_.load(std::memory_order_relaxed);
+  if (slot < 0) return;
+  // The release ordering ensures that all uses of cells by this iterator
+  // happen before any thread that observes the decrement deletes them.
+  index_->num_readers_[slot].fetch_sub(1, std::memory_order_release);
+  reader_slot_.store(-1, std::memory_order_relaxed);
+}
+
 inline void EncodedS2ShapeIndex::Iterator::Refresh() {
   if (cell_pos_ == num_cells_) {
     set_finished();
@@ -247,19 +512,33 @@ inline S2Shape* EncodedS2ShapeIndex::shape(int id) const {
 
 // Returns true if the given cell has been decoded yet.
 inline bool EncodedS2ShapeIndex::cell_decoded(int i) const {
-  uint64 group_bits = cells_decoded_[i >> 6].load(std::memory_order_relaxed);
+  uint64 group_bits = cells_decoded_[i >> 6].load(std::memory_order_acquire);
   return (group_bits & (1ULL << (i & 63))) != 0;
 }
 
 // Marks the given cell as decoded and returns true if it was already marked.
+// The release store ensures that readers who observe the bit also observe
+// the cell pointer stored before this call.
+//
+// REQUIRES: cells_lock_ is held.
 inline bool EncodedS2ShapeIndex::test_and_set_cell_decoded(int i) const {
   std::atomic<uint64>* group = &cells_decoded_[i >> 6];
   uint64 group_bits = group->load(std::memory_order_relaxed);
   uint64 test_bit = 1ULL << (i & 63);
-  group->store(group_bits | test_bit, std::memory_order_relaxed);
+  group->store(group_bits | test_bit, std::memory_order_release);
   return (group_bits & test_bit) != 0;
 }
 
+// Sets the CLOCK reference bit for the given cell.  The bit is tested first
+// so that hot cells do not cause repeated writes to shared cache lines.
+inline void EncodedS2ShapeIndex::mark_cell_referenced(int i) const {
+  std::atomic<uint64>* group = &cells_referenced_[i >> 6];
+  uint64 test_bit = 1ULL << (i & 63);
+  if ((group->load(std::memory_order_relaxed) & test_bit) == 0) {
+    group->fetch_or(test_bit, std::memory_order_relaxed);
+  }
+}
+
 inline int EncodedS2ShapeIndex::max_cell_cache_size() const {
   // The cell cache is sized so that scanning decoded_cells_ in the destructor
   // costs about 30 cycles per decoded cell in the worst case.  (This overhead
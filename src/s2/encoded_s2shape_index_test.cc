@@ -17,7 +17,13 @@
 
 #include "s2/encoded_s2shape_index.h"
 
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
 #include <map>
+#include <string>
+#include <thread>
 #include <vector>
 #include <gtest/gtest.h>
 #include "s2/third_party/absl/memory/memory.h"
@@ -46,6 +52,7 @@ using absl::StrCat;
 using s2builderutil::S2CellIdSnapFunction;
 using s2builderutil::S2PolylineLayer;
 using std::max;
+using std::string;
 using std::unique_ptr;
 using std::vector;
 
@@ -242,3 +249,296 @@ TEST(EncodedS2ShapeIndex, SnappedFractalPolylines) {
   TestEncodedS2ShapeIndex<S2LaxPolylineShape, EncodedS2LaxPolylineShape>(
       index, 8698);
 }
+
+// Replaces the contents of "filename" with the first "size" bytes of "data".
+static void WriteFile(const string& filename, const char* data, size_t size) {
+  FILE* file = std::fopen(filename.c_str(), "wb");
+  ASSERT_TRUE(file != nullptr);
+  EXPECT_EQ(size, std::fwrite(data, 1, size, file));
+  std::fclose(file);
+}
+
+// Writes "size" bytes of "data" to a new uniquely named temporary file and
+// returns its name.
+static string WriteTempFile(const char* data, size_t size) {
+  const char* dir = std::getenv("TEST_TMPDIR");
+  string filename = StrCat(dir ? dir : "/tmp",
+                           "/encoded_s2shape_index_test.XXXXXX");
+  int fd = mkstemp(&filename[0]);
+  EXPECT_GE(fd, 0);
+  if (fd >= 0) close(fd);
+  WriteFile(filename, data, size);
+  return filename;
+}
+
+TEST(EncodedS2ShapeIndex, InitFromFile) {
+  MutableS2ShapeIndex expected;
+  expected.Add(make_unique<S2LaxPolygonShape>(S2Polygon(
+      S2Loop::MakeRegularLoop(S2Point(3, 2, 1).Normalize(),
+                              S1Angle::Degrees(0.1), 1000))));
+  expected.Add(s2textformat::MakeLaxPolylineOrDie("1:1, 2:2, 3:3"));
+  Encoder encoder;
+  ASSERT_TRUE(s2shapeutil::CompactEncodeTaggedShapes(expected, &encoder));
+  expected.Encode(&encoder);
+  string filename = WriteTempFile(encoder.base(), encoder.length());
+
+  EncodedS2ShapeIndex::FileOptions options;
+  options.set_access_pattern(
+      EncodedS2ShapeIndex::FileOptions::AccessPattern::RANDOM);
+  options.set_prefetch(true);
+  EncodedS2ShapeIndex actual;
+  ASSERT_TRUE(actual.InitFromFile(filename, options));
+  s2testing::ExpectEqual(expected, actual);
+
+  // Re-initializing releases the previous mapping; Minimize() must not
+  // invalidate the shapes' encoded data.
+  ASSERT_TRUE(actual.InitFromFile(filename));
+  actual.Minimize();
+  s2testing::ExpectEqual(expected, actual);
+  std::remove(filename.c_str());
+}
+
+TEST(EncodedS2ShapeIndex, InitFromFileRejectsInvalidFiles) {
+  MutableS2ShapeIndex index;
+  index.Add(s2textformat::MakeLaxPolylineOrDie("1:1, 2:2"));
+  Encoder encoder;
+  ASSERT_TRUE(s2shapeutil::CompactEncodeTaggedShapes(index, &encoder));
+  index.Encode(&encoder);
+  encoder.Ensure(1);
+  encoder.put8(0);  // Trailing garbage.
+
+  EncodedS2ShapeIndex actual;
+  EXPECT_FALSE(actual.InitFromFile("/nonexistent/encoded_s2shape_index"));
+  string filename = WriteTempFile(encoder.base(), 0);
+  EXPECT_FALSE(actual.InitFromFile(filename));  // Empty file.
+  WriteFile(filename, encoder.base(), 1);
+  EXPECT_FALSE(actual.InitFromFile(filename));  // Truncated.
+  WriteFile(filename, encoder.base(), encoder.length());
+  EXPECT_FALSE(actual.InitFromFile(filename));  // Trailing data.
+  WriteFile(filename, encoder.base(), encoder.length() - 1);
+  EXPECT_TRUE(actual.InitFromFile(filename));
+  s2testing::ExpectEqual(index, actual);
+  std::remove(filename.c_str());
+}
+
+// Encodes "index" as tagged shapes followed by the index itself.
+static void EncodeTaggedIndex(const MutableS2ShapeIndex& index,
+                              Encoder* encoder) {
+  ASSERT_TRUE(s2shapeutil::CompactEncodeTaggedShapes(index, encoder));
+  index.Encode(encoder);
+}
+
+using CellCacheOptions = EncodedS2ShapeIndex::CellCacheOptions;
+
+static void MakeManyCellIndex(MutableS2ShapeIndex* index) {
+  MutableS2ShapeIndex::Options options;
+  options.set_max_edges_per_cell(1);
+  index->Init(options);
+  index->Add(make_unique<S2LaxPolygonShape>(S2Polygon(
+      S2Loop::MakeRegularLoop(S2Point(3, 2, 1).Normalize(),
+                              S1Angle::Degrees(1), 2000))));
+  index->ForceBuild();
+}
+
+TEST(EncodedS2ShapeIndex, ClockCellCacheIsBounded) {
+  MutableS2ShapeIndex expected;
+  MakeManyCellIndex(&expected);
+  Encoder encoder;
+  EncodeTaggedIndex(expected, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex actual;
+  CellCacheOptions cache_options;
+  cache_options.set_policy(CellCacheOptions::Policy::CLOCK);
+  cache_options.set_max_bytes(4096);
+  cache_options.set_count_hits(true);
+  actual.set_cell_cache_options(cache_options);
+  ASSERT_TRUE(actual.Init(&decoder,
+                          s2shapeutil::LazyDecodeShapeFactory(&decoder)));
+
+  // Scan the index twice; every cell should be decoded on each pass since
+  // the cache is much smaller than the index.
+  // (Allow one cell's worth of slack since eviction happens before insertion.)
+  for (int pass = 0; pass < 2; ++pass) {
+    s2testing::ExpectEqual(expected, actual);
+    EXPECT_LE(actual.cell_cache_stats().cached_bytes, 4096 + 1024);
+  }
+  int num_cells = 0;
+  for (EncodedS2ShapeIndex::Iterator it(&actual, S2ShapeIndex::BEGIN);
+       !it.done(); it.Next()) {
+    ++num_cells;
+  }
+  auto stats = actual.cell_cache_stats();
+  EXPECT_GE(stats.misses, 2 * num_cells);
+  EXPECT_GT(stats.evictions, 0);
+  EXPECT_GT(stats.retired_bytes, 0);
+
+  // TrimCellCache() frees the evicted cells without affecting correctness.
+  actual.TrimCellCache();
+  stats = actual.cell_cache_stats();
+  EXPECT_EQ(0, stats.retired_bytes);
+  s2testing::ExpectEqual(expected, actual);
+}
+
+TEST(EncodedS2ShapeIndex, ClockCellCacheReclaimsEvictedCells) {
+  MutableS2ShapeIndex expected;
+  MakeManyCellIndex(&expected);
+  Encoder encoder;
+  EncodeTaggedIndex(expected, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex actual;
+  CellCacheOptions cache_options;
+  cache_options.set_policy(CellCacheOptions::Policy::CLOCK);
+  cache_options.set_max_bytes(4096);
+  actual.set_cell_cache_options(cache_options);
+  ASSERT_TRUE(actual.Init(&decoder,
+                          s2shapeutil::LazyDecodeShapeFactory(&decoder)));
+
+  // Cells evicted while an iterator exists are not freed, since the iterator
+  // might still be using them.
+  vector<S2CellId> ids;
+  {
+    EncodedS2ShapeIndex::Iterator it(&actual, S2ShapeIndex::BEGIN);
+    for (; !it.done(); it.Next()) {
+      ids.push_back(it.id());
+      it.cell();
+    }
+    EXPECT_GT(actual.cell_cache_stats().retired_bytes, 4 * 4096);
+  }
+  // Once that iterator is gone, the evicted cells are freed by later cache
+  // misses, and when each iterator is short-lived only the cells evicted
+  // during the last couple of misses are retained.
+  for (S2CellId id : ids) {
+    EncodedS2ShapeIndex::Iterator it(&actual);
+    it.Seek(id);
+    it.cell();
+  }
+  auto stats = actual.cell_cache_stats();
+  EXPECT_GE(stats.misses, 2 * ids.size());
+  EXPECT_LE(stats.retired_bytes, 4096);
+  s2testing::ExpectEqual(expected, actual);
+}
+
+TEST(EncodedS2ShapeIndex, ClockCellCacheReclaimsCellsOfReusedQueries) {
+  // Query objects keep their iterators between calls, so they must not
+  // prevent evicted cells from being freed.
+  MutableS2ShapeIndex expected;
+  MakeManyCellIndex(&expected);
+  Encoder encoder;
+  EncodeTaggedIndex(expected, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex actual;
+  CellCacheOptions cache_options;
+  cache_options.set_policy(CellCacheOptions::Policy::CLOCK);
+  cache_options.set_max_bytes(4096);
+  actual.set_cell_cache_options(cache_options);
+  ASSERT_TRUE(actual.Init(&decoder,
+                          s2shapeutil::LazyDecodeShapeFactory(&decoder)));
+
+  S2ClosestEdgeQuery query(&actual);
+  query.mutable_options()->set_max_results(3);
+  auto contains_query = MakeS2ContainsPointQuery(&actual);
+  S2Cap cap(S2Point(3, 2, 1).Normalize(), S1Angle::Degrees(1.5));
+  size_t max_retired_bytes = 0;
+  for (int i = 0; i < 1000; ++i) {
+    S2ClosestEdgeQuery::PointTarget target(S2Testing::SamplePoint(cap));
+    query.FindClosestEdges(&target);
+    contains_query.Contains(S2Testing::SamplePoint(cap));
+    max_retired_bytes = max(max_retired_bytes,
+                            actual.cell_cache_stats().retired_bytes);
+  }
+  // Many thousands of cells are evicted during the queries, but only those
+  // evicted during the last couple of queries are retained.
+  EXPECT_GT(actual.cell_cache_stats().evictions, 10000);
+  EXPECT_LE(max_retired_bytes, 64 * 4096);
+}
+
+TEST(EncodedS2ShapeIndex, PinnedCellsSurviveEvictionAndTrim) {
+  MutableS2ShapeIndex expected;
+  MakeManyCellIndex(&expected);
+  Encoder encoder;
+  EncodeTaggedIndex(expected, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex actual;
+  ASSERT_TRUE(actual.Init(&decoder,
+                          s2shapeutil::LazyDecodeShapeFactory(&decoder)));
+  CellCacheOptions cache_options;
+  cache_options.set_policy(CellCacheOptions::Policy::CLOCK);
+  cache_options.set_max_bytes(0);
+  actual.set_cell_cache_options(cache_options);
+
+  // Pin the cells near one vertex of the loop.
+  S2CellId target(S2Point(3, 2, 1).Normalize());
+  EncodedS2ShapeIndex::Iterator it(&actual, S2ShapeIndex::BEGIN);
+  it.Seek(target.parent(10).range_min());
+  S2CellId pinned_id = it.id();
+  actual.PinCells({target.parent(10), pinned_id});
+  auto stats = actual.cell_cache_stats();
+  EXPECT_GT(stats.num_pinned_cells, 0);
+  EXPECT_EQ(stats.num_pinned_cells, stats.num_cached_cells);
+
+  // With a zero byte budget, a full scan leaves only the pinned cells and the
+  // most recently decoded cell.  TrimCellCache() keeps cells that have been
+  // accessed since the previous call, so it takes two calls to release that
+  // last cell.
+  s2testing::ExpectEqual(expected, actual);
+  stats = actual.cell_cache_stats();
+  EXPECT_EQ(stats.num_pinned_cells + 1, stats.num_cached_cells);
+  actual.TrimCellCache();
+  EXPECT_EQ(stats.num_cached_cells, actual.cell_cache_stats().num_cached_cells);
+  actual.TrimCellCache();
+  stats = actual.cell_cache_stats();
+  EXPECT_EQ(stats.num_pinned_cells, stats.num_cached_cells);
+  int64 misses = stats.misses;
+  it.Seek(pinned_id);
+  ASSERT_EQ(pinned_id, it.id());
+  it.cell();
+  EXPECT_EQ(misses, actual.cell_cache_stats().misses);
+
+  // Minimize() releases everything, including pinned cells.
+  actual.Minimize();
+  stats = actual.cell_cache_stats();
+  EXPECT_EQ(0, stats.num_cached_cells);
+  EXPECT_EQ(0, stats.num_pinned_cells);
+}
+
+TEST(EncodedS2ShapeIndex, ClockCellCacheConcurrentReaders) {
+  MutableS2ShapeIndex expected;
+  MakeManyCellIndex(&expected);
+  Encoder encoder;
+  EncodeTaggedIndex(expected, &encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex actual;
+  CellCacheOptions cache_options;
+  cache_options.set_policy(CellCacheOptions::Policy::CLOCK);
+  cache_options.set_max_bytes(8192);
+  actual.set_cell_cache_options(cache_options);
+  ASSERT_TRUE(actual.Init(&decoder,
+                          s2shapeutil::LazyDecodeShapeFactory(&decoder)));
+
+  // Closest edge queries hold pointers to many cells at once, so this checks
+  // that cells evicted by one thread remain valid for readers in another.
+  const int kNumThreads = 4, kNumQueries = 50;
+  S2Cap cap(S2Point(3, 2, 1).Normalize(), S1Angle::Degrees(2));
+  vector<S2Point> targets;
+  for (int i = 0; i < kNumThreads * kNumQueries; ++i) {
+    targets.push_back(S2Testing::SamplePoint(cap));
+  }
+  vector<S1ChordAngle> distances(targets.size());
+  vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      S2ClosestEdgeQuery query(&actual);
+      for (int i = t * kNumQueries; i < (t + 1) * kNumQueries; ++i) {
+        S2ClosestEdgeQuery::PointTarget target(targets[i]);
+        distances[i] = query.GetDistance(&target);
+      }
+    }));
+  }
+  for (auto& thread : threads) thread.join();
+  S2ClosestEdgeQuery query(&expected);
+  for (int i = 0; i < targets.size(); ++i) {
+    S2ClosestEdgeQuery::PointTarget target(targets[i]);
+    EXPECT_EQ(query.GetDistance(&target), distances[i]);
+  }
+  EXPECT_GT(actual.cell_cache_stats().evictions, 0);
+}
@@ -18,8 +18,10 @@
 #ifndef S2_ENCODED_UINT_VECTOR_H_
 #define S2_ENCODED_UINT_VECTOR_H_
 
+#include <cstring>
 #include <type_traits>
 #include <vector>
+#include "s2/base/port.h"
 #include "s2/third_party/absl/base/internal/unaligned_access.h"
 #include "s2/third_party/absl/types/span.h"
 #include "s2/util/coding/coder.h"
@@ -82,11 +84,31 @@ class EncodedUintVector {
   // REQUIRES: The vector elements are sorted in non-decreasing order.
   size_t lower_bound(T target) const;
 
+  // Like lower_bound(target), except that only the elements in the range
+  // [lo, hi) are searched (and "hi" is returned if no such element exists).
+  // This is useful when an auxiliary search structure has already narrowed
+  // down the range of possible results.
+  //
+  // REQUIRES: lo <= hi <= size()
+  size_t lower_bound(T target, size_t lo, size_t hi) const;
+
   // Decodes and returns the entire original vector.
   std::vector<T> Decode() const;
 
+  // Decodes the "count" elements starting at index "start" into "out".  This
+  // is much faster than calling operator[] repeatedly because the element
+  // length is dispatched only once, and the decoding loop for each length
+  // can be unrolled and vectorized by the compiler.
+  //
+  // REQUIRES: start + count <= size()
+  void Decode(size_t start, size_t count, T* out) const;
+
  private:
-  template <int length> size_t lower_bound(T target) const;
+  template <int length>
+  size_t lower_bound(T target, size_t lo, size_t hi) const;
+
+  template <int length>
+  void Decode(size_t start, size_t count, T* out) const;
 
   const char* data_;
   uint32 size_;
@@ -248,10 +270,16 @@ inline T EncodedUintVector<T>::operator[](int i) const {
 }
 
 template <class T>
-size_t EncodedUintVector<T>::lower_bound(T target) const {
+inline size_t EncodedUintVector<T>::lower_bound(T target) const {
+  return lower_bound(target, 0, size_);
+}
+
+template <class T>
+size_t EncodedUintVector<T>::lower_bound(T target, size_t lo,
+                                         size_t hi) const {
   static_assert(sizeof(T) & 0xe, "Unsupported integer length");
   S2_DCHECK(len_ >= 1 && len_ <= sizeof(T));
-
+  S2_DCHECK(lo <= hi && hi <= size_);
   // TODO(ericv): Consider using the unused 28 bits of "len_" to store the
   // last result of lower_bound() to be used as a hint.  This should help in
   // common situation where the same element is looked up repeatedly.  This
@@ -259,21 +287,27 @@ size_t EncodedUintVector<T>::lower_bound(T target) const {
   // mutable std::atomic<uint32> (accessed using std::memory_order_relaxed)
   // with a custom copy constructor that resets the hint component to zero.
   switch (len_) {
-    case 1: return lower_bound<1>(target);
-    case 2: return lower_bound<2>(target);
-    case 3: return lower_bound<3>(target);
-    case 4: return lower_bound<4>(target);
-    case 5: return lower_bound<5>(target);
-    case 6: return lower_bound<6>(target);
-    case 7: return lower_bound<7>(target);
-    default: return lower_bound<8>(target);
+    case 1: return lower_bound<1>(target, lo, hi);
+    case 2: return lower_bound<2>(target, lo, hi);
+    case 3: return lower_bound<3>(target, lo, hi);
+    case 4: return lower_bound<4>(target, lo, hi);
+    case 5: return lower_bound<5>(target, lo, hi);
+    case 6: return lower_bound<6>(target, lo, hi);
+    case 7: return lower_bound<7>(target, lo, hi);
+    default: return lower_bound<8>(target, lo, hi);
   }
 }
 
 template <class T> template <int length>
-inline size_t EncodedUintVector<T>::lower_bound(T target) const {
-  size_t lo = 0, hi = size_;
-  while (lo < hi) {
+inline size_t EncodedUintVector<T>::lower_bound(T target, size_t lo,
+                                                size_t hi) const {
+  // Binary search until only a few elements remain, and then count the
+  // elements less than "target" using a loop without data-dependent
+  // branches.  (The loop has a fixed element size so that the compiler can
+  // unroll and vectorize it, and it avoids the branch mispredictions of the
+  // last few binary search steps.)
+  constexpr size_t kMaxScanSize = 16;
+  while (hi - lo > kMaxScanSize) {
     size_t mid = (lo + hi) >> 1;
     T value = GetUintWithLength<T>(data_ + mid * length, length);
     if (value < target) {
@@ -282,18 +316,54 @@ inline size_t EncodedUintVector<T>::lower_bound(T target) const {
       hi = mid;
     }
   }
-  return lo;
+  size_t count = 0;
+  for (const char* ptr = data_ + lo * length, *limit = data_ + hi * length;
+       ptr < limit; ptr += length) {
+    count += GetUintWithLength<T>(ptr, length) < target;
+  }
+  return lo + count;
 }
 
 template <class T>
 std::vector<T> EncodedUintVector<T>::Decode() const {
   std::vector<T> result(size_);
-  for (int i = 0; i < size_; ++i) {
-    result[i] = (*this)[i];
-  }
+  Decode(0, size_, result.data());
   return result;
 }
 
+template <class T>
+void EncodedUintVector<T>::Decode(size_t start, size_t count, T* out) const {
+  S2_DCHECK(len_ >= 1 && len_ <= sizeof(T));
+  S2_DCHECK_LE(start + count, size_);
+  switch (len_) {
+    case 1: return Decode<1>(start, count, out);
+    case 2: return Decode<2>(start, count, out);
+    case 3: return Decode<3>(start, count, out);
+    case 4: return Decode<4>(start, count, out);
+    case 5: return Decode<5>(start, count, out);
+    case 6: return Decode<6>(start, count, out);
+    case 7: return Decode<7>(start, count, out);
+    default: return Decode<8>(start, count, out);
+  }
+}
+
+template <class T> template <int length>
+inline void EncodedUintVector<T>::Decode(size_t start, size_t count,
+                                         T* out) const {
+  const char* ptr = data_ + start * length;
+#ifdef IS_LITTLE_ENDIAN
+  if (length == sizeof(T)) {
+    // Values that use all sizeof(T) bytes are stored in the host byte order,
+    // so they can be copied directly.
+    memcpy(out, ptr, count * sizeof(T));
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; ++i, ptr += length) {
+    out[i] = GetUintWithLength<T>(ptr, length);
+  }
+}
+
 }  // namespace s2coding
 
 #endif  // S2_ENCODED_UINT_VECTOR_H_
@@ -17,6 +17,7 @@
 
 #include "s2/encoded_uint_vector.h"
 
+#include <algorithm>
 #include <vector>
 #include <gtest/gtest.h>
 
@@ -109,6 +110,21 @@ void TestLowerBound(int bytes_per_value, int num_values) {
   }
 }
 
+TEST(EncodedUintVector, LowerBoundInRange) {
+  auto v = MakeSortedTestVector<uint64>(5, 100);
+  Encoder encoder;
+  auto actual = MakeEncodedVector(v, &encoder);
+  for (size_t lo = 0; lo <= v.size(); lo += 7) {
+    for (size_t hi = lo; hi <= v.size(); hi += 11) {
+      for (uint64 x : {v[lo % v.size()], v[lo % v.size()] + 1,
+                       v[(hi + 3) % v.size()], uint64{0}, ~uint64{0}}) {
+        EXPECT_EQ(std::lower_bound(v.begin() + lo, v.begin() + hi, x) -
+                  v.begin(), actual.lower_bound(x, lo, hi));
+      }
+    }
+  }
+}
+
 TEST(EncodedUintVector, LowerBound) {
   for (int bytes_per_value = 8; bytes_per_value <= 8; ++bytes_per_value) {
     TestLowerBound<uint64>(bytes_per_value, 10);
@@ -121,4 +137,30 @@ TEST(EncodedUintVector, LowerBound) {
   }
 }
 
+template <class T>
+void TestDecodeRange(int bytes_per_value, int num_values) {
+  auto v = MakeSortedTestVector<T>(bytes_per_value, num_values);
+  Encoder encoder;
+  auto actual = MakeEncodedVector(v, &encoder);
+  for (size_t start = 0; start <= v.size(); start += 3) {
+    for (size_t count = 0; start + count <= v.size(); count += 5) {
+      vector<T> range(count);
+      actual.Decode(start, count, range.data());
+      EXPECT_TRUE(std::equal(range.begin(), range.end(), v.begin() + start));
+    }
+  }
+}
+
+TEST(EncodedUintVector, DecodeRange) {
+  for (int bytes_per_value = 1; bytes_per_value <= 8; ++bytes_per_value) {
+    TestDecodeRange<uint64>(bytes_per_value, 40);
+    if (bytes_per_value <= 4) {
+      TestDecodeRange<uint32>(bytes_per_value, 40);
+      if (bytes_per_value <= 2) {
+        TestDecodeRange<uint16>(bytes_per_value, 40);
+      }
+    }
+  }
+}
+
 }  // namespace s2coding
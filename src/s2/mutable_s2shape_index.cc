@@ -19,7 +19,11 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <new>
+#include <thread>
+#include <utility>
 
 #include "s2/base/casts.h"
 #include "s2/base/commandlineflags.h"
@@ -117,6 +121,15 @@ void MutableS2ShapeIndex::Options::set_max_edges_per_cell(
   max_edges_per_cell_ = max_edges_per_cell;
 }
 
+void MutableS2ShapeIndex::Options::set_num_threads(int num_threads) {
+  S2_DCHECK_GE(num_threads, 1);
+  num_threads_ = num_threads;
+}
+
+void MutableS2ShapeIndex::Options::set_snapshot_mode(bool snapshot_mode) {
+  snapshot_mode_ = snapshot_mode;
+}
+
 bool MutableS2ShapeIndex::Iterator::Locate(const S2Point& target) {
   return LocateImpl(target, this);
 }
@@ -140,6 +153,34 @@ void MutableS2ShapeIndex::Iterator::Copy(const IteratorBase& other)  {
   *this = *down_cast<const Iterator*>(&other);
 }
 
+// Given that the iterator is at the end of the current chunk, advances it to
+// the first cell of the next non-empty chunk (if any).
+void MutableS2ShapeIndex::Iterator::SkipEmptyChunks() {
+  const auto& chunks = snapshot_->chunks;
+  for (int chunk = pos_ + 1; chunk < chunks.size(); ++chunk) {
+    if (!chunks[chunk]->empty()) {
+      SetChunk(chunk);
+      iter_ = cell_map_->begin();
+      return;
+    }
+  }
+}
+
+// Given that the iterator is at the beginning of the current chunk, moves it
+// to the end of the previous non-empty chunk and returns true, or returns
+// false (leaving the iterator unchanged) if there is no such chunk.
+bool MutableS2ShapeIndex::Iterator::PrevChunk() {
+  const auto& chunks = snapshot_->chunks;
+  for (int chunk = pos_ - 1; chunk >= 0; --chunk) {
+    if (!chunks[chunk]->empty()) {
+      SetChunk(chunk);
+      iter_ = end_;
+      return true;
+    }
+  }
+  return false;
+}
+
 // Defines the initial focus point of MutableS2ShapeIndex::InteriorTracker
 // (the start of the S2CellId space-filling curve).
 //
@@ -148,18 +189,51 @@ static S2Point kInteriorTrackerOrigin() {
   return S2::FaceUVtoXYZ(0, -1, -1).Normalize();
 }
 
+// Adds the time elapsed during the lifetime of this object to "*seconds".
+// Does nothing (and does not read the clock) if "enabled" is false.
+class ScopedBuildTimer {
+ public:
+  ScopedBuildTimer(bool enabled, double* seconds)
+      : seconds_(enabled ? seconds : nullptr) {
+    if (seconds_ != nullptr) start_ = Clock::now();
+  }
+  ~ScopedBuildTimer() {
+    if (seconds_ == nullptr) return;
+    *seconds_ += std::chrono::duration<double>(Clock::now() - start_).count();
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  double* seconds_;
+  Clock::time_point start_;
+};
+
 MutableS2ShapeIndex::MutableS2ShapeIndex()
-    : index_status_(FRESH) {
+    : index_status_(FRESH),
+      snapshot_shapes_(nullptr),
+      writer_thread_(std::thread::id()) {
 }
 
 MutableS2ShapeIndex::MutableS2ShapeIndex(const Options& options)
     : options_(options),
-      index_status_(FRESH) {
+      index_status_(FRESH),
+      snapshot_shapes_(nullptr),
+      writer_thread_(std::thread::id()) {
+  ResetArena();
+  if (options_.snapshot_mode()) PublishSnapshot();
 }
 
 void MutableS2ShapeIndex::Init(const Options& options) {
   S2_DCHECK(shapes_.empty());
   options_ = options;
+  ResetArena();
+  if (options_.snapshot_mode()) {
+    PublishSnapshot();
+  } else {
+    snapshot_shapes_.store(nullptr, std::memory_order_relaxed);
+    snapshot_.reset();
+    dirty_chunks_.clear();
+  }
 }
 
 MutableS2ShapeIndex::~MutableS2ShapeIndex() {
@@ -167,12 +241,37 @@ MutableS2ShapeIndex::~MutableS2ShapeIndex() {
 }
 
 void MutableS2ShapeIndex::Minimize() {
-  // TODO(ericv): Implement.  In theory we should be able to discard the
-  // entire index and rebuild it the next time it is needed.
+  ReleaseUnusedMemory();
+}
+
+size_t MutableS2ShapeIndex::ReleaseUnusedMemory() {
+  // Pending updates are applied first, so that the removed-shape bookkeeping
+  // (which includes a copy of every edge being removed) can be discarded.
+  // The index cells themselves are kept, since rebuilding them the next time
+  // they are needed would cost far more than the memory they use.
+  ForceBuild();
+  size_t size_before = SpaceUsed();
+  S2_DCHECK(pending_removals_ == nullptr);
+  shapes_.shrink_to_fit();
+  vector<const S2ShapeIndexCell*>(retired_cells_).swap(retired_cells_);
+
+  // Incremental updates can leave btree nodes partially empty.  Inserting the
+  // cells in order into a new map packs the nodes densely.
+  if (frozen_ == nullptr) {
+    CellMap cell_map(cell_map_.begin(), cell_map_.end());
+    cell_map_.swap(cell_map);
+    // In snapshot mode, cells that were replaced by updates may still be in
+    // use by readers, so the arena cannot be compacted.
+    if (arena_ != nullptr && !options_.snapshot_mode()) CompactArena();
+  }
+  size_t size_after = SpaceUsed();
+  return size_before > size_after ? size_before - size_after : 0;
 }
 
 int MutableS2ShapeIndex::Add(unique_ptr<S2Shape> shape) {
   // Additions are processed lazily by ApplyUpdates().
+  SetWriterThread();
+  Thaw();
   const int id = shapes_.size();
   shape->id_ = id;
   shapes_.push_back(std::move(shape));
@@ -187,6 +286,8 @@ unique_ptr<S2Shape> MutableS2ShapeIndex::Release(int shape_id) {
   // client is free to delete "shape" once this call is finished.
 
   S2_DCHECK(shapes_[shape_id] != nullptr);
+  SetWriterThread();
+  Thaw();
   auto shape = std::move(shapes_[shape_id]);
   if (shape_id >= pending_additions_begin_) {
     // We are removing a shape that has not yet been added to the index,
@@ -214,17 +315,26 @@ unique_ptr<S2Shape> MutableS2ShapeIndex::Release(int shape_id) {
 }
 
 vector<unique_ptr<S2Shape>> MutableS2ShapeIndex::ReleaseAll() {
+  // Discard all published versions of the index first, since they may refer
+  // to the cells deleted below.  (In snapshot mode, this method requires that
+  // there are no active readers.)
+  snapshot_.reset();
+  for (const S2ShapeIndexCell* cell : retired_cells_) delete cell;
+  retired_cells_.clear();
   Iterator it;
   for (it.InitStale(this, S2ShapeIndex::BEGIN); !it.done(); it.Next()) {
-    delete &it.cell();
+    if (it.cell().owns_data_) delete &it.cell();
   }
   cell_map_.clear();
+  frozen_.reset();
+  ResetArena();
   pending_additions_begin_ = 0;
   pending_removals_.reset();
   S2_DCHECK(update_state_ == nullptr);
   index_status_.store(FRESH, std::memory_order_relaxed);
   vector<unique_ptr<S2Shape>> result;
   result.swap(shapes_);
+  if (options_.snapshot_mode()) PublishSnapshot();
   return result;
 }
 
@@ -353,6 +463,14 @@ class MutableS2ShapeIndex::InteriorTracker {
   // only affects the state for shape_ids below "limit_shape_id".
   void RestoreStateBefore(int32 limit_shape_id);
 
+  // Makes this tracker equivalent to "other", i.e. it tracks the same shapes
+  // and has the same focus.  (InteriorTracker cannot be copied in the usual
+  // way because S2EdgeCrosser is not copyable; this is harmless because
+  // DrawTo() must always be called before TestEdge().)
+  //
+  // REQUIRES: "other" does not have any saved state.
+  void CopyFrom(const InteriorTracker& other);
+
  private:
   // Removes "shape_id" from shape_ids_ if it exists, otherwise insert it.
   void ToggleShape(int shape_id);
@@ -454,6 +572,15 @@ void MutableS2ShapeIndex::InteriorTracker::RestoreStateBefore(
   saved_ids_.clear();
 }
 
+void MutableS2ShapeIndex::InteriorTracker::CopyFrom(
+    const InteriorTracker& other) {
+  S2_DCHECK(other.saved_ids_.empty());
+  is_active_ = other.is_active_;
+  b_ = other.b_;
+  next_cellid_ = other.next_cellid_;
+  shape_ids_ = other.shape_ids_;
+}
+
 // Apply any pending updates in a thread-safe way.
 void MutableS2ShapeIndex::ApplyUpdatesThreadSafe() {
   lock_.Lock();
@@ -518,13 +645,90 @@ inline void MutableS2ShapeIndex::UnlockAndSignal() {
 
 void MutableS2ShapeIndex::ForceBuild() {
   // No locks required because this is not a const method.  It is the client's
-  // responsibility to ensure correct thread synchronization.
+  // responsibility to ensure correct thread synchronization.  (In snapshot
+  // mode, readers never access the fields modified here.)
+  SetWriterThread();
   if (index_status_.load(std::memory_order_relaxed) != FRESH) {
     ApplyUpdatesInternal();
+    if (options_.snapshot_mode()) PublishSnapshot();
     index_status_.store(FRESH, std::memory_order_relaxed);
   }
 }
 
+// An Epoch owns the data that must remain valid while any reader might be
+// using a particular published version of the index: the shape table of that
+// version, and the index cells that were removed when the following version
+// was built.  Each Epoch keeps the following Epoch alive, so that the data
+// for a given version is only reclaimed once all readers of that version
+// *and* all earlier versions have finished.
+struct MutableS2ShapeIndex::Epoch {
+  ~Epoch() {
+    for (const S2ShapeIndexCell* cell : retired_cells) delete cell;
+
+    // Release the following Epochs iteratively rather than recursively, since
+    // the chain may be arbitrarily long if a reader holds an old version
+    // while many new versions are published.  An Epoch whose only reference
+    // is "next" cannot be acquired by any other thread.
+    std::shared_ptr<Epoch> epoch = std::move(next);
+    while (epoch != nullptr && epoch.use_count() == 1) {
+      std::shared_ptr<Epoch> following = std::move(epoch->next);
+      epoch = std::move(following);
+    }
+  }
+  vector<S2Shape*> shapes;
+  vector<const S2ShapeIndexCell*> retired_cells;
+  std::shared_ptr<Epoch> next;
+};
+
+// Publishes the current contents of the index as a new immutable version.
+// Existing Iterators continue to use the version they were created with.
+// Only the chunks of the cell map that have changed since the previous
+// version are copied.
+void MutableS2ShapeIndex::PublishSnapshot() {
+  auto epoch = std::make_shared<Epoch>();
+  epoch->shapes.reserve(shapes_.size());
+  for (const auto& shape : shapes_) {
+    epoch->shapes.push_back(shape.get());
+  }
+  auto snapshot = std::make_shared<Snapshot>();
+  if (snapshot_ != nullptr) {
+    snapshot->chunks = snapshot_->chunks;
+  } else {
+    snapshot->chunks.resize(kNumSnapshotChunks);
+    dirty_chunks_.assign(kNumSnapshotChunks, true);
+  }
+  // Every valid S2CellId is less than the start of the (nonexistent) chunk
+  // that follows the last one.
+  const int shift = S2CellId::kPosBits - 2 * kSnapshotChunkLevel;
+  for (int chunk = 0; chunk < kNumSnapshotChunks; ++chunk) {
+    if (!dirty_chunks_[chunk]) continue;
+    S2CellId chunk_begin(static_cast<uint64>(chunk) << shift);
+    S2CellId chunk_end(static_cast<uint64>(chunk + 1) << shift);
+    snapshot->chunks[chunk] = std::make_shared<const CellMap>(
+        cell_map_.lower_bound(chunk_begin), cell_map_.lower_bound(chunk_end));
+    dirty_chunks_[chunk] = false;
+  }
+  snapshot->epoch = epoch;
+  if (snapshot_ != nullptr) {
+    // The cells removed while building this version may still be in use by
+    // readers of the previous version.  (Only this thread modifies
+    // snapshot_, so it is safe to read it without synchronization.)
+    Epoch* previous = snapshot_->epoch.get();
+    S2_DCHECK(previous->retired_cells.empty());
+    previous->retired_cells.swap(retired_cells_);
+    previous->next = epoch;
+  } else {
+    for (const S2ShapeIndexCell* cell : retired_cells_) delete cell;
+    retired_cells_.clear();
+  }
+  // The new shape table is published first, since readers of the new
+  // version must not see an older table.  (Readers of older versions may
+  // see the new table, which is a superset of the old one.)
+  snapshot_shapes_.store(&epoch->shapes, std::memory_order_release);
+  std::atomic_store(&snapshot_,
+                    std::shared_ptr<const Snapshot>(std::move(snapshot)));
+}
+
 // A BatchDescriptor represents a set of pending updates that will be applied
 // at the same time.  The batch consists of all updates with shape ids between
 // the current value of "ShapeIndex::pending_additions_begin_" (inclusive) and
@@ -547,6 +751,10 @@ void MutableS2ShapeIndex::ApplyUpdatesInternal() {
   // to 20x as much memory (per edge) as the final index size.
   vector<BatchDescriptor> batches;
   GetUpdateBatches(&batches);
+  build_stats_ = BuildStats();
+  build_stats_.num_batches = batches.size();
+  build_stats_.tmp_memory_budget_bytes =
+      static_cast<int64>(FLAGS_s2shape_index_tmp_memory_budget_mb) << 20;
   int i = 0;
   for (const BatchDescriptor& batch : batches) {
     vector<FaceEdge> all_edges[6];
@@ -565,13 +773,30 @@ void MutableS2ShapeIndex::ApplyUpdatesInternal() {
     for (int id = pending_additions_begin_; id < batch.additions_end; ++id) {
       AddShape(id, all_edges, &tracker);
     }
+    size_t face_edges_bytes = 0;
     for (int face = 0; face < 6; ++face) {
-      UpdateFaceEdges(face, all_edges[face], &tracker);
-      // Save memory by clearing vectors after we are done with them.
-      vector<FaceEdge>().swap(all_edges[face]);
+      build_stats_.face_edges[face] += all_edges[face].size();
+      face_edges_bytes += all_edges[face].capacity() * sizeof(FaceEdge);
     }
+    size_t tmp_bytes = 0;
+    ScopedBuildTimer timer(true, &build_stats_.update_edges_seconds);
+    if (options_.num_threads() > 1 && is_first_update()) {
+      // There are no existing index cells to absorb, so the index can be
+      // built as a set of independent subtrees.
+      tmp_bytes = UpdateFaceEdgesParallel(all_edges, &tracker);
+    } else {
+      for (int face = 0; face < 6; ++face) {
+        tmp_bytes = max(tmp_bytes,
+                        UpdateFaceEdges(face, all_edges[face], &tracker));
+        // Save memory by clearing vectors after we are done with them.
+        vector<FaceEdge>().swap(all_edges[face]);
+      }
+    }
+    build_stats_.peak_tmp_memory_bytes = max<int64>(
+        build_stats_.peak_tmp_memory_bytes, face_edges_bytes + tmp_bytes);
     pending_additions_begin_ = batch.additions_end;
   }
+  MaybeCompactArena();
   // It is the caller's responsibility to update index_status_.
 }
 
@@ -589,7 +814,7 @@ void MutableS2ShapeIndex::GetUpdateBatches(vector<BatchDescriptor>* batches)
   }
   int num_edges_added = 0;
   for (int id = pending_additions_begin_; id < shapes_.size(); ++id) {
-    const S2Shape* shape = this->shape(id);
+    const S2Shape* shape = shapes_[id].get();
     if (shape == nullptr) continue;
     num_edges_added += shape->num_edges();
   }
@@ -649,7 +874,7 @@ void MutableS2ShapeIndex::GetUpdateBatches(vector<BatchDescriptor>* batches)
   // Keep adding shapes to each batch until the recommended number of edges
   // for that batch is reached, then move on to the next batch.
   for (int id = pending_additions_begin_; id < shapes_.size(); ++id) {
-    const S2Shape* shape = this->shape(id);
+    const S2Shape* shape = shapes_[id].get();
     if (shape == nullptr) continue;
     num_edges += shape->num_edges();
     if (num_edges >= batch_sizes[batches->size()]) {
@@ -759,7 +984,7 @@ void MutableS2ShapeIndex::ReserveSpace(const BatchDescriptor& batch,
     }
   }
   for (int id = pending_additions_begin_; id < batch.additions_end; ++id) {
-    const S2Shape* shape = this->shape(id);
+    const S2Shape* shape = shapes_[id].get();
     if (shape == nullptr) continue;
     edge_id += shape->num_edges();
     while (edge_id >= sample_interval) {
@@ -800,7 +1025,7 @@ void MutableS2ShapeIndex::ReserveSpace(const BatchDescriptor& batch,
 // edges to "all_edges", and start tracking its interior if necessary.
 void MutableS2ShapeIndex::AddShape(int id, vector<FaceEdge> all_edges[6],
                                    InteriorTracker* tracker) const {
-  const S2Shape* shape = this->shape(id);
+  const S2Shape* shape = shapes_[id].get();
   if (shape == nullptr) {
     return;  // This shape has already been removed.
   }
@@ -880,10 +1105,15 @@ int MutableS2ShapeIndex::GetEdgeMaxLevel(const S2Shape::Edge& edge) const {
 // allocated as the recursion does down and freed as it comes back up.
 //
 // It also provides a mutable vector of FaceEdges that is used when
-// incrementally updating the index (see AbsorbIndexCell).
+// incrementally updating the index (see AbsorbIndexCell), and optionally
+// collects the index cells created when subtrees of the index are built in
+// parallel (see UpdateFaceEdgesParallel).
 class MutableS2ShapeIndex::EdgeAllocator {
  public:
-  EdgeAllocator() : size_(0) {}
+  using CellList = vector<std::pair<S2CellId, S2ShapeIndexCell*>>;
+
+  EdgeAllocator()
+      : size_(0), new_cells_(nullptr), arena_(nullptr), stats_(nullptr) {}
 
   // Return a pointer to a newly allocated edge.  The EdgeAllocator
   // retains ownership.
@@ -903,6 +1133,36 @@ class MutableS2ShapeIndex::EdgeAllocator {
     return &face_edges_;
   }
 
+  // If non-null, MakeIndexCell() appends new index cells to this list rather
+  // than inserting them into cell_map_.
+  CellList* new_cells() const { return new_cells_; }
+  void set_new_cells(CellList* new_cells) { new_cells_ = new_cells; }
+
+  // If non-null, new index cells are allocated from this arena.
+  CellArena* arena() const { return arena_; }
+  void set_arena(CellArena* arena) { arena_ = arena; }
+
+  // Returns a new index cell with room for "num_shapes" clipped shapes, which
+  // must be initialized by calling InitClipped().
+  S2ShapeIndexCell* NewCell(int num_shapes);
+
+  // Initializes a clipped shape of a cell returned by NewCell().
+  void InitClipped(S2ClippedShape* clipped, int32 shape_id, int32 num_edges);
+
+  // Returns a copy of the given cell, allocated in the same way as NewCell().
+  S2ShapeIndexCell* CopyCell(const S2ShapeIndexCell& cell);
+
+  // The statistics that should be updated while using this allocator.
+  BuildStats* stats() const { return stats_; }
+  void set_stats(BuildStats* stats) { stats_ = stats; }
+
+  // Returns the approximate amount of temporary memory used.
+  size_t SpaceUsed() const {
+    return clipped_edges_.capacity() * sizeof(clipped_edges_[0]) +
+           clipped_edges_.size() * sizeof(ClippedEdge) +
+           face_edges_.capacity() * sizeof(FaceEdge);
+  }
+
  private:
   // We can't use vector<ClippedEdge> because edges are not allowed to move
   // once they have been allocated.  Instead we keep a pool of allocated edges
@@ -915,18 +1175,291 @@ class MutableS2ShapeIndex::EdgeAllocator {
   // absorb an existing index cell).
   vector<FaceEdge> face_edges_;
 
+  CellList* new_cells_;
+  CellArena* arena_;
+  BuildStats* stats_;
+
   EdgeAllocator(const EdgeAllocator&) = delete;
   void operator=(const EdgeAllocator&) = delete;
 };
 
+// A CellArena allocates index cells together with their clipped shapes and
+// edge arrays from large contiguous slabs.  Cells allocated from an arena are
+// never deleted individually; instead all slabs are released together when
+// the arena is destroyed.  The arena keeps track of how much of its memory
+// belongs to cells that have been discarded, so that the index can decide
+// when to copy its cells into a new arena.
+class MutableS2ShapeIndex::CellArena {
+ public:
+  CellArena()
+      : next_(nullptr), limit_(nullptr), slab_bytes_(0), unused_bytes_(0) {}
+
+  // Returns a new cell with room for "num_shapes" clipped shapes, which must
+  // be initialized by calling InitClipped().
+  S2ShapeIndexCell* NewCell(int num_shapes) {
+    void* data = Allocate(sizeof(S2ShapeIndexCell) +
+                          num_shapes * sizeof(S2ClippedShape));
+    S2ShapeIndexCell* cell = new (data) S2ShapeIndexCell;
+    cell->shapes_ = reinterpret_cast<S2ClippedShape*>(cell + 1);
+    cell->num_shapes_ = num_shapes;
+    cell->capacity_ = num_shapes;
+    cell->owns_data_ = false;
+    return cell;
+  }
+
+  // Like S2ClippedShape::Init(), except that the edge array (if any) is
+  // allocated from the arena.
+  void InitClipped(S2ClippedShape* clipped, int32 shape_id, int32 num_edges) {
+    clipped->shape_id_ = shape_id;
+    clipped->num_edges_ = num_edges;
+    clipped->contains_center_ = false;
+    if (!clipped->is_inline()) {
+      clipped->edges_ = static_cast<int32*>(Allocate(num_edges * sizeof(int32)));
+    }
+  }
+
+  // Returns a copy of the given cell allocated from this arena.
+  S2ShapeIndexCell* CopyCell(const S2ShapeIndexCell& cell) {
+    S2ShapeIndexCell* result = NewCell(cell.num_clipped());
+    for (int s = 0; s < cell.num_clipped(); ++s) {
+      const S2ClippedShape& clipped = cell.clipped(s);
+      S2ClippedShape* copy = &result->shapes_[s];
+      InitClipped(copy, clipped.shape_id(), clipped.num_edges());
+      copy->set_contains_center(clipped.contains_center());
+      for (int e = 0; e < clipped.num_edges(); ++e) {
+        copy->set_edge(e, clipped.edge(e));
+      }
+    }
+    return result;
+  }
+
+  // Records that the given cell (which must have been allocated from this
+  // arena) is no longer used.
+  void Discard(const S2ShapeIndexCell& cell) {
+    S2_DCHECK(!cell.owns_data_);
+    unused_bytes_ += CellBytes(cell);
+  }
+
+  // Returns the number of bytes needed to copy the given cell into an arena.
+  static size_t CellBytes(const S2ShapeIndexCell& cell) {
+    size_t bytes = RoundUp(sizeof(S2ShapeIndexCell) +
+                           cell.num_clipped() * sizeof(S2ClippedShape));
+    for (int s = 0; s < cell.num_clipped(); ++s) {
+      const S2ClippedShape& clipped = cell.clipped(s);
+      if (!clipped.is_inline()) {
+        bytes += RoundUp(clipped.num_edges() * sizeof(int32));
+      }
+    }
+    return bytes;
+  }
+
+  // Ensures that the next "bytes" bytes of allocations are satisfied from a
+  // single slab, so that the objects allocated are contiguous in memory.
+  void Reserve(size_t bytes) {
+    if (bytes > static_cast<size_t>(limit_ - next_)) AddSlab(bytes);
+  }
+
+  // Transfers all slabs from "other" to this arena.  The space remaining in
+  // the current slab of "other" is no longer available for allocation.
+  void Splice(CellArena* other) {
+    slab_bytes_ += other->slab_bytes_;
+    unused_bytes_ += other->unused_bytes_ + (other->limit_ - other->next_);
+    for (auto& slab : other->slabs_) slabs_.push_back(std::move(slab));
+    other->slabs_.clear();
+    other->next_ = other->limit_ = nullptr;
+    other->slab_bytes_ = other->unused_bytes_ = 0;
+  }
+
+  // Returns true if more than half of the slab memory is no longer used.
+  bool IsMostlyUnused() const {
+    size_t unused = unused_bytes_ + (limit_ - next_);
+    return unused > kMinSlabBytes && 2 * unused > slab_bytes_;
+  }
+
+  // Returns the total size of all slabs, including unused space.
+  size_t SpaceUsed() const {
+    return sizeof(*this) + slabs_.capacity() * sizeof(slabs_[0]) + slab_bytes_;
+  }
+
+ private:
+  static constexpr size_t kMinSlabBytes = 4096;
+  static constexpr size_t kMaxSlabBytes = 1 << 20;
+
+  // All allocations are aligned to 8 bytes, which is sufficient for
+  // S2ShapeIndexCell and S2ClippedShape.
+  static size_t RoundUp(size_t bytes) { return (bytes + 7) & ~size_t{7}; }
+
+  void* Allocate(size_t bytes) {
+    bytes = RoundUp(bytes);
+    if (bytes > static_cast<size_t>(limit_ - next_)) {
+      // Slabs grow geometrically so that small indexes do not waste memory.
+      AddSlab(std::max(bytes, std::min(kMaxSlabBytes,
+                                       std::max(kMinSlabBytes, slab_bytes_))));
+    }
+    void* result = next_;
+    next_ += bytes;
+    return result;
+  }
+
+  // Starts a new slab of the given size.  Any space remaining in the current
+  // slab is abandoned.
+  void AddSlab(size_t size) {
+    unused_bytes_ += limit_ - next_;
+    slabs_.emplace_back(new char[size]);
+    slab_bytes_ += size;
+    next_ = slabs_.back().get();
+    limit_ = next_ + size;
+  }
+
+  vector<unique_ptr<char[]>> slabs_;
+  char* next_;            // The next free byte in the current slab.
+  char* limit_;           // The end of the current slab.
+  size_t slab_bytes_;     // The total size of all slabs.
+  size_t unused_bytes_;   // Discarded or abandoned bytes within slabs.
+
+  CellArena(const CellArena&) = delete;
+  void operator=(const CellArena&) = delete;
+};
+
+constexpr size_t MutableS2ShapeIndex::CellArena::kMinSlabBytes;
+constexpr size_t MutableS2ShapeIndex::CellArena::kMaxSlabBytes;
+
+S2ShapeIndexCell* MutableS2ShapeIndex::EdgeAllocator::NewCell(int num_shapes) {
+  if (arena_ != nullptr) return arena_->NewCell(num_shapes);
+  S2ShapeIndexCell* cell = new S2ShapeIndexCell;
+  cell->add_shapes(num_shapes);
+  return cell;
+}
+
+void MutableS2ShapeIndex::EdgeAllocator::InitClipped(
+    S2ClippedShape* clipped, int32 shape_id, int32 num_edges) {
+  if (arena_ != nullptr) {
+    arena_->InitClipped(clipped, shape_id, num_edges);
+  } else {
+    clipped->Init(shape_id, num_edges);
+  }
+}
+
+S2ShapeIndexCell* MutableS2ShapeIndex::EdgeAllocator::CopyCell(
+    const S2ShapeIndexCell& cell) {
+  if (arena_ != nullptr) return arena_->CopyCell(cell);
+  S2ShapeIndexCell* result = NewCell(cell.num_clipped());
+  for (int s = 0; s < cell.num_clipped(); ++s) {
+    const S2ClippedShape& clipped = cell.clipped(s);
+    S2ClippedShape* copy = &result->shapes_[s];
+    InitClipped(copy, clipped.shape_id(), clipped.num_edges());
+    copy->set_contains_center(clipped.contains_center());
+    for (int e = 0; e < clipped.num_edges(); ++e) {
+      copy->set_edge(e, clipped.edge(e));
+    }
+  }
+  return result;
+}
+
+// Discards the current arena (if any), creating a new one if necessary.  The
+// caller must ensure that no index cells are allocated from the old arena.
+void MutableS2ShapeIndex::ResetArena() {
+  if (options_.use_arena()) {
+    arena_ = absl::make_unique<CellArena>();
+  } else {
+    arena_.reset();
+  }
+}
+
+// If most of the arena memory belongs to cells that have been replaced by
+// incremental updates, copies the remaining cells to a new arena.  This is
+// not done in snapshot mode because readers may still be using the old cells.
+void MutableS2ShapeIndex::MaybeCompactArena() {
+  if (arena_ == nullptr || options_.snapshot_mode() ||
+      !arena_->IsMostlyUnused()) {
+    return;
+  }
+  CompactArena();
+}
+
+// Copies all index cells into a single slab of a new arena, and then
+// discards the previous arena (if any).
+void MutableS2ShapeIndex::CompactArena() {
+  S2_DCHECK(frozen_ == nullptr);
+  size_t bytes = 0;
+  for (const auto& entry : cell_map_) {
+    bytes += CellArena::CellBytes(*entry.second);
+  }
+  auto arena = absl::make_unique<CellArena>();
+  arena->Reserve(bytes);
+  for (auto& entry : cell_map_) {
+    S2ShapeIndexCell* cell = entry.second;
+    entry.second = arena->CopyCell(*cell);
+    if (cell->owns_data_) delete cell;
+  }
+  arena_ = std::move(arena);
+}
+
+void MutableS2ShapeIndex::Freeze() {
+  if (options_.snapshot_mode()) return;
+  ForceBuild();
+  if (frozen_ != nullptr) return;
+
+  // Copy the cells in order into a single slab of a new arena, and then
+  // discard the previous arena (if any) and all other cells.
+  size_t bytes = 0;
+  for (const auto& entry : cell_map_) {
+    bytes += CellArena::CellBytes(*entry.second);
+  }
+  auto arena = absl::make_unique<CellArena>();
+  arena->Reserve(bytes);
+  frozen_ = absl::make_unique<FrozenCells>();
+  frozen_->ids.reserve(cell_map_.size());
+  frozen_->cells.reserve(cell_map_.size());
+  for (const auto& entry : cell_map_) {
+    frozen_->ids.push_back(entry.first);
+    frozen_->cells.push_back(arena->CopyCell(*entry.second));
+    if (entry.second->owns_data_) delete entry.second;
+  }
+  cell_map_.clear();
+  arena_ = std::move(arena);
+}
+
+// Converts a frozen index back into its normal form so that it can be
+// updated.  If options_.use_arena() is true the cells remain in the arena
+// created by Freeze(); otherwise they are copied back to the heap and the
+// arena is released, so that later updates do not allocate from it.
+void MutableS2ShapeIndex::Thaw() {
+  if (frozen_ == nullptr) return;
+  EdgeAllocator alloc;  // Allocates cells from the heap.
+  for (int i = 0; i < frozen_->ids.size(); ++i) {
+    S2ShapeIndexCell* cell = frozen_->cells[i];
+    if (!options_.use_arena()) cell = alloc.CopyCell(*cell);
+    cell_map_.insert(cell_map_.end(), std::make_pair(frozen_->ids[i], cell));
+  }
+  frozen_.reset();
+  if (!options_.use_arena()) ResetArena();
+}
+
+// A BuildTask represents a subtree of the index that can be built
+// independently of all other subtrees: a cell, the edges that intersect it,
+// and an InteriorTracker whose focus is the entry vertex of that cell.  Tasks
+// are only used during the initial construction of the index, since in that
+// case there are no existing index cells that need to be absorbed.
+struct MutableS2ShapeIndex::BuildTask {
+  explicit BuildTask(const S2PaddedCell& _pcell) : pcell(_pcell) {}
+
+  S2PaddedCell pcell;
+  vector<const ClippedEdge*> edges;
+  InteriorTracker tracker;
+  EdgeAllocator::CellList cells;  // The index cells created by this task.
+  unique_ptr<CellArena> arena;    // Used if options_.use_arena() is true.
+  BuildStats stats;               // Statistics for this task.
+  size_t tmp_bytes = 0;           // Temporary memory used by this task.
+};
+
 // Given a face and a vector of edges that intersect that face, add or remove
 // all the edges from the index.  (An edge is added if shapes_[id] is not
 // nullptr, and removed otherwise.)
-void MutableS2ShapeIndex::UpdateFaceEdges(int face,
-                                          const vector<FaceEdge>& face_edges,
-                                          InteriorTracker* tracker) {
+size_t MutableS2ShapeIndex::UpdateFaceEdges(
+    int face, const vector<FaceEdge>& face_edges, InteriorTracker* tracker) {
   int num_edges = face_edges.size();
-  if (num_edges == 0 && tracker->shape_ids().empty()) return;
+  if (num_edges == 0 && tracker->shape_ids().empty()) return 0;
 
   // Create the initial ClippedEdge for each FaceEdge.  Additional clipped
   // edges are created when edges are split between child cells.  We create
@@ -949,30 +1482,233 @@ void MutableS2ShapeIndex::UpdateFaceEdges(int face,
   // Construct the initial face cell containing all the edges, and then update
   // all the edges in the index recursively.
   EdgeAllocator alloc;
+  alloc.set_arena(arena_.get());
+  alloc.set_stats(&build_stats_);
   S2CellId face_id = S2CellId::FromFace(face);
   S2PaddedCell pcell(face_id, kCellPadding);
 
   // "disjoint_from_index" means that the current cell being processed (and
   // all its descendants) are not already present in the index.
   bool disjoint_from_index = is_first_update();
-  if (num_edges > 0) {
-    S2CellId shrunk_id = ShrinkToFit(pcell, bound);
-    if (shrunk_id != pcell.id()) {
-      // All the edges are contained by some descendant of the face cell.  We
-      // can save a lot of work by starting directly with that cell, but if we
-      // are in the interior of at least one shape then we need to create
-      // index entries for the cells we are skipping over.
-      SkipCellRange(face_id.range_min(), shrunk_id.range_min(),
-                    tracker, &alloc, disjoint_from_index);
-      pcell = S2PaddedCell(shrunk_id, kCellPadding);
-      UpdateEdges(pcell, &clipped_edges, tracker, &alloc, disjoint_from_index);
+  S2CellId shrunk_id = pcell.id();
+  if (num_edges > 0) shrunk_id = ShrinkToFit(pcell, bound);
+  if (shrunk_id != pcell.id()) {
+    // All the edges are contained by some descendant of the face cell.  We
+    // can save a lot of work by starting directly with that cell, but if we
+    // are in the interior of at least one shape then we need to create
+    // index entries for the cells we are skipping over.
+    SkipCellRange(face_id.range_min(), shrunk_id.range_min(),
+                  tracker, &alloc, disjoint_from_index);
+    pcell = S2PaddedCell(shrunk_id, kCellPadding);
+    UpdateEdges(pcell, &clipped_edges, tracker, &alloc, disjoint_from_index);
+    SkipCellRange(shrunk_id.range_max().next(), face_id.range_max().next(),
+                  tracker, &alloc, disjoint_from_index);
+  } else {
+    // Otherwise (no edges, or no shrinking is possible), subdivide normally.
+    UpdateEdges(pcell, &clipped_edges, tracker, &alloc, disjoint_from_index);
+  }
+  // Return the approximate amount of temporary memory used.
+  return (clipped_edge_storage.capacity() * sizeof(ClippedEdge) +
+          clipped_edges.capacity() * sizeof(const ClippedEdge*) +
+          alloc.SpaceUsed());
+}
+
+// Like calling UpdateFaceEdges() for each face in turn, except that the index
+// cells are built using up to options_.num_threads() threads.  The edges on
+// each face are first subdivided (exactly as UpdateEdges would do) until
+// each subtree is small enough, then the subtrees are built concurrently,
+// and finally the resulting cells are inserted into cell_map_.  The index is
+// identical to the one that would be built sequentially.  Returns the
+// approximate amount of temporary memory used.
+//
+// REQUIRES: is_first_update()
+size_t MutableS2ShapeIndex::UpdateFaceEdgesParallel(
+    const vector<FaceEdge> all_edges[6], InteriorTracker* tracker) {
+  S2_DCHECK(is_first_update());
+
+  // Subdivide until there are several tasks per thread (so that the work is
+  // balanced reasonably well), but don't bother creating tasks that are so
+  // small that the subdivision overhead becomes significant.
+  const int kTasksPerThread = 8;
+  const int kMinTaskEdges = 1000;
+  size_t num_edges = 0;
+  for (int face = 0; face < 6; ++face) num_edges += all_edges[face].size();
+  const int max_task_edges = max<size_t>(
+      kMinTaskEdges, num_edges / (kTasksPerThread * options_.num_threads()));
+
+  // The ClippedEdges created while subdividing must remain valid until all
+  // the tasks have finished.  Any index cells created while subdividing
+  // (i.e., by SkipCellRange) are collected in "cells".
+  vector<ClippedEdge> clipped_edge_storage[6];
+  EdgeAllocator alloc;
+  EdgeAllocator::CellList cells;
+  alloc.set_new_cells(&cells);
+  alloc.set_arena(arena_.get());
+  alloc.set_stats(&build_stats_);
+  vector<unique_ptr<BuildTask>> tasks;
+  for (int face = 0; face < 6; ++face) {
+    S2CellId face_id = S2CellId::FromFace(face);
+    S2PaddedCell pcell(face_id, kCellPadding);
+
+    // When the index is built sequentially, the InteriorTracker state is
+    // passed from one face to the next.  Here the tracker focus is currently
+    // somewhere on the previous face, so we move it to the entry vertex of
+    // this face by testing the edges of the previous face.
+    if (face > 0 && tracker->is_active()) {
+      tracker->DrawTo(pcell.GetEntryVertex());
+      for (const FaceEdge& edge : all_edges[face - 1]) {
+        if (edge.has_interior) tracker->TestEdge(edge.shape_id, edge.edge);
+      }
+    }
+    const vector<FaceEdge>& face_edges = all_edges[face];
+    if (face_edges.empty() && tracker->shape_ids().empty()) continue;
+
+    // See UpdateFaceEdges() for comments.
+    vector<ClippedEdge>* storage = &clipped_edge_storage[face];
+    vector<const ClippedEdge*> clipped_edges;
+    storage->reserve(face_edges.size());
+    clipped_edges.reserve(face_edges.size());
+    R2Rect bound = R2Rect::Empty();
+    for (const FaceEdge& face_edge : face_edges) {
+      ClippedEdge clipped;
+      clipped.face_edge = &face_edge;
+      clipped.bound = R2Rect::FromPointPair(face_edge.a, face_edge.b);
+      storage->push_back(clipped);
+      clipped_edges.push_back(&storage->back());
+      bound.AddRect(clipped.bound);
+    }
+    S2CellId shrunk_id = face_id;
+    if (!face_edges.empty()) {
+      shrunk_id = ShrinkToFit(pcell, bound);
+      if (shrunk_id != face_id) {
+        SkipCellRange(face_id.range_min(), shrunk_id.range_min(),
+                      tracker, &alloc, true /*disjoint_from_index*/);
+        pcell = S2PaddedCell(shrunk_id, kCellPadding);
+        if (tracker->is_active()) {
+          tracker->DrawTo(pcell.GetEntryVertex());
+          TestAllEdges(clipped_edges, tracker);
+        }
+      }
+    }
+    GetBuildTasks(pcell, &clipped_edges, tracker, &alloc, max_task_edges,
+                  &tasks);
+    if (shrunk_id != face_id) {
+      // Move the tracker focus to the exit vertex of the shrunk cell so that
+      // we know which shapes contain the remainder of the face.
+      if (tracker->is_active()) {
+        tracker->DrawTo(pcell.GetExitVertex());
+        TestAllEdges(clipped_edges, tracker);
+      }
       SkipCellRange(shrunk_id.range_max().next(), face_id.range_max().next(),
-                    tracker, &alloc, disjoint_from_index);
-      return;
+                    tracker, &alloc, true /*disjoint_from_index*/);
+    }
+  }
+
+  // Build the tasks using a simple shared work queue.  The calling thread
+  // also processes tasks.
+  std::atomic<size_t> next_task(0);
+  auto worker = [this, &tasks, &next_task]() {
+    for (size_t i; (i = next_task.fetch_add(1)) < tasks.size(); ) {
+      RunBuildTask(tasks[i].get());
+    }
+  };
+  const int num_threads = std::min<size_t>(options_.num_threads(),
+                                           tasks.size());
+  vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) thread.join();
+
+  // Merge the cells and statistics of all tasks.  Since cell_map_ is empty,
+  // we can sort the cells and then insert them in order (which is much
+  // faster).
+  size_t tmp_bytes = alloc.SpaceUsed();
+  for (int face = 0; face < 6; ++face) {
+    tmp_bytes += clipped_edge_storage[face].capacity() * sizeof(ClippedEdge);
+  }
+  for (const auto& task : tasks) {
+    cells.insert(cells.end(), task->cells.begin(), task->cells.end());
+    if (task->arena != nullptr) arena_->Splice(task->arena.get());
+    const BuildStats& stats = task->stats;
+    build_stats_.max_depth = max(build_stats_.max_depth, stats.max_depth);
+    build_stats_.cells_created += stats.cells_created;
+    build_stats_.split_edges_seconds += stats.split_edges_seconds;
+    tmp_bytes += task->edges.capacity() * sizeof(const ClippedEdge*) +
+                 task->tmp_bytes;
+  }
+  std::sort(cells.begin(), cells.end(),
+            [](const EdgeAllocator::CellList::value_type& x,
+               const EdgeAllocator::CellList::value_type& y) {
+              return x.first < y.first;
+            });
+  for (const auto& cell : cells) {
+    cell_map_.insert(cell_map_.end(), cell);
+    MarkSnapshotChunk(cell.first);
+  }
+  return tmp_bytes;
+}
+
+// Subdivides "pcell" exactly as UpdateEdges() would during the initial
+// construction of the index, and appends a BuildTask to "tasks" for every
+// subtree that has at most "max_task_edges" edges or that UpdateEdges()
+// would not subdivide any further.  The tracker focus must be the entry
+// vertex of "pcell"; on return, the focus is somewhere within "pcell".
+void MutableS2ShapeIndex::GetBuildTasks(
+    const S2PaddedCell& pcell, vector<const ClippedEdge*>* edges,
+    InteriorTracker* tracker, EdgeAllocator* alloc, int max_task_edges,
+    vector<unique_ptr<BuildTask>>* tasks) const {
+  // This is the same test as in MakeIndexCell().
+  int count = 0;
+  for (const ClippedEdge* edge : *edges) {
+    count += (pcell.level() < edge->face_edge->max_level);
+  }
+  if (edges->size() <= max_task_edges ||
+      count <= options_.max_edges_per_cell()) {
+    auto task = absl::make_unique<BuildTask>(pcell);
+    if (arena_ != nullptr) task->arena = absl::make_unique<CellArena>();
+    task->edges = *edges;
+    task->tracker.CopyFrom(*tracker);
+    task->tracker.MoveTo(pcell.GetEntryVertex());
+    task->tracker.set_next_cellid(pcell.id());
+    tasks->push_back(std::move(task));
+    return;
+  }
+  vector<const ClippedEdge*> child_edges[2][2];  // [i][j]
+  {
+    ScopedBuildTimer timer(options_.time_build_phases(),
+                           &alloc->stats()->split_edges_seconds);
+    SplitEdges(pcell, *edges, child_edges, alloc);
+  }
+  for (int pos = 0; pos < 4; ++pos) {
+    int i, j;
+    pcell.GetChildIJ(pos, &i, &j);
+    S2PaddedCell child(pcell, i, j);
+    // Move the tracker focus to the entry vertex of the child.  (The first
+    // child has the same entry vertex as its parent.)  The path from the
+    // current focus lies within "pcell", so only its edges need to be tested.
+    if (pos > 0 && tracker->is_active()) {
+      tracker->DrawTo(child.GetEntryVertex());
+      TestAllEdges(*edges, tracker);
+    }
+    if (!child_edges[i][j].empty() || !tracker->shape_ids().empty()) {
+      GetBuildTasks(child, &child_edges[i][j], tracker, alloc,
+                    max_task_edges, tasks);
     }
   }
-  // Otherwise (no edges, or no shrinking is possible), subdivide normally.
-  UpdateEdges(pcell, &clipped_edges, tracker, &alloc, disjoint_from_index);
+}
+
+// Builds the index cells for the given subtree.  This method may be called
+// concurrently for different tasks.
+void MutableS2ShapeIndex::RunBuildTask(BuildTask* task) {
+  EdgeAllocator alloc;
+  alloc.set_new_cells(&task->cells);
+  if (task->arena != nullptr) alloc.set_arena(task->arena.get());
+  alloc.set_stats(&task->stats);
+  UpdateEdges(task->pcell, &task->edges, &task->tracker, &alloc,
+              true /*disjoint_from_index*/);
+  task->tmp_bytes = alloc.SpaceUsed();
 }
 
 inline S2CellId MutableS2ShapeIndex::ShrinkToFit(const S2PaddedCell& pcell,
@@ -1043,6 +1779,8 @@ void MutableS2ShapeIndex::UpdateEdges(const S2PaddedCell& pcell,
   // subdivision process is so that we can find all of the index cells that
   // contain those shapes efficiently, without maintaining an explicit list of
   // index cells for each shape (which would be expensive in terms of memory).
+  BuildStats* stats = alloc->stats();
+  stats->max_depth = max(stats->max_depth, pcell.level());
   bool index_cell_absorbed = false;
   if (!disjoint_from_index) {
     // There may be existing index cells contained inside "pcell".  If we
@@ -1055,9 +1793,20 @@ void MutableS2ShapeIndex::UpdateEdges(const S2PaddedCell& pcell,
     if (r == DISJOINT) {
       disjoint_from_index = true;
     } else if (r == INDEXED) {
-      // Absorb the index cell by transferring its contents to "edges" and
-      // deleting it.  We also start tracking the interior of any new shapes.
-      AbsorbIndexCell(pcell, iter, edges, tracker, alloc);
+      // If possible, add the new edges directly to the existing index cell.
+      if (SpliceIndexCell(pcell, iter, *edges, tracker, alloc)) {
+        ++stats->cells_spliced;
+        return;
+      }
+      // Otherwise absorb the index cell by transferring its contents to
+      // "edges" and deleting it.  We also start tracking the interior of any
+      // new shapes.
+      {
+        ScopedBuildTimer timer(options_.time_build_phases(),
+                               &stats->absorb_cells_seconds);
+        AbsorbIndexCell(pcell, iter, edges, tracker, alloc);
+      }
+      ++stats->cells_absorbed;
       index_cell_absorbed = true;
       disjoint_from_index = true;
     } else {
@@ -1069,69 +1818,20 @@ void MutableS2ShapeIndex::UpdateEdges(const S2PaddedCell& pcell,
   // subdividing so that we can merge with those cells.  Otherwise,
   // MakeIndexCell checks if the number of edges is small enough, and creates
   // an index cell if possible (returning true when it does so).
-  if (!disjoint_from_index || !MakeIndexCell(pcell, *edges, tracker)) {
-    // Reserve space for the edges that will be passed to each child.  This is
-    // important since otherwise the running time is dominated by the time
-    // required to grow the vectors.  The amount of memory involved is
-    // relatively small, so we simply reserve the maximum space for every child.
-    vector<const ClippedEdge*> child_edges[2][2];  // [i][j]
-    int num_edges = edges->size();
-    for (int i = 0; i < 2; ++i) {
-      for (int j = 0; j < 2; ++j) {
-        child_edges[i][j].reserve(num_edges);
-      }
-    }
+  if (!disjoint_from_index || !MakeIndexCell(pcell, *edges, tracker, alloc)) {
+    if (index_cell_absorbed) ++stats->cells_split;
 
     // Remember the current size of the EdgeAllocator so that we can free any
     // edges that are allocated during edge splitting.
     size_t alloc_size = alloc->size();
 
-    // Compute the middle of the padded cell, defined as the rectangle in
-    // (u,v)-space that belongs to all four (padded) children.  By comparing
-    // against the four boundaries of "middle" we can determine which children
-    // each edge needs to be propagated to.
-    const R2Rect& middle = pcell.middle();
-
-    // Build up a vector edges to be passed to each child cell.  The (i,j)
-    // directions are left (i=0), right (i=1), lower (j=0), and upper (j=1).
-    // Note that the vast majority of edges are propagated to a single child.
-    // This case is very fast, consisting of between 2 and 4 floating-point
-    // comparisons and copying one pointer.  (ClipVAxis is inline.)
-    for (int e = 0; e < num_edges; ++e) {
-      const ClippedEdge* edge = (*edges)[e];
-      if (edge->bound[0].hi() <= middle[0].lo()) {
-        // Edge is entirely contained in the two left children.
-        ClipVAxis(edge, middle[1], child_edges[0], alloc);
-      } else if (edge->bound[0].lo() >= middle[0].hi()) {
-        // Edge is entirely contained in the two right children.
-        ClipVAxis(edge, middle[1], child_edges[1], alloc);
-      } else if (edge->bound[1].hi() <= middle[1].lo()) {
-        // Edge is entirely contained in the two lower children.
-        child_edges[0][0].push_back(ClipUBound(edge, 1, middle[0].hi(), alloc));
-        child_edges[1][0].push_back(ClipUBound(edge, 0, middle[0].lo(), alloc));
-      } else if (edge->bound[1].lo() >= middle[1].hi()) {
-        // Edge is entirely contained in the two upper children.
-        child_edges[0][1].push_back(ClipUBound(edge, 1, middle[0].hi(), alloc));
-        child_edges[1][1].push_back(ClipUBound(edge, 0, middle[0].lo(), alloc));
-      } else {
-        // The edge bound spans all four children.  The edge itself intersects
-        // either three or four (padded) children.
-        const ClippedEdge* left = ClipUBound(edge, 1, middle[0].hi(), alloc);
-        ClipVAxis(left, middle[1], child_edges[0], alloc);
-        const ClippedEdge* right = ClipUBound(edge, 0, middle[0].lo(), alloc);
-        ClipVAxis(right, middle[1], child_edges[1], alloc);
-      }
-    }
-    // Free any memory reserved for children that turned out to be empty.  This
-    // step is cheap and reduces peak memory usage by about 10% when building
-    // large indexes (> 10M edges).
-    for (int i = 0; i < 2; ++i) {
-      for (int j = 0; j < 2; ++j) {
-        if (child_edges[i][j].empty()) {
-          vector<const ClippedEdge*>().swap(child_edges[i][j]);
-        }
-      }
+    vector<const ClippedEdge*> child_edges[2][2];  // [i][j]
+    {
+      ScopedBuildTimer timer(options_.time_build_phases(),
+                             &stats->split_edges_seconds);
+      SplitEdges(pcell, *edges, child_edges, alloc);
     }
+
     // Now recursively update the edges in each child.  We call the children in
     // increasing order of S2CellId so that when the index is first constructed,
     // all insertions into cell_map_ are at the end (which is much faster).
@@ -1152,6 +1852,72 @@ void MutableS2ShapeIndex::UpdateEdges(const S2PaddedCell& pcell,
   }
 }
 
+// Given a cell and a set of ClippedEdges whose bounding boxes intersect that
+// cell, distribute the edges among the four children of the cell (clipping
+// them as necessary).  "child_edges" is indexed by the (i,j) child position.
+/* static */
+void MutableS2ShapeIndex::SplitEdges(
+    const S2PaddedCell& pcell, const vector<const ClippedEdge*>& edges,
+    vector<const ClippedEdge*> child_edges[2][2], EdgeAllocator* alloc) {
+  // Reserve space for the edges that will be passed to each child.  This is
+  // important since otherwise the running time is dominated by the time
+  // required to grow the vectors.  The amount of memory involved is
+  // relatively small, so we simply reserve the maximum space for every child.
+  int num_edges = edges.size();
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      child_edges[i][j].reserve(num_edges);
+    }
+  }
+
+  // Compute the middle of the padded cell, defined as the rectangle in
+  // (u,v)-space that belongs to all four (padded) children.  By comparing
+  // against the four boundaries of "middle" we can determine which children
+  // each edge needs to be propagated to.
+  const R2Rect& middle = pcell.middle();
+
+  // Build up a vector edges to be passed to each child cell.  The (i,j)
+  // directions are left (i=0), right (i=1), lower (j=0), and upper (j=1).
+  // Note that the vast majority of edges are propagated to a single child.
+  // This case is very fast, consisting of between 2 and 4 floating-point
+  // comparisons and copying one pointer.  (ClipVAxis is inline.)
+  for (int e = 0; e < num_edges; ++e) {
+    const ClippedEdge* edge = edges[e];
+    if (edge->bound[0].hi() <= middle[0].lo()) {
+      // Edge is entirely contained in the two left children.
+      ClipVAxis(edge, middle[1], child_edges[0], alloc);
+    } else if (edge->bound[0].lo() >= middle[0].hi()) {
+      // Edge is entirely contained in the two right children.
+      ClipVAxis(edge, middle[1], child_edges[1], alloc);
+    } else if (edge->bound[1].hi() <= middle[1].lo()) {
+      // Edge is entirely contained in the two lower children.
+      child_edges[0][0].push_back(ClipUBound(edge, 1, middle[0].hi(), alloc));
+      child_edges[1][0].push_back(ClipUBound(edge, 0, middle[0].lo(), alloc));
+    } else if (edge->bound[1].lo() >= middle[1].hi()) {
+      // Edge is entirely contained in the two upper children.
+      child_edges[0][1].push_back(ClipUBound(edge, 1, middle[0].hi(), alloc));
+      child_edges[1][1].push_back(ClipUBound(edge, 0, middle[0].lo(), alloc));
+    } else {
+      // The edge bound spans all four children.  The edge itself intersects
+      // either three or four (padded) children.
+      const ClippedEdge* left = ClipUBound(edge, 1, middle[0].hi(), alloc);
+      ClipVAxis(left, middle[1], child_edges[0], alloc);
+      const ClippedEdge* right = ClipUBound(edge, 0, middle[0].lo(), alloc);
+      ClipVAxis(right, middle[1], child_edges[1], alloc);
+    }
+  }
+  // Free any memory reserved for children that turned out to be empty.  This
+  // step is cheap and reduces peak memory usage by about 10% when building
+  // large indexes (> 10M edges).
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      if (child_edges[i][j].empty()) {
+        vector<const ClippedEdge*>().swap(child_edges[i][j]);
+      }
+    }
+  }
+}
+
 // Given an edge and an interval "middle" along the v-axis, clip the edge
 // against the boundaries of "middle" and add the edge to the corresponding
 // children.
@@ -1299,7 +2065,7 @@ void MutableS2ShapeIndex::AbsorbIndexCell(const S2PaddedCell& pcell,
   for (int s = 0; s < cell.num_clipped(); ++s) {
     const S2ClippedShape& clipped = cell.clipped(s);
     int shape_id = clipped.shape_id();
-    const S2Shape* shape = this->shape(shape_id);
+    const S2Shape* shape = shapes_[shape_id].get();
     if (shape == nullptr) continue;  // This shape is being removed.
     int num_edges = clipped.num_edges();
 
@@ -1357,14 +2123,88 @@ void MutableS2ShapeIndex::AbsorbIndexCell(const S2PaddedCell& pcell,
   // Update the edge list and delete this cell from the index.
   edges->swap(new_edges);
   cell_map_.erase(pcell.id());
-  delete &cell;
+  MarkSnapshotChunk(pcell.id());
+  DeleteIndexCell(&cell);
+}
+
+// Deletes an index cell that has been removed from cell_map_.  In snapshot
+// mode the cell may still be in use by readers, so it is retired instead.
+// (Cells allocated from the arena are reclaimed by MaybeCompactArena.)
+void MutableS2ShapeIndex::DeleteIndexCell(const S2ShapeIndexCell* cell) {
+  if (!cell->owns_data_) {
+    arena_->Discard(*cell);
+  } else if (options_.snapshot_mode()) {
+    retired_cells_.push_back(cell);
+  } else {
+    delete cell;
+  }
+}
+
+// Attempt to add the given edges (and any shapes in "tracker" that contain
+// the cell center) to the existing index cell "iter" without absorbing it,
+// and return true if successful.  This is possible when no shapes are being
+// removed from the cell and the updated cell does not need to be subdivided.
+// It is much faster than absorbing the cell, since the existing edges do not
+// need to be clipped again.  The result is the same either way.
+bool MutableS2ShapeIndex::SpliceIndexCell(
+    const S2PaddedCell& pcell, const Iterator& iter,
+    const vector<const ClippedEdge*>& edges, InteriorTracker* tracker,
+    EdgeAllocator* alloc) {
+  S2_DCHECK_EQ(pcell.id(), iter.id());
+  S2_DCHECK(alloc->new_cells() == nullptr);
+
+  // Shapes being removed have the smallest ids, so we only need to check the
+  // first edge and the first containing shape.
+  const ShapeIdSet& cshape_ids = tracker->shape_ids();
+  if ((!edges.empty() &&
+       is_shape_being_removed(edges[0]->face_edge->shape_id)) ||
+      (!cshape_ids.empty() && is_shape_being_removed(cshape_ids[0]))) {
+    return false;
+  }
+  // This is the same test as in MakeIndexCell(), except that every existing
+  // edge is counted (since we don't know which ones have reached their
+  // maximum level).  This is conservative: if the test succeeds, then
+  // absorbing the cell would not subdivide it either.
+  const S2ShapeIndexCell& cell = iter.cell();
+  int count = 0;
+  for (int s = 0; s < cell.num_clipped(); ++s) {
+    const S2ClippedShape& clipped = cell.clipped(s);
+    if (shapes_[clipped.shape_id()] == nullptr) return false;
+    count += clipped.num_edges();
+  }
+  for (const ClippedEdge* edge : edges) {
+    count += (pcell.level() < edge->face_edge->max_level);
+    if (count > options_.max_edges_per_cell()) return false;
+  }
+  if (count > options_.max_edges_per_cell()) return false;
+
+  // Update the InteriorTracker exactly as MakeIndexCell() does.  The existing
+  // shapes do not need to be tracked since their state is already known.
+  if (tracker->is_active() && !edges.empty()) {
+    if (!tracker->at_cellid(pcell.id())) {
+      tracker->MoveTo(pcell.GetEntryVertex());
+    }
+    tracker->DrawTo(pcell.GetCenter());
+    TestAllEdges(edges, tracker);
+  }
+  S2ShapeIndexCell* new_cell = NewIndexCell(&cell, edges, cshape_ids, alloc);
+  cell_map_.find(pcell.id())->second = new_cell;
+  MarkSnapshotChunk(pcell.id());
+  DeleteIndexCell(&cell);
+  if (tracker->is_active() && !edges.empty()) {
+    tracker->DrawTo(pcell.GetExitVertex());
+    TestAllEdges(edges, tracker);
+    tracker->set_next_cellid(pcell.id().next());
+  }
+  return true;
 }
 
 // Attempt to build an index cell containing the given edges, and return true
 // if successful.  (Otherwise the edges should be subdivided further.)
 bool MutableS2ShapeIndex::MakeIndexCell(const S2PaddedCell& pcell,
                                         const vector<const ClippedEdge*>& edges,
-                                        InteriorTracker* tracker) {
+                                        InteriorTracker* tracker,
+                                        EdgeAllocator* alloc) {
   if (edges.empty() && tracker->shape_ids().empty()) {
     // No index cell is needed.  (In most cases this situation is detected
     // before we get to this point, but this can happen when all shapes in a
@@ -1411,24 +2251,65 @@ bool MutableS2ShapeIndex::MakeIndexCell(const S2PaddedCell& pcell,
     tracker->DrawTo(pcell.GetCenter());
     TestAllEdges(edges, tracker);
   }
-  // Allocate and fill a new index cell.  To get the total number of shapes we
-  // need to merge the shapes associated with the intersecting edges together
-  // with the shapes that happen to contain the cell center.
-  const ShapeIdSet& cshape_ids = tracker->shape_ids();
-  int num_shapes = CountShapes(edges, cshape_ids);
-  S2ShapeIndexCell* cell = new S2ShapeIndexCell;
-  S2ClippedShape* base = cell->add_shapes(num_shapes);
+  S2ShapeIndexCell* cell = NewIndexCell(nullptr, edges, tracker->shape_ids(),
+                                        alloc);
+  ++alloc->stats()->cells_created;
 
-  // To fill the index cell we merge the two sources of shapes: "edge shapes"
-  // (those that have at least one edge that intersects this cell), and
-  // "containing shapes" (those that contain the cell center).  We keep track
-  // of the index of the next intersecting edge and the next containing shape
-  // as we go along.  Both sets of shape ids are already sorted.
+  // UpdateEdges() visits cells in increasing order of S2CellId, so during
+  // initial construction of the index all insertions happen at the end.  It
+  // is much faster to give an insertion hint in this case.  Otherwise the
+  // hint doesn't do much harm.  With more effort we could provide a hint even
+  // during incremental updates, but this is probably not worth the effort.
+  if (alloc->new_cells() != nullptr) {
+    alloc->new_cells()->push_back(std::make_pair(pcell.id(), cell));
+  } else {
+    cell_map_.insert(cell_map_.end(), std::make_pair(pcell.id(), cell));
+    MarkSnapshotChunk(pcell.id());
+  }
+
+  // Shift the InteriorTracker focus point to the exit vertex of this cell.
+  if (tracker->is_active() && !edges.empty()) {
+    tracker->DrawTo(pcell.GetExitVertex());
+    TestAllEdges(edges, tracker);
+    tracker->set_next_cellid(pcell.id().next());
+  }
+  return true;
+}
+
+// Allocate and fill a new index cell.  The cell contains the clipped shapes of
+// "existing" (if non-null), followed by the shapes associated with "edges"
+// and "cshape_ids" (which must all have larger shape ids).
+S2ShapeIndexCell* MutableS2ShapeIndex::NewIndexCell(
+    const S2ShapeIndexCell* existing, const vector<const ClippedEdge*>& edges,
+    const ShapeIdSet& cshape_ids, EdgeAllocator* alloc) const {
+  // To get the total number of shapes we need to merge the shapes associated
+  // with the intersecting edges together with the shapes that happen to
+  // contain the cell center.
+  int num_existing = (existing == nullptr) ? 0 : existing->num_clipped();
+  int num_shapes = num_existing + CountShapes(edges, cshape_ids);
+  S2ShapeIndexCell* cell = alloc->NewCell(num_shapes);
+  S2ClippedShape* base = cell->shapes_;
+  for (int i = 0; i < num_existing; ++i) {
+    const S2ClippedShape& src = existing->clipped(i);
+    S2ClippedShape* clipped = base + i;
+    alloc->InitClipped(clipped, src.shape_id(), src.num_edges());
+    clipped->set_contains_center(src.contains_center());
+    for (int e = 0; e < src.num_edges(); ++e) {
+      clipped->set_edge(e, src.edge(e));
+    }
+  }
+
+  // To fill the rest of the index cell we merge the two sources of shapes:
+  // "edge shapes" (those that have at least one edge that intersects this
+  // cell), and "containing shapes" (those that contain the cell center).  We
+  // keep track of the index of the next intersecting edge and the next
+  // containing shape as we go along.  Both sets of shape ids are already
+  // sorted.
   int enext = 0;
   ShapeIdSet::const_iterator cnext = cshape_ids.begin();
-  for (int i = 0; i < num_shapes; ++i) {
+  for (int i = num_existing; i < num_shapes; ++i) {
     S2ClippedShape* clipped = base + i;
-    int eshape_id = num_shape_ids(), cshape_id = eshape_id;  // Sentinels
+    int eshape_id = shapes_.size(), cshape_id = eshape_id;  // Sentinels
     if (enext != edges.size()) {
       eshape_id = edges[enext]->face_edge->shape_id;
     }
@@ -1438,7 +2319,7 @@ bool MutableS2ShapeIndex::MakeIndexCell(const S2PaddedCell& pcell,
     int ebegin = enext;
     if (cshape_id < eshape_id) {
       // The entire cell is in the shape interior.
-      clipped->Init(cshape_id, 0);
+      alloc->InitClipped(clipped, cshape_id, 0);
       clipped->set_contains_center(true);
       ++cnext;
     } else {
@@ -1447,7 +2328,7 @@ bool MutableS2ShapeIndex::MakeIndexCell(const S2PaddedCell& pcell,
              edges[enext]->face_edge->shape_id == eshape_id) {
         ++enext;
       }
-      clipped->Init(eshape_id, enext - ebegin);
+      alloc->InitClipped(clipped, eshape_id, enext - ebegin);
       for (int e = ebegin; e < enext; ++e) {
         clipped->set_edge(e - ebegin, edges[e]->face_edge->edge_id);
       }
@@ -1456,21 +2337,9 @@ bool MutableS2ShapeIndex::MakeIndexCell(const S2PaddedCell& pcell,
         ++cnext;
       }
     }
+    S2_DCHECK(i == 0 || clipped->shape_id() > base[i - 1].shape_id());
   }
-  // UpdateEdges() visits cells in increasing order of S2CellId, so during
-  // initial construction of the index all insertions happen at the end.  It
-  // is much faster to give an insertion hint in this case.  Otherwise the
-  // hint doesn't do much harm.  With more effort we could provide a hint even
-  // during incremental updates, but this is probably not worth the effort.
-  cell_map_.insert(cell_map_.end(), std::make_pair(pcell.id(), cell));
-
-  // Shift the InteriorTracker focus point to the exit vertex of this cell.
-  if (tracker->is_active() && !edges.empty()) {
-    tracker->DrawTo(pcell.GetExitVertex());
-    TestAllEdges(edges, tracker);
-    tracker->set_next_cellid(pcell.id().next());
-  }
-  return true;
+  return cell;
 }
 
 // Call tracker->TestEdge() on all edges from shapes that have interiors.
@@ -1515,11 +2384,17 @@ size_t MutableS2ShapeIndex::SpaceUsed() const {
   size += shapes_.capacity() * sizeof(std::unique_ptr<S2Shape>);
   // cell_map_ itself is already included in sizeof(*this).
   size += cell_map_.bytes_used() - sizeof(cell_map_);
-  size += cell_map_.size() * sizeof(S2ShapeIndexCell);
+  if (frozen_ != nullptr) {
+    size += sizeof(*frozen_);
+    size += frozen_->ids.capacity() * sizeof(S2CellId);
+    size += frozen_->cells.capacity() * sizeof(S2ShapeIndexCell*);
+  }
+  if (arena_ != nullptr) size += arena_->SpaceUsed();
   Iterator it;
   for (it.InitStale(this, S2ShapeIndex::BEGIN); !it.done(); it.Next()) {
     const S2ShapeIndexCell& cell = it.cell();
-    size += cell.shapes_.capacity() * sizeof(S2ClippedShape);
+    if (!cell.owns_data_) continue;  // Included in the arena size above.
+    size += sizeof(cell) + cell.capacity_ * sizeof(S2ClippedShape);
     for (int s = 0; s < cell.num_clipped(); ++s) {
       const S2ClippedShape& clipped = cell.clipped(s);
       if (!clipped.is_inline()) {
@@ -1576,10 +2451,20 @@ bool MutableS2ShapeIndex::Init(Decoder* decoder,
 
   for (int i = 0; i < cell_ids.size(); ++i) {
     S2CellId id = cell_ids[i];
-    S2ShapeIndexCell* cell = new S2ShapeIndexCell;
     Decoder decoder = encoded_cells.GetDecoder(i);
+    if (arena_ != nullptr) {
+      S2ShapeIndexCell cell;
+      if (!cell.Decode(num_shapes, &decoder)) return false;
+      cell_map_.insert(cell_map_.end(),
+                       std::make_pair(id, arena_->CopyCell(cell)));
+      MarkSnapshotChunk(id);
+      continue;
+    }
+    S2ShapeIndexCell* cell = new S2ShapeIndexCell;
     if (!cell->Decode(num_shapes, &decoder)) return false;
     cell_map_.insert(cell_map_.end(), std::make_pair(id, cell));
+    MarkSnapshotChunk(id);
   }
+  if (options_.snapshot_mode()) PublishSnapshot();
   return true;
 }
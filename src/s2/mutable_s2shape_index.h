@@ -18,10 +18,12 @@
 #ifndef S2_MUTABLE_S2SHAPE_INDEX_H_
 #define S2_MUTABLE_S2SHAPE_INDEX_H_
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cstddef>
 #include <memory>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -106,6 +108,11 @@
 // if one thread updates the index, you must ensure that no other thread is
 // reading or updating the index at the same time.
 //
+// Alternatively, the index can be used in "snapshot mode" (see Options).  In
+// this mode readers never wait for updates: they see the most recently
+// published version of the index, while a single writer thread adds shapes
+// and publishes new versions by calling ForceBuild().
+//
 // TODO(ericv): MutableS2ShapeIndex has an Encode() method that allows the
 // index to be serialized.  An encoded S2ShapeIndex can be decoded either into
 // its original form (MutableS2ShapeIndex) or into an EncodedS2ShapeIndex.
@@ -117,6 +124,8 @@
 class MutableS2ShapeIndex final : public S2ShapeIndex {
  private:
   using CellMap = gtl::btree_map<S2CellId, S2ShapeIndexCell*>;
+  struct FrozenCells;
+  struct Snapshot;
 
  public:
   // Options that affect construction of the MutableS2ShapeIndex.
@@ -144,8 +153,82 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
     int max_edges_per_cell() const { return max_edges_per_cell_; }
     void set_max_edges_per_cell(int max_edges_per_cell);
 
+    // The number of threads used to build the index.  When this value is
+    // greater than 1, the initial construction of the index (i.e., the first
+    // batch of updates applied to an empty index) is split into independent
+    // subtrees of the cube faces which are built concurrently.  The resulting
+    // index is identical to the one built by a single thread.  Incremental
+    // updates to an existing index are always applied by a single thread.
+    //
+    // Threads are created only for the duration of each build, so this
+    // option is only worthwhile for indexes with a large number of edges
+    // (typically at least several hundred thousand).
+    //
+    // DEFAULT: 1
+    int num_threads() const { return num_threads_; }
+    void set_num_threads(int num_threads);
+
+    // If true, the index operates in "snapshot mode".  Queries never apply
+    // pending updates (and therefore never block); instead, every Iterator
+    // uses the most recently published version of the index, which remains
+    // valid for as long as the Iterator exists.  New versions are published
+    // only by calling ForceBuild(), which may be done in a background
+    // thread.  The new version is swapped in atomically, and the memory used
+    // by old versions is reclaimed once the last Iterator that could be
+    // using them has been destroyed.
+    //
+    // In this mode, a single writer thread may call Add() and ForceBuild()
+    // concurrently with any number of readers that use Iterators together
+    // with shape() and num_shape_ids() (readers should call shape() and
+    // num_shape_ids() only while holding an Iterator).  On the writer thread
+    // (the thread that most recently called Add(), Release() or
+    // ForceBuild()), shape() and num_shape_ids() reflect all the shapes that
+    // have been added, including those that have not been published yet;
+    // other threads see the shapes of the most recently published version.
+    // All other non-const
+    // methods, including Release(), still require exclusive access, and any
+    // shape that is released must remain valid until all readers using
+    // versions that contain it have finished.
+    //
+    // The map from S2CellIds to index cells is divided into a fixed set of
+    // S2CellId ranges, and publishing a version copies only the ranges that
+    // contain cells changed since the previous version (the other ranges are
+    // shared).  Nevertheless this mode is best suited to indexes that are
+    // updated in batches rather than one shape at a time.
+    //
+    // DEFAULT: false
+    bool snapshot_mode() const { return snapshot_mode_; }
+    void set_snapshot_mode(bool snapshot_mode);
+
+    // If true, index cells and their clipped shapes are allocated from large
+    // contiguous slabs rather than individually from the heap.  This makes
+    // building and destroying large indexes much faster and reduces heap
+    // fragmentation.  All slabs are released together by Clear() and when
+    // the index is destroyed.  The memory of cells that are replaced by
+    // incremental updates is reclaimed by copying the remaining cells into
+    // new slabs once more than half of the slab memory is unused (except in
+    // snapshot mode, where it is only reclaimed by Clear()).
+    //
+    // DEFAULT: false
+    bool use_arena() const { return use_arena_; }
+    void set_use_arena(bool use_arena) { use_arena_ = use_arena; }
+
+    // If true, build_stats() reports the time spent subdividing edges and
+    // absorbing existing index cells.  This is disabled by default because
+    // it reads the clock at every step of the recursive subdivision.
+    //
+    // DEFAULT: false
+    bool time_build_phases() const { return time_build_phases_; }
+    void set_time_build_phases(bool time_build_phases) {
+      time_build_phases_ = time_build_phases;
+    }
+
    private:
     int max_edges_per_cell_;
+    int num_threads_ = 1;
+    bool snapshot_mode_ = false;
+    bool use_arena_ = false;
+    bool time_build_phases_ = false;
   };
 
   // Creates a MutableS2ShapeIndex that uses the default option settings.
@@ -167,20 +250,30 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
   // The number of distinct shape ids that have been assigned.  This equals
   // the number of shapes in the index provided that no shapes have ever been
   // removed.  (Shape ids are not reused.)
-  int num_shape_ids() const override {
-    return static_cast<int>(shapes_.size());
-  }
+  //
+  // In snapshot mode, threads other than the writer see the number of shape
+  // ids in the most recently published version of the index.
+  int num_shape_ids() const override;
 
   // Returns a pointer to the shape with the given id, or nullptr if the shape
   // has been removed from the index.
-  S2Shape* shape(int id) const override { return shapes_[id].get(); }
+  S2Shape* shape(int id) const override;
 
   // Minimizes memory usage by requesting that any data structures that can be
   // rebuilt should be discarded.  This method invalidates all iterators.
   //
   // Like all non-const methods, this method is not thread-safe.
+  //
+  // MutableS2ShapeIndex applies any pending updates and then releases memory
+  // that is only needed while updates are being processed, such as excess
+  // vector capacity and (if options().use_arena() is true) the arena memory
+  // of cells that were replaced by incremental updates.
   void Minimize() override;
 
+  // Equivalent to Minimize(), except that it returns the number of bytes
+  // freed as measured by SpaceUsed().
+  size_t ReleaseUnusedMemory();
+
   // Appends an encoded representation of the S2ShapeIndex to "encoder".
   //
   // This method does not encode the S2Shapes in the index; it is the client's
@@ -232,7 +325,8 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
 
     // Initialize an iterator for the given MutableS2ShapeIndex without
     // applying any pending updates.  This can be used to observe the actual
-    // current state of the index without modifying it in any way.
+    // current state of the index without modifying it in any way.  (In
+    // snapshot mode, this state is private to the writer thread.)
     void InitStale(const MutableS2ShapeIndex* index,
                    InitialPosition pos = UNPOSITIONED);
 
@@ -257,9 +351,29 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
     void Copy(const IteratorBase& other) override;
 
    private:
+    void InitCellMap(const MutableS2ShapeIndex* index,
+                     const CellMap* cell_map, InitialPosition pos);
     void Refresh();  // Updates the IteratorBase fields.
+
+    // Snapshot mode only (see Snapshot).
+    void SetChunk(int chunk);
+    void BeginChunks();
+    void FinishChunks();
+    void SkipEmptyChunks();
+    bool PrevChunk();
+
     const MutableS2ShapeIndex* index_;
+    const CellMap* cell_map_;
     CellMap::const_iterator iter_, end_;
+
+    // If the index is frozen, cell_map_ is nullptr and the iterator position
+    // is instead an index into the arrays of "frozen_".  In snapshot mode,
+    // cell_map_ is the chunk of the snapshot with index "pos_".
+    const FrozenCells* frozen_;
+    int pos_;
+
+    // In snapshot mode, the version of the index used by this iterator.
+    std::shared_ptr<const Snapshot> snapshot_;
   };
 
   // Takes ownership of the given shape and adds it to the index.  Also
@@ -294,8 +408,70 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
   // This method forces any pending updates to be applied immediately.
   // Calling this method is rarely a good idea.  (One valid reason is to
   // exclude the cost of building the index from benchmark results.)
+  //
+  // In snapshot mode, this is the only way that updates are applied; the
+  // updated index is then published atomically to new Iterators.
   void ForceBuild();
 
+  // Applies any pending updates and then converts the index into a compact
+  // read-only form: the cell ids are stored in a sorted array, and the cells
+  // are stored contiguously in the same order.  This makes iteration and
+  // seeking significantly faster, so it is worthwhile for indexes that are
+  // built once and then queried many times.  The index is converted back
+  // automatically (which takes time proportional to the number of cells)
+  // when it is next modified by Add() or Release().  Invalidates all
+  // iterators and their associated data.
+  //
+  // This method has no effect in snapshot mode.
+  void Freeze();
+
+  // Returns true if the index is currently frozen (see Freeze).
+  bool is_frozen() const { return frozen_ != nullptr; }
+
+  // Statistics about the most recent application of pending updates (i.e.,
+  // the most recent call to ForceBuild() or the first query after the index
+  // was modified).  These can be useful for understanding why a particular
+  // index is slow to build, or for tuning Options::max_edges_per_cell().
+  struct BuildStats {
+    // The number of batches that the updates were divided into (see
+    // FLAGS_s2shape_index_tmp_memory_budget_mb).
+    int num_batches = 0;
+
+    // The number of edges added or removed that intersect each cube face.
+    int64 face_edges[6] = {0, 0, 0, 0, 0, 0};
+
+    // The maximum depth of recursive subdivision, i.e. the maximum level of
+    // any cell that was visited.
+    int max_depth = 0;
+
+    // The number of index cells that were created.
+    int64 cells_created = 0;
+
+    // When new edges are added to an existing index cell that has room for
+    // them, they are "spliced" into the cell directly.  Otherwise the cell is
+    // "absorbed", i.e. rebuilt from the edges of all its shapes, which is
+    // much more expensive.  Absorbed cells may also need to be "split" into
+    // smaller cells.
+    int64 cells_spliced = 0;
+    int64 cells_absorbed = 0;
+    int64 cells_split = 0;
+
+    // The time spent updating the index cells (which includes the time spent
+    // subdividing edges and absorbing existing cells).  The last two values
+    // are measured only if Options::time_build_phases() is true, and they
+    // are summed over all threads when the index is built in parallel.
+    double update_edges_seconds = 0;
+    double split_edges_seconds = 0;
+    double absorb_cells_seconds = 0;
+
+    // An estimate of the maximum temporary memory used while processing any
+    // batch, and the memory budget that was used to divide the updates into
+    // batches.
+    int64 peak_tmp_memory_bytes = 0;
+    int64 tmp_memory_budget_bytes = 0;
+  };
+  const BuildStats& build_stats() const { return build_stats_; }
+
   // Returns true if there are no pending updates that need to be applied.
   // This can be useful to avoid building the index unnecessarily, or for
   // choosing between two different algorithms depending on whether the index
@@ -317,8 +493,11 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
   friend class S2Stats;
 
   struct BatchDescriptor;
+  struct BuildTask;
+  class CellArena;
   struct ClippedEdge;
   class EdgeAllocator;
+  struct Epoch;
   struct FaceEdge;
   class InteriorTracker;
   struct RemovedShape;
@@ -349,8 +528,16 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
                    std::vector<FaceEdge> all_edges[6],
                    InteriorTracker* tracker) const;
   void AddFaceEdge(FaceEdge* edge, std::vector<FaceEdge> all_edges[6]) const;
-  void UpdateFaceEdges(int face, const std::vector<FaceEdge>& face_edges,
-                       InteriorTracker* tracker);
+  size_t UpdateFaceEdges(int face, const std::vector<FaceEdge>& face_edges,
+                         InteriorTracker* tracker);
+  size_t UpdateFaceEdgesParallel(const std::vector<FaceEdge> all_edges[6],
+                                 InteriorTracker* tracker);
+  void GetBuildTasks(const S2PaddedCell& pcell,
+                     std::vector<const ClippedEdge*>* edges,
+                     InteriorTracker* tracker, EdgeAllocator* alloc,
+                     int max_task_edges,
+                     std::vector<std::unique_ptr<BuildTask>>* tasks) const;
+  void RunBuildTask(BuildTask* task);
   S2CellId ShrinkToFit(const S2PaddedCell& pcell, const R2Rect& bound) const;
   void SkipCellRange(S2CellId begin, S2CellId end, InteriorTracker* tracker,
                      EdgeAllocator* alloc, bool disjoint_from_index);
@@ -368,7 +555,15 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
                          const ShapeIdSet& cshape_ids);
   bool MakeIndexCell(const S2PaddedCell& pcell,
                      const std::vector<const ClippedEdge*>& edges,
-                     InteriorTracker* tracker);
+                     InteriorTracker* tracker, EdgeAllocator* alloc);
+  S2ShapeIndexCell* NewIndexCell(const S2ShapeIndexCell* existing,
+                                 const std::vector<const ClippedEdge*>& edges,
+                                 const ShapeIdSet& cshape_ids,
+                                 EdgeAllocator* alloc) const;
+  bool SpliceIndexCell(const S2PaddedCell& pcell, const Iterator& iter,
+                       const std::vector<const ClippedEdge*>& edges,
+                       InteriorTracker* tracker, EdgeAllocator* alloc);
+  void DeleteIndexCell(const S2ShapeIndexCell* cell);
   static void TestAllEdges(const std::vector<const ClippedEdge*>& edges,
                            InteriorTracker* tracker);
   inline static const ClippedEdge* UpdateBound(const ClippedEdge* edge,
@@ -384,6 +579,10 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
   static void ClipVAxis(const ClippedEdge* edge, const R1Interval& middle,
                         std::vector<const ClippedEdge*> child_edges[2],
                         EdgeAllocator* alloc);
+  static void SplitEdges(const S2PaddedCell& pcell,
+                         const std::vector<const ClippedEdge*>& edges,
+                         std::vector<const ClippedEdge*> child_edges[2][2],
+                         EdgeAllocator* alloc);
 
   // The amount by which cells are "padded" to compensate for numerical errors
   // when clipping line segments to cell boundaries.
@@ -400,6 +599,18 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
   // (The easiest way to achieve this is simply to use an Iterator.)
   CellMap cell_map_;
 
+  // If the index is frozen (see Freeze), the index cells are stored here
+  // rather than in cell_map_.  The cells themselves are allocated from
+  // arena_ in increasing S2CellId order.
+  struct FrozenCells {
+    std::vector<S2CellId> ids;
+    std::vector<S2ShapeIndexCell*> cells;
+  };
+  std::unique_ptr<FrozenCells> frozen_;
+
+  // Statistics about the most recent update (see build_stats()).
+  BuildStats build_stats_;
+
   // The options supplied for this index.
   Options options_;
 
@@ -481,6 +692,59 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
       UNLOCK_FUNCTION(lock_)
       UNLOCK_FUNCTION(update_state_->wait_mutex);
 
+  // In snapshot mode, each published version of the index is represented by
+  // an immutable Snapshot.  Iterators hold a reference to the Snapshot they
+  // are using, while the Epoch of each version owns the data that readers of
+  // that version (or any earlier version) might still need.
+  //
+  // The cells of a Snapshot are divided into "chunks" according to which
+  // S2CellId range at kSnapshotChunkLevel contains each S2CellId.  Each chunk
+  // is a separate CellMap, and chunks that have not changed since the
+  // previous version are shared with it rather than copied.
+  struct Snapshot {
+    std::vector<std::shared_ptr<const CellMap>> chunks;
+    std::shared_ptr<Epoch> epoch;
+  };
+  static const int kSnapshotChunkLevel = 3;
+  static const int kNumSnapshotChunks = 6 << (2 * kSnapshotChunkLevel);
+
+  static int SnapshotChunk(S2CellId id);
+  void MarkSnapshotChunk(S2CellId id);
+  void PublishSnapshot();
+
+  // In snapshot mode, the chunks whose cells have changed since the last
+  // version was published.
+  std::vector<bool> dirty_chunks_;
+
+  // The most recently published version of the index (snapshot mode only).
+  // Readers must access this field using std::atomic_load().
+  std::shared_ptr<const Snapshot> snapshot_;
+
+  // The shape table of the most recently published version of the index
+  // (snapshot mode only), or nullptr.
+  std::atomic<const std::vector<S2Shape*>*> snapshot_shapes_;
+
+  // In snapshot mode, the thread that most recently modified shapes_.  That
+  // thread reads shapes_ directly, while all other threads read
+  // snapshot_shapes_.
+  std::atomic<std::thread::id> writer_thread_;
+  bool IsSnapshotReader() const;
+  void SetWriterThread();
+
+  // In snapshot mode, index cells that have been removed from cell_map_
+  // since the last version was published.  They are not deleted until no
+  // reader can be using the previous version.
+  std::vector<const S2ShapeIndexCell*> retired_cells_;
+
+  // If options_.use_arena() is true, the arena that index cells are
+  // allocated from.  Otherwise nullptr.
+  std::unique_ptr<CellArena> arena_;
+
+  void ResetArena();
+  void MaybeCompactArena();
+  void CompactArena();
+  void Thaw();
+
   MutableS2ShapeIndex(const MutableS2ShapeIndex&) = delete;
   void operator=(const MutableS2ShapeIndex&) = delete;
 };
@@ -489,7 +753,8 @@ class MutableS2ShapeIndex final : public S2ShapeIndex {
 //////////////////   Implementation details follow   ////////////////////
 
 
-inline MutableS2ShapeIndex::Iterator::Iterator() : index_(nullptr) {
+inline MutableS2ShapeIndex::Iterator::Iterator()
+    : index_(nullptr), cell_map_(nullptr), frozen_(nullptr), pos_(0) {
 }
 
 inline MutableS2ShapeIndex::Iterator::Iterator(
@@ -499,16 +764,48 @@ inline MutableS2ShapeIndex::Iterator::Iterator(
 
 inline void MutableS2ShapeIndex::Iterator::Init(
     const MutableS2ShapeIndex* index, InitialPosition pos) {
-  index->MaybeApplyUpdates();
-  InitStale(index, pos);
+  if (index->options_.snapshot_mode()) {
+    // Use the most recently published version without waiting for any
+    // pending updates.
+    index_ = index;
+    frozen_ = nullptr;
+    snapshot_ = std::atomic_load(&index->snapshot_);
+    if (pos == BEGIN) {
+      BeginChunks();
+    } else {
+      FinishChunks();
+    }
+    Refresh();
+  } else {
+    index->MaybeApplyUpdates();
+    InitStale(index, pos);
+  }
 }
 
 inline void MutableS2ShapeIndex::Iterator::InitStale(
     const MutableS2ShapeIndex* index, InitialPosition pos) {
+  snapshot_.reset();
+  if (index->frozen_ != nullptr) {
+    index_ = index;
+    cell_map_ = nullptr;
+    frozen_ = index->frozen_.get();
+    pos_ = (pos == BEGIN) ? 0 : frozen_->ids.size();
+    Refresh();
+  } else {
+    InitCellMap(index, &index->cell_map_, pos);
+  }
+}
+
+inline void MutableS2ShapeIndex::Iterator::InitCellMap(
+    const MutableS2ShapeIndex* index, const CellMap* cell_map,
+    InitialPosition pos) {
   index_ = index;
-  end_ = index_->cell_map_.end();
+  cell_map_ = cell_map;
+  frozen_ = nullptr;
+  pos_ = 0;
+  end_ = cell_map_->end();
   if (pos == BEGIN) {
-    iter_ = index_->cell_map_.begin();
+    iter_ = cell_map_->begin();
   } else {
     iter_ = end_;
   }
@@ -522,7 +819,13 @@ inline const S2ShapeIndexCell& MutableS2ShapeIndex::Iterator::cell() const {
 }
 
 inline void MutableS2ShapeIndex::Iterator::Refresh() {
-  if (iter_ == end_) {
+  if (frozen_ != nullptr) {
+    if (pos_ == static_cast<int>(frozen_->ids.size())) {
+      set_finished();
+    } else {
+      set_state(frozen_->ids[pos_], frozen_->cells[pos_]);
+    }
+  } else if (iter_ == end_) {
     set_finished();
   } else {
     set_state(iter_->first, iter_->second);
@@ -531,39 +834,135 @@ inline void MutableS2ShapeIndex::Iterator::Refresh() {
 
 inline void MutableS2ShapeIndex::Iterator::Begin() {
   // Make sure that the index has not been modified since Init() was called.
-  S2_DCHECK(index_->is_fresh());
-  iter_ = index_->cell_map_.begin();
+  // (In snapshot mode the iterator's version never changes.)
+  S2_DCHECK(snapshot_ != nullptr || index_->is_fresh());
+  if (frozen_ != nullptr) {
+    pos_ = 0;
+  } else if (snapshot_ != nullptr) {
+    BeginChunks();
+  } else {
+    iter_ = cell_map_->begin();
+  }
   Refresh();
 }
 
 inline void MutableS2ShapeIndex::Iterator::Finish() {
-  iter_ = end_;
+  if (frozen_ != nullptr) {
+    pos_ = frozen_->ids.size();
+  } else {
+    if (snapshot_ != nullptr) FinishChunks();
+    iter_ = end_;
+  }
   Refresh();
 }
 
 inline void MutableS2ShapeIndex::Iterator::Next() {
   S2_DCHECK(!done());
-  ++iter_;
+  if (frozen_ != nullptr) {
+    ++pos_;
+  } else {
+    ++iter_;
+    if (iter_ == end_ && snapshot_ != nullptr) SkipEmptyChunks();
+  }
   Refresh();
 }
 
 inline bool MutableS2ShapeIndex::Iterator::Prev() {
-  if (iter_ == index_->cell_map_.begin()) return false;
-  --iter_;
+  if (frozen_ != nullptr) {
+    if (pos_ == 0) return false;
+    --pos_;
+  } else {
+    if (iter_ == cell_map_->begin()) {
+      if (snapshot_ == nullptr || !PrevChunk()) return false;
+    }
+    --iter_;
+  }
   Refresh();
   return true;
 }
 
 inline void MutableS2ShapeIndex::Iterator::Seek(S2CellId target) {
-  iter_ = index_->cell_map_.lower_bound(target);
+  if (frozen_ != nullptr) {
+    const std::vector<S2CellId>& ids = frozen_->ids;
+    pos_ = std::lower_bound(ids.begin(), ids.end(), target) - ids.begin();
+  } else if (snapshot_ != nullptr) {
+    SetChunk(SnapshotChunk(target));
+    iter_ = cell_map_->lower_bound(target);
+    if (iter_ == end_) SkipEmptyChunks();
+  } else {
+    iter_ = cell_map_->lower_bound(target);
+  }
   Refresh();
 }
 
+// The chunks of a snapshot are visited in order.  The iterator is positioned
+// at the end of a chunk only if all the following chunks are empty, so that
+// done() can be determined without looking at the other chunks.
+inline void MutableS2ShapeIndex::Iterator::SetChunk(int chunk) {
+  pos_ = chunk;
+  cell_map_ = snapshot_->chunks[chunk].get();
+  end_ = cell_map_->end();
+}
+
+inline void MutableS2ShapeIndex::Iterator::BeginChunks() {
+  SetChunk(0);
+  iter_ = cell_map_->begin();
+  if (iter_ == end_) SkipEmptyChunks();
+}
+
+inline void MutableS2ShapeIndex::Iterator::FinishChunks() {
+  SetChunk(kNumSnapshotChunks - 1);
+  iter_ = end_;
+}
+
 inline std::unique_ptr<MutableS2ShapeIndex::IteratorBase>
 MutableS2ShapeIndex::NewIterator(InitialPosition pos) const {
   return absl::make_unique<Iterator>(this, pos);
 }
 
+inline bool MutableS2ShapeIndex::IsSnapshotReader() const {
+  return options_.snapshot_mode() &&
+      writer_thread_.load(std::memory_order_relaxed) !=
+      std::this_thread::get_id();
+}
+
+inline void MutableS2ShapeIndex::SetWriterThread() {
+  if (options_.snapshot_mode()) {
+    writer_thread_.store(std::this_thread::get_id(),
+                         std::memory_order_relaxed);
+  }
+}
+
+inline int MutableS2ShapeIndex::num_shape_ids() const {
+  if (IsSnapshotReader()) {
+    const auto* shapes = snapshot_shapes_.load(std::memory_order_acquire);
+    return static_cast<int>(shapes->size());
+  }
+  return static_cast<int>(shapes_.size());
+}
+
+inline S2Shape* MutableS2ShapeIndex::shape(int id) const {
+  if (IsSnapshotReader()) {
+    return (*snapshot_shapes_.load(std::memory_order_acquire))[id];
+  }
+  return shapes_[id].get();
+}
+
+// Returns the snapshot chunk that contains the given S2CellId.
+inline int MutableS2ShapeIndex::SnapshotChunk(S2CellId id) {
+  // The chunk is determined by the face and the first kSnapshotChunkLevel
+  // levels of the Hilbert curve position.  (Larger values such as
+  // S2CellId::Sentinel() belong to the last chunk.)
+  uint64 chunk = id.id() >> (S2CellId::kPosBits - 2 * kSnapshotChunkLevel);
+  return static_cast<int>(std::min<uint64>(chunk, kNumSnapshotChunks - 1));
+}
+
+// Records that a cell in the chunk containing "id" has been added, replaced,
+// or removed since the last version was published.
+inline void MutableS2ShapeIndex::MarkSnapshotChunk(S2CellId id) {
+  if (options_.snapshot_mode()) dirty_chunks_[SnapshotChunk(id)] = true;
+}
+
 inline bool MutableS2ShapeIndex::is_fresh() const {
   return index_status_.load(std::memory_order_relaxed) == FRESH;
 }
@@ -17,6 +17,7 @@
 
 #include "s2/mutable_s2shape_index.h"
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <numeric>
@@ -39,6 +40,7 @@
 #include "s2/s2debug.h"
 #include "s2/s2edge_clipping.h"
 #include "s2/s2edge_crosser.h"
+#include "s2/s2edge_distances.h"
 #include "s2/s2edge_vector_shape.h"
 #include "s2/s2error.h"
 #include "s2/s2loop.h"
@@ -439,6 +441,265 @@ TEST_F(MutableS2ShapeIndexTest, RandomUpdates) {
   }
 }
 
+TEST_F(MutableS2ShapeIndexTest, ParallelBuild) {
+  // Build the same index sequentially and in parallel, and verify that the
+  // results are identical.  The geometry includes shapes that span several
+  // faces, shapes without interiors, and a shape that covers the sphere.
+  vector<unique_ptr<S2Loop>> loops;
+  for (int i = 0; i < 20; ++i) {
+    loops.push_back(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(2000), 1000));
+  }
+  loops.push_back(S2Loop::MakeRegularLoop(
+      S2Point(1, -1, -1).Normalize(), S1Angle::Degrees(30), 2000));
+  loops.push_back(make_unique<S2Loop>(S2Loop::kFull()));
+  auto polyline = MakePolyline("0:0, 20:10, 0:20, 20:30, 0:40, 20:50, 0:60");
+  MutableS2ShapeIndex::Options options;
+  options.set_time_build_phases(true);
+  index_.Init(options);
+  options.set_num_threads(4);
+  MutableS2ShapeIndex index2(options);
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (const auto& loop : loops) {
+      index->Add(make_unique<S2Loop::Shape>(loop.get()));
+    }
+    index->Add(make_unique<S2Polyline::Shape>(polyline.get()));
+  }
+  index_.ForceBuild();
+  index2.ForceBuild();
+  s2testing::ExpectEqual(index_, index2);
+}
+
+TEST_F(MutableS2ShapeIndexTest, ArenaAllocation) {
+  // Verify that indexes whose cells are allocated from an arena are identical
+  // to ordinary indexes, both for the initial build (sequential or parallel)
+  // and after incremental updates that cause the arena to be compacted.
+  vector<unique_ptr<S2Loop>> loops;
+  for (int i = 0; i < 10; ++i) {
+    loops.push_back(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(3000), 500));
+  }
+  MutableS2ShapeIndex::Options options;
+  options.set_use_arena(true);
+  MutableS2ShapeIndex index2(options);
+  options.set_num_threads(4);
+  MutableS2ShapeIndex index3(options);
+  for (MutableS2ShapeIndex* index : {&index_, &index2, &index3}) {
+    for (const auto& loop : loops) {
+      index->Add(make_unique<S2Loop::Shape>(loop.get()));
+    }
+    index->ForceBuild();
+  }
+  s2testing::ExpectEqual(index_, index2);
+  s2testing::ExpectEqual(index_, index3);
+  EXPECT_LT(index2.SpaceUsed(), 2 * index_.SpaceUsed());
+
+  for (int iter = 0; iter < 5; ++iter) {
+    for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+      for (int id = 2 * iter; id < 2 * iter + 2; ++id) {
+        index->Add(index->Release(id));
+      }
+      index->ForceBuild();
+    }
+    s2testing::ExpectEqual(index_, index2);
+  }
+  EXPECT_LT(index2.SpaceUsed(), 2 * index_.SpaceUsed());
+
+  Encoder encoder;
+  index_.Encode(&encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  MutableS2ShapeIndex index4(options);
+  ASSERT_TRUE(index4.Init(&decoder, s2shapeutil::WrappedShapeFactory(&index_)));
+  s2testing::ExpectEqual(index_, index4);
+}
+
+TEST_F(MutableS2ShapeIndexTest, Freeze) {
+  // Verify that a frozen index has the same contents as an ordinary index,
+  // and that it is thawed correctly by subsequent updates.
+  S2Polygon polygon;
+  S2Testing::ConcentricLoopsPolygon(S2Point(1, -1, 1).Normalize(), 4, 50,
+                                    &polygon);
+  auto polyline = MakePolyline("0:0, 20:10, 0:20, 20:30, 0:40");
+  MutableS2ShapeIndex index2;
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (int i = 0; i < polygon.num_loops(); ++i) {
+      index->Add(make_unique<S2Loop::Shape>(polygon.loop(i)));
+    }
+  }
+  index2.Freeze();
+  EXPECT_TRUE(index2.is_frozen());
+  s2testing::ExpectEqual(index_, index2);
+  TestIteratorMethods(index2);
+
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    index->Add(make_unique<S2Polyline::Shape>(polyline.get()));
+  }
+  EXPECT_FALSE(index2.is_frozen());
+  s2testing::ExpectEqual(index_, index2);
+
+  index2.Freeze();
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    index->Release(1);
+  }
+  EXPECT_FALSE(index2.is_frozen());
+  s2testing::ExpectEqual(index_, index2);
+  index2.Freeze();
+  s2testing::ExpectEqual(index_, index2);
+  index2.Clear();
+  EXPECT_FALSE(index2.is_frozen());
+}
+
+TEST_F(MutableS2ShapeIndexTest, ThawWithoutArena) {
+  // Verify that when the arena option is disabled, thawing an index releases
+  // the arena created by Freeze() so that the cells of the updated index are
+  // no longer kept alive by it.
+  vector<unique_ptr<S2Loop>> loops;
+  for (int i = 0; i < 20; ++i) {
+    loops.push_back(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(1000), 200));
+  }
+  MutableS2ShapeIndex index2;
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (const auto& loop : loops) {
+      index->Add(make_unique<S2Loop::Shape>(loop.get()));
+    }
+    index->ForceBuild();
+  }
+  index2.Freeze();
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (int id = 0; id < 10; ++id) index->Release(id);
+    index->ForceBuild();
+  }
+  EXPECT_FALSE(index2.is_frozen());
+  s2testing::ExpectEqual(index_, index2);
+  // The thawed index should not use more memory than an index that was never
+  // frozen (the frozen arena would otherwise be retained).
+  EXPECT_LE(index2.SpaceUsed(), index_.SpaceUsed());
+}
+
+TEST_F(MutableS2ShapeIndexTest, Minimize) {
+  // Replace a few shapes in an index whose cells are allocated from an arena,
+  // and check that Minimize() applies pending updates and frees the memory of
+  // the replaced cells without changing the index contents.
+  vector<unique_ptr<S2Loop>> loops;
+  for (int i = 0; i < 20; ++i) {
+    loops.push_back(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(1000), 200));
+  }
+  MutableS2ShapeIndex::Options options;
+  options.set_use_arena(true);
+  MutableS2ShapeIndex index2(options);
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (const auto& loop : loops) {
+      index->Add(make_unique<S2Loop::Shape>(loop.get()));
+    }
+    for (int id = 0; id < 2; ++id) {
+      index->ForceBuild();
+      index->Add(index->Release(id));
+    }
+  }
+  index2.Minimize();
+  EXPECT_TRUE(index2.is_fresh());
+  s2testing::ExpectEqual(index_, index2);
+
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    index->Add(index->Release(2));
+    index->ForceBuild();
+  }
+  size_t size_before = index2.SpaceUsed();
+  size_t bytes_freed = index2.ReleaseUnusedMemory();
+  EXPECT_GT(bytes_freed, 0);
+  EXPECT_EQ(size_before - bytes_freed, index2.SpaceUsed());
+  s2testing::ExpectEqual(index_, index2);
+  index_.Minimize();
+  s2testing::ExpectEqual(index_, index2);
+}
+
+TEST_F(MutableS2ShapeIndexTest, IncrementalUpdatesSpliceCells) {
+  // Add small shapes one at a time to an index of large loops.  The new edges
+  // should usually be spliced into existing cells, and a shape with many
+  // edges should cause existing cells to be subdivided.
+  for (int i = 0; i < 10; ++i) {
+    index_.Add(make_unique<S2Loop::OwningShape>(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(3000), 20)));
+  }
+  QuadraticValidate();
+  int cells_spliced = 0;
+  for (int i = 0; i < 20; ++i) {
+    S2Point a = S2Testing::RandomPoint();
+    S2Point b = S2::InterpolateAtDistance(S2Testing::KmToAngle(1), a,
+                                          S2Testing::RandomPoint());
+    index_.Add(make_unique<S2EdgeVectorShape>(a, b));
+    QuadraticValidate();
+    const auto& stats = index_.build_stats();
+    EXPECT_GE(stats.cells_absorbed, stats.cells_split);
+    cells_spliced += stats.cells_spliced;
+  }
+  EXPECT_GT(cells_spliced, 0);
+
+  index_.Add(make_unique<S2Loop::OwningShape>(S2Loop::MakeRegularLoop(
+      index_.shape(0)->edge(0).v0, S2Testing::KmToAngle(10), 200)));
+  QuadraticValidate();
+  EXPECT_GT(index_.build_stats().cells_split, 0);
+  TestEncodeDecode();
+}
+
+TEST_F(MutableS2ShapeIndexTest, BuildStats) {
+  // Check that the statistics are consistent with the index contents, and
+  // that they are the same whether the index is built sequentially or in
+  // parallel.
+  vector<unique_ptr<S2Loop>> loops;
+  for (int i = 0; i < 10; ++i) {
+    loops.push_back(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(2000), 500));
+  }
+  MutableS2ShapeIndex::Options options;
+  options.set_time_build_phases(true);
+  index_.Init(options);
+  options.set_num_threads(4);
+  MutableS2ShapeIndex index2(options);
+  for (MutableS2ShapeIndex* index : {&index_, &index2}) {
+    for (const auto& loop : loops) {
+      index->Add(make_unique<S2Loop::Shape>(loop.get()));
+    }
+    index->ForceBuild();
+    const auto& stats = index->build_stats();
+    EXPECT_EQ(1, stats.num_batches);
+    int64 num_face_edges = 0;
+    for (int face = 0; face < 6; ++face) {
+      num_face_edges += stats.face_edges[face];
+    }
+    EXPECT_GE(num_face_edges, 10 * 500);
+    int num_cells = 0, max_level = 0;
+    for (MutableS2ShapeIndex::Iterator it(index, S2ShapeIndex::BEGIN);
+         !it.done(); it.Next()) {
+      ++num_cells;
+      max_level = std::max(max_level, it.id().level());
+    }
+    EXPECT_EQ(num_cells, stats.cells_created);
+    EXPECT_EQ(max_level, stats.max_depth);
+    EXPECT_EQ(0, stats.cells_absorbed);
+    EXPECT_GT(stats.peak_tmp_memory_bytes, 0);
+    EXPECT_EQ(int64{100} << 20, stats.tmp_memory_budget_bytes);
+  }
+  EXPECT_EQ(index_.build_stats().cells_created,
+            index2.build_stats().cells_created);
+  EXPECT_GE(index_.build_stats().update_edges_seconds,
+            index_.build_stats().split_edges_seconds);
+
+  // By default only the total update time is measured.
+  MutableS2ShapeIndex index3;
+  index3.Add(make_unique<S2Loop::Shape>(loops[0].get()));
+  index3.ForceBuild();
+  EXPECT_GT(index3.build_stats().update_edges_seconds, 0);
+  EXPECT_EQ(0, index3.build_stats().split_edges_seconds);
+
+  index_.Add(index_.Release(0));
+  index_.ForceBuild();
+  EXPECT_GT(index_.build_stats().cells_absorbed, 0);
+  EXPECT_GT(index_.build_stats().absorb_cells_seconds, 0);
+}
+
 // A test that repeatedly updates "index_" in one thread and attempts to
 // concurrently read the index_ from several other threads.  When all threads
 // have finished reading, the first thread makes another update.
@@ -543,6 +804,128 @@ TEST_F(LazyUpdatesTest, ConstMethodsThreadSafe) {
   // ReaderThreadPool destructor waits for all threads to complete.
 }
 
+TEST(MutableS2ShapeIndex, SnapshotMode) {
+  MutableS2ShapeIndex::Options options;
+  options.set_snapshot_mode(true);
+  MutableS2ShapeIndex index(options), expected;
+  S2Polygon polygon;
+  S2Testing::ConcentricLoopsPolygon(S2Point(1, 0, 0), 3, 20, &polygon);
+  for (MutableS2ShapeIndex* i : {&index, &expected}) {
+    i->Add(make_unique<S2Loop::Shape>(polygon.loop(0)));
+  }
+  // Updates are not visible until they have been published.
+  MutableS2ShapeIndex::Iterator old_it(&index, S2ShapeIndex::BEGIN);
+  EXPECT_TRUE(old_it.done());
+  index.ForceBuild();
+  s2testing::ExpectEqual(expected, index);
+
+  // Existing iterators continue to use the version they were created with,
+  // even after cells are removed from the index by subsequent updates.
+  MutableS2ShapeIndex::Iterator it(&index, S2ShapeIndex::BEGIN);
+  vector<S2CellId> cell_ids;
+  for (; !it.done(); it.Next()) cell_ids.push_back(it.id());
+  for (MutableS2ShapeIndex* i : {&index, &expected}) {
+    i->Add(make_unique<S2Loop::Shape>(polygon.loop(1)));
+    i->Add(make_unique<S2Loop::Shape>(polygon.loop(2)));
+  }
+  index.ForceBuild();
+  s2testing::ExpectEqual(expected, index);
+  old_it.Begin();
+  EXPECT_TRUE(old_it.done());
+  int i = 0;
+  for (it.Begin(); !it.done(); it.Next(), ++i) {
+    EXPECT_EQ(cell_ids[i], it.id());
+    EXPECT_EQ(1, it.cell().num_clipped());
+  }
+  EXPECT_EQ(cell_ids.size(), i);
+}
+
+TEST(MutableS2ShapeIndex, SnapshotModeWriterSeesUnpublishedShapes) {
+  // The writer thread sees every shape it has added, while other threads see
+  // only the shapes of the published version.
+  MutableS2ShapeIndex::Options options;
+  options.set_snapshot_mode(true);
+  MutableS2ShapeIndex index(options);
+  auto edges = make_unique<S2EdgeVectorShape>(S2Point(1, 0, 0),
+                                              S2Point(0, 1, 0));
+  const S2Shape* shape = edges.get();
+  int id = index.Add(std::move(edges));
+  EXPECT_EQ(shape, index.shape(id));
+  EXPECT_EQ(1, index.num_shape_ids());
+  int reader_num_shape_ids = -1;
+  std::thread([&index, &reader_num_shape_ids]() {
+      reader_num_shape_ids = index.num_shape_ids();
+    }).join();
+  EXPECT_EQ(0, reader_num_shape_ids);
+
+  index.ForceBuild();
+  const S2Shape* reader_shape = nullptr;
+  std::thread([&index, id, &reader_shape]() {
+      reader_shape = index.shape(id);
+    }).join();
+  EXPECT_EQ(shape, reader_shape);
+}
+
+TEST(MutableS2ShapeIndex, SnapshotModeIteratorMethods) {
+  // Published versions are divided into chunks of S2CellIds.  Check that
+  // iterators move between chunks correctly, both for the initial version
+  // and for versions that share some chunks with earlier versions.
+  MutableS2ShapeIndex::Options options;
+  options.set_snapshot_mode(true);
+  MutableS2ShapeIndex index(options), expected;
+  TestIteratorMethods(index);
+  MutableS2ShapeIndex::Iterator first_it(&index, S2ShapeIndex::BEGIN);
+  vector<unique_ptr<S2Loop>> loops;
+  for (int iter = 0; iter < 5; ++iter) {
+    for (int i = 0; i < 4; ++i) {
+      loops.push_back(S2Loop::MakeRegularLoop(
+          S2Testing::RandomPoint(), S2Testing::KmToAngle(2000), 50));
+      for (MutableS2ShapeIndex* i : {&index, &expected}) {
+        i->Add(make_unique<S2Loop::Shape>(loops.back().get()));
+      }
+    }
+    index.ForceBuild();
+    s2testing::ExpectEqual(expected, index);
+    TestIteratorMethods(index);
+  }
+  // An iterator created before any shapes were added still uses the empty
+  // version of the index.
+  first_it.Begin();
+  EXPECT_TRUE(first_it.done());
+}
+
+TEST(MutableS2ShapeIndex, SnapshotModeConcurrentReads) {
+  // Readers iterate over the index while a writer thread adds shapes and
+  // publishes new versions.  Every version must be internally consistent.
+  MutableS2ShapeIndex::Options options;
+  options.set_snapshot_mode(true);
+  MutableS2ShapeIndex index(options);
+  std::atomic<bool> done(false);
+  auto reader = [&index, &done]() {
+    while (!done.load()) {
+      MutableS2ShapeIndex::Iterator it(&index, S2ShapeIndex::BEGIN);
+      for (; !it.done(); it.Next()) {
+        const S2ShapeIndexCell& cell = it.cell();
+        for (int s = 0; s < cell.num_clipped(); ++s) {
+          int shape_id = cell.clipped(s).shape_id();
+          ASSERT_LT(shape_id, index.num_shape_ids());
+          ASSERT_TRUE(index.shape(shape_id) != nullptr);
+        }
+      }
+    }
+  };
+  vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) readers.emplace_back(reader);
+  for (int iter = 0; iter < 50; ++iter) {
+    index.Add(make_unique<S2Loop::OwningShape>(S2Loop::MakeRegularLoop(
+        S2Testing::RandomPoint(), S2Testing::KmToAngle(1000), 100)));
+    index.ForceBuild();
+  }
+  done.store(true);
+  for (auto& thread : readers) thread.join();
+  EXPECT_EQ(50, index.num_shape_ids());
+}
+
 TEST(MutableS2ShapeIndex, MixedGeometry) {
   // This test used to trigger a bug where the presence of a shape with an
   // interior could cause shapes that don't have an interior to suddenly
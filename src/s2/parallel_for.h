@@ -0,0 +1,159 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Simple helpers for running work on multiple threads.  In both cases the
+// calling thread also does work.
+//
+//  - ParallelFor() creates threads for the duration of a single call.  It is
+//    intended for large one-time jobs such as building an index.
+//
+//  - WorkerPool keeps its threads alive between calls.  It is intended for
+//    algorithms that alternate between many small sequential and parallel
+//    steps, where the cost of creating threads for each step would dominate.
+
+#ifndef S2_PARALLEL_FOR_H_
+#define S2_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "s2/base/integral_types.h"
+
+namespace s2parallel {
+
+// Calls fn(i) for each i in [0, n) using up to "num_threads" threads.  The
+// calling thread also processes tasks.
+template <class Fn>
+void ParallelFor(int num_threads, int n, const Fn& fn) {
+  std::atomic<int> next_task(0);
+  auto worker = [n, &fn, &next_task]() {
+    for (int i; (i = next_task.fetch_add(1)) < n; ) fn(i);
+  };
+  num_threads = std::min(num_threads, n);
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) thread.join();
+}
+
+// A fixed set of threads that repeatedly run a function supplied by the
+// owner.  Example usage:
+//
+//   WorkerPool pool(4);
+//   for (...) {
+//     pool.Run([&](int worker) { ... });
+//   }
+//
+// The pool is not thread-safe: Run() must not be called concurrently.
+class WorkerPool {
+ public:
+  // Creates "num_threads - 1" threads.  The thread that calls Run() acts as
+  // the remaining worker.
+  //
+  // REQUIRES: num_threads >= 1
+  explicit WorkerPool(int num_threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  void operator=(const WorkerPool&) = delete;
+
+  int num_threads() const { return threads_.size() + 1; }
+
+  // Calls fn(worker) concurrently for each worker in [0, num_threads()) and
+  // returns once all the calls have finished.  Worker 0 is the calling
+  // thread.
+  void Run(const std::function<void(int)>& fn);
+
+ private:
+  void WorkerLoop(int worker);
+
+  std::mutex mutex_;
+  std::condition_variable start_;  // Signaled when a new round begins.
+  std::condition_variable done_;   // Signaled when num_running_ reaches 0.
+  const std::function<void(int)>* fn_ = nullptr;
+  uint64 round_ = 0;
+  int num_running_ = 0;
+  bool shutdown_ = false;
+  std::vector<std::thread> threads_;
+};
+
+
+//////////////////   Implementation details follow   ////////////////////
+
+
+inline WorkerPool::WorkerPool(int num_threads) {
+  for (int i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkerPool::WorkerLoop, this, i);
+  }
+}
+
+inline WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  start_.notify_all();
+  for (std::thread& thread : threads_) thread.join();
+}
+
+inline void WorkerPool::Run(const std::function<void(int)>& fn) {
+  if (threads_.empty()) {
+    fn(0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    num_running_ = threads_.size();
+    ++round_;
+  }
+  start_.notify_all();
+  fn(0);
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this]() { return num_running_ == 0; });
+  fn_ = nullptr;
+}
+
+inline void WorkerPool::WorkerLoop(int worker) {
+  // Run() does not start a new round until every worker has finished the
+  // previous one, so each worker runs each round exactly once.
+  uint64 last_round = 0;
+  for (;;) {
+    const std::function<void(int)>* fn;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [this, last_round]() {
+          return shutdown_ || round_ != last_round;
+        });
+      if (shutdown_) return;
+      last_round = round_;
+      fn = fn_;
+    }
+    (*fn)(worker);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--num_running_ == 0) done_.notify_one();
+  }
+}
+
+}  // namespace s2parallel
+
+#endif  // S2_PARALLEL_FOR_H_
@@ -0,0 +1,67 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/parallel_for.h"
+
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace {
+
+TEST(ParallelFor, VisitsEachIndexOnce) {
+  for (int num_threads : {1, 3, 8}) {
+    for (int n : {0, 1, 5, 1000}) {
+      vector<std::atomic<int>> counts(n);
+      for (auto& count : counts) count = 0;
+      s2parallel::ParallelFor(num_threads, n, [&counts](int i) {
+          ++counts[i];
+        });
+      for (const auto& count : counts) EXPECT_EQ(1, count);
+    }
+  }
+}
+
+TEST(WorkerPool, RunsEachWorkerOncePerRound) {
+  for (int num_threads : {1, 2, 5}) {
+    s2parallel::WorkerPool pool(num_threads);
+    EXPECT_EQ(num_threads, pool.num_threads());
+    vector<int> counts(num_threads, 0);
+    for (int round = 1; round <= 100; ++round) {
+      // Each worker writes only its own element, and Run() does not return
+      // until all workers are done, so no synchronization is needed here.
+      pool.Run([&counts](int worker) { ++counts[worker]; });
+      for (int count : counts) ASSERT_EQ(round, count);
+    }
+  }
+}
+
+TEST(WorkerPool, SharesWorkBetweenWorkers) {
+  s2parallel::WorkerPool pool(4);
+  const int kNumTasks = 1000;
+  vector<std::atomic<int>> counts(kNumTasks);
+  for (auto& count : counts) count = 0;
+  for (int round = 0; round < 10; ++round) {
+    std::atomic<int> next_task(0);
+    pool.Run([&](int worker) {
+        for (int i; (i = next_task.fetch_add(1)) < kNumTasks; ) ++counts[i];
+      });
+  }
+  for (const auto& count : counts) EXPECT_EQ(10, count);
+}
+
+}  // namespace
@@ -0,0 +1,146 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// A parallel radix sort for building large indexes (e.g. S2CellIndex and
+// S2PointIndex) using multiple threads.  Threads are created only for the
+// duration of each call, and the calling thread also does work.
+
+#ifndef S2_PARALLEL_RADIX_SORT_H_
+#define S2_PARALLEL_RADIX_SORT_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "s2/base/integral_types.h"
+#include "s2/parallel_for.h"
+#include "s2/util/bits/bits.h"
+
+namespace s2parallel {
+
+// Sorts "v" according to "less" using up to "num_threads" threads, where
+// key(x) is a uint64 such that key(x) < key(y) implies less(x, y).  The
+// result is the same as std::stable_sort(v, less).
+//
+// The elements are first partitioned according to the highest-order key
+// bits that are not shared by all elements (an MSD radix pass, which is
+// parallelized across chunks of the input).  Each partition is then sorted
+// by the remaining key bits using an LSD radix sort (in parallel across
+// partitions), and finally each run of elements with equal keys is sorted
+// using "less".  All of these steps preserve the order of equal elements.
+//
+// REQUIRES: T has a default constructor.
+template <class T, class KeyFn, class Less>
+void ParallelRadixSort(std::vector<T>* v, const KeyFn& key, const Less& less,
+                       int num_threads) {
+  static const int kMsdBits = 11;
+  static const int kLsdBits = 8;
+  static const int kNumBuckets = 1 << kMsdBits;
+  static const size_t kMinRadixSortSize = 256;
+
+  // Divide the input into one chunk per thread, and find the range of keys.
+  const size_t n = v->size();
+  const int num_chunks = num_threads;
+  const size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+  std::vector<uint64> chunk_and(num_chunks, ~uint64{0});
+  std::vector<uint64> chunk_or(num_chunks, 0);
+  ParallelFor(num_threads, num_chunks, [&](int c) {
+      size_t end = std::min(n, (c + 1) * chunk_size);
+      for (size_t i = c * chunk_size; i < end; ++i) {
+        uint64 k = key((*v)[i]);
+        chunk_and[c] &= k;
+        chunk_or[c] |= k;
+      }
+    });
+  uint64 all_and = ~uint64{0}, all_or = 0;
+  for (int c = 0; c < num_chunks; ++c) {
+    all_and &= chunk_and[c];
+    all_or |= chunk_or[c];
+  }
+  // The MSD pass uses the kMsdBits highest-order bits that vary.
+  int msd_shift = std::max(0, Bits::Log2Floor64(all_and ^ all_or) + 1 -
+                           kMsdBits);
+
+  // Count the elements of each chunk in each bucket, convert the counts to
+  // output positions, and then scatter the elements into "tmp".  Elements
+  // within each bucket remain in their original order.
+  std::vector<std::vector<size_t>> offsets(num_chunks,
+                                          std::vector<size_t>(kNumBuckets));
+  ParallelFor(num_threads, num_chunks, [&](int c) {
+      size_t end = std::min(n, (c + 1) * chunk_size);
+      for (size_t i = c * chunk_size; i < end; ++i) {
+        ++offsets[c][(key((*v)[i]) >> msd_shift) & (kNumBuckets - 1)];
+      }
+    });
+  std::vector<size_t> bucket_start(kNumBuckets + 1);
+  size_t pos = 0;
+  for (int b = 0; b < kNumBuckets; ++b) {
+    bucket_start[b] = pos;
+    for (int c = 0; c < num_chunks; ++c) {
+      size_t count = offsets[c][b];
+      offsets[c][b] = pos;
+      pos += count;
+    }
+  }
+  bucket_start[kNumBuckets] = n;
+  std::vector<T> tmp(n);
+  ParallelFor(num_threads, num_chunks, [&](int c) {
+      size_t end = std::min(n, (c + 1) * chunk_size);
+      for (size_t i = c * chunk_size; i < end; ++i) {
+        const T& x = (*v)[i];
+        tmp[offsets[c][(key(x) >> msd_shift) & (kNumBuckets - 1)]++] = x;
+      }
+    });
+
+  // Sort each bucket, using the corresponding range of "v" as scratch space.
+  ParallelFor(num_threads, kNumBuckets, [&](int b) {
+      size_t size = bucket_start[b + 1] - bucket_start[b];
+      T* src = tmp.data() + bucket_start[b];
+      T* dst = v->data() + bucket_start[b];
+      if (size < kMinRadixSortSize) {
+        std::stable_sort(src, src + size, less);
+        std::copy(src, src + size, dst);
+        return;
+      }
+      for (int shift = 0; shift < msd_shift; shift += kLsdBits) {
+        size_t count[(1 << kLsdBits) + 1] = {0};
+        for (size_t i = 0; i < size; ++i) {
+          ++count[((key(src[i]) >> shift) & ((1 << kLsdBits) - 1)) + 1];
+        }
+        // Skip digits that are the same for all elements.
+        if (std::find(count, count + (1 << kLsdBits) + 1, size) !=
+            count + (1 << kLsdBits) + 1) {
+          continue;
+        }
+        for (int d = 1; d <= (1 << kLsdBits); ++d) count[d] += count[d - 1];
+        for (size_t i = 0; i < size; ++i) {
+          dst[count[(key(src[i]) >> shift) & ((1 << kLsdBits) - 1)]++] =
+              src[i];
+        }
+        std::swap(src, dst);
+      }
+      for (size_t i = 0; i < size; ) {
+        size_t j = i + 1;
+        uint64 k = key(src[i]);
+        while (j < size && key(src[j]) == k) ++j;
+        if (j - i > 1) std::stable_sort(src + i, src + j, less);
+        i = j;
+      }
+      if (src != v->data() + bucket_start[b]) std::copy(src, src + size, dst);
+    });
+}
+
+}  // namespace s2parallel
+
+#endif  // S2_PARALLEL_RADIX_SORT_H_
@@ -0,0 +1,62 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/parallel_radix_sort.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "s2/s2testing.h"
+
+using std::pair;
+using std::vector;
+
+namespace {
+
+// Sorts (key, sequence number) pairs and verifies that the result is the
+// same as std::stable_sort() by key.
+void TestSort(int n, int key_bits, int num_threads) {
+  using Element = pair<uint64, int>;
+  vector<Element> v;
+  uint64 base = S2Testing::rnd.Rand64();
+  for (int i = 0; i < n; ++i) {
+    uint64 key = S2Testing::rnd.Rand64();
+    if (key_bits < 64) key = base + (key & ((uint64{1} << key_bits) - 1));
+    v.push_back(Element(key, i));
+  }
+  auto less = [](const Element& x, const Element& y) {
+    return x.first < y.first;
+  };
+  vector<Element> expected = v;
+  std::stable_sort(expected.begin(), expected.end(), less);
+  s2parallel::ParallelRadixSort(
+      &v, [](const Element& x) { return x.first; }, less, num_threads);
+  EXPECT_TRUE(expected == v) << "n=" << n << " key_bits=" << key_bits
+                             << " num_threads=" << num_threads;
+}
+
+TEST(ParallelRadixSort, MatchesStableSort) {
+  for (int num_threads : {1, 2, 5}) {
+    for (int n : {0, 1, 100, 5000, 100000}) {
+      // Small key ranges have many duplicates and few varying bits.
+      for (int key_bits : {0, 4, 12, 20, 40, 64}) {
+        TestSort(n, key_bits, num_threads);
+      }
+    }
+  }
+}
+
+}  // namespace
@@ -505,6 +505,9 @@ void S2Builder::ChooseSites() {
     S2PointIndex<SiteId> site_index;
     AddForcedSites(&site_index);
     ChooseInitialSites(&site_index);
+    // No more sites are added, so convert the index to its faster read-only
+    // representation.
+    site_index.Freeze();
     CollectSiteEdges(site_index);
   }
   if (snapping_needed_) {
@@ -17,45 +17,31 @@
 
 #include "s2/s2cell_index.h"
 
+#include <algorithm>
+#include <functional>
+
+#include "s2/encoded_s2cell_id_vector.h"
+#include "s2/encoded_uint_vector.h"
+#include "s2/parallel_for.h"
+#include "s2/parallel_radix_sort.h"
+
+using s2parallel::ParallelFor;
+using s2parallel::ParallelRadixSort;
 using std::vector;
 
 using Label = S2CellIndex::Label;
 
-void S2CellIndex::RangeIterator::Seek(S2CellId target) {
-  S2_DCHECK(target.is_leaf());
-  it_ = std::upper_bound(range_nodes_->begin(), range_nodes_->end(),
-                         target) - 1;
+int S2CellIndex::SeekRange(S2CellId target) const {
+  return std::upper_bound(range_nodes_.begin(), range_nodes_.end(), target) -
+         range_nodes_.begin() - 1;
 }
 
-void S2CellIndex::ContentsIterator::StartUnion(const RangeIterator& range) {
-  if (range.start_id() < prev_start_id_) {
-    node_cutoff_ = -1;  // Can't automatically eliminate duplicates.
-  }
-  prev_start_id_ = range.start_id();
-
-  // TODO(ericv): Since RangeNode only uses 12 of its 16 bytes, we could add a
-  // "label" field without using any extra space.  Then we could store a leaf
-  // node of cell_tree_ directly in each RangeNode, where the cell_id is
-  // implicitly defined as the one that covers the current leaf cell range.
-  // This would save quite a bit of space; e.g. if the given cells are
-  // non-overlapping, then cell_tree_ would be empty (since every node is a
-  // leaf node and could therefore be stored directly in a RangeNode).  It
-  // would also be faster because cell_tree_ would rarely be accessed.
-  int contents = range.it_->contents;
-  if (contents <= node_cutoff_) {
-    set_done();
-  } else {
-    node_ = (*cell_tree_)[contents];
-  }
-
-  // When visiting ancestors, we can stop as soon as the node index is smaller
-  // than any previously visited node index.  Because indexes are assigned
-  // using a preorder traversal, such nodes are guaranteed to have already
-  // been reported.
-  next_node_cutoff_ = contents;
+S2CellIndex::S2CellIndex() {
 }
 
-S2CellIndex::S2CellIndex() {
+size_t S2CellIndex::SpaceUsed() const {
+  return sizeof(*this) + cell_tree_.capacity() * sizeof(CellNode) +
+         range_nodes_.capacity() * sizeof(RangeNode);
 }
 
 void S2CellIndex::Add(const S2CellUnion& cell_ids, Label label) {
@@ -64,70 +50,219 @@ void S2CellIndex::Add(const S2CellUnion& cell_ids, Label label) {
   }
 }
 
+// To build the cell tree and leaf cell ranges, we maintain a stack of
+// (cell_id, label) pairs that contain the current leaf cell.  This class
+// represents an instruction to push or pop a (cell_id, label) pair.
+//
+// If label >= 0, the (cell_id, label) pair is pushed on the stack.
+// If cell_id == S2CellId::Sentinel(), a pair is popped from the stack.
+// Otherwise the stack is unchanged but a RangeNode is still emitted.
+struct S2CellIndex::Delta {
+  S2CellId start_id, cell_id;
+  Label label;
+
+  Delta() {}
+  Delta(S2CellId _start_id, S2CellId _cell_id, Label _label)
+      : start_id(_start_id), cell_id(_cell_id), label(_label) {}
+
+  // Deltas are sorted first by start_id, then in reverse order by cell_id,
+  // and then by label.  This is necessary to ensure that (1) larger cells
+  // are pushed on the stack before smaller cells, and (2) cells are popped
+  // off the stack before any new cells are added.
+  bool operator<(const Delta& y) const {
+    if (start_id < y.start_id) return true;
+    if (y.start_id < start_id) return false;
+    if (y.cell_id < cell_id) return true;
+    if (cell_id < y.cell_id) return false;
+    return label < y.label;
+  }
+};
+
 void S2CellIndex::Build() {
-  // To build the cell tree and leaf cell ranges, we maintain a stack of
-  // (cell_id, label) pairs that contain the current leaf cell.  This class
-  // represents an instruction to push or pop a (cell_id, label) pair.
-  //
-  // If label >= 0, the (cell_id, label) pair is pushed on the stack.
-  // If cell_id == S2CellId::Sentinel(), a pair is popped from the stack.
-  // Otherwise the stack is unchanged but a RangeNode is still emitted.
-  struct Delta {
-    S2CellId start_id, cell_id;
-    Label label;
-
-    Delta(S2CellId _start_id, S2CellId _cell_id, Label _label)
-        : start_id(_start_id), cell_id(_cell_id), label(_label) {}
-
-    // Deltas are sorted first by start_id, then in reverse order by cell_id,
-    // and then by label.  This is necessary to ensure that (1) larger cells
-    // are pushed on the stack before smaller cells, and (2) cells are popped
-    // off the stack before any new cells are added.
-    bool operator<(const Delta& y) const {
-      if (start_id < y.start_id) return true;
-      if (y.start_id < start_id) return false;
-      if (y.cell_id < cell_id) return true;
-      if (cell_id < y.cell_id) return false;
-      return label < y.label;
-    }
-  };
+  Build(1);
+}
+
+void S2CellIndex::Build(int num_threads) {
+  S2_DCHECK_GE(num_threads, 1);
 
-  vector<Delta> deltas;
-  deltas.reserve(2 * cell_tree_.size() + 2);
   // Create two deltas for each (cell_id, label) pair: one to add the pair to
   // the stack (at the start of its leaf cell range), and one to remove it from
   // the stack (at the end of its leaf cell range).
-  for (const CellNode& node : cell_tree_) {
-    deltas.push_back(Delta(node.cell_id.range_min(), node.cell_id, node.label));
-    deltas.push_back(Delta(node.cell_id.range_max().next(),
-                           S2CellId::Sentinel(), -1));
-  }
+  const int num_cells = cell_tree_.size();
+  vector<Delta> deltas(2 * num_cells + 2);
+  const int kChunkSize = 1 << 16;
+  ParallelFor(num_threads, (num_cells + kChunkSize - 1) / kChunkSize,
+              [this, num_cells, kChunkSize, &deltas](int c) {
+      int end = std::min(num_cells, (c + 1) * kChunkSize);
+      for (int i = c * kChunkSize; i < end; ++i) {
+        S2CellId id = cell_tree_[i].cell_id;
+        deltas[2 * i] = Delta(id.range_min(), id, cell_tree_[i].label);
+        deltas[2 * i + 1] = Delta(id.range_max().next(),
+                                  S2CellId::Sentinel(), -1);
+      }
+    });
+  vector<CellNode>().swap(cell_tree_);
   // We also create two special deltas to ensure that a RangeNode is emitted at
   // the beginning and end of the S2CellId range.
-  deltas.push_back(
-      Delta(S2CellId::Begin(S2CellId::kMaxLevel), S2CellId::None(), -1));
-  deltas.push_back(
-      Delta(S2CellId::End(S2CellId::kMaxLevel), S2CellId::None(), -1));
-  std::sort(deltas.begin(), deltas.end());
+  deltas[2 * num_cells] =
+      Delta(S2CellId::Begin(S2CellId::kMaxLevel), S2CellId::None(), -1);
+  deltas[2 * num_cells + 1] =
+      Delta(S2CellId::End(S2CellId::kMaxLevel), S2CellId::None(), -1);
+  if (num_threads == 1) {
+    std::sort(deltas.begin(), deltas.end());
+  } else {
+    ParallelRadixSort(&deltas, [](const Delta& x) { return x.start_id.id(); },
+                      std::less<Delta>(), num_threads);
+  }
+
+  // Since no cell spans more than one face, the stack is empty at each face
+  // boundary and therefore the cell tree and leaf cell ranges for each face
+  // can be built independently.  The results are then concatenated.
+  const Delta* face_begin[S2CellId::kNumFaces + 1];
+  for (int face = 0; face < S2CellId::kNumFaces; ++face) {
+    face_begin[face] = &*std::lower_bound(
+        deltas.begin(), deltas.end(),
+        Delta(S2CellId::FromFace(face).range_min(), S2CellId::Sentinel(), -1));
+  }
+  face_begin[S2CellId::kNumFaces] = deltas.data() + deltas.size();
+  vector<CellNode> face_tree[S2CellId::kNumFaces];
+  vector<RangeNode> face_ranges[S2CellId::kNumFaces];
+  int face_range_cells[S2CellId::kNumFaces];
+  ParallelFor(num_threads, S2CellId::kNumFaces, [&](int face) {
+      S2CellId limit_id = (face + 1 < S2CellId::kNumFaces) ?
+          S2CellId::FromFace(face + 1).range_min() :
+          S2CellId::End(S2CellId::kMaxLevel);
+      BuildFace(face_begin[face], face_begin[face + 1], limit_id,
+                &face_tree[face], &face_ranges[face], &face_range_cells[face]);
+    });
+  vector<Delta>().swap(deltas);
 
-  // Now walk through the deltas to build the leaf cell ranges and cell tree
+  size_t tree_size = 0, range_size = 0;
+  int tree_offset[S2CellId::kNumFaces], range_offset[S2CellId::kNumFaces];
+  num_range_cells_ = 0;
+  for (int face = 0; face < S2CellId::kNumFaces; ++face) {
+    tree_offset[face] = tree_size;
+    range_offset[face] = range_size;
+    tree_size += face_tree[face].size();
+    range_size += face_ranges[face].size();
+    num_range_cells_ += face_range_cells[face];
+  }
+  cell_tree_.resize(tree_size);
+  range_nodes_.resize(range_size);
+  ParallelFor(num_threads, S2CellId::kNumFaces, [&](int face) {
+      int offset = tree_offset[face];
+      CellNode* tree = cell_tree_.data() + offset;
+      for (CellNode node : face_tree[face]) {
+        if (node.parent >= 0) node.parent += offset;
+        *tree++ = node;
+      }
+      RangeNode* range = range_nodes_.data() + range_offset[face];
+      for (RangeNode node : face_ranges[face]) {
+        if (node.contents >= 0) node.contents += offset;
+        *range++ = node;
+      }
+      vector<CellNode>().swap(face_tree[face]);
+      vector<RangeNode>().swap(face_ranges[face]);
+    });
+}
+
+void S2CellIndex::BuildFace(const Delta* begin, const Delta* end,
+                            S2CellId limit_id, vector<CellNode>* cell_tree,
+                            vector<RangeNode>* range_nodes,
+                            int* num_range_cells) {
+  // Walk through the deltas to build the leaf cell ranges and cell tree
   // (which is essentially a permanent form of the "stack" described above).
-  cell_tree_.clear();
-  range_nodes_.reserve(deltas.size());
+  // Deltas that pop cells belonging to the previous face occur before any
+  // cells of this face have been pushed, and are ignored.
+  vector<CellNode> tree;
   int contents = -1;
-  for (int i = 0; i < deltas.size(); ) {
-    S2CellId start_id = deltas[i].start_id;
+  for (const Delta* delta = begin; delta != end; ) {
+    S2CellId start_id = delta->start_id;
     // Process all the deltas associated with the current start_id.
-    for (; i < deltas.size() && deltas[i].start_id == start_id; ++i) {
-      if (deltas[i].label >= 0) {
-        cell_tree_.push_back({deltas[i].cell_id, deltas[i].label, contents});
-        contents = cell_tree_.size() - 1;
-      } else if (deltas[i].cell_id == S2CellId::Sentinel()) {
-        contents = cell_tree_[contents].parent;
+    for (; delta != end && delta->start_id == start_id; ++delta) {
+      if (delta->label >= 0) {
+        tree.push_back({delta->cell_id, delta->label, contents});
+        contents = tree.size() - 1;
+      } else if (delta->cell_id == S2CellId::Sentinel() && contents >= 0) {
+        contents = tree[contents].parent;
       }
     }
-    range_nodes_.push_back({start_id, contents});
+    range_nodes->push_back({start_id, contents});
+  }
+
+  // Finally, nodes without children are moved into the RangeNode that they
+  // cover, and the remaining nodes are renumbered.  (Since nodes are
+  // numbered in preorder, renumbering them in the same order preserves this
+  // property, which is required by ContentsIterator.)
+  vector<bool> has_children(tree.size());
+  int num_internal_nodes = 0;
+  for (const CellNode& node : tree) {
+    if (node.parent >= 0 && !has_children[node.parent]) {
+      has_children[node.parent] = true;
+      ++num_internal_nodes;
+    }
+  }
+  cell_tree->reserve(num_internal_nodes);
+  vector<int32> new_index(tree.size(), -1);
+  for (int i = 0; i < tree.size(); ++i) {
+    if (!has_children[i]) continue;
+    int32 parent = tree[i].parent;
+    new_index[i] = cell_tree->size();
+    cell_tree->push_back({tree[i].cell_id, tree[i].label,
+                          parent >= 0 ? new_index[parent] : -1});
+  }
+  *num_range_cells = 0;
+  for (int i = 0; i < range_nodes->size(); ++i) {
+    RangeNode* range = &(*range_nodes)[i];
+    if (range->contents < 0) continue;
+    const CellNode& node = tree[range->contents];
+    if (has_children[range->contents]) {
+      range->contents = new_index[range->contents];
+    } else {
+      S2_DCHECK_EQ(node.cell_id, RangeCellId(
+          range->start_id, i + 1 < range_nodes->size() ?
+          (*range_nodes)[i + 1].start_id : limit_id));
+      range->label = node.label;
+      range->contents = node.parent >= 0 ? new_index[node.parent] : -1;
+      ++*num_range_cells;
+    }
+  }
+}
+
+void S2CellIndex::Encode(Encoder* encoder) const {
+  S2_DCHECK(!range_nodes_.empty()) << "Call Build() first.";
+  // The version number is encoded in 2 bits (as in MutableS2ShapeIndex).
+  encoder->Ensure(Varint::kMax64);
+  encoder->put_varint64(static_cast<uint64>(num_range_cells_) << 2 |
+                        kCurrentEncodingVersionNumber);
+
+  // The cell tree and leaf cell ranges are each encoded as a set of
+  // parallel vectors.  Values that may be -1 are stored as (value + 1).
+  vector<S2CellId> cell_ids;
+  vector<uint32> values1, values2;
+  cell_ids.reserve(range_nodes_.size());
+  values1.reserve(range_nodes_.size());
+  values2.reserve(range_nodes_.size());
+  for (const CellNode& node : cell_tree_) {
+    cell_ids.push_back(node.cell_id);
+    values1.push_back(node.label);
+    values2.push_back(node.parent + 1);
+  }
+  s2coding::EncodeS2CellIdVector(cell_ids, encoder);
+  s2coding::EncodeUintVector<uint32>(values1, encoder);
+  s2coding::EncodeUintVector<uint32>(values2, encoder);
+
+  cell_ids.clear();
+  values1.clear();
+  values2.clear();
+  for (const RangeNode& node : range_nodes_) {
+    cell_ids.push_back(node.start_id);
+    values1.push_back(node.contents + 1);
+    values2.push_back(node.label + 1);
   }
+  s2coding::EncodeS2CellIdVector(cell_ids, encoder);
+  s2coding::EncodeUintVector<uint32>(values1, encoder);
+  s2coding::EncodeUintVector<uint32>(values2, encoder);
 }
 
 vector<Label> S2CellIndex::GetIntersectingLabels(const S2CellUnion& target)
@@ -139,11 +274,46 @@ vector<Label> S2CellIndex::GetIntersectingLabels(const S2CellUnion& target)
 
 void S2CellIndex::GetIntersectingLabels(const S2CellUnion& target,
                                         std::vector<Label>* labels) const {
+  s2internal::GetIntersectingLabels(*this, target, labels);
+}
+
+void S2CellIndex::GetIntersectingLabels(absl::Span<const S2CellUnion> targets,
+                                        vector<Label>* labels,
+                                        vector<size_t>* offsets) const {
   labels->clear();
-  VisitIntersectingCells(target, [labels](S2CellId cell_id, Label label) {
-      labels->push_back(label);
-      return true;
-    });
-  std::sort(labels->begin(), labels->end());
-  labels->erase(std::unique(labels->begin(), labels->end()), labels->end());
+  offsets->clear();
+  offsets->reserve(targets.size() + 1);
+  offsets->push_back(0);
+  ContentsIterator contents(this);
+  RangeIterator range(this);
+  range.Begin();
+  for (const S2CellUnion& target : targets) {
+    // This loop is similar to VisitIntersectingCells(), except that the
+    // iterators are shared between targets.  The ContentsIterator is cleared
+    // so that duplicates are only eliminated within each target, and the
+    // RangeIterator only seeks backward when the targets overlap.
+    contents.Clear();
+    auto it = target.begin();
+    if (it != target.end() && it->range_min() < range.start_id()) {
+      range.Seek(it->range_min());
+    }
+    while (it != target.end()) {
+      if (range.limit_id() <= it->range_min()) {
+        range.SeekForward(it->range_min());
+      }
+      for (; range.start_id() <= it->range_max(); range.Next()) {
+        for (contents.StartUnion(range); !contents.done(); contents.Next()) {
+          labels->push_back(contents.label());
+        }
+      }
+      if (++it != target.end() && it->range_max() < range.start_id()) {
+        it = std::lower_bound(it + 1, target.end(), range.start_id());
+        if ((it - 1)->range_max() >= range.start_id()) --it;
+      }
+    }
+    auto begin = labels->begin() + offsets->back();
+    std::sort(begin, labels->end());
+    labels->erase(std::unique(begin, labels->end()), labels->end());
+    offsets->push_back(labels->size());
+  }
 }
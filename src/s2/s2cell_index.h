@@ -18,11 +18,25 @@
 #ifndef S2_S2CELL_INDEX_H_
 #define S2_S2CELL_INDEX_H_
 
+#include <algorithm>
 #include <vector>
 #include "s2/base/integral_types.h"
 #include "s2/base/logging.h"
 #include "s2/s2cell_id.h"
 #include "s2/s2cell_union.h"
+#include "s2/third_party/absl/types/span.h"
+
+namespace s2internal {
+
+// The iterator types shared by S2CellIndex and EncodedS2CellIndex.  They are
+// defined below (after S2CellIndex), and are normally referred to using the
+// aliases S2CellIndex::RangeIterator, EncodedS2CellIndex::RangeIterator, etc.
+template <class Index> class S2CellIndexCellIterator;
+template <class Index> class S2CellIndexRangeIterator;
+template <class Index> class S2CellIndexNonEmptyRangeIterator;
+template <class Index> class S2CellIndexContentsIterator;
+
+}  // namespace s2internal
 
 // S2CellIndex stores a collection of (cell_id, label) pairs.  The S2CellIds
 // may be overlapping or contain duplicate values.  For example, an
@@ -133,6 +147,9 @@ class S2CellIndex {
   // Returns the number of (cell_id, label) pairs in the index.
   int num_cells() const;
 
+  // Returns the approximate amount of memory used by the index (in bytes).
+  size_t SpaceUsed() const;
+
   // Adds the given (cell_id, label) pair to the index.  Note that the index
   // is not valid until Build() is called.
   //
@@ -150,9 +167,28 @@ class S2CellIndex {
   // may be used until the index is built.
   void Build();
 
+  // Like Build(), but uses up to "num_threads" threads.  The (cell_id, label)
+  // pairs are sorted using a parallel radix sort, and the leaf cell ranges
+  // for each cube face are built concurrently.  The resulting index is
+  // identical to the one constructed by Build().  Threads are created only
+  // for the duration of the call, so this is mainly useful for indexes with
+  // millions of cells.
+  //
+  // REQUIRES: num_threads >= 1
+  void Build(int num_threads);
+
   // Clears the index so that it can be re-used.
   void Clear();
 
+  // Appends an encoded representation of the index to "encoder".  The
+  // encoded index can be queried without decoding it using
+  // EncodedS2CellIndex (see encoded_s2cell_index.h).
+  //
+  // REQUIRES: Build() has been called.
+  // REQUIRES: "encoder" uses the default constructor, so that its buffer
+  //           can be enlarged as necessary by calling Ensure(int).
+  void Encode(Encoder* encoder) const;
+
   // A function that is called with each (cell_id, label) pair to be visited.
   // The function may return false in order to indicate that no further
   // (cell_id, label) pairs are needed.
@@ -176,6 +212,21 @@ class S2CellIndex {
   void GetIntersectingLabels(const S2CellUnion& target,
                              std::vector<Label>* labels) const;
 
+  // Like GetIntersectingLabels(), but processes a batch of targets in a
+  // single pass over the index.  The labels of the cells that intersect
+  // targets[i] are returned in (*labels)[(*offsets)[i], (*offsets)[i+1]),
+  // i.e. in compressed sparse row format.  Each such subrange contains each
+  // label at most once, and is sorted.  Both vectors are cleared first, but
+  // their memory is reused so that no allocation is needed per target.
+  //
+  // This is most efficient when the targets are sorted by their first
+  // S2CellId, since the index is then visited in increasing order (and
+  // nearby ranges are found without a full binary search).  Other orders
+  // also yield correct results.
+  void GetIntersectingLabels(absl::Span<const S2CellUnion> targets,
+                             std::vector<Label>* labels,
+                             std::vector<size_t>* offsets) const;
+
  private:
   // Represents a node in the set of non-overlapping leaf cell ranges.
   struct RangeNode;
@@ -197,134 +248,20 @@ class S2CellIndex {
   };
 
  public:
-  class ContentsIterator;
-
   // An iterator that visits the entire set of indexed (cell_id, label) pairs
   // in an unspecified order.
-  class CellIterator {
-   public:
-    // Initializes a CellIterator for the given S2CellIndex, positioned at the
-    // first cell (if any).
-    explicit CellIterator(const S2CellIndex* index);
-
-    // The S2CellId of the current (cell_id, label) pair.
-    // REQUIRES: !done()
-    S2CellId cell_id() const;
-
-    // The Label of the current (cell_id, label) pair.
-    // REQUIRES: !done()
-    Label label() const;
-
-    // Returns the current (cell_id, label) pair.
-    LabelledCell labelled_cell() const;
-
-    // Returns true if all (cell_id, label) pairs have been visited.
-    bool done() const;
-
-    // Advances the iterator to the next (cell_id, label) pair.
-    // REQUIRES: !done()
-    void Next();
-
-   private:
-    // NOTE(ericv): There is a potential optimization that would require this
-    // class to iterate over both cell_tree_ *and* range_nodes_.
-    std::vector<CellNode>::const_iterator cell_it_, cell_end_;
-  };
+  using CellIterator = s2internal::S2CellIndexCellIterator<S2CellIndex>;
 
   // An iterator that seeks and iterates over a set of non-overlapping leaf
   // cell ranges that cover the entire sphere.  The indexed (s2cell_id, label)
   // pairs that intersect the current leaf cell range can be visited using
   // ContentsIterator (see below).
-  class RangeIterator {
-   public:
-    // Initializes a RangeIterator for the given S2CellIndex.  The iterator is
-    // initially *unpositioned*; you must call a positioning method such as
-    // Begin() or Seek() before accessing its contents.
-    explicit RangeIterator(const S2CellIndex* index);
-
-    // The start of the current range of leaf S2CellIds.
-    //
-    // If done() is true, returns S2CellId::End(S2CellId::kMaxLevel).  This
-    // property means that most loops do not need to test done() explicitly.
-    S2CellId start_id() const;
-
-    // The (non-inclusive) end of the current range of leaf S2CellIds.
-    // REQUIRES: !done()
-    S2CellId limit_id() const;
-
-    // Returns true if the iterator is positioned beyond the last valid range.
-    bool done() const;
-
-    // Positions the iterator at the first range of leaf cells (if any).
-    void Begin();
-
-    // Positions the iterator so that done() is true.
-    void Finish();
-
-    // Advances the iterator to the next range of leaf cells.
-    // REQUIRES: !done()
-    void Next();
-
-    // If the iterator is already positioned at the beginning, returns false.
-    // Otherwise positions the iterator at the previous entry and returns true.
-    bool Prev();
-
-    // Positions the iterator at the first range with start_id() >= target.
-    // (Such an entry always exists as long as "target" is a valid leaf cell.
-    // Note that it is valid to access start_id() even when done() is true.)
-    //
-    // REQUIRES: target.is_leaf()
-    void Seek(S2CellId target);
-
-    // Returns true if no (s2cell_id, label) pairs intersect this range.
-    // Also returns true if done() is true.
-    bool is_empty() const;
-
-    // If advancing the iterator "n" times would leave it positioned on a
-    // valid range, does so and returns true.  Otherwise leaves the iterator
-    // unmodified and returns false.
-    bool Advance(int n);
-
-   private:
-    // A special value used to indicate that the RangeIterator has not yet
-    // been initialized by calling Begin() or Seek().
-    std::vector<RangeNode>::const_iterator kUninitialized() const {
-      // Note that since the last element of range_nodes_ is a sentinel value,
-      // it_ will never legitimately be positioned at range_nodes_->end().
-      return range_nodes_->end();
-    }
-
-    friend class ContentsIterator;
-    const std::vector<RangeNode>* range_nodes_;
-    std::vector<RangeNode>::const_iterator it_;
-  };
+  using RangeIterator = s2internal::S2CellIndexRangeIterator<S2CellIndex>;
 
   // Like RangeIterator, but only visits leaf cell ranges that overlap at
   // least one (cell_id, label) pair.
-  class NonEmptyRangeIterator : public RangeIterator {
-   public:
-    // Initializes a NonEmptyRangeIterator for the given S2CellIndex.
-    // The iterator is initially *unpositioned*; you must call a positioning
-    // method such as Begin() or Seek() before accessing its contents.
-    explicit NonEmptyRangeIterator(const S2CellIndex* index);
-
-    // Positions the iterator at the first non-empty range of leaf cells.
-    void Begin();
-
-    // Advances the iterator to the next non-empty range of leaf cells.
-    // REQUIRES: !done()
-    void Next();
-
-    // If the iterator is already positioned at the beginning, returns false.
-    // Otherwise positions the iterator at the previous entry and returns true.
-    bool Prev();
-
-    // Positions the iterator at the first non-empty range with
-    // start_id() >= target.
-    //
-    // REQUIRES: target.is_leaf()
-    void Seek(S2CellId target);
-  };
+  using NonEmptyRangeIterator =
+      s2internal::S2CellIndexNonEmptyRangeIterator<S2CellIndex>;
 
   // An iterator that visits the (cell_id, label) pairs that cover a set of
   // leaf cell ranges (see RangeIterator).  Note that when multiple leaf cell
@@ -335,76 +272,29 @@ class S2CellIndex {
   // [In particular, the implementation guarantees that when multiple leaf
   // cell ranges are visited in monotonically increasing order, then each
   // (cell_id, label) pair is reported exactly once.]
-  class ContentsIterator {
-   public:
-    // Default constructor; must be followed by a call to Init().
-    ContentsIterator();
-
-    // Convenience constructor that calls Init().
-    explicit ContentsIterator(const S2CellIndex* index);
-
-    // Initializes the iterator.  Should be followed by a call to UnionWith()
-    // to visit the contents of each desired leaf cell range.
-    void Init(const S2CellIndex* index);
-
-    // Clears all state with respect to which range(s) have been visited.
-    void Clear();
-
-    // Positions the ContentsIterator at the first (cell_id, label) pair that
-    // covers the given leaf cell range.  Note that when multiple leaf cell
-    // ranges are visited using the same ContentsIterator, duplicate values
-    // may be suppressed.  If you don't want this behavior, call Clear() first.
-    void StartUnion(const RangeIterator& range);
-
-    // The S2CellId of the current (cell_id, label) pair.
-    // REQUIRES: !done()
-    S2CellId cell_id() const;
-
-    // The Label of the current (cell_id, label) pair.
-    // REQUIRES: !done()
-    Label label() const;
-
-    // Returns the current (cell_id, label) pair.
-    // REQUIRES: !done()
-    LabelledCell labelled_cell() const;
-
-    // Returns true if all (cell_id, label) pairs have been visited.
-    bool done() const;
-
-    // Advances the iterator to the next (cell_id, label) pair covered by the
-    // current leaf cell range.
-    // REQUIRES: !done()
-    void Next();
-
-   private:
-    // node_.label == kDoneContents indicates that done() is true.
-    void set_done() { node_.label = kDoneContents; }
-
-    // A pointer to the cell tree itself (owned by the S2CellIndex).
-    const std::vector<CellNode>* cell_tree_;
-
-    // The value of it.start_id() from the previous call to StartUnion().
-    // This is used to check whether these values are monotonically
-    // increasing.
-    S2CellId prev_start_id_;
-
-    // The maximum index within the cell_tree_ vector visited during the
-    // previous call to StartUnion().  This is used to eliminate duplicate
-    // values when StartUnion() is called multiple times.
-    int32 node_cutoff_;
-
-    // The maximum index within the cell_tree_ vector visited during the
-    // current call to StartUnion().  This is used to update node_cutoff_.
-    int32 next_node_cutoff_;
-
-    // A copy of the current node in the cell tree.
-    CellNode node_;
-  };
+  using ContentsIterator =
+      s2internal::S2CellIndexContentsIterator<S2CellIndex>;
 
  private:
-  friend class CellIterator;
-  friend class RangeIterator;
-  friend class ContentsIterator;
+  template <class Index> friend class s2internal::S2CellIndexCellIterator;
+  template <class Index> friend class s2internal::S2CellIndexRangeIterator;
+  template <class Index>
+  friend class s2internal::S2CellIndexContentsIterator;
+  friend class EncodedS2CellIndex;
+
+  static const unsigned char kCurrentEncodingVersionNumber = 0;
+
+  // The methods used by the iterators to access the cell tree and the leaf
+  // cell ranges (see the s2internal namespace below).
+  int num_tree_nodes() const;
+  S2CellId tree_cell_id(int i) const;
+  Label tree_label(int i) const;
+  int32 tree_parent(int i) const;
+  int num_ranges() const;
+  S2CellId range_start_id(int i) const;
+  int32 range_contents(int i) const;
+  Label range_label(int i) const;
+  int SeekRange(S2CellId target) const;
 
   // A tree of (cell_id, label) pairs such that if X is an ancestor of Y, then
   // X.cell_id contains Y.cell_id.  The contents of a given range of leaf
@@ -415,12 +305,23 @@ class S2CellIndex {
   // "start_id" (a leaf cell) and ends at the "start_id" field of the next
   // RangeNode.  "contents" points to the node of cell_tree_ representing the
   // cells that overlap this range.
+  //
+  // Nodes of the cell tree that have no children are not stored in
+  // cell_tree_.  Such a node covers exactly one leaf cell range, so instead
+  // its label is stored in the corresponding RangeNode (in what would
+  // otherwise be padding) and its S2CellId is implicitly the cell whose leaf
+  // cell range is [start_id, next start_id).  In that case "contents" points
+  // to the node's parent.  For example, if the indexed cells do not overlap
+  // then cell_tree_ is empty.
   struct RangeNode {
     S2CellId start_id;  // First leaf cell contained by this range.
     int32 contents;     // Contents of this node (an index within cell_tree_).
+    Label label;        // Label of a leaf node, or kDoneContents if none.
 
-    RangeNode(S2CellId _start_id, int32 _contents)
-        : start_id(_start_id), contents(_contents) {
+    RangeNode() : contents(-1), label(kDoneContents) {}
+    RangeNode(S2CellId _start_id, int32 _contents,
+              Label _label = kDoneContents)
+        : start_id(_start_id), contents(_contents), label(_label) {
     }
 
     // Comparison operator needed for std::upper_bound().
@@ -432,201 +333,588 @@ class S2CellIndex {
   // in order to represent the range covered by the previous element.
   std::vector<RangeNode> range_nodes_;
 
+  // The number of cell tree leaf nodes that are stored in range_nodes_.
+  int num_range_cells_ = 0;
+
+  // Returns the S2CellId whose leaf cell range is [start_id, limit_id), i.e.
+  // the cell of a leaf node stored in the RangeNode at "start_id".
+  static S2CellId RangeCellId(S2CellId start_id, S2CellId limit_id);
+
+  // An instruction to push or pop a (cell_id, label) pair while building the
+  // index (see Build).
+  struct Delta;
+
+  // Builds the cell tree and leaf cell ranges for the sorted deltas in
+  // [begin, end), which must consist of the deltas for a single cube face
+  // (see Build).  "limit_id" is the end of the last leaf cell range.  Cell
+  // tree nodes are numbered starting from zero, and "num_range_cells" is set
+  // to the number of leaf nodes that are stored in "range_nodes".
+  static void BuildFace(const Delta* begin, const Delta* end,
+                        S2CellId limit_id, std::vector<CellNode>* cell_tree,
+                        std::vector<RangeNode>* range_nodes,
+                        int* num_range_cells);
+
   S2CellIndex(const S2CellIndex&) = delete;
   void operator=(const S2CellIndex&) = delete;
 };
 std::ostream& operator<<(std::ostream& os, S2CellIndex::LabelledCell x);
 
+namespace s2internal {
+
+// The iterators below access an index of type "Index" (S2CellIndex or
+// EncodedS2CellIndex) only through the following private methods:
+//
+//   // The nodes of the cell tree that are stored explicitly, in preorder.
+//   // tree_parent() returns the index of the parent node, or -1 if none.
+//   int num_tree_nodes() const;
+//   S2CellId tree_cell_id(int i) const;
+//   Label tree_label(int i) const;
+//   int32 tree_parent(int i) const;
+//
+//   // The leaf cell ranges.  range_start_id(num_ranges()) is the sentinel
+//   // value marking the end of the last range.  range_contents() returns the
+//   // cell tree node that represents the contents of the range (or -1 if
+//   // none), and range_label() returns the label of the cell tree leaf node
+//   // stored in the range (or -1 if none; see S2CellIndex::RangeNode).
+//   int num_ranges() const;
+//   S2CellId range_start_id(int i) const;
+//   int32 range_contents(int i) const;
+//   Label range_label(int i) const;
+//
+//   // Returns the last range whose start_id is <= "target".
+//   int SeekRange(S2CellId target) const;
+
+template <class Index>
+class S2CellIndexCellIterator {
+ public:
+  using Label = S2CellIndex::Label;
+  using LabelledCell = S2CellIndex::LabelledCell;
+
+  // Initializes a CellIterator for the given index, positioned at the first
+  // cell (if any).
+  explicit S2CellIndexCellIterator(const Index* index);
+
+  // The S2CellId of the current (cell_id, label) pair.
+  // REQUIRES: !done()
+  S2CellId cell_id() const;
+
+  // The Label of the current (cell_id, label) pair.
+  // REQUIRES: !done()
+  Label label() const;
+
+  // Returns the current (cell_id, label) pair.
+  LabelledCell labelled_cell() const;
+
+  // Returns true if all (cell_id, label) pairs have been visited.
+  bool done() const;
+
+  // Advances the iterator to the next (cell_id, label) pair.
+  // REQUIRES: !done()
+  void Next();
+
+ private:
+  // Positions range_pos_ at the next range (starting with the current one)
+  // that stores a leaf node of the cell tree, if any.
+  void SkipUnlabelledRanges();
+
+  // The iterator first visits the nodes of the cell tree, and then the leaf
+  // nodes that are stored directly in the leaf cell ranges.
+  const Index* index_;
+  int cell_pos_, range_pos_;
+};
+
+template <class Index>
+class S2CellIndexRangeIterator {
+ public:
+  // Initializes a RangeIterator for the given index.  The iterator is
+  // initially *unpositioned*; you must call a positioning method such as
+  // Begin() or Seek() before accessing its contents.
+  explicit S2CellIndexRangeIterator(const Index* index);
+
+  // The start of the current range of leaf S2CellIds.
+  //
+  // If done() is true, returns S2CellId::End(S2CellId::kMaxLevel).  This
+  // property means that most loops do not need to test done() explicitly.
+  S2CellId start_id() const;
+
+  // The (non-inclusive) end of the current range of leaf S2CellIds.
+  // REQUIRES: !done()
+  S2CellId limit_id() const;
+
+  // Returns true if the iterator is positioned beyond the last valid range.
+  bool done() const;
+
+  // Positions the iterator at the first range of leaf cells (if any).
+  void Begin();
+
+  // Positions the iterator so that done() is true.
+  void Finish();
+
+  // Advances the iterator to the next range of leaf cells.
+  // REQUIRES: !done()
+  void Next();
+
+  // If the iterator is already positioned at the beginning, returns false.
+  // Otherwise positions the iterator at the previous entry and returns true.
+  bool Prev();
+
+  // Positions the iterator at the first range with start_id() >= target.
+  // (Such an entry always exists as long as "target" is a valid leaf cell.
+  // Note that it is valid to access start_id() even when done() is true.)
+  //
+  // REQUIRES: target.is_leaf()
+  void Seek(S2CellId target);
+
+  // Returns true if no (s2cell_id, label) pairs intersect this range.
+  // Also returns true if done() is true.
+  bool is_empty() const;
+
+  // If advancing the iterator "n" times would leave it positioned on a
+  // valid range, does so and returns true.  Otherwise leaves the iterator
+  // unmodified and returns false.
+  bool Advance(int n);
+
+ private:
+  friend Index;
+  friend class S2CellIndexContentsIterator<Index>;
+
+  // Like Seek(), but uses an exponential search starting from the current
+  // position, which is much faster than Seek() when the target is nearby.
+  //
+  // REQUIRES: start_id() <= target
+  void SeekForward(S2CellId target);
+
+  const Index* index_;
+  int pos_;  // -1 if the iterator has not been positioned.
+};
+
+template <class Index>
+class S2CellIndexNonEmptyRangeIterator
+    : public S2CellIndexRangeIterator<Index> {
+ public:
+  // Initializes a NonEmptyRangeIterator for the given index.  The iterator
+  // is initially *unpositioned*; you must call a positioning method such as
+  // Begin() or Seek() before accessing its contents.
+  explicit S2CellIndexNonEmptyRangeIterator(const Index* index);
+
+  // Positions the iterator at the first non-empty range of leaf cells.
+  void Begin();
+
+  // Advances the iterator to the next non-empty range of leaf cells.
+  // REQUIRES: !done()
+  void Next();
+
+  // If the iterator is already positioned at the beginning, returns false.
+  // Otherwise positions the iterator at the previous entry and returns true.
+  bool Prev();
+
+  // Positions the iterator at the first non-empty range with
+  // start_id() >= target.
+  //
+  // REQUIRES: target.is_leaf()
+  void Seek(S2CellId target);
+
+ private:
+  using Base = S2CellIndexRangeIterator<Index>;
+};
+
+template <class Index>
+class S2CellIndexContentsIterator {
+ public:
+  using Label = S2CellIndex::Label;
+  using LabelledCell = S2CellIndex::LabelledCell;
+
+  // Default constructor; must be followed by a call to Init().
+  S2CellIndexContentsIterator();
+
+  // Convenience constructor that calls Init().
+  explicit S2CellIndexContentsIterator(const Index* index);
+
+  // Initializes the iterator.  Should be followed by a call to UnionWith()
+  // to visit the contents of each desired leaf cell range.
+  void Init(const Index* index);
+
+  // Clears all state with respect to which range(s) have been visited.
+  void Clear();
+
+  // Positions the ContentsIterator at the first (cell_id, label) pair that
+  // covers the given leaf cell range.  Note that when multiple leaf cell
+  // ranges are visited using the same ContentsIterator, duplicate values
+  // may be suppressed.  If you don't want this behavior, call Clear() first.
+  void StartUnion(const S2CellIndexRangeIterator<Index>& range);
+
+  // The S2CellId of the current (cell_id, label) pair.
+  // REQUIRES: !done()
+  S2CellId cell_id() const;
+
+  // The Label of the current (cell_id, label) pair.
+  // REQUIRES: !done()
+  Label label() const;
+
+  // Returns the current (cell_id, label) pair.
+  // REQUIRES: !done()
+  LabelledCell labelled_cell() const;
+
+  // Returns true if all (cell_id, label) pairs have been visited.
+  bool done() const;
+
+  // Advances the iterator to the next (cell_id, label) pair covered by the
+  // current leaf cell range.
+  // REQUIRES: !done()
+  void Next();
+
+ private:
+  // label_ == kDoneContents indicates that done() is true.
+  void set_done() { label_ = S2CellIndex::kDoneContents; }
+
+  // Sets the current (cell_id, label) pair to the given cell tree node.
+  void set_node(int32 i);
+
+  const Index* index_;
+
+  // The value of it.start_id() from the previous call to StartUnion().
+  // This is used to check whether these values are monotonically
+  // increasing.
+  S2CellId prev_start_id_;
+
+  // The start_id() of the most recent range whose contents (including a
+  // leaf node stored in the range) were visited to completion.  This is
+  // used to suppress that leaf node if the same range is visited again.
+  S2CellId leaf_cutoff_;
+
+  // The maximum index within the cell tree visited during the previous call
+  // to StartUnion().  This is used to eliminate duplicate values when
+  // StartUnion() is called multiple times.
+  int32 node_cutoff_;
+
+  // The maximum index within the cell tree visited during the current call
+  // to StartUnion().  This is used to update node_cutoff_.
+  int32 next_node_cutoff_;
+
+  // The current (cell_id, label) pair and the index of its parent node in
+  // the cell tree.
+  S2CellId cell_id_;
+  Label label_;
+  int32 parent_;
+};
+
+// The implementation of S2CellIndex::VisitIntersectingCells() and
+// EncodedS2CellIndex::VisitIntersectingCells().
+template <class Index>
+bool VisitIntersectingCells(const Index& index, const S2CellUnion& target,
+                            const S2CellIndex::CellVisitor& visitor);
+
+// The implementation of S2CellIndex::GetIntersectingLabels() and
+// EncodedS2CellIndex::GetIntersectingLabels().
+template <class Index>
+void GetIntersectingLabels(const Index& index, const S2CellUnion& target,
+                           std::vector<S2CellIndex::Label>* labels);
+
+}  // namespace s2internal
+
 //////////////////   Implementation details follow   ////////////////////
 
 
-inline S2CellIndex::CellIterator::CellIterator(const S2CellIndex* index)
-    : cell_it_(index->cell_tree_.begin()),
-      cell_end_(index->cell_tree_.end()) {
-  S2_DCHECK(!index->range_nodes_.empty()) << "Call Build() first.";
+namespace s2internal {
+
+template <class Index>
+inline S2CellIndexCellIterator<Index>::S2CellIndexCellIterator(
+    const Index* index)
+    : index_(index), cell_pos_(0), range_pos_(0) {
+  S2_DCHECK_GE(index->num_ranges(), 0) << "The index has not been built.";
+  SkipUnlabelledRanges();
 }
 
-inline S2CellId S2CellIndex::CellIterator::cell_id() const {
+template <class Index>
+inline void S2CellIndexCellIterator<Index>::SkipUnlabelledRanges() {
+  while (range_pos_ < index_->num_ranges() &&
+         index_->range_label(range_pos_) == S2CellIndex::kDoneContents) {
+    ++range_pos_;
+  }
+}
+
+template <class Index>
+inline S2CellId S2CellIndexCellIterator<Index>::cell_id() const {
   S2_DCHECK(!done());
-  return cell_it_->cell_id;
+  if (cell_pos_ < index_->num_tree_nodes()) {
+    return index_->tree_cell_id(cell_pos_);
+  }
+  return S2CellIndex::RangeCellId(index_->range_start_id(range_pos_),
+                                  index_->range_start_id(range_pos_ + 1));
 }
 
-inline S2CellIndex::Label S2CellIndex::CellIterator::label() const {
+template <class Index>
+inline S2CellIndex::Label S2CellIndexCellIterator<Index>::label() const {
   S2_DCHECK(!done());
-  return cell_it_->label;
+  if (cell_pos_ < index_->num_tree_nodes()) {
+    return index_->tree_label(cell_pos_);
+  }
+  return index_->range_label(range_pos_);
 }
 
-inline S2CellIndex::LabelledCell S2CellIndex::CellIterator::labelled_cell()
-    const {
+template <class Index>
+inline S2CellIndex::LabelledCell
+S2CellIndexCellIterator<Index>::labelled_cell() const {
   S2_DCHECK(!done());
-  return LabelledCell(cell_it_->cell_id, cell_it_->label);
+  return LabelledCell(cell_id(), label());
 }
 
-inline bool S2CellIndex::CellIterator::done() const {
-  return cell_it_ == cell_end_;
+template <class Index>
+inline bool S2CellIndexCellIterator<Index>::done() const {
+  return (cell_pos_ == index_->num_tree_nodes() &&
+          range_pos_ == index_->num_ranges());
 }
 
-inline void S2CellIndex::CellIterator::Next() {
+template <class Index>
+inline void S2CellIndexCellIterator<Index>::Next() {
   S2_DCHECK(!done());
-  ++cell_it_;
+  if (cell_pos_ < index_->num_tree_nodes()) {
+    ++cell_pos_;
+  } else {
+    ++range_pos_;
+    SkipUnlabelledRanges();
+  }
 }
 
-inline S2CellIndex::RangeIterator::RangeIterator(const S2CellIndex* index)
-    : range_nodes_(&index->range_nodes_), it_() {
-  S2_DCHECK(!range_nodes_->empty()) << "Call Build() first.";
-  if (google::DEBUG_MODE) it_ = kUninitialized();  // See done().
+template <class Index>
+inline S2CellIndexRangeIterator<Index>::S2CellIndexRangeIterator(
+    const Index* index)
+    : index_(index), pos_(-1) {
+  S2_DCHECK_GE(index->num_ranges(), 0) << "The index has not been built.";
 }
 
-inline S2CellId S2CellIndex::RangeIterator::start_id() const {
-  return it_->start_id;
+template <class Index>
+inline S2CellId S2CellIndexRangeIterator<Index>::start_id() const {
+  return index_->range_start_id(pos_);
 }
 
-inline S2CellId S2CellIndex::RangeIterator::limit_id() const {
+template <class Index>
+inline S2CellId S2CellIndexRangeIterator<Index>::limit_id() const {
   S2_DCHECK(!done());
-  return (it_ + 1)->start_id;
+  return index_->range_start_id(pos_ + 1);
 }
 
-inline bool S2CellIndex::RangeIterator::done() const {
-  S2_DCHECK(it_ != kUninitialized()) << "Call Begin() or Seek() first.";
-
-  // Note that the last element of range_nodes_ is a sentinel value.
-  return it_ >= range_nodes_->end() - 1;
+template <class Index>
+inline bool S2CellIndexRangeIterator<Index>::done() const {
+  S2_DCHECK_GE(pos_, 0) << "Call Begin() or Seek() first.";
+  return pos_ >= index_->num_ranges();
 }
 
-inline void S2CellIndex::RangeIterator::Begin() {
-  it_ = range_nodes_->begin();
+template <class Index>
+inline void S2CellIndexRangeIterator<Index>::Begin() {
+  pos_ = 0;
 }
 
-inline void S2CellIndex::RangeIterator::Finish() {
-  // Note that the last element of range_nodes_ is a sentinel value.
-  it_ = range_nodes_->end() - 1;
+template <class Index>
+inline void S2CellIndexRangeIterator<Index>::Finish() {
+  pos_ = index_->num_ranges();
 }
 
-inline void S2CellIndex::RangeIterator::Next() {
+template <class Index>
+inline void S2CellIndexRangeIterator<Index>::Next() {
   S2_DCHECK(!done());
-  ++it_;
+  ++pos_;
+}
+
+template <class Index>
+inline bool S2CellIndexRangeIterator<Index>::Prev() {
+  if (pos_ == 0) return false;
+  --pos_;
+  return true;
 }
 
-inline bool S2CellIndex::RangeIterator::is_empty() const {
-  return it_->contents == kDoneContents;
+template <class Index>
+inline void S2CellIndexRangeIterator<Index>::Seek(S2CellId target) {
+  S2_DCHECK(target.is_leaf());
+  pos_ = index_->SeekRange(target);
 }
 
-inline bool S2CellIndex::RangeIterator::Advance(int n) {
-  // Note that the last element of range_nodes_ is a sentinel value.
-  if (n >= range_nodes_->end() - 1 - it_) return false;
-  it_ += n;
+template <class Index>
+void S2CellIndexRangeIterator<Index>::SeekForward(S2CellId target) {
+  S2_DCHECK(target.is_leaf());
+  S2_DCHECK_LE(start_id(), target);
+  // Find a position "lo" such that range_start_id(lo) <= target and either
+  // range_start_id(lo + step) > target or lo + step is beyond the end.
+  int lo = pos_;
+  const int end = index_->num_ranges() + 1;
+  int step = 1;
+  while (step < end - lo && index_->range_start_id(lo + step) <= target) {
+    lo += step;
+    step *= 2;
+  }
+  // Now binary search for the last range in [lo, hi) whose start_id is
+  // <= target.
+  int hi = (step < end - lo) ? lo + step : end;
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+    if (index_->range_start_id(mid) <= target) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  pos_ = lo;
+}
+
+template <class Index>
+inline bool S2CellIndexRangeIterator<Index>::is_empty() const {
+  return (index_->range_contents(pos_) == S2CellIndex::kDoneContents &&
+          index_->range_label(pos_) == S2CellIndex::kDoneContents);
+}
+
+template <class Index>
+inline bool S2CellIndexRangeIterator<Index>::Advance(int n) {
+  if (n >= index_->num_ranges() - pos_) return false;
+  pos_ += n;
   return true;
 }
 
-inline S2CellIndex::NonEmptyRangeIterator::NonEmptyRangeIterator(
-    const S2CellIndex* index)
-    : RangeIterator(index) {
+template <class Index>
+inline S2CellIndexNonEmptyRangeIterator<Index>::
+S2CellIndexNonEmptyRangeIterator(const Index* index)
+    : Base(index) {
 }
 
-inline void S2CellIndex::NonEmptyRangeIterator::Begin() {
-  RangeIterator::Begin();
-  while (is_empty() && !done()) RangeIterator::Next();
+template <class Index>
+inline void S2CellIndexNonEmptyRangeIterator<Index>::Begin() {
+  Base::Begin();
+  while (this->is_empty() && !this->done()) Base::Next();
 }
 
-inline void S2CellIndex::NonEmptyRangeIterator::Next() {
+template <class Index>
+inline void S2CellIndexNonEmptyRangeIterator<Index>::Next() {
   do {
-    RangeIterator::Next();
-  } while (is_empty() && !done());
+    Base::Next();
+  } while (this->is_empty() && !this->done());
 }
 
-inline bool S2CellIndex::NonEmptyRangeIterator::Prev() {
-  while (RangeIterator::Prev()) {
-    if (!is_empty()) return true;
+template <class Index>
+inline bool S2CellIndexNonEmptyRangeIterator<Index>::Prev() {
+  while (Base::Prev()) {
+    if (!this->is_empty()) return true;
   }
   // Return the iterator to its original position.
-  if (is_empty() && !done()) Next();
+  if (this->is_empty() && !this->done()) Next();
   return false;
 }
 
-inline void S2CellIndex::NonEmptyRangeIterator::Seek(S2CellId target) {
-  RangeIterator::Seek(target);
-  while (is_empty() && !done()) RangeIterator::Next();
+template <class Index>
+inline void S2CellIndexNonEmptyRangeIterator<Index>::Seek(S2CellId target) {
+  Base::Seek(target);
+  while (this->is_empty() && !this->done()) Base::Next();
 }
 
-inline bool S2CellIndex::RangeIterator::Prev() {
-  if (it_ == range_nodes_->begin()) return false;
-  --it_;
-  return true;
+template <class Index>
+inline S2CellIndexContentsIterator<Index>::S2CellIndexContentsIterator()
+    : index_(nullptr) {
 }
 
-inline S2CellIndex::ContentsIterator::ContentsIterator()
-    : cell_tree_(nullptr) {
+template <class Index>
+inline S2CellIndexContentsIterator<Index>::S2CellIndexContentsIterator(
+    const Index* index) {
+  Init(index);
 }
 
-inline S2CellIndex::ContentsIterator::ContentsIterator(
-    const S2CellIndex* index) {
-    Init(index);
-}
-
-inline void S2CellIndex::ContentsIterator::Init(const S2CellIndex* index) {
-  cell_tree_ = &index->cell_tree_;
+template <class Index>
+inline void S2CellIndexContentsIterator<Index>::Init(const Index* index) {
+  index_ = index;
   Clear();
 }
 
-inline void S2CellIndex::ContentsIterator::Clear() {
+template <class Index>
+inline void S2CellIndexContentsIterator<Index>::Clear() {
   prev_start_id_ = S2CellId::None();
+  leaf_cutoff_ = S2CellId::None();
   node_cutoff_ = -1;
   next_node_cutoff_ = -1;
   set_done();
 }
 
-inline S2CellId S2CellIndex::ContentsIterator::cell_id() const {
+template <class Index>
+inline void S2CellIndexContentsIterator<Index>::set_node(int32 i) {
+  cell_id_ = index_->tree_cell_id(i);
+  label_ = index_->tree_label(i);
+  parent_ = index_->tree_parent(i);
+}
+
+template <class Index>
+void S2CellIndexContentsIterator<Index>::StartUnion(
+    const S2CellIndexRangeIterator<Index>& range) {
+  if (range.start_id() < prev_start_id_) {
+    node_cutoff_ = -1;  // Can't automatically eliminate duplicates.
+    leaf_cutoff_ = S2CellId::None();
+  }
+  prev_start_id_ = range.start_id();
+
+  // If the range stores a leaf node of the cell tree, we start with that
+  // node (unless this range was already visited) and then continue with its
+  // ancestors in the cell tree.  Note that leaf nodes are the most common
+  // case (e.g., when the indexed cells do not overlap) and in that case the
+  // cell tree is only accessed for cells that contain other cells.
+  int32 contents = index_->range_contents(range.pos_);
+  Label label = index_->range_label(range.pos_);
+  if (label != S2CellIndex::kDoneContents &&
+      range.start_id() != leaf_cutoff_) {
+    cell_id_ = S2CellIndex::RangeCellId(range.start_id(), range.limit_id());
+    label_ = label;
+    parent_ = contents;
+  } else if (contents <= node_cutoff_) {
+    set_done();
+  } else {
+    set_node(contents);
+  }
+
+  // When visiting ancestors, we can stop as soon as the node index is smaller
+  // than any previously visited node index.  Because indexes are assigned
+  // using a preorder traversal, such nodes are guaranteed to have already
+  // been reported.
+  next_node_cutoff_ = contents;
+}
+
+template <class Index>
+inline S2CellId S2CellIndexContentsIterator<Index>::cell_id() const {
   S2_DCHECK(!done());
-  return node_.cell_id;
+  return cell_id_;
 }
 
-inline S2CellIndex::Label S2CellIndex::ContentsIterator::label() const {
+template <class Index>
+inline S2CellIndex::Label S2CellIndexContentsIterator<Index>::label() const {
   S2_DCHECK(!done());
-  return node_.label;
+  return label_;
 }
 
-inline S2CellIndex::LabelledCell S2CellIndex::ContentsIterator::labelled_cell()
-    const {
+template <class Index>
+inline S2CellIndex::LabelledCell
+S2CellIndexContentsIterator<Index>::labelled_cell() const {
   S2_DCHECK(!done());
-  return LabelledCell(node_.cell_id, node_.label);
+  return LabelledCell(cell_id_, label_);
 }
 
-inline bool S2CellIndex::ContentsIterator::done() const {
-  return node_.label == kDoneContents;
+template <class Index>
+inline bool S2CellIndexContentsIterator<Index>::done() const {
+  return label_ == S2CellIndex::kDoneContents;
 }
 
-inline void S2CellIndex::ContentsIterator::Next() {
+template <class Index>
+inline void S2CellIndexContentsIterator<Index>::Next() {
   S2_DCHECK(!done());
-  if (node_.parent <= node_cutoff_) {
+  if (parent_ <= node_cutoff_) {
     // We have already processed this node and its ancestors.
     node_cutoff_ = next_node_cutoff_;
+    leaf_cutoff_ = prev_start_id_;
     set_done();
   } else {
-    node_ = (*cell_tree_)[node_.parent];
+    set_node(parent_);
   }
 }
 
-inline int S2CellIndex::num_cells() const {
-  return cell_tree_.size();
-}
-
-inline void S2CellIndex::Add(S2CellId cell_id, Label label) {
-  S2_DCHECK(cell_id.is_valid());
-  S2_DCHECK_GE(label, 0);
-  cell_tree_.push_back(CellNode(cell_id, label, -1));
-}
-
-inline void S2CellIndex::Clear() {
-  cell_tree_.clear();
-  range_nodes_.clear();
-}
-
-inline bool S2CellIndex::VisitIntersectingCells(
-    const S2CellUnion& target, const CellVisitor& visitor) const {
+template <class Index>
+bool VisitIntersectingCells(const Index& index, const S2CellUnion& target,
+                            const S2CellIndex::CellVisitor& visitor) {
   if (target.empty()) return true;
   auto it = target.begin();
-  ContentsIterator contents(this);
-  RangeIterator range(this);
+  S2CellIndexContentsIterator<Index> contents(&index);
+  S2CellIndexRangeIterator<Index> range(&index);
   range.Begin();
   do {
     if (range.limit_id() <= it->range_min()) {
@@ -652,6 +940,83 @@ inline bool S2CellIndex::VisitIntersectingCells(
   return true;
 }
 
+template <class Index>
+void GetIntersectingLabels(const Index& index, const S2CellUnion& target,
+                           std::vector<S2CellIndex::Label>* labels) {
+  labels->clear();
+  VisitIntersectingCells(
+      index, target, [labels](S2CellId cell_id, S2CellIndex::Label label) {
+        labels->push_back(label);
+        return true;
+      });
+  std::sort(labels->begin(), labels->end());
+  labels->erase(std::unique(labels->begin(), labels->end()), labels->end());
+}
+
+}  // namespace s2internal
+
+inline int S2CellIndex::num_cells() const {
+  return cell_tree_.size() + num_range_cells_;
+}
+
+inline S2CellId S2CellIndex::RangeCellId(S2CellId start_id,
+                                         S2CellId limit_id) {
+  // The range of a cell at level k consists of 4**(30-k) leaf cells, and
+  // the cell id is at the midpoint of the range.  (Leaf cell ids are odd and
+  // consecutive leaf cells differ by 2.)
+  return S2CellId(start_id.id() + ((limit_id.id() - start_id.id()) >> 1) - 1);
+}
+
+inline void S2CellIndex::Add(S2CellId cell_id, Label label) {
+  S2_DCHECK(cell_id.is_valid());
+  S2_DCHECK_GE(label, 0);
+  cell_tree_.push_back(CellNode(cell_id, label, -1));
+}
+
+inline void S2CellIndex::Clear() {
+  cell_tree_.clear();
+  range_nodes_.clear();
+  num_range_cells_ = 0;
+}
+
+inline int S2CellIndex::num_tree_nodes() const {
+  return cell_tree_.size();
+}
+
+inline S2CellId S2CellIndex::tree_cell_id(int i) const {
+  return cell_tree_[i].cell_id;
+}
+
+inline S2CellIndex::Label S2CellIndex::tree_label(int i) const {
+  return cell_tree_[i].label;
+}
+
+inline int32 S2CellIndex::tree_parent(int i) const {
+  return cell_tree_[i].parent;
+}
+
+inline int S2CellIndex::num_ranges() const {
+  // Note that the last element of range_nodes_ is a sentinel value.
+  return static_cast<int>(range_nodes_.size()) - 1;
+}
+
+inline S2CellId S2CellIndex::range_start_id(int i) const {
+  return range_nodes_[i].start_id;
+}
+
+inline int32 S2CellIndex::range_contents(int i) const {
+  return range_nodes_[i].contents;
+}
+
+inline S2CellIndex::Label S2CellIndex::range_label(int i) const {
+  return range_nodes_[i].label;
+}
+
+inline bool S2CellIndex::VisitIntersectingCells(
+    const S2CellUnion& target, const CellVisitor& visitor) const {
+  return s2internal::VisitIntersectingCells(*this, target, visitor);
+}
+
 inline std::ostream& operator<<(std::ostream& os,
                                 S2CellIndex::LabelledCell x) {
   return os << "(" << x.cell_id << ", " << x.label << ")";
@@ -23,7 +23,10 @@
 #include "s2/base/stringprintf.h"
 #include <gtest/gtest.h>
 #include "s2/s2cell_id.h"
+#include "s2/s2cap.h"
+#include "s2/s2cell.h"
 #include "s2/s2cell_union.h"
+#include "s2/s2region_coverer.h"
 #include "s2/s2testing.h"
 
 using std::pair;
@@ -408,4 +411,169 @@ TEST_F(S2CellIndexTest, IntersectionSemiRandomUnions) {
   }
 }
 
+// Returns the covering of a random cap within a random descendant of "root"
+// at the given level.
+static S2CellUnion GetRandomCoveringInCell(S2CellId root, int level,
+                                          S2RegionCoverer* coverer) {
+  S2CellId id = root;
+  while (id.level() < level) id = id.child(S2Testing::rnd.Uniform(4));
+  S2Cap cap(id.ToPoint(), 0.5 * S2Testing::rnd.RandDouble() *
+                           S2Cell(id).GetBoundaryDistance(id.ToPoint())
+                               .ToAngle());
+  return coverer->GetCovering(cap).Intersection(S2CellUnion({id}));
+}
+
+TEST_F(S2CellIndexTest, NonOverlappingCoverings) {
+  // Tests an index of non-overlapping coverings.  Since no indexed cell
+  // contains another, every cell is stored directly in the leaf cell range
+  // that it covers.
+  S2RegionCoverer::Options options;
+  options.set_max_cells(16);
+  S2RegionCoverer coverer(options);
+  // The regions are within random distinct level 9 cells of a level 3 cell,
+  // and the query targets are somewhat larger.
+  S2CellId root = S2Testing::GetRandomCellId(3);
+  std::set<S2CellId> used;
+  for (int i = 0; i < 1000; ++i) {
+    S2CellUnion covering = GetRandomCoveringInCell(root, 9, &coverer);
+    if (!used.insert(covering.cell_id(0).parent(9)).second) continue;
+    Add(covering, i);
+  }
+  Build();
+  VerifyCellIterator();
+  VerifyIndexContents();
+  VerifyRangeIterators();
+  for (int i = 0; i < 50; ++i) {
+    TestIntersection(GetRandomCoveringInCell(root, 7, &coverer));
+  }
+}
+
+TEST_F(S2CellIndexTest, BatchIntersectingLabels) {
+  // Verifies that the batch version of GetIntersectingLabels() returns the
+  // same results as calling the single-target version for each target.  The
+  // targets are sorted by their first S2CellId (as recommended), except that
+  // a few are out of order.
+  const int kNumTargets = 1000;
+  S2RegionCoverer::Options options;
+  options.set_max_cells(8);
+  S2RegionCoverer coverer(options);
+  S2CellId root = S2Testing::GetRandomCellId(2);
+  for (int i = 0; i < 2000; ++i) {
+    Add(GetRandomCoveringInCell(root, 8, &coverer), i);
+  }
+  for (int i = 0; i < 20; ++i) Add(GetRandomCellUnion(), 2000 + i);
+  Build();
+
+  vector<S2CellUnion> targets;
+  for (int i = 0; i < kNumTargets; ++i) {
+    targets.push_back(GetRandomCoveringInCell(root, 9, &coverer));
+  }
+  std::sort(targets.begin(), targets.end(),
+            [](const S2CellUnion& x, const S2CellUnion& y) {
+              return x.cell_id(0) < y.cell_id(0);
+            });
+  for (int i = 0; i < 10; ++i) {
+    std::swap(targets[S2Testing::rnd.Uniform(kNumTargets)],
+              targets[S2Testing::rnd.Uniform(kNumTargets)]);
+  }
+  targets.push_back(S2CellUnion());
+  targets.push_back(S2CellUnion({S2CellId::FromFace(5).range_max()}));
+  targets.push_back(GetRandomCellUnion());
+
+  vector<Label> labels;
+  vector<size_t> offsets;
+  index_.GetIntersectingLabels(targets, &labels, &offsets);
+  vector<vector<Label>> expected(targets.size());
+  for (int i = 0; i < targets.size(); ++i) {
+    index_.GetIntersectingLabels(targets[i], &expected[i]);
+  }
+
+  ASSERT_EQ(targets.size() + 1, offsets.size());
+  EXPECT_EQ(labels.size(), offsets.back());
+  for (int i = 0; i < targets.size(); ++i) {
+    EXPECT_EQ(expected[i], vector<Label>(labels.begin() + offsets[i],
+                                         labels.begin() + offsets[i + 1]));
+  }
+
+  // The output vectors are cleared before being reused.
+  index_.GetIntersectingLabels(absl::Span<const S2CellUnion>(), &labels,
+                               &offsets);
+  EXPECT_TRUE(labels.empty());
+  EXPECT_EQ(vector<size_t>({0}), offsets);
+}
+
+TEST_F(S2CellIndexTest, ParallelBuildRandomCellUnions) {
+  for (int i = 0; i < 100; ++i) {
+    Add(GetRandomCellUnion(), i);
+  }
+  index_.Build(4);
+  VerifyCellIterator();
+  VerifyIndexContents();
+  VerifyRangeIterators();
+}
+
+// Returns the sequence of (cell_id, label) pairs visited by iterating over
+// every leaf cell range of "index" and reporting its contents.
+static vector<LabelledCell> GetAllRangeContents(const S2CellIndex& index) {
+  vector<LabelledCell> result;
+  S2CellIndex::RangeIterator range(&index);
+  S2CellIndex::ContentsIterator contents(&index);
+  for (range.Begin(); !range.done(); range.Next()) {
+    result.push_back(LabelledCell(range.start_id(), -1));
+    for (contents.StartUnion(range); !contents.done(); contents.Next()) {
+      result.push_back(LabelledCell(contents.cell_id(), contents.label()));
+    }
+  }
+  return result;
+}
+
+TEST(S2CellIndex, ParallelBuildIsIdentical) {
+  // Verifies that Build(num_threads) constructs exactly the same index as
+  // Build().  The cells include large clusters of overlapping cells (so that
+  // the radix sort is used for most partitions), duplicate pairs, and cells
+  // that touch the face boundaries.
+  const int kNumCells = 100000;
+  vector<LabelledCell> cells;
+  S2CellId root = S2Testing::GetRandomCellId(2);
+  for (int i = 0; i < kNumCells; ++i) {
+    S2CellId id;
+    if (S2Testing::rnd.OneIn(4)) {
+      id = S2Testing::GetRandomCellId();
+    } else {
+      id = root.child_begin(S2CellId::kMaxLevel)
+               .advance(S2Testing::rnd.Rand64() % (uint64{1} << 56))
+               .parent(S2Testing::rnd.Uniform(28) + 3);
+    }
+    Label label = S2Testing::rnd.Uniform(1000);
+    cells.push_back(LabelledCell(id, label));
+    if (S2Testing::rnd.OneIn(100)) cells.push_back(LabelledCell(id, label));
+  }
+  for (int face = 0; face < 6; ++face) {
+    S2CellId id = S2CellId::FromFace(face);
+    cells.push_back(LabelledCell(id, face));
+    cells.push_back(LabelledCell(id.child_begin(S2CellId::kMaxLevel), face));
+    cells.push_back(LabelledCell(id.range_max(), face));
+    cells.push_back(LabelledCell(id.range_max().parent(10), face));
+  }
+  S2CellIndex index1, index2;
+  for (const LabelledCell& cell : cells) {
+    index1.Add(cell.cell_id, cell.label);
+    index2.Add(cell.cell_id, cell.label);
+  }
+  index1.Build();
+  index2.Build(4);
+
+  ASSERT_EQ(index1.num_cells(), index2.num_cells());
+  EXPECT_EQ(index1.SpaceUsed(), index2.SpaceUsed());
+  vector<LabelledCell> cells1, cells2;
+  for (S2CellIndex::CellIterator it(&index1); !it.done(); it.Next()) {
+    cells1.push_back(LabelledCell(it.cell_id(), it.label()));
+  }
+  for (S2CellIndex::CellIterator it(&index2); !it.done(); it.Next()) {
+    cells2.push_back(LabelledCell(it.cell_id(), it.label()));
+  }
+  EXPECT_TRUE(cells1 == cells2);
+  EXPECT_TRUE(GetAllRangeContents(index1) == GetAllRangeContents(index2));
+}
+
 }  // namespace
@@ -60,6 +60,14 @@ int S2ClosestEdgeQuery::CellTarget::max_brute_force_index_size() const {
   return 30;
 }
 
+bool S2ClosestEdgeQuery::CellTarget::avoid_duplicates() const {
+  // Using a fractal loop index with 100,000 edges, avoiding duplicates makes
+  // S2ClosestEdgeQuery about 5% faster for cell targets.  (For point and
+  // edge targets the difference is within measurement noise, since their
+  // distances are about as cheap to compute as the hash table lookup.)
+  return true;
+}
+
 int S2ClosestEdgeQuery::ShapeIndexTarget::max_brute_force_index_size() const {
   // For BM_FindClosestToSameSizeAbuttingIndex (which uses two nearby indexes
   // with similar edge counts), the break-even points are approximately 20,
@@ -68,6 +76,12 @@ int S2ClosestEdgeQuery::ShapeIndexTarget::max_brute_force_index_size() const {
   return 25;
 }
 
+bool S2ClosestEdgeQuery::ShapeIndexTarget::avoid_duplicates() const {
+  // Using a fractal loop index with 100,000 edges and 100-edge fractal
+  // targets, avoiding duplicates makes S2ClosestEdgeQuery about 10% faster.
+  return true;
+}
+
 S2ClosestEdgeQuery::S2ClosestEdgeQuery() {
   // Prevent inline constructor bloat by defining here.
 }
@@ -26,6 +26,7 @@
 #include "s2/base/logging.h"
 #include "s2/third_party/absl/base/macros.h"
 #include "s2/third_party/absl/container/inlined_vector.h"
+#include "s2/third_party/absl/types/span.h"
 #include "s2/_fp_contract_off.h"
 #include "s2/s1angle.h"
 #include "s2/s1chord_angle.h"
@@ -192,6 +193,7 @@ class S2ClosestEdgeQuery {
    public:
     explicit CellTarget(const S2Cell& cell);
     int max_brute_force_index_size() const override;
+    bool avoid_duplicates() const override;
   };
 
   // Target subtype that computes the closest distance to an S2ShapeIndex
@@ -208,6 +210,7 @@ class S2ClosestEdgeQuery {
    public:
     explicit ShapeIndexTarget(const S2ShapeIndex* index);
     int max_brute_force_index_size() const override;
+    bool avoid_duplicates() const override;
   };
 
   // Convenience constructor that calls Init().  Options may be specified here
@@ -249,6 +252,16 @@ class S2ClosestEdgeQuery {
   // since it does not require allocating a new vector on each call.
   void FindClosestEdges(Target* target, std::vector<Result>* results);
 
+  // Finds the closest edges to each of the given targets.  The results for
+  // targets[i] are returned in positions [(*offsets)[i], (*offsets)[i+1]) of
+  // "results".  This is much faster than calling FindClosestEdges() for each
+  // target when nearby targets are common, for example when matching a large
+  // batch of GPS fixes (PointTargets) to a road network.  See
+  // S2ClosestEdgeQueryBase::FindClosestEdges for details.
+  void FindClosestEdges(absl::Span<Target* const> targets,
+                        std::vector<Result>* results,
+                        std::vector<size_t>* offsets);
+
   //////////////////////// Convenience Methods ////////////////////////
 
   // Returns the closest edge to the target.  If no edge satisfies the search
@@ -395,6 +408,12 @@ inline void S2ClosestEdgeQuery::FindClosestEdges(Target* target,
   base_.FindClosestEdges(target, options_, results);
 }
 
+inline void S2ClosestEdgeQuery::FindClosestEdges(
+    absl::Span<Target* const> targets, std::vector<Result>* results,
+    std::vector<size_t>* offsets) {
+  base_.FindClosestEdges(targets, options_, results, offsets);
+}
+
 inline S2ClosestEdgeQuery::Result S2ClosestEdgeQuery::FindClosestEdge(
     Target* target) {
   static_assert(sizeof(Options) <= 32, "Consider not copying Options here");
@@ -18,13 +18,20 @@
 #ifndef S2_S2CLOSEST_EDGE_QUERY_BASE_H_
 #define S2_S2CLOSEST_EDGE_QUERY_BASE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "s2/base/logging.h"
 #include "s2/util/gtl/btree_set.h"
 #include "s2/third_party/absl/container/inlined_vector.h"
+#include "s2/third_party/absl/types/span.h"
 #include "s2/_fp_contract_off.h"
+#include "s2/parallel_for.h"
 #include "s2/s1angle.h"
 #include "s2/s1chord_angle.h"
 #include "s2/s2cap.h"
@@ -36,7 +43,7 @@
 #include "s2/s2shape_index.h"
 #include "s2/s2shapeutil_count_edges.h"
 #include "s2/s2shapeutil_shape_edge_id.h"
-#include "s2/util/gtl/dense_hash_set.h"
+#include "s2/s2shapeutil_shape_edge_id_set.h"
 
 // S2ClosestEdgeQueryBase is a templatized class for finding the closest
 // edge(s) between two geometries.  It is not intended to be used directly,
@@ -143,12 +150,37 @@ class S2ClosestEdgeQueryBase {
     bool use_brute_force() const;
     void set_use_brute_force(bool use_brute_force);
 
+    // Specifies the maximum number of threads that may be used to compute
+    // distances from the target to candidate cells and edges of the index.
+    // This is only worthwhile when each distance computation is expensive,
+    // e.g. for S2ShapeIndex targets with many edges.  The priority queue is
+    // expanded in batches: the calling thread pops a batch of cells, and
+    // the worker threads measure their children and edges, abandoning any
+    // candidate whose lower bound exceeds the best distance found so far by
+    // any thread.  The threads are created on first use and kept by the
+    // query for later calls.
+    //
+    // Multiple threads are used only if the target supports Clone(), since
+    // targets are not required to be thread-safe.  The results do not depend
+    // on thread scheduling: the same query always returns the same edges,
+    // and when several edges are at the same distance the ones with the
+    // smallest (shape_id, edge_id) are preferred.  The results satisfy the
+    // same error bounds as with num_threads == 1, but they are not always
+    // identical since the edges are examined in a different order.  The
+    // Distance type must be trivially copyable.
+    //
+    // REQUIRES: num_threads >= 1
+    // DEFAULT: 1
+    int num_threads() const;
+    void set_num_threads(int num_threads);
+
    private:
     Distance max_distance_ = Distance::Infinity();
     Delta max_error_ = Delta::Zero();
     int max_results_ = kMaxMaxResults;
     bool include_interiors_ = true;
     bool use_brute_force_ = false;
+    int num_threads_ = 1;
   };
 
   // The Target class represents the geometry to which the distance is
@@ -271,23 +303,61 @@ class S2ClosestEdgeQueryBase {
   // REQUIRES: options.max_results() == 1
   Result FindClosestEdge(Target* target, const Options& options);
 
+  // Finds the closest edges to each of the given targets.  The results for
+  // targets[i] are returned in positions [(*offsets)[i], (*offsets)[i+1]) of
+  // "results" (sorted by distance), and "offsets" has size targets.size() + 1.
+  // The distances are the same as FindClosestEdges() would return for each
+  // target; however when several edges are exactly the same distance away,
+  // they may be returned in a different order, and when max_results() would
+  // cut such a group short, different edges may be chosen.
+  //
+  // This method is much faster than calling FindClosestEdges() for each
+  // target when the targets exhibit spatial locality (e.g., a sequence of
+  // GPS fixes along a road network).  The targets are processed in S2CellId
+  // (Hilbert curve) order of their bounding cap centers, and the closest
+  // edges found for each target are tested against the next target before
+  // the index is searched.  This typically yields a tight distance limit
+  // immediately.  The index cells near each target are then collected once
+  // and shared by all subsequent targets whose search region they cover, so
+  // that most targets do not need to seek the index at all.
+  void FindClosestEdges(absl::Span<Target* const> targets,
+                        const Options& options, std::vector<Result>* results,
+                        std::vector<size_t>* offsets);
+
  private:
   struct QueueEntry;
 
   const Options& options() const { return *options_; }
   void FindClosestEdgesInternal(Target* target, const Options& options);
+  void ReleaseCells();
   void FindClosestEdgesBruteForce();
   void FindClosestEdgesOptimized();
+  bool InitWorkerTargets();
+  void FindClosestEdgesParallel();
+  void AddCellTask(Distance bound, S2CellId id);
+  void AddEdgeTasks(Distance bound, const S2ShapeIndexCell* index_cell);
+  bool ProcessBatchCells();
+  bool InitBatchCells(const S2Cap& cap);
   void InitQueue();
+  bool LocateCell(const S2Point& point);
   void InitCovering();
   void AddInitialRange(const S2ShapeIndex::Iterator& first,
                        const S2ShapeIndex::Iterator& last);
   void MaybeAddResult(const S2Shape& shape, int edge_id);
   void AddResult(const Result& result);
   void ProcessEdges(const QueueEntry& entry);
+  void ProcessEdgeBatch(const S2ShapeIndexCell* index_cell);
   void ProcessOrEnqueue(S2CellId id);
   void ProcessOrEnqueue(S2CellId id, const S2ShapeIndexCell* index_cell);
 
+  // Index cells with fewer edges than this are processed immediately rather
+  // than being added to the priority queue.
+  static const int kMinEdgesToEnqueue = 10;
+
+  // Index cells with fewer edges than this are processed one edge at a time
+  // even when the target supports edge batches (see ProcessEdges).
+  static const int kMinEdgesToBatch = 8;
+
   const S2ShapeIndex* index_;
   const Options* options_;
   Target* target_;
@@ -298,6 +368,14 @@ class S2ClosestEdgeQueryBase {
   // return faster results, and 0 < max_error() < distance_limit_.
   bool use_conservative_cell_distance_;
 
+  // True if the edges of each index cell are screened using the target's
+  // GetEdgeLowerBounds() method before computing their distances (see
+  // ProcessEdges).  The following vectors hold the edges being screened.
+  bool use_edge_batches_;
+  std::vector<S2Shape::Edge> cell_edges_;
+  std::vector<s2shapeutil::ShapeEdgeId> cell_edge_ids_;
+  std::vector<Distance> cell_edge_bounds_;
+
   // For the optimized algorihm we precompute the top-level S2CellIds that
   // will be added to the priority queue.  There can be at most 6 of these
   // cells.  Essentially this is just a covering of the indexed edges, except
@@ -357,13 +435,57 @@ class S2ClosestEdgeQueryBase {
   // The flag below is true when duplicates must be avoided explicitly.  This
   // is achieved by maintaining a separate set keyed by (shape_id, edge_id)
   // only, and checking whether each edge is in that set before computing the
-  // distance to it.
-  //
-  // TODO(ericv): Check whether it is faster to avoid duplicates by default
-  // (even when Options::max_results() == 1), rather than just when we need to.
+  // distance to it.  The flag is also set when the target requests it (see
+  // S2DistanceTarget::avoid_duplicates), since for targets with expensive
+  // distances this is faster even when it is not needed.  The set is reused
+  // by every query and can be cleared in constant time.
   bool avoid_duplicates_;
   using ShapeEdgeId = s2shapeutil::ShapeEdgeId;
-  gtl::dense_hash_set<ShapeEdgeId, s2shapeutil::ShapeEdgeIdHash> tested_edges_;
+  s2shapeutil::ShapeEdgeIdSet tested_edges_;
+
+  // When processing a batch of targets, this field contains the edges that
+  // were returned for the previous target.  They are tested before the
+  // index is searched in order to initialize distance_limit_.
+  std::vector<ShapeEdgeId> hint_edges_;
+
+  // When processing a batch of targets, batch_cells_ contains every index
+  // cell that intersects batch_cap_.  Any target whose search region is
+  // contained by batch_cap_ can be processed by testing these cells
+  // directly rather than searching the index.
+  struct BatchCell {
+    S2Cell cell;
+    const S2ShapeIndexCell* index_cell;
+    BatchCell(S2CellId id, const S2ShapeIndexCell* _index_cell)
+        : cell(id), index_cell(_index_cell) {}
+  };
+  bool in_batch_ = false;
+  int batch_backoff_, batch_skip_;
+  S2Cap batch_cap_;
+  std::vector<BatchCell> batch_cells_;
+
+  // When Options::num_threads() > 1, each additional thread measures
+  // distances using its own copy of the target (see InitWorkerTargets).
+  // The candidates for each batch of queue entries are collected in tasks_
+  // and evaluated in parallel.  A task is either an edge (edge_id >= 0) or
+  // a cell of the index.  "bound" is a lower bound on the distance to the
+  // candidate, taken from the queue entry that produced it.
+  struct ParallelTask {
+    Distance bound;
+    S2CellId id;
+    const S2ShapeIndexCell* index_cell;
+    int32 shape_id, edge_id;
+    Distance distance;
+    bool found;
+  };
+  std::vector<std::unique_ptr<Target>> worker_targets_;
+  std::vector<ParallelTask> tasks_;
+  std::unique_ptr<s2parallel::WorkerPool> worker_pool_;
+
+  // When 1 < max_results() < kMaxMaxResults, each thread keeps the closest
+  // edges that it has found in the current batch so that it can tighten the
+  // shared distance limit without waiting for the candidates to be merged.
+  std::vector<gtl::btree_set<Result>> worker_results_;
+  std::vector<Result> batch_results_;
 
   // The algorithm maintains a priority queue of unprocessed S2CellIds, sorted
   // in increasing order of distance from the target.
@@ -387,7 +509,10 @@ class S2ClosestEdgeQueryBase {
     }
     bool operator<(const QueueEntry& other) const {
       // The priority queue returns the largest elements first, so we want the
-      // "largest" entry to have the smallest distance.
+      // "largest" entry to have the smallest distance.  Ties are broken by
+      // S2CellId so that the processing order does not depend on the order
+      // in which entries were added (see FindClosestEdgesParallel).
+      if (distance == other.distance) return other.id < id;
       return other.distance < distance;
     }
   };
@@ -400,6 +525,7 @@ class S2ClosestEdgeQueryBase {
   S2ShapeIndex::Iterator iter_;
   std::vector<S2CellId> max_distance_covering_;
   std::vector<S2CellId> initial_cells_;
+  std::vector<Result> target_results_;
 };
 
 
@@ -470,9 +596,19 @@ inline void S2ClosestEdgeQueryBase<Distance>::Options::set_use_brute_force(
 }
 
 template <class Distance>
-S2ClosestEdgeQueryBase<Distance>::S2ClosestEdgeQueryBase()
-    : tested_edges_(1) /* expected_max_elements*/ {
-  tested_edges_.set_empty_key(ShapeEdgeId(-1, -1));
+inline int S2ClosestEdgeQueryBase<Distance>::Options::num_threads() const {
+  return num_threads_;
+}
+
+template <class Distance>
+inline void S2ClosestEdgeQueryBase<Distance>::Options::set_num_threads(
+    int num_threads) {
+  S2_DCHECK_GE(num_threads, 1);
+  num_threads_ = num_threads;
+}
+
+template <class Distance>
+S2ClosestEdgeQueryBase<Distance>::S2ClosestEdgeQueryBase() {
 }
 
 template <class Distance>
@@ -522,6 +658,7 @@ S2ClosestEdgeQueryBase<Distance>::FindClosestEdge(Target* target,
                                                   const Options& options) {
   S2_DCHECK_EQ(options.max_results(), 1);
   FindClosestEdgesInternal(target, options);
+  ReleaseCells();
   return result_singleton_;
 }
 
@@ -530,6 +667,7 @@ void S2ClosestEdgeQueryBase<Distance>::FindClosestEdges(
     Target* target, const Options& options,
     std::vector<Result>* results) {
   FindClosestEdgesInternal(target, options);
+  ReleaseCells();
   results->clear();
   if (options.max_results() == 1) {
     if (result_singleton_.shape_id() >= 0) {
@@ -546,13 +684,80 @@ void S2ClosestEdgeQueryBase<Distance>::FindClosestEdges(
   }
 }
 
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::FindClosestEdges(
+    absl::Span<Target* const> targets, const Options& options,
+    std::vector<Result>* results, std::vector<size_t>* offsets) {
+  // Sort the targets along the Hilbert curve.  Empty targets are sorted last.
+  std::vector<std::pair<S2CellId, int>> order;
+  order.reserve(targets.size());
+  for (int i = 0; i < targets.size(); ++i) {
+    S2Cap cap = targets[i]->GetCapBound();
+    order.push_back(std::make_pair(
+        cap.is_empty() ? S2CellId::Sentinel() : S2CellId(cap.center()), i));
+  }
+  std::sort(order.begin(), order.end());
+
+  // Process the targets in sorted order, and then copy the results for each
+  // target to its final position.
+  std::vector<Result> sorted_results;
+  std::vector<std::pair<size_t, size_t>> ranges(targets.size());
+  hint_edges_.clear();
+  in_batch_ = true;
+  batch_backoff_ = batch_skip_ = 0;
+  batch_cap_ = S2Cap::Empty();
+  for (const auto& entry : order) {
+    FindClosestEdges(targets[entry.second], options, &target_results_);
+    ranges[entry.second] =
+        std::make_pair(sorted_results.size(), target_results_.size());
+    sorted_results.insert(sorted_results.end(), target_results_.begin(),
+                          target_results_.end());
+    hint_edges_.clear();
+    for (const Result& result : target_results_) {
+      if (result.edge_id() >= 0) {
+        hint_edges_.push_back(ShapeEdgeId(result.shape_id(),
+                                          result.edge_id()));
+      }
+    }
+  }
+  hint_edges_.clear();
+  in_batch_ = false;
+  batch_cells_.clear();
+  ReleaseCells();
+
+  results->clear();
+  results->reserve(sorted_results.size());
+  offsets->clear();
+  offsets->reserve(targets.size() + 1);
+  for (const auto& range : ranges) {
+    offsets->push_back(results->size());
+    auto begin = sorted_results.begin() + range.first;
+    results->insert(results->end(), begin, begin + range.second);
+  }
+  offsets->push_back(results->size());
+}
+
+// Lets the index free any cells that were used by the last query (see
+// S2ShapeIndex::Iterator::ReleaseCells).  When processing a batch of targets
+// this is done only at the end of the batch, since batch_cells_ refers to
+// cells of the index.
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::ReleaseCells() {
+  if (in_batch_) return;
+  if (iter_.ReleaseCells()) {
+    // The precomputed covering refers to cells of the index.
+    index_covering_.clear();
+    index_cells_.clear();
+  }
+}
+
 template <class Distance>
 void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesInternal(
     Target* target, const Options& options) {
   target_ = target;
   options_ = &options;
 
-  tested_edges_.clear();
+  tested_edges_.Clear();
   distance_limit_ = options.max_distance();
   result_singleton_ = Result();
   S2_DCHECK(result_vector_.empty());
@@ -609,6 +814,21 @@ void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesInternal(
       (distance_limit_ == Distance::Infinity() ||
        Distance::Zero() < distance_limit_ - options.max_error());
 
+  use_edge_batches_ = target_->supports_edge_batches();
+
+  // If only the closest edge is needed and the target is itself an
+  // S2ShapeIndex, both indexes can be traversed simultaneously rather than
+  // computing the distance to each candidate cell and edge separately.
+  if (options.max_results() == 1 && !options.use_brute_force() &&
+      target_->supports_index_distance()) {
+    Distance min_dist = distance_limit_;
+    s2shapeutil::ShapeEdgeId edge;
+    if (target_->UpdateMinDistanceToIndex(*index_, &min_dist, &edge)) {
+      AddResult(Result(min_dist, edge.shape_id, edge.edge_id));
+    }
+    return;
+  }
+
   // Use the brute force algorithm if the index is small enough.  To avoid
   // spending too much time counting edges when there are many shapes, we stop
   // counting once there are too many edges.  We may need to recount the edges
@@ -628,7 +848,11 @@ void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesInternal(
   } else {
     // If the target takes advantage of max_error() then we need to avoid
     // duplicate edges explicitly.  (Otherwise it happens automatically.)
-    avoid_duplicates_ = (target_uses_max_error && options.max_results() > 1);
+    // Some targets also request it because their distances are expensive
+    // enough that testing each edge only once is faster.
+    avoid_duplicates_ = ((target_uses_max_error &&
+                          options.max_results() > 1) ||
+                         target_->avoid_duplicates());
     FindClosestEdgesOptimized();
   }
 }
@@ -646,6 +870,18 @@ void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesBruteForce() {
 
 template <class Distance>
 void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesOptimized() {
+  // When processing a batch of targets, first test the edges that were
+  // closest to the previous target.  Nearby targets usually have nearby
+  // closest edges, so this gives a good initial distance limit.
+  for (const ShapeEdgeId& hint : hint_edges_) {
+    MaybeAddResult(*index_->shape(hint.shape_id), hint.edge_id);
+  }
+  if (distance_limit_ == Distance::Zero()) return;
+  if (in_batch_ && ProcessBatchCells()) return;
+  if (options().num_threads() > 1 && InitWorkerTargets()) {
+    FindClosestEdgesParallel();
+    return;
+  }
   InitQueue();
   // Repeatedly find the closest S2Cell to "target" and either split it into
   // its four children or process all of its edges.
@@ -710,7 +946,7 @@ void S2ClosestEdgeQueryBase<Distance>::InitQueue() {
   // provided that those cells are closer than distance_limit_.
   S2Cap cap = target_->GetCapBound();
   if (cap.is_empty()) return;  // Empty target.
-  if (options().max_results() == 1 && iter_.Locate(cap.center())) {
+  if (options().max_results() == 1 && LocateCell(cap.center())) {
     ProcessEdges(QueueEntry(Distance::Zero(), iter_.id(), &iter_.cell()));
     // Skip the rest of the algorithm if we found an intersecting edge.
     if (distance_limit_ == Distance::Zero()) return;
@@ -766,6 +1002,92 @@ void S2ClosestEdgeQueryBase<Distance>::InitQueue() {
   }
 }
 
+// Processes the current target using batch_cells_, first recomputing them if
+// necessary.  Returns false if the target should be processed using the
+// priority queue instead.
+template <class Distance>
+bool S2ClosestEdgeQueryBase<Distance>::ProcessBatchCells() {
+  if (distance_limit_ == Distance::Infinity()) return false;
+  S2Cap cap = target_->GetCapBound();
+  if (cap.is_empty()) return false;
+  S1ChordAngle radius = cap.radius() + distance_limit_.GetChordAngleBound();
+  S2Cap search_cap(cap.center(), radius);
+  if (!batch_cap_.Contains(search_cap)) {
+    // If the index cells near recent targets were too numerous to be worth
+    // caching, wait for an exponentially increasing number of targets before
+    // trying again.
+    if (batch_skip_ > 0) {
+      --batch_skip_;
+      return false;
+    }
+    // Collect the index cells within twice the search radius, so that they
+    // can also be used for subsequent targets that are nearby.
+    if (!InitBatchCells(S2Cap(cap.center(), 2 * radius.ToAngle()))) {
+      batch_backoff_ = std::min(2 * batch_backoff_ + 1, 63);
+      batch_skip_ = batch_backoff_;
+      return false;
+    }
+    batch_backoff_ = 0;
+  }
+  for (const BatchCell& batch_cell : batch_cells_) {
+    Distance distance = distance_limit_;
+    if (target_->UpdateMinDistance(batch_cell.cell, &distance)) {
+      ProcessEdges(QueueEntry(distance, batch_cell.cell.id(),
+                              batch_cell.index_cell));
+    }
+  }
+  return true;
+}
+
+// Sets batch_cells_ to the index cells that intersect "cap" and returns
+// true, unless there are too many such cells (in which case batch_cap_ is
+// set to be empty and false is returned).
+template <class Distance>
+bool S2ClosestEdgeQueryBase<Distance>::InitBatchCells(const S2Cap& cap) {
+  // Testing each cell is cheaper than searching the priority queue only if
+  // the number of cells is small.
+  static const int kMaxBatchCells = 32;
+
+  if (index_covering_.empty()) {
+    iter_.Init(index_, S2ShapeIndex::UNPOSITIONED);
+    InitCovering();
+  }
+  batch_cap_ = S2Cap::Empty();
+  batch_cells_.clear();
+  S2RegionCoverer coverer;
+  coverer.mutable_options()->set_max_cells(4);
+  coverer.GetFastCovering(cap, &max_distance_covering_);
+  for (S2CellId id : max_distance_covering_) {
+    S2ShapeIndex::CellRelation r = iter_.Locate(id);
+    if (r == S2ShapeIndex::DISJOINT) continue;
+    if (r == S2ShapeIndex::INDEXED) {
+      // Several covering cells may be contained by the same index cell.
+      if (batch_cells_.empty() || batch_cells_.back().cell.id() != iter_.id()) {
+        if (batch_cells_.size() == kMaxBatchCells) return false;
+        batch_cells_.push_back(BatchCell(iter_.id(), &iter_.cell()));
+      }
+    } else {
+      for (; !iter_.done() && iter_.id() <= id.range_max(); iter_.Next()) {
+        if (batch_cells_.size() == kMaxBatchCells) return false;
+        batch_cells_.push_back(BatchCell(iter_.id(), &iter_.cell()));
+      }
+    }
+  }
+  batch_cap_ = cap;
+  return true;
+}
+
+// Positions iter_ at the index cell containing "point" and returns true, or
+// returns false if there is no such cell.  The iterator is not moved if it
+// is already positioned at the correct cell, which is often the case when a
+// batch of nearby targets is processed.
+template <class Distance>
+inline bool S2ClosestEdgeQueryBase<Distance>::LocateCell(
+    const S2Point& point) {
+  if (!iter_.done() && iter_.id().contains(S2CellId(point))) return true;
+  return iter_.Locate(point);
+}
+
 template <class Distance>
 void S2ClosestEdgeQueryBase<Distance>::InitCovering() {
   // Find the range of S2Cells spanned by the index and choose a level such
@@ -842,7 +1164,7 @@ template <class Distance>
 void S2ClosestEdgeQueryBase<Distance>::MaybeAddResult(
     const S2Shape& shape, int edge_id) {
   if (avoid_duplicates_ &&
-      !tested_edges_.insert(ShapeEdgeId(shape.id(), edge_id)).second) {
+      !tested_edges_.Insert(ShapeEdgeId(shape.id(), edge_id))) {
     return;
   }
   auto edge = shape.edge(edge_id);
@@ -889,6 +1211,10 @@ inline static int CountEdges(const S2ShapeIndexCell* cell) {
 template <class Distance>
 void S2ClosestEdgeQueryBase<Distance>::ProcessEdges(const QueueEntry& entry) {
   const S2ShapeIndexCell* index_cell = entry.index_cell;
+  if (use_edge_batches_ && CountEdges(index_cell) >= kMinEdgesToBatch) {
+    ProcessEdgeBatch(index_cell);
+    return;
+  }
   for (int s = 0; s < index_cell->num_clipped(); ++s) {
     const S2ClippedShape& clipped = index_cell->clipped(s);
     const S2Shape* shape = index_->shape(clipped.shape_id());
@@ -898,6 +1224,38 @@ void S2ClosestEdgeQueryBase<Distance>::ProcessEdges(const QueueEntry& entry) {
   }
 }
 
+// Like ProcessEdges, except that lower bounds for all the edges are computed
+// first, and the exact distance is only computed for edges whose bound is
+// less than the current distance limit.  The edges are considered in the same
+// order and the bounds are conservative, so the results are identical.
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::ProcessEdgeBatch(
+    const S2ShapeIndexCell* index_cell) {
+  cell_edges_.clear();
+  cell_edge_ids_.clear();
+  for (int s = 0; s < index_cell->num_clipped(); ++s) {
+    const S2ClippedShape& clipped = index_cell->clipped(s);
+    const S2Shape* shape = index_->shape(clipped.shape_id());
+    for (int j = 0; j < clipped.num_edges(); ++j) {
+      ShapeEdgeId id(shape->id(), clipped.edge(j));
+      if (avoid_duplicates_ && !tested_edges_.Insert(id)) continue;
+      cell_edges_.push_back(shape->edge(id.edge_id));
+      cell_edge_ids_.push_back(id);
+    }
+  }
+  cell_edge_bounds_.resize(cell_edges_.size());
+  target_->GetEdgeLowerBounds(cell_edges_, cell_edge_bounds_.data());
+  for (int i = 0; i < cell_edges_.size(); ++i) {
+    if (!(cell_edge_bounds_[i] < distance_limit_)) continue;
+    const S2Shape::Edge& edge = cell_edges_[i];
+    Distance distance = distance_limit_;
+    if (target_->UpdateMinDistance(edge.v0, edge.v1, &distance)) {
+      const ShapeEdgeId& id = cell_edge_ids_[i];
+      AddResult(Result(distance, id.shape_id, id.edge_id));
+    }
+  }
+}
+
 // Enqueue the given cell id.
 // REQUIRES: iter_ is positioned at a cell contained by "id".
 template <class Distance>
@@ -922,7 +1280,6 @@ void S2ClosestEdgeQueryBase<Distance>::ProcessOrEnqueue(
     // If this index cell has only a few edges, then it is faster to check
     // them directly rather than computing the minimum distance to the S2Cell
     // and inserting it into the queue.
-    static const int kMinEdgesToEnqueue = 10;
     int num_edges = CountEdges(index_cell);
     if (num_edges == 0) return;
     if (num_edges < kMinEdgesToEnqueue) {
@@ -943,4 +1300,203 @@ void S2ClosestEdgeQueryBase<Distance>::ProcessOrEnqueue(
   queue_.push(QueueEntry(distance, id, index_cell));
 }
 
+// Creates a copy of the target for each additional thread, and creates the
+// worker threads if necessary.  Returns false if the target cannot be copied.
+template <class Distance>
+bool S2ClosestEdgeQueryBase<Distance>::InitWorkerTargets() {
+  const int num_threads = options().num_threads();
+  worker_targets_.clear();
+  for (int i = 1; i < num_threads; ++i) {
+    std::unique_ptr<Target> target = target_->Clone();
+    if (target == nullptr) return false;
+    worker_targets_.push_back(std::move(target));
+  }
+  if (worker_pool_ == nullptr || worker_pool_->num_threads() != num_threads) {
+    worker_pool_.reset(new s2parallel::WorkerPool(num_threads));
+  }
+  worker_results_.resize(num_threads);
+  return true;
+}
+
+// A version of the optimized algorithm that processes the priority queue in
+// batches.  Expanding each batch into candidate cells and edges (which
+// requires seeking the index) is done by the calling thread, while the
+// distances to the candidates are computed by all threads.  The candidates
+// are then merged into the results and the queue in their original order.
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::FindClosestEdgesParallel() {
+  // Each batch has enough tasks to keep every thread busy even when some
+  // tasks are much more expensive than others.
+  static const int kTasksPerThread = 4;
+  const int num_threads = options().num_threads();
+  const size_t batch_size = kTasksPerThread * num_threads;
+
+  // The results must not depend on thread scheduling.  Every candidate is
+  // therefore measured against "batch_limit", the distance limit when the
+  // batch was formed (which includes max_error()).  In addition, threads
+  // share "shared_limit", the exact distance to the closest edges found so
+  // far in the current batch, and skip candidates whose lower bound is
+  // strictly larger.  Such candidates would be rejected when the batch is
+  // merged anyway, since the edges that determine "shared_limit" are merged
+  // before them (see below).
+  static_assert(std::is_trivially_copyable<Distance>::value,
+                "Options::num_threads() > 1 requires a trivially copyable "
+                "Distance type, since it is shared using std::atomic");
+  std::atomic<Distance> shared_limit(Distance::Infinity());
+  Distance batch_limit = distance_limit_;
+  const int max_results = options().max_results();
+  const Delta max_error = options().max_error();
+  auto update_limit = [&shared_limit](Distance distance) {
+    Distance limit = shared_limit.load(std::memory_order_relaxed);
+    while (distance < limit &&
+           !shared_limit.compare_exchange_weak(limit, distance,
+                                               std::memory_order_relaxed)) {
+    }
+  };
+  std::atomic<int> next_task(0);
+  const std::function<void(int)> measure = [&](int worker) {
+    Target* target = (worker == 0) ? target_
+                                   : worker_targets_[worker - 1].get();
+    gtl::btree_set<Result>& results = worker_results_[worker];
+    const int num_tasks = tasks_.size();
+    for (int i; (i = next_task.fetch_add(1)) < num_tasks; ) {
+      ParallelTask& task = tasks_[i];
+      task.found = false;
+      task.distance = batch_limit;
+      if (!(task.bound < batch_limit) ||
+          shared_limit.load(std::memory_order_relaxed) < task.bound) {
+        continue;
+      }
+      if (task.edge_id < 0) {
+        task.found = target->UpdateMinDistance(S2Cell(task.id),
+                                               &task.distance);
+        continue;
+      }
+      auto edge = index_->shape(task.shape_id)->edge(task.edge_id);
+      task.found = target->UpdateMinDistance(edge.v0, edge.v1,
+                                             &task.distance);
+      if (!task.found) continue;
+      if (max_results == 1) {
+        update_limit(task.distance);
+      } else if (max_results < Options::kMaxMaxResults) {
+        // Duplicate edges are not counted twice since "results" is a set.
+        results.insert(Result(task.distance, task.shape_id, task.edge_id));
+        int size = results.size();
+        if (size > max_results) results.erase(--results.end());
+        if (size >= max_results) {
+          update_limit((--results.end())->distance());
+        }
+      }
+    }
+  };
+
+  InitQueue();
+  while (!queue_.empty()) {
+    // Pop a batch of entries and expand them into tasks.
+    tasks_.clear();
+    while (tasks_.size() < batch_size && !queue_.empty()) {
+      QueueEntry entry = queue_.top();
+      Distance distance = entry.distance;
+      if (!(distance < distance_limit_)) {
+        queue_ = CellQueue();  // Clear any remaining entries.
+        break;
+      }
+      queue_.pop();
+      if (entry.index_cell != nullptr) {
+        AddEdgeTasks(distance, entry.index_cell);
+        continue;
+      }
+      // See FindClosestEdgesOptimized() for how the children are found.
+      S2CellId id = entry.id;
+      iter_.Seek(id.child(1).range_min());
+      if (!iter_.done() && iter_.id() <= id.child(1).range_max()) {
+        AddCellTask(distance, id.child(1));
+      }
+      if (iter_.Prev() && iter_.id() >= id.range_min()) {
+        AddCellTask(distance, id.child(0));
+      }
+      iter_.Seek(id.child(3).range_min());
+      if (!iter_.done() && iter_.id() <= id.range_max()) {
+        AddCellTask(distance, id.child(3));
+      }
+      if (iter_.Prev() && iter_.id() >= id.child(2).range_min()) {
+        AddCellTask(distance, id.child(2));
+      }
+    }
+    if (tasks_.empty()) continue;
+
+    // Measure the distance to each candidate.
+    batch_limit = distance_limit_;
+    shared_limit.store(Distance::Infinity(), std::memory_order_relaxed);
+    for (auto& results : worker_results_) results.clear();
+    next_task = 0;
+    if (tasks_.size() == 1) {
+      measure(0);
+    } else {
+      worker_pool_->Run(measure);
+    }
+
+    // Merge the edges in increasing order of (distance, shape_id, edge_id),
+    // so that ties are broken the same way regardless of which thread found
+    // each edge.  Cells are added to the queue, which orders them by
+    // (distance, id).
+    batch_results_.clear();
+    for (const ParallelTask& task : tasks_) {
+      if (!task.found) continue;
+      if (task.edge_id >= 0) {
+        batch_results_.push_back(
+            Result(task.distance, task.shape_id, task.edge_id));
+      } else {
+        Distance distance = task.distance;
+        if (use_conservative_cell_distance_) {
+          distance = distance - max_error;
+        }
+        queue_.push(QueueEntry(distance, task.id, task.index_cell));
+      }
+    }
+    std::sort(batch_results_.begin(), batch_results_.end());
+    for (const Result& result : batch_results_) {
+      if (!(result.distance() < distance_limit_)) break;
+      AddResult(result);
+    }
+  }
+}
+
+// Adds a task for the given child cell, or tasks for its edges if it is an
+// index cell with only a few edges (see ProcessOrEnqueue).
+// REQUIRES: iter_ is positioned at a cell contained by "id".
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::AddCellTask(Distance bound,
+                                                   S2CellId id) {
+  const S2ShapeIndexCell* index_cell = nullptr;
+  if (iter_.id() == id) {
+    index_cell = &iter_.cell();
+    int num_edges = CountEdges(index_cell);
+    if (num_edges == 0) return;
+    if (num_edges < kMinEdgesToEnqueue) {
+      AddEdgeTasks(bound, index_cell);
+      return;
+    }
+  }
+  tasks_.push_back(ParallelTask{bound, id, index_cell, -1, -1, bound, false});
+}
+
+template <class Distance>
+void S2ClosestEdgeQueryBase<Distance>::AddEdgeTasks(
+    Distance bound, const S2ShapeIndexCell* index_cell) {
+  for (int s = 0; s < index_cell->num_clipped(); ++s) {
+    const S2ClippedShape& clipped = index_cell->clipped(s);
+    int32 shape_id = clipped.shape_id();
+    for (int j = 0; j < clipped.num_edges(); ++j) {
+      int32 edge_id = clipped.edge(j);
+      if (avoid_duplicates_ &&
+          !tested_edges_.Insert(ShapeEdgeId(shape_id, edge_id))) {
+        continue;
+      }
+      tasks_.push_back(ParallelTask{bound, S2CellId::None(), nullptr,
+                                    shape_id, edge_id, bound, false});
+    }
+  }
+}
+
 #endif  // S2_S2CLOSEST_EDGE_QUERY_BASE_H_
@@ -17,6 +17,7 @@
 
 #include "s2/s2closest_edge_query.h"
 
+#include <cstdio>
 #include <memory>
 #include <vector>
 
@@ -196,6 +197,30 @@ TEST(S2ClosestEdgeQuery, TargetPolygonContainingIndexedPoints) {
   EXPECT_EQ(3, results[1].edge_id());  // 3:13
 }
 
+TEST(S2ClosestEdgeQuery, SingleResultIndexTarget) {
+  // When only the closest edge is requested, S2ShapeIndex targets traverse
+  // both indexes at once.  Check that target interiors are respected and
+  // that the result agrees with the brute force algorithm.
+  auto index = MakeIndexOrDie("# 1:1, 2:2 | 10:10, 11:12 #");
+  auto target_index = MakeIndexOrDie("# # 0:0, 0:5, 5:5, 5:0");
+  S2ClosestEdgeQuery query(index.get());
+  S2ClosestEdgeQuery::ShapeIndexTarget target(target_index.get());
+  target.set_include_interiors(true);
+  auto result = query.FindClosestEdge(&target);
+  EXPECT_EQ(S1ChordAngle::Zero(), result.distance());
+  EXPECT_EQ(0, result.shape_id());
+  EXPECT_EQ(0, result.edge_id());
+
+  target.set_include_interiors(false);
+  result = query.FindClosestEdge(&target);
+  query.mutable_options()->set_use_brute_force(true);
+  auto expected = query.FindClosestEdge(&target);
+  EXPECT_LT(S1ChordAngle::Zero(), result.distance());
+  EXPECT_EQ(expected.distance(), result.distance());
+  EXPECT_EQ(expected.shape_id(), result.shape_id());
+  EXPECT_EQ(expected.edge_id(), result.edge_id());
+}
+
 TEST(S2ClosestEdgeQuery, EmptyTargetOptimized) {
   // Ensure that the optimized algorithm handles empty targets when a distance
   // limit is specified.
@@ -503,3 +528,131 @@ TEST(S2ClosestEdgeQuery, ConservativeCellDistanceIsUsed) {
   FLAGS_s2_random_seed = saved_seed;
 }
 
+TEST(S2ClosestEdgeQuery, BatchPointTargets) {
+  // Verifies that the batch version of FindClosestEdges() returns the same
+  // results as querying each target separately for a sequence of nearby
+  // points (similar to a GPS track being matched to a road network).
+  const int kNumTargets = 2000;
+  S2Cap index_cap(S2Testing::RandomPoint(), kTestCapRadius);
+  MutableS2ShapeIndex index;
+  s2testing::FractalLoopShapeIndexFactory().AddEdges(index_cap, 10000,
+                                                     &index);
+  // Generate points near the indexed edges, in order along the loop, with
+  // occasional jumps to a random location.
+  const S2Shape& shape = *index.shape(0);
+  vector<S2Point> points;
+  for (int i = 0, e = 0; i < kNumTargets; ++i) {
+    e = S2Testing::rnd.OneIn(100) ? S2Testing::rnd.Uniform(shape.num_edges())
+                                  : (e + 1) % shape.num_edges();
+    points.push_back(S2Testing::SamplePoint(
+        S2Cap(shape.edge(e).v0, S2Testing::KmToAngle(0.02))));
+  }
+  vector<unique_ptr<S2ClosestEdgeQuery::PointTarget>> targets;
+  vector<S2ClosestEdgeQuery::Target*> target_ptrs;
+  for (const S2Point& p : points) {
+    targets.push_back(make_unique<S2ClosestEdgeQuery::PointTarget>(p));
+    target_ptrs.push_back(targets.back().get());
+  }
+  for (int max_results : {1, 3}) {
+    for (bool include_interiors : {false, true}) {
+      S2ClosestEdgeQuery query(&index);
+      query.mutable_options()->set_max_results(max_results);
+      query.mutable_options()->set_include_interiors(include_interiors);
+      if (max_results > 1) {
+        query.mutable_options()->set_max_distance(S2Testing::KmToAngle(0.1));
+      }
+      vector<S2ClosestEdgeQuery::Result> expected, actual, results;
+      vector<size_t> offsets;
+      for (auto& target : targets) {
+        query.FindClosestEdges(target.get(), &results);
+        expected.insert(expected.end(), results.begin(), results.end());
+        offsets.push_back(results.size());
+      }
+      vector<size_t> expected_offsets(1, 0);
+      for (size_t count : offsets) {
+        expected_offsets.push_back(expected_offsets.back() + count);
+      }
+      query.FindClosestEdges(target_ptrs, &actual, &offsets);
+      EXPECT_EQ(expected_offsets, offsets);
+      // Edges that are exactly the same distance from the target (e.g.,
+      // because the closest point is a shared vertex) may be returned in
+      // either order, or different edges may be chosen when max_results()
+      // cuts off such a group, so only the distances are compared.
+      ASSERT_EQ(expected.size(), actual.size());
+      for (int k = 0; k < expected.size(); ++k) {
+        EXPECT_EQ(expected[k].distance(), actual[k].distance());
+      }
+    }
+  }
+  // Empty batches are allowed.
+  vector<S2ClosestEdgeQuery::Result> results;
+  vector<size_t> offsets;
+  S2ClosestEdgeQuery query(&index);
+  query.FindClosestEdges(absl::Span<S2ClosestEdgeQuery::Target* const>(),
+                         &results, &offsets);
+  EXPECT_TRUE(results.empty());
+  EXPECT_EQ(vector<size_t>(1, 0), offsets);
+}
+
+TEST(S2ClosestEdgeQuery, ParallelShapeIndexTarget) {
+  // Verifies that using multiple threads yields the same result distances as
+  // a single thread when max_error() is zero, and valid approximate results
+  // otherwise.  Also verifies that the results do not depend on thread
+  // scheduling.
+  const int kNumTargetEdges = 3000;
+  S2Cap index_cap(S2Testing::RandomPoint(), kTestCapRadius);
+  MutableS2ShapeIndex index, target_index;
+  s2testing::FractalLoopShapeIndexFactory().AddEdges(index_cap, 1000, &index);
+  s2testing::FractalLoopShapeIndexFactory().AddEdges(
+      S2Cap(S2Testing::SamplePoint(S2Cap(index_cap.center(),
+                                         2 * index_cap.GetRadius())),
+            index_cap.GetRadius()),
+      kNumTargetEdges, &target_index);
+  target_index.ForceBuild();
+  for (bool use_max_error : {false, true}) {
+    S1ChordAngle max_error(use_max_error ? 0.1 * index_cap.GetRadius()
+                                         : S1Angle::Zero());
+    vector<S2ClosestEdgeQuery::Result> expected;
+    for (int num_threads : {1, 2, 3, 8}) {
+      S2ClosestEdgeQuery query(&index);
+      query.mutable_options()->set_max_results(5);
+      query.mutable_options()->set_num_threads(num_threads);
+      query.mutable_options()->set_max_error(max_error);
+      S2ClosestEdgeQuery::ShapeIndexTarget target(&target_index);
+      target.set_include_interiors(false);
+      // Run each query several times so that the worker threads are reused.
+      vector<S2ClosestEdgeQuery::Result> first_results;
+      for (int iter = 0; iter < 3; ++iter) {
+        auto results = query.FindClosestEdges(&target);
+        ASSERT_EQ(5, results.size());
+        if (iter == 0) {
+          first_results = results;
+        } else {
+          EXPECT_TRUE(first_results == results);
+        }
+        if (num_threads == 1 && iter == 0) {
+          query.mutable_options()->set_use_brute_force(true);
+          query.mutable_options()->set_max_error(S1ChordAngle::Zero());
+          expected = query.FindClosestEdges(&target);
+          query.mutable_options()->set_use_brute_force(false);
+          query.mutable_options()->set_max_error(max_error);
+        }
+        if (use_max_error) {
+          // The query passes max_error() on to the target, so both the
+          // distances it reports and the distances used for pruning may be
+          // too large by up to max_error().  Only the last result has a
+          // guaranteed bound.
+          EXPECT_LE(results.back().distance(),
+                    expected.back().distance() + max_error + max_error);
+        } else {
+          // Edges at exactly the same distance may be returned in a
+          // different order.
+          for (int i = 0; i < results.size(); ++i) {
+            EXPECT_EQ(expected[i].distance(), results[i].distance());
+          }
+        }
+      }
+    }
+  }
+}
+
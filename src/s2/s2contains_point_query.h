@@ -152,6 +152,18 @@ class S2ContainsPointQuery {
                      const S2Point& p) const;
 
  private:
+  // Lets the index free the cells used by a query method when it returns,
+  // since it_ is kept between calls (see S2ShapeIndex::IteratorBase::
+  // ReleaseCells).
+  class CellReleaser {
+   public:
+    explicit CellReleaser(Iterator* it) : it_(it) {}
+    ~CellReleaser() { it_->ReleaseCells(); }
+
+   private:
+    Iterator* it_;
+  };
+
   const IndexType* index_;
   Options options_;
   Iterator it_;
@@ -211,6 +223,7 @@ void S2ContainsPointQuery<IndexType>::Init(const IndexType* index,
 
 template <class IndexType>
 bool S2ContainsPointQuery<IndexType>::Contains(const S2Point& p) {
+  CellReleaser releaser(&it_);
   if (!it_.Locate(p)) return false;
 
   const S2ShapeIndexCell& cell = it_.cell();
@@ -224,6 +237,7 @@ bool S2ContainsPointQuery<IndexType>::Contains(const S2Point& p) {
 template <class IndexType>
 bool S2ContainsPointQuery<IndexType>::ShapeContains(const S2Shape& shape,
                                                     const S2Point& p) {
+  CellReleaser releaser(&it_);
   if (!it_.Locate(p)) return false;
   const S2ClippedShape* clipped = it_.cell().find_clipped(shape.id());
   if (clipped == nullptr) return false;
@@ -235,6 +249,7 @@ bool S2ContainsPointQuery<IndexType>::VisitContainingShapes(
     const S2Point& p, const ShapeVisitor& visitor) {
   // This function returns "false" only if the algorithm terminates early
   // because the "visitor" function returned false.
+  CellReleaser releaser(&it_);
   if (!it_.Locate(p)) return true;
 
   const S2ShapeIndexCell& cell = it_.cell();
@@ -254,6 +269,7 @@ bool S2ContainsPointQuery<IndexType>::VisitIncidentEdges(
     const S2Point& p, const EdgeVisitor& visitor) {
   // This function returns "false" only if the algorithm terminates early
   // because the "visitor" function returned false.
+  CellReleaser releaser(&it_);
   if (!it_.Locate(p)) return true;
 
   const S2ShapeIndexCell& cell = it_.cell();
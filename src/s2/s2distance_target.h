@@ -18,9 +18,15 @@
 #ifndef S2_S2DISTANCE_TARGET_H_
 #define S2_S2DISTANCE_TARGET_H_
 
+#include <algorithm>
+#include <memory>
+
+#include "s2/third_party/absl/types/span.h"
 #include "s2/s2cap.h"
 #include "s2/s2cell.h"
+#include "s2/s2shape.h"
 #include "s2/s2shape_index.h"
+#include "s2/s2shapeutil_shape_edge_id.h"
 
 // S2DistanceTarget represents a geometric object to which distances are
 // measured.  For example, there are subtypes for measuring distances to a
@@ -149,6 +155,56 @@ class S2DistanceTarget {
   // the default implementation which simply returns false.)
   virtual bool set_max_error(const Delta& max_error) { return false; }
 
+  // Targets that consist of an S2ShapeIndex may override the following two
+  // methods in order to find the closest edge of "query_index" by traversing
+  // both indexes simultaneously, which is much faster than calling
+  // UpdateMinDistance() for the candidate cells and edges of "query_index"
+  // one at a time.  This is only used when a single closest edge is needed.
+  //
+  // If the distance from the target to some edge of "query_index" is less
+  // than "min_dist", UpdateMinDistanceToIndex() updates "min_dist", sets
+  // "edge" to the corresponding edge, and returns true.  Otherwise it returns
+  // false.  The interiors of polygons in "query_index" are not considered
+  // (see VisitContainingShapes), but the target's own polygon interiors are.
+  // The "max_error" passed to set_max_error() is respected.
+  //
+  // By default index-to-index distances are not supported.
+  virtual bool supports_index_distance() const { return false; }
+  virtual bool UpdateMinDistanceToIndex(const S2ShapeIndex& query_index,
+                                        Distance* min_dist,
+                                        s2shapeutil::ShapeEdgeId* edge) {
+    return false;
+  }
+
+  // Targets whose distance to an edge can be bounded cheaply may override
+  // the following two methods.  This allows all the edges of an index cell
+  // to be screened at once, so that UpdateMinDistance() is only called for
+  // edges that might be closer than the current distance limit.
+  //
+  // GetEdgeLowerBounds() sets "bounds[i]" to a lower bound on the distance
+  // to "edges[i]".  The bounds must account for the rounding errors of
+  // UpdateMinDistance(), i.e. UpdateMinDistance() must return false for
+  // "edges[i]" whenever "*min_dist <= bounds[i]".  This guarantees that
+  // screening edges does not change the results.
+  //
+  // By default edge batches are not supported.
+  virtual bool supports_edge_batches() const { return false; }
+  virtual void GetEdgeLowerBounds(absl::Span<const S2Shape::Edge> edges,
+                                  Distance* bounds) {
+    std::fill(bounds, bounds + edges.size(), Distance::Zero());
+  }
+
+  // Returns a new target that measures distances to the same geometry in the
+  // same way (including the "max_error" passed to set_max_error), or nullptr
+  // if this is not supported.  Since targets are not required to be
+  // thread-safe, this is used to give each thread its own target when
+  // distances are computed in parallel (see
+  // S2ClosestEdgeQueryBase::Options::num_threads).  The copy is only used
+  // to call the UpdateMinDistance() methods above.
+  //
+  // By default this method returns nullptr.
+  virtual std::unique_ptr<S2DistanceTarget> Clone() const { return nullptr; }
+
   // The following method is provided as a convenience for classes that
   // compute distances to a collection of indexed geometry, such as
   // S2ClosestPointQuery, S2ClosestEdgeQuery, and S2ClosestCellQuery.  It
@@ -160,6 +216,16 @@ class S2DistanceTarget {
   //
   // By default this method returns -1, indicating that it is not implemented.
   virtual int max_brute_force_index_size() const { return -1; }
+
+  // Returns true if distances to this target are expensive enough that
+  // classes such as S2ClosestEdgeQuery should keep track of which indexed
+  // objects have already been measured, so that objects that appear in
+  // several index cells (e.g., long edges) are only measured once.  Like
+  // max_brute_force_index_size(), the appropriate value depends on the
+  // target type and can be determined by running benchmarks.
+  //
+  // By default this method returns false.
+  virtual bool avoid_duplicates() const { return false; }
 };
 
 #endif  // S2_S2DISTANCE_TARGET_H_
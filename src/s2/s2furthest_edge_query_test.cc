@@ -230,6 +230,30 @@ TEST(S2FurthestEdgeQuery, AntipodalPolygonContainingIndexedPoints) {
   EXPECT_EQ(3, results[1].edge_id());  // 3:13
 }
 
+TEST(S2FurthestEdgeQuery, SingleResultIndexTarget) {
+  // When only the furthest edge is requested, S2ShapeIndex targets traverse
+  // both indexes at once.  Check that target interiors are respected and
+  // that the result agrees with the brute force algorithm.
+  auto index = MakeIndexOrDie("# -1:-179, -2:-178 | 10:10, 11:12 #");
+  auto target_index = MakeIndexOrDie("# # 0:0, 0:5, 5:5, 5:0");
+  S2FurthestEdgeQuery query(index.get());
+  S2FurthestEdgeQuery::ShapeIndexTarget target(target_index.get());
+  target.set_include_interiors(true);
+  auto result = query.FindFurthestEdge(&target);
+  EXPECT_EQ(S1ChordAngle::Straight(), result.distance());
+  EXPECT_EQ(0, result.shape_id());
+  EXPECT_EQ(0, result.edge_id());
+
+  target.set_include_interiors(false);
+  result = query.FindFurthestEdge(&target);
+  query.mutable_options()->set_use_brute_force(true);
+  auto expected = query.FindFurthestEdge(&target);
+  EXPECT_LT(result.distance(), S1ChordAngle::Straight());
+  EXPECT_EQ(expected.distance(), result.distance());
+  EXPECT_EQ(expected.shape_id(), result.shape_id());
+  EXPECT_EQ(expected.edge_id(), result.edge_id());
+}
+
 TEST(S2FurthestEdgeQuery, EmptyPolygonTarget) {
   // Verifies that distances are measured correctly to empty polygon targets.
   auto empty_polygon_index = MakeIndexOrDie("# # empty");
@@ -156,18 +156,15 @@ bool S2LaxPolygonShape::Init(Decoder* decoder) {
     vertices_ = nullptr;
   } else {
     vertices_ = make_unique<S2Point[]>(vertices.size());
-    for (int i = 0; i < vertices.size(); ++i) {
-      vertices_[i] = vertices[i];
-    }
+    vertices.DecodePoints(0, vertices.size(), vertices_.get());
     if (num_loops_ == 1) {
       num_vertices_ = vertices.size();
     } else {
       s2coding::EncodedUintVector<uint32> cumulative_vertices;
       if (!cumulative_vertices.Init(decoder)) return false;
       cumulative_vertices_ = new uint32[cumulative_vertices.size()];
-      for (int i = 0; i < cumulative_vertices.size(); ++i) {
-        cumulative_vertices_[i] = cumulative_vertices[i];
-      }
+      cumulative_vertices.Decode(0, cumulative_vertices.size(),
+                                 cumulative_vertices_);
     }
   }
   return true;
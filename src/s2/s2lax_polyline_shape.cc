@@ -61,9 +61,7 @@ bool S2LaxPolylineShape::Init(Decoder* decoder) {
   if (!vertices.Init(decoder)) return false;
   num_vertices_ = vertices.size();
   vertices_ = make_unique<S2Point[]>(vertices.size());
-  for (int i = 0; i < num_vertices_; ++i) {
-    vertices_[i] = vertices[i];
-  }
+  vertices.DecodePoints(0, num_vertices_, vertices_.get());
   return true;
 }
 
@@ -16,13 +16,16 @@
 #include "s2/s2max_distance_targets.h"
 
 #include <memory>
+#include <utility>
 #include "s2/third_party/absl/memory/memory.h"
 #include "s2/s1angle.h"
 #include "s2/s2cap.h"
 #include "s2/s2cell.h"
+#include "s2/s2contains_point_query.h"
 #include "s2/s2edge_distances.h"
 #include "s2/s2furthest_edge_query.h"
 #include "s2/s2shape_index_region.h"
+#include "s2/s2shapeutil_closest_edge_pair.h"
 #include "s2/s2text_format.h"
 
 //////////////////   Point Target   ////////////////////
@@ -263,3 +266,48 @@ bool S2MaxDistanceShapeIndexTarget::VisitContainingShapes(
   }
   return true;
 }
+
+namespace {
+
+// Distance operations used by s2shapeutil::FindClosestEdgePair().
+struct MaxDistanceOps {
+  static S2MaxDistance GetDistance(const S2Cell& a, const S2Cell& b) {
+    return S2MaxDistance(a.GetMaxDistance(b));
+  }
+  static bool UpdateEdgePairDistance(const S2Point& a0, const S2Point& a1,
+                                     const S2Point& b0, const S2Point& b1,
+                                     S2MaxDistance* min_dist) {
+    S1ChordAngle dist(*min_dist);
+    if (S2::UpdateEdgePairMaxDistance(a0, a1, b0, b1, &dist)) {
+      min_dist->UpdateMin(S2MaxDistance(dist));
+      return true;
+    }
+    return false;
+  }
+  static S2Point InteriorTestPoint(const S2Point& p) { return -p; }
+};
+
+}  // namespace
+
+std::unique_ptr<S2MaxDistanceTarget>
+S2MaxDistanceShapeIndexTarget::Clone() const {
+  auto target = absl::make_unique<S2MaxDistanceShapeIndexTarget>(index_);
+  *target->query_->mutable_options() = query_->options();
+  return std::move(target);
+}
+
+bool S2MaxDistanceShapeIndexTarget::supports_index_distance() const {
+  return !use_brute_force();
+}
+
+bool S2MaxDistanceShapeIndexTarget::UpdateMinDistanceToIndex(
+    const S2ShapeIndex& query_index, S2MaxDistance* min_dist,
+    s2shapeutil::ShapeEdgeId* edge) {
+  // If the target has polygon interiors, the distance is S2MaxDistance::Zero()
+  // (i.e., antipodal) whenever a target polygon contains the antipodal
+  // reflection of one of the query edges.
+  s2shapeutil::ShapeEdgeId target_edge;
+  return s2shapeutil::FindClosestEdgePair<S2MaxDistance, MaxDistanceOps>(
+      query_index, *index_, include_interiors(),
+      query_->options().max_error(), min_dist, edge, &target_edge);
+}
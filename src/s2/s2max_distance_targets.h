@@ -178,6 +178,11 @@ class S2MaxDistanceShapeIndexTarget : public S2MaxDistanceTarget {
                          S2MaxDistance* min_dist) final;
   bool VisitContainingShapes(const S2ShapeIndex& query_index,
                              const ShapeVisitor& visitor) final;
+  bool supports_index_distance() const final;
+  bool UpdateMinDistanceToIndex(const S2ShapeIndex& query_index,
+                                S2MaxDistance* min_dist,
+                                s2shapeutil::ShapeEdgeId* edge) final;
+  std::unique_ptr<S2MaxDistanceTarget> Clone() const override;
 
  private:
   const S2ShapeIndex* index_;
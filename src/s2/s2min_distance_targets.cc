@@ -17,15 +17,21 @@
 
 #include "s2/s2min_distance_targets.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <memory>
+#include <utility>
 #include "s2/third_party/absl/memory/memory.h"
 #include "s2/s1angle.h"
 #include "s2/s2cap.h"
 #include "s2/s2cell.h"
 #include "s2/s2closest_cell_query.h"
 #include "s2/s2closest_edge_query.h"
+#include "s2/s2contains_point_query.h"
 #include "s2/s2edge_distances.h"
 #include "s2/s2shape_index_region.h"
+#include "s2/s2shapeutil_closest_edge_pair.h"
 
 S2Cap S2MinDistancePointTarget::GetCapBound() {
   return S2Cap(point_, S1ChordAngle::Zero());
@@ -54,6 +60,68 @@ bool S2MinDistancePointTarget::VisitContainingShapes(
       });
 }
 
+bool S2MinDistancePointTarget::supports_edge_batches() const {
+  return true;
+}
+
+// The bound is computed as follows.  Let X be the target point, let A and B
+// be the edge endpoints, and let M = max(X.A, X.B).  Every point P of the
+// edge can be written as (sA + tB) / |sA + tB| with s, t >= 0 and s + t = 1,
+// and since |sA + tB|^2 >= (1 + A.B) / 2 it follows that
+//
+//    X.P <= M / sqrt((1 + A.B) / 2)       (if M >= 0)
+//    X.P <= M                             (otherwise)
+//
+// Writing the dot products in terms of squared chord lengths (X.A = 1 -
+// XA^2 / 2, etc) and rearranging gives the following bound, where D =
+// min(XA^2, XB^2) and R = sqrt(1 - AB^2 / 4):
+//
+//    XP^2 >= (D - AB^2 / (2 * (1 + R))) / R
+//             >= D - (AB^2 / 4) * (1 + AB^2 / 6)
+//
+// The second form holds for edges shorter than 90 degrees (longer edges are
+// not bounded) and avoids square roots and divisions.  The edges are
+// processed in fixed-size blocks with each coordinate stored in its own
+// array so that the compiler can vectorize the loop.  The error margin
+// covers the rounding errors of both this calculation and
+// S2::UpdateMinDistance (see S2::GetUpdateMinDistanceMaxError), including
+// errors due to input points that are not exactly unit length.
+void S2MinDistancePointTarget::GetEdgeLowerBounds(
+    absl::Span<const S2Shape::Edge> edges, S2MinDistance* bounds) {
+  static const int kBlockSize = 8;
+  double ax[kBlockSize], ay[kBlockSize], az[kBlockSize];
+  double bx[kBlockSize], by[kBlockSize], bz[kBlockSize];
+  double bound2[kBlockSize];
+  const double x = point_.x(), y = point_.y(), z = point_.z();
+  const int num_edges = edges.size();
+  for (int i = 0; i < num_edges; i += kBlockSize) {
+    // The last block is padded by repeating its final edge.
+    int n = std::min(kBlockSize, num_edges - i);
+    for (int j = 0; j < kBlockSize; ++j) {
+      const S2Shape::Edge& edge = edges[i + std::min(j, n - 1)];
+      ax[j] = edge.v0.x(); ay[j] = edge.v0.y(); az[j] = edge.v0.z();
+      bx[j] = edge.v1.x(); by[j] = edge.v1.y(); bz[j] = edge.v1.z();
+    }
+    for (int j = 0; j < kBlockSize; ++j) {
+      double xa2 = ((x - ax[j]) * (x - ax[j]) + (y - ay[j]) * (y - ay[j]) +
+                    (z - az[j]) * (z - az[j]));
+      double xb2 = ((x - bx[j]) * (x - bx[j]) + (y - by[j]) * (y - by[j]) +
+                    (z - bz[j]) * (z - bz[j]));
+      double ab2 = ((ax[j] - bx[j]) * (ax[j] - bx[j]) +
+                    (ay[j] - by[j]) * (ay[j] - by[j]) +
+                    (az[j] - bz[j]) * (az[j] - bz[j]));
+      double d2 = (xa2 < xb2) ? xa2 : xb2;
+      double b2 = d2 - 0.25 * ab2 * (1 + ab2 / 6) -
+                  (32 * (d2 + ab2) + 32) * DBL_EPSILON;
+      b2 = (b2 > 0) ? b2 : 0.0;
+      bound2[j] = (ab2 < 2) ? b2 : 0.0;
+    }
+    for (int j = 0; j < n; ++j) {
+      bounds[i + j] = S2MinDistance(S1ChordAngle::FromLength2(bound2[j]));
+    }
+  }
+}
+
 S2Cap S2MinDistanceEdgeTarget::GetCapBound() {
   // The following computes a radius equal to half the edge length in an
   // efficient and numerically stable way.
@@ -293,3 +361,42 @@ bool S2MinDistanceShapeIndexTarget::VisitContainingShapes(
   }
   return true;
 }
+
+namespace {
+
+// Distance operations used by s2shapeutil::FindClosestEdgePair().
+struct MinDistanceOps {
+  static S2MinDistance GetDistance(const S2Cell& a, const S2Cell& b) {
+    return S2MinDistance(a.GetDistance(b));
+  }
+  static bool UpdateEdgePairDistance(const S2Point& a0, const S2Point& a1,
+                                     const S2Point& b0, const S2Point& b1,
+                                     S2MinDistance* min_dist) {
+    return S2::UpdateEdgePairMinDistance(a0, a1, b0, b1, min_dist);
+  }
+  static S2Point InteriorTestPoint(const S2Point& p) { return p; }
+};
+
+}  // namespace
+
+std::unique_ptr<S2MinDistanceTarget>
+S2MinDistanceShapeIndexTarget::Clone() const {
+  auto target = absl::make_unique<S2MinDistanceShapeIndexTarget>(index_);
+  *target->query_->mutable_options() = query_->options();
+  return std::move(target);
+}
+
+bool S2MinDistanceShapeIndexTarget::supports_index_distance() const {
+  return !use_brute_force();
+}
+
+bool S2MinDistanceShapeIndexTarget::UpdateMinDistanceToIndex(
+    const S2ShapeIndex& query_index, S2MinDistance* min_dist,
+    s2shapeutil::ShapeEdgeId* edge) {
+  // If the target has polygon interiors, the distance is zero whenever a
+  // target polygon contains one of the query edges.
+  s2shapeutil::ShapeEdgeId target_edge;
+  return s2shapeutil::FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      query_index, *index_, include_interiors(),
+      query_->options().max_error(), min_dist, edge, &target_edge);
+}
@@ -25,6 +25,7 @@
 
 #include <memory>
 
+#include "s2/third_party/absl/types/span.h"
 #include "s2/_fp_contract_off.h"
 #include "s2/s1angle.h"
 #include "s2/s1chord_angle.h"
@@ -81,6 +82,9 @@ class S2MinDistancePointTarget : public S2MinDistanceTarget {
                          S2MinDistance* min_dist) final;
   bool VisitContainingShapes(const S2ShapeIndex& index,
                              const ShapeVisitor& visitor) final;
+  bool supports_edge_batches() const final;
+  void GetEdgeLowerBounds(absl::Span<const S2Shape::Edge> edges,
+                          S2MinDistance* bounds) final;
 
  private:
   S2Point point_;
@@ -221,6 +225,11 @@ class S2MinDistanceShapeIndexTarget : public S2MinDistanceTarget {
                          S2MinDistance* min_dist) final;
   bool VisitContainingShapes(const S2ShapeIndex& query_index,
                              const ShapeVisitor& visitor) final;
+  bool supports_index_distance() const final;
+  bool UpdateMinDistanceToIndex(const S2ShapeIndex& query_index,
+                                S2MinDistance* min_dist,
+                                s2shapeutil::ShapeEdgeId* edge) final;
+  std::unique_ptr<S2MinDistanceTarget> Clone() const override;
 
  private:
   bool UpdateMinDistance(S2MinDistanceTarget* target, S2MinDistance* min_dist);
@@ -17,6 +17,7 @@
 
 #include "s2/s2min_distance_targets.h"
 
+#include <cmath>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -27,6 +28,7 @@
 #include "s2/s2cell.h"
 #include "s2/s2edge_distances.h"
 #include "s2/s2shape_index.h"
+#include "s2/s2testing.h"
 #include "s2/s2text_format.h"
 
 using s2textformat::MakeIndexOrDie;
@@ -54,6 +56,49 @@ TEST(PointTarget, UpdateMinDistanceToCellWhenEqual) {
   EXPECT_FALSE(target.UpdateMinDistance(cell, &dist));
 }
 
+TEST(PointTarget, GetEdgeLowerBounds) {
+  // Verifies that the bounds are conservative, i.e. that UpdateMinDistance
+  // never succeeds when "min_dist" is set to the bound, and that they are
+  // reasonably tight for edges that are far away compared to their length.
+  // The batch sizes are chosen so that partial blocks are exercised.
+  for (int iter = 0; iter < 200; ++iter) {
+    S2Point x = S2Testing::RandomPoint();
+    S2MinDistancePointTarget target(x);
+    vector<S2Shape::Edge> edges;
+    int num_edges = S2Testing::rnd.Uniform(20) + 1;
+    for (int i = 0; i < num_edges; ++i) {
+      // Edges have random lengths and distances spanning 9 orders of
+      // magnitude, and some edges touch or pass through the target point.
+      S1Angle dist = S1Angle::Radians(pow(1e-9, S2Testing::rnd.RandDouble()));
+      S1Angle len = S1Angle::Radians(pow(1e-9, S2Testing::rnd.RandDouble()));
+      S2Point a = S2Testing::SamplePoint(S2Cap(x, dist));
+      if (S2Testing::rnd.OneIn(10)) a = x;
+      S2Point b = S2Testing::SamplePoint(S2Cap(a, len));
+      if (S2Testing::rnd.OneIn(10)) b = S2Testing::RandomPoint();
+      if (a != x && S2Testing::rnd.OneIn(10)) {
+        // Make the edge pass through the target point (up to rounding).
+        b = S2::Interpolate(-1.0, x, a);
+      }
+      edges.push_back(S2Shape::Edge(a, b));
+    }
+    vector<S2MinDistance> bounds(num_edges);
+    target.GetEdgeLowerBounds(edges, bounds.data());
+    for (int i = 0; i < num_edges; ++i) {
+      const S2Shape::Edge& edge = edges[i];
+      S2MinDistance dist = bounds[i];
+      EXPECT_FALSE(target.UpdateMinDistance(edge.v0, edge.v1, &dist));
+      S2MinDistance exact = S2MinDistance::Infinity();
+      ASSERT_TRUE(target.UpdateMinDistance(edge.v0, edge.v1, &exact));
+      // (The bounds include a small absolute error margin, so they are only
+      // useful for distances larger than about 1e-7 radians.)
+      if (exact.length2() > 1e-12 &&
+          S1ChordAngle(edge.v0, edge.v1).length2() < 0.01 * exact.length2()) {
+        EXPECT_GE(bounds[i].length2(), 0.5 * exact.length2());
+      }
+    }
+  }
+}
+
 TEST(EdgeTarget, UpdateMinDistanceToEdgeWhenEqual) {
   S2MinDistanceEdgeTarget target(MakePointOrDie("1:0"), MakePointOrDie("1:1"));
   S2MinDistance dist(S1ChordAngle::Infinity());
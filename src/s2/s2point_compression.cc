@@ -31,6 +31,7 @@
 #include "s2/util/coding/coder.h"
 #include "s2/util/coding/nth-derivative.h"
 #include "s2/util/coding/transforms.h"
+#include "s2/util/coding/varint.h"
 #include "s2/util/endian/endian.h"
 
 using absl::Span;
@@ -225,11 +226,10 @@ void EncodeFirstPointFixedLength(const pair<int, int>& vertex_pi_qi,
   S2_DCHECK_GE(encoder->avail(), 0);
 }
 
-void EncodePointCompressed(const pair<int, int>& vertex_pi_qi,
-                           int level,
-                           NthDerivativeCoder* pi_coder,
-                           NthDerivativeCoder* qi_coder,
-                           Encoder* encoder) {
+// Returns the varint64 value that encodes the given vertex.
+uint64 EncodePointCompressed(const pair<int, int>& vertex_pi_qi,
+                             NthDerivativeCoder* pi_coder,
+                             NthDerivativeCoder* qi_coder) {
   // ZigZagEncode, as varint requires the maximum number of bytes for
   // negative numbers.
   const uint32 zig_zag_encoded_deriv_pi =
@@ -237,33 +237,33 @@ void EncodePointCompressed(const pair<int, int>& vertex_pi_qi,
   const uint32 zig_zag_encoded_deriv_qi =
       ZigZagEncode(qi_coder->Encode(vertex_pi_qi.second));
   // Interleave to reduce overhead from two partial bytes to one.
-  const uint64 interleaved_zig_zag_encoded_derivs =
-      util_bits::InterleaveUint32(zig_zag_encoded_deriv_pi,
-                                  zig_zag_encoded_deriv_qi);
-
-  encoder->Ensure(Encoder::kVarintMax64);
-  encoder->put_varint64(interleaved_zig_zag_encoded_derivs);
-  S2_DCHECK_GE(encoder->avail(), 0);
+  return util_bits::InterleaveUint32(zig_zag_encoded_deriv_pi,
+                                     zig_zag_encoded_deriv_qi);
 }
 
 void EncodePointsCompressed(Span<const pair<int, int>> vertices_pi_qi,
                             int level, Encoder* encoder) {
+  if (vertices_pi_qi.empty()) return;
   NthDerivativeCoder pi_coder(kDerivativeEncodingOrder);
   NthDerivativeCoder qi_coder(kDerivativeEncodingOrder);
-  for (int i = 0; i < vertices_pi_qi.size(); ++i) {
-    if (i == 0) {
-      // The first point will be just the (pi, qi) coordinates
-      // of the S2Point.  NthDerivativeCoder will not save anything
-      // in that case, so we encode in fixed format rather than varint
-      // to avoid the varint overhead.
-      EncodeFirstPointFixedLength(vertices_pi_qi[i], level,
-                                  &pi_coder, &qi_coder, encoder);
-    } else {
-      EncodePointCompressed(vertices_pi_qi[i], level,
-                            &pi_coder, &qi_coder, encoder);
-    }
-  }
 
+  // The first point will be just the (pi, qi) coordinates of the S2Point.
+  // NthDerivativeCoder will not save anything in that case, so we encode in
+  // fixed format rather than varint to avoid the varint overhead.
+  EncodeFirstPointFixedLength(vertices_pi_qi[0], level,
+                              &pi_coder, &qi_coder, encoder);
+
+  // The remaining points are encoded as a sequence of varint64s, which are
+  // computed first so that they can be encoded (and decoded) as a batch.
+  absl::FixedArray<uint64> values(vertices_pi_qi.size() - 1);
+  size_t bytes_required = 0;
+  for (int i = 1; i < vertices_pi_qi.size(); ++i) {
+    values[i - 1] = EncodePointCompressed(vertices_pi_qi[i],
+                                          &pi_coder, &qi_coder);
+    bytes_required += Varint::Length64(values[i - 1]);
+  }
+  encoder->Ensure(bytes_required);
+  encoder->put_varint64_array(values.data(), values.size());
   S2_DCHECK_GE(encoder->avail(), 0);
 }
 
@@ -289,16 +289,11 @@ bool DecodeFirstPointFixedLength(Decoder* decoder,
   return true;
 }
 
-bool DecodePointCompressed(Decoder* decoder,
-                           int level,
+// Decodes a vertex from the varint64 value returned by EncodePointCompressed.
+void DecodePointCompressed(uint64 interleaved_zig_zag_encoded_deriv_pi_qi,
                            NthDerivativeCoder* pi_coder,
                            NthDerivativeCoder* qi_coder,
                            pair<int, int>* vertex_pi_qi) {
-  uint64 interleaved_zig_zag_encoded_deriv_pi_qi;
-  if (!decoder->get_varint64(&interleaved_zig_zag_encoded_deriv_pi_qi)) {
-    return false;
-  }
-
   uint32 zig_zag_encoded_deriv_pi, zig_zag_encoded_deriv_qi;
   util_bits::DeinterleaveUint32(interleaved_zig_zag_encoded_deriv_pi_qi,
                                 &zig_zag_encoded_deriv_pi,
@@ -308,8 +303,6 @@ bool DecodePointCompressed(Decoder* decoder,
       pi_coder->Decode(ZigZagDecode(zig_zag_encoded_deriv_pi));
   vertex_pi_qi->second =
       qi_coder->Decode(ZigZagDecode(zig_zag_encoded_deriv_qi));
-
-  return true;
 }
 
 }  // namespace
@@ -352,23 +345,27 @@ bool S2DecodePointsCompressed(Decoder* decoder, int level,
   NthDerivativeCoder pi_coder(kDerivativeEncodingOrder);
   NthDerivativeCoder qi_coder(kDerivativeEncodingOrder);
   Faces::Iterator faces_iterator = faces.GetIterator();
-  for (int i = 0; i < points.size(); ++i) {
+  if (!points.empty()) {
     pair<int, int> vertex_pi_qi;
-    if (i == 0) {
-      if (!DecodeFirstPointFixedLength(decoder, level, &pi_coder, &qi_coder,
-                                       &vertex_pi_qi)) {
-        return false;
-      }
-    } else {
-      if (!DecodePointCompressed(decoder, level, &pi_coder, &qi_coder,
-                                 &vertex_pi_qi)) {
-        return false;
-      }
+    if (!DecodeFirstPointFixedLength(decoder, level, &pi_coder, &qi_coder,
+                                     &vertex_pi_qi)) {
+      return false;
     }
+    points[0] = FacePiQitoXYZ(faces_iterator.Next(), vertex_pi_qi.first,
+                              vertex_pi_qi.second, level);
 
-    int face = faces_iterator.Next();
-    points[i] =
-        FacePiQitoXYZ(face, vertex_pi_qi.first, vertex_pi_qi.second, level);
+    // The remaining points are decoded as a batch of varint64s.
+    absl::FixedArray<uint64> values(points.size() - 1);
+    if (!decoder->get_varint64_array(values.data(), values.size())) {
+      return false;
+    }
+    for (int i = 1; i < points.size(); ++i) {
+      DecodePointCompressed(values[i - 1], &pi_coder, &qi_coder,
+                            &vertex_pi_qi);
+      int face = faces_iterator.Next();
+      points[i] =
+          FacePiQitoXYZ(face, vertex_pi_qi.first, vertex_pi_qi.second, level);
+    }
   }
 
   unsigned int num_off_center;
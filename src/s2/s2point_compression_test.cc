@@ -32,6 +32,7 @@
 #include "s2/third_party/absl/container/fixed_array.h"
 #include "s2/third_party/absl/types/span.h"
 #include "s2/util/coding/coder.h"
+#include "s2/util/coding/varint.h"
 
 using absl::FixedArray;
 using absl::MakeSpan;
@@ -302,4 +303,94 @@ TEST_F(S2PointCompressionTest, FirstPointOnFaceEdge) {
   S2_CHECK(result[1] == points[1].xyz);
 }
 
+// Returns "n" random values whose varint encodings have between 1 and
+// "max_bytes" bytes.
+template <class T>
+vector<T> MakeRandomVarintValues(int n, int max_bytes) {
+  vector<T> values;
+  for (int i = 0; i < n; ++i) {
+    int bits = std::min<int>(8 * sizeof(T),
+                             7 * (1 + S2Testing::rnd.Uniform(max_bytes)));
+    values.push_back(S2Testing::rnd.Rand64() >> (64 - bits));
+  }
+  return values;
+}
+
+template <class T>
+void TestVarintArray(const vector<T>& values) {
+  // The encoder only needs room for the exact encoded size.  The bytes that
+  // follow the buffer must not be modified.
+  size_t encoded_bytes = 0;
+  for (T value : values) encoded_bytes += Varint::Length64(value);
+  const char kGuard = '\x55';
+  vector<char> buffer(encoded_bytes + Varint::kMax64, kGuard);
+  Encoder encoder(buffer.data(), encoded_bytes);
+  if (sizeof(T) == 4) {
+    encoder.put_varint32_array(reinterpret_cast<const uint32*>(values.data()),
+                               values.size());
+  } else {
+    encoder.put_varint64_array(reinterpret_cast<const uint64*>(values.data()),
+                               values.size());
+  }
+  // The encoding must be the same as encoding the values one at a time.
+  Encoder expected_encoder;
+  expected_encoder.Ensure(values.size() * Varint::kMax64);
+  for (T value : values) expected_encoder.put_varint64(value);
+  ASSERT_EQ(string(expected_encoder.base(), expected_encoder.length()),
+            string(encoder.base(), encoder.length()));
+  EXPECT_EQ(0, encoder.avail());
+  for (size_t i = encoded_bytes; i < buffer.size(); ++i) {
+    EXPECT_EQ(kGuard, buffer[i]);
+  }
+
+  vector<T> actual(values.size());
+  Decoder decoder(encoder.base(), encoder.length());
+  bool ok = (sizeof(T) == 4) ?
+      decoder.get_varint32_array(reinterpret_cast<uint32*>(actual.data()),
+                                 actual.size()) :
+      decoder.get_varint64_array(reinterpret_cast<uint64*>(actual.data()),
+                                 actual.size());
+  ASSERT_TRUE(ok);
+  EXPECT_EQ(0, decoder.avail());
+  EXPECT_EQ(values, actual);
+
+  // Decoding fails if the last value is truncated, and the decoder position
+  // is unchanged.
+  if (!values.empty()) {
+    Decoder truncated(encoder.base(), encoder.length() - 1);
+    ok = (sizeof(T) == 4) ?
+        truncated.get_varint32_array(reinterpret_cast<uint32*>(actual.data()),
+                                     actual.size()) :
+        truncated.get_varint64_array(reinterpret_cast<uint64*>(actual.data()),
+                                     actual.size());
+    EXPECT_FALSE(ok);
+    EXPECT_EQ(0, truncated.pos());
+  }
+}
+
+TEST(VarintArray, RoundTrips) {
+  TestVarintArray(vector<uint32>{});
+  TestVarintArray(vector<uint64>{0, 127, 128, ~uint64{0}, 1, 2, 3, 4, 5});
+  TestVarintArray(vector<uint32>{~uint32{0}, 0, 0x7f, 0x3fff, 0x4000});
+  for (int max_bytes = 1; max_bytes <= Varint::kMax64; ++max_bytes) {
+    for (int n : {1, 7, 8, 9, 100}) {
+      TestVarintArray(MakeRandomVarintValues<uint64>(n, max_bytes));
+      TestVarintArray(MakeRandomVarintValues<uint32>(n, max_bytes));
+    }
+  }
+}
+
+TEST(VarintArray, RejectsLongVarint32) {
+  // A 6-byte varint (padded so that the fast path is used) is not a valid
+  // varint32, but it is a valid varint64.
+  const char kData[] = "\x81\x80\x80\x80\x80\x00\x00\x00\x00\x00";
+  uint32 v32[5];
+  Decoder decoder32(kData, sizeof(kData) - 1);
+  EXPECT_FALSE(decoder32.get_varint32_array(v32, 5));
+  uint64 v64[5];
+  Decoder decoder64(kData, sizeof(kData) - 1);
+  EXPECT_TRUE(decoder64.get_varint64_array(v64, 5));
+  EXPECT_EQ(1, v64[0]);
+}
+
 }  // namespace
@@ -18,9 +18,15 @@
 #ifndef S2_S2POINT_INDEX_H_
 #define S2_S2POINT_INDEX_H_
 
+#include <algorithm>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
+#include "s2/third_party/absl/types/span.h"
 #include "s2/util/gtl/btree_map.h"
+#include "s2/parallel_for.h"
+#include "s2/parallel_radix_sort.h"
 #include "s2/s2cell_id.h"
 
 // S2PointIndex maintains an index of points sorted by leaf S2CellId.  Each
@@ -80,6 +86,17 @@
 //     DoSomething(it.id(), it.point(), it.data());
 //   }
 //
+// Large static collections of points can be loaded much more efficiently
+// using the bulk loading constructor, which sorts the points (optionally
+// using multiple threads) and stores them in a flat array rather than a
+// btree.  This "frozen" representation uses less memory and is faster to
+// iterate over, but otherwise the index behaves exactly the same way:
+//
+//   vector<S2PointIndex<int>::PointData> points = ...;
+//   S2PointIndex<int> index(points, 8 /*num_threads*/);
+//
+// An existing index can also be converted by calling Freeze().
+//
 // TODO(ericv): Consider adding an S2PointIndexRegion class, which could be
 // used to efficiently compute coverings of a collection of S2Points.
 //
@@ -116,9 +133,31 @@ class S2PointIndex {
   // Default constructor.
   S2PointIndex();
 
+  // Constructs a frozen index (see Freeze) containing the given points.
+  // This is much faster than calling Add() for each point, especially when
+  // "num_threads" > 1 (in which case the points are sorted by S2CellId using
+  // a parallel radix sort).  Points with the same S2CellId are visited in
+  // the order they were given, just as if Add() had been called for each
+  // point in order.
+  //
+  // REQUIRES: num_threads >= 1
+  explicit S2PointIndex(absl::Span<const PointData> points,
+                        int num_threads = 1);
+
   // Returns the number of points in the index.
   int num_points() const;
 
+  // Converts the index to a compact representation where the points are
+  // stored in a sorted array rather than a btree.  This uses less memory and
+  // makes iteration and Seek() faster.  The index can still be modified, but
+  // the next call to Add() or Remove() converts it back to a btree (which
+  // takes time proportional to the number of points).  Invalidates all
+  // iterators.
+  void Freeze();
+
+  // Returns true if the index uses the frozen representation.
+  bool is_frozen() const { return frozen_; }
+
   // Adds the given point to the index.  Invalidates all iterators.
   void Add(const S2Point& point, const Data& data);
   void Add(const PointData& point_data);
@@ -141,6 +180,7 @@ class S2PointIndex {
  private:
   // Defined here because the Iterator class below uses it.
   using Map = gtl::btree_multimap<S2CellId, PointData>;
+  using Array = std::vector<std::pair<S2CellId, PointData>>;
 
  public:
   class Iterator {
@@ -195,13 +235,25 @@ class S2PointIndex {
     void Seek(S2CellId target);
 
    private:
+    // If the index is frozen then array_ is non-null and pos_ is the current
+    // position within it; otherwise the map_ fields are used.
     const Map* map_;
     typename Map::const_iterator iter_, end_;
+    const Array* array_;
+    typename Array::const_iterator pos_;
   };
 
  private:
   friend class Iterator;
+
+  // Converts a frozen index back to the btree representation.
+  void Unfreeze();
+
+  // The points are stored in map_ unless the index is frozen, in which case
+  // they are stored in array_ (sorted by S2CellId).
   Map map_;
+  Array array_;
+  bool frozen_ = false;
 
   S2PointIndex(const S2PointIndex&) = delete;
   void operator=(const S2PointIndex&) = delete;
@@ -215,13 +267,57 @@ template <class Data>
 S2PointIndex<Data>::S2PointIndex() {
 }
 
+template <class Data>
+S2PointIndex<Data>::S2PointIndex(absl::Span<const PointData> points,
+                                 int num_threads) {
+  S2_DCHECK_GE(num_threads, 1);
+  array_.resize(points.size());
+  const int kChunkSize = 1 << 16;
+  s2parallel::ParallelFor(
+      num_threads, (points.size() + kChunkSize - 1) / kChunkSize,
+      [this, &points, kChunkSize](int c) {
+        size_t begin = static_cast<size_t>(c) * kChunkSize;
+        size_t end = std::min(points.size(), begin + kChunkSize);
+        for (size_t i = begin; i < end; ++i) {
+          array_[i] = std::make_pair(S2CellId(points[i].point()), points[i]);
+        }
+      });
+  using Entry = typename Array::value_type;
+  auto less = [](const Entry& x, const Entry& y) { return x.first < y.first; };
+  if (num_threads == 1) {
+    std::stable_sort(array_.begin(), array_.end(), less);
+  } else {
+    s2parallel::ParallelRadixSort(
+        &array_, [](const Entry& x) { return x.first.id(); }, less,
+        num_threads);
+  }
+  frozen_ = true;
+}
+
 template <class Data>
 inline int S2PointIndex<Data>::num_points() const {
-  return map_.size();
+  return frozen_ ? array_.size() : map_.size();
+}
+
+template <class Data>
+void S2PointIndex<Data>::Freeze() {
+  if (frozen_) return;
+  array_.assign(map_.begin(), map_.end());
+  map_.clear();
+  frozen_ = true;
+}
+
+template <class Data>
+void S2PointIndex<Data>::Unfreeze() {
+  // Since the points are sorted, inserting each point at the end is fast.
+  for (const auto& entry : array_) map_.insert(map_.end(), entry);
+  Array().swap(array_);
+  frozen_ = false;
 }
 
 template <class Data>
 void S2PointIndex<Data>::Add(const PointData& point_data) {
+  if (frozen_) Unfreeze();
   S2CellId id(point_data.point());
   map_.insert(std::make_pair(id, point_data));
 }
@@ -239,6 +335,7 @@ void S2PointIndex<Data>::Add(const S2Point& point) {
 
 template <class Data>
 bool S2PointIndex<Data>::Remove(const PointData& point_data) {
+  if (frozen_) Unfreeze();
   S2CellId id(point_data.point());
   for (typename Map::iterator it = map_.lower_bound(id), end = map_.end();
        it != end && it->first == id; ++it) {
@@ -264,10 +361,13 @@ void S2PointIndex<Data>::Remove(const S2Point& point) {
 template <class Data>
 void S2PointIndex<Data>::Clear() {
   map_.clear();
+  Array().swap(array_);
+  frozen_ = false;
 }
 
 template <class Data>
-inline S2PointIndex<Data>::Iterator::Iterator() : map_(nullptr) {
+inline S2PointIndex<Data>::Iterator::Iterator()
+    : map_(nullptr), array_(nullptr) {
 }
 
 template <class Data>
@@ -282,23 +382,28 @@ inline void S2PointIndex<Data>::Iterator::Init(
   map_ = &index->map_;
   iter_ = map_->begin();
   end_ = map_->end();
+  array_ = index->frozen_ ? &index->array_ : nullptr;
+  if (array_) pos_ = array_->begin();
 }
 
 template <class Data>
 inline S2CellId S2PointIndex<Data>::Iterator::id() const {
   S2_DCHECK(!done());
+  if (array_) return pos_->first;
   return iter_->first;
 }
 
 template <class Data>
 inline const S2Point& S2PointIndex<Data>::Iterator::point() const {
   S2_DCHECK(!done());
+  if (array_) return pos_->second.point();
   return iter_->second.point();
 }
 
 template <class Data>
 inline const Data& S2PointIndex<Data>::Iterator::data() const {
   S2_DCHECK(!done());
+  if (array_) return pos_->second.data();
   return iter_->second.data();
 }
 
@@ -306,40 +411,67 @@ template <class Data>
 inline const typename S2PointIndex<Data>::PointData&
 S2PointIndex<Data>::Iterator::point_data() const {
   S2_DCHECK(!done());
+  if (array_) return pos_->second;
   return iter_->second;
 }
 
 template <class Data>
 inline bool S2PointIndex<Data>::Iterator::done() const {
+  if (array_) return pos_ == array_->end();
   return iter_ == end_;
 }
 
 template <class Data>
 inline void S2PointIndex<Data>::Iterator::Begin() {
-  iter_ = map_->begin();
+  if (array_) {
+    pos_ = array_->begin();
+  } else {
+    iter_ = map_->begin();
+  }
 }
 
 template <class Data>
 inline void S2PointIndex<Data>::Iterator::Finish() {
-  iter_ = end_;
+  if (array_) {
+    pos_ = array_->end();
+  } else {
+    iter_ = end_;
+  }
 }
 
 template <class Data>
 inline void S2PointIndex<Data>::Iterator::Next() {
   S2_DCHECK(!done());
-  ++iter_;
+  if (array_) {
+    ++pos_;
+  } else {
+    ++iter_;
+  }
 }
 
 template <class Data>
 inline bool S2PointIndex<Data>::Iterator::Prev() {
-  if (iter_ == map_->begin()) return false;
-  --iter_;
+  if (array_) {
+    if (pos_ == array_->begin()) return false;
+    --pos_;
+  } else {
+    if (iter_ == map_->begin()) return false;
+    --iter_;
+  }
   return true;
 }
 
 template <class Data>
 inline void S2PointIndex<Data>::Iterator::Seek(S2CellId target) {
-  iter_ = map_->lower_bound(target);
+  if (array_) {
+    pos_ = std::lower_bound(
+        array_->begin(), array_->end(), target,
+        [](const typename Array::value_type& x, S2CellId y) {
+          return x.first < y;
+        });
+  } else {
+    iter_ = map_->lower_bound(target);
+  }
 }
 
 #endif  // S2_S2POINT_INDEX_H_
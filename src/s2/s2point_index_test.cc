@@ -18,12 +18,15 @@
 #include "s2/s2point_index.h"
 
 #include <set>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "s2/s2cell_id.h"
 #include "s2/s2cell_union.h"
 #include "s2/s2testing.h"
 
+using std::vector;
+
 class S2PointIndexTest : public ::testing::Test {
  protected:
   using Index = S2PointIndex<int>;
@@ -145,3 +148,51 @@ TEST(S2PointIndex, EmptyData) {
   index.Remove(S2Point(1, 0, 0));
   EXPECT_EQ(0, index.num_points());
 }
+
+TEST_F(S2PointIndexTest, FrozenRandomPoints) {
+  for (int i = 0; i < 100; ++i) {
+    Add(S2Testing::RandomPoint(), S2Testing::rnd.Uniform(100));
+  }
+  index_.Freeze();
+  EXPECT_TRUE(index_.is_frozen());
+  Verify();
+  // Removing a point converts the index back to the btree representation.
+  S2PointIndex<int>::Iterator it(&index_);
+  Remove(it.point(), it.data());
+  EXPECT_FALSE(index_.is_frozen());
+  Verify();
+  Add(S2Testing::RandomPoint(), 100);
+  index_.Freeze();
+  Verify();
+}
+
+TEST(S2PointIndex, BulkLoad) {
+  // Verifies that the bulk loading constructor yields the same iteration
+  // order as calling Add() for each point (including the order of points
+  // with the same S2CellId).
+  const int kNumPoints = 100000;
+  using PointData = S2PointIndex<int>::PointData;
+  vector<PointData> points;
+  for (int i = 0; i < kNumPoints; ++i) {
+    S2Point point = S2Testing::RandomPoint();
+    if (i > 0 && S2Testing::rnd.OneIn(10)) point = points.back().point();
+    points.push_back(PointData(point, i));
+  }
+  S2PointIndex<int> index;
+  for (const PointData& point_data : points) index.Add(point_data);
+  vector<PointData> expected;
+  for (S2PointIndex<int>::Iterator it(&index); !it.done(); it.Next()) {
+    expected.push_back(it.point_data());
+  }
+  for (int num_threads : {1, 4}) {
+    S2PointIndex<int> frozen_index(points, num_threads);
+    EXPECT_TRUE(frozen_index.is_frozen());
+    EXPECT_EQ(kNumPoints, frozen_index.num_points());
+    vector<PointData> actual;
+    for (S2PointIndex<int>::Iterator it(&frozen_index); !it.done();
+         it.Next()) {
+      actual.push_back(it.point_data());
+    }
+    EXPECT_TRUE(expected == actual);
+  }
+}
@@ -17,6 +17,8 @@
 
 #include "s2/s2shape_index.h"
 
+#include <algorithm>
+
 bool S2ClippedShape::ContainsEdge(int id) const {
   // Linear search is fast because the number of edges per shape is typically
   // very small (less than 10).
@@ -28,9 +30,11 @@ bool S2ClippedShape::ContainsEdge(int id) const {
 
 S2ShapeIndexCell::~S2ShapeIndexCell() {
   // Free memory for all shapes owned by this cell.
-  for (S2ClippedShape& s : shapes_)
-    s.Destruct();
-  shapes_.clear();
+  if (!owns_data_) return;
+  for (int i = 0; i < num_shapes_; ++i) {
+    shapes_[i].Destruct();
+  }
+  delete[] shapes_;
 }
 
 const S2ClippedShape*
@@ -38,8 +42,8 @@ S2ShapeIndexCell::find_clipped(int shape_id) const {
   // Linear search is fine because the number of shapes per cell is typically
   // very small (most often 1), and is large only for pathological inputs
   // (e.g. very deeply nested loops).
-  for (const auto& s : shapes_) {
-    if (s.shape_id() == shape_id) return &s;
+  for (int i = 0; i < num_shapes_; ++i) {
+    if (shapes_[i].shape_id() == shape_id) return &shapes_[i];
   }
   return nullptr;
 }
@@ -48,10 +52,23 @@ S2ShapeIndexCell::find_clipped(int shape_id) const {
 // pointer to the first new clipped shape.  Expects that all new clipped
 // shapes will have a larger shape id than any current shape, and that shapes
 // will be added in increasing shape id order.
+//
+// Exactly the required space is allocated, since all the clipped shapes of a
+// cell are normally added by a single call.  The new clipped shapes are
+// value-initialized (i.e., they have no edges) so that the cell can be
+// destroyed safely even if they are never set (e.g. if decoding fails).
 S2ClippedShape* S2ShapeIndexCell::add_shapes(int n) {
-  int size = shapes_.size();
-  shapes_.resize(size + n);
-  return &shapes_[size];
+  S2_DCHECK(owns_data_);
+  int size = num_shapes_ + n;
+  if (size > capacity_) {
+    S2ClippedShape* shapes = new S2ClippedShape[size]();
+    std::copy(shapes_, shapes_ + num_shapes_, shapes);
+    delete[] shapes_;
+    shapes_ = shapes;
+    capacity_ = size;
+  }
+  num_shapes_ = size;
+  return &shapes_[num_shapes_ - n];
 }
 
 void S2ShapeIndexCell::Encode(int num_shape_ids, Encoder* encoder) const {
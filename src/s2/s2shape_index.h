@@ -41,7 +41,6 @@
 #include "s2/third_party/absl/base/macros.h"
 #include "s2/third_party/absl/base/thread_annotations.h"
 #include "s2/third_party/absl/memory/memory.h"
-#include "s2/util/gtl/compact_array.h"
 
 class R1Interval;
 class S2PaddedCell;
@@ -109,11 +108,12 @@ class S2ClippedShape {
 // It consists of a set of clipped shapes.
 class S2ShapeIndexCell {
  public:
-  S2ShapeIndexCell() {}
+  S2ShapeIndexCell()
+      : shapes_(nullptr), num_shapes_(0), capacity_(0), owns_data_(true) {}
   ~S2ShapeIndexCell();
 
   // Returns the number of clipped shapes in this cell.
-  int num_clipped() const { return shapes_.size(); }
+  int num_clipped() const { return num_shapes_; }
 
   // Returns the clipped shape at the given index.  Shapes are kept sorted in
   // increasing order of shape id.
@@ -153,8 +153,16 @@ class S2ShapeIndexCell {
   static bool DecodeEdges(int num_edges, S2ClippedShape* clipped,
                           Decoder* decoder);
 
-  using S2ClippedShapeSet = gtl::compact_array<S2ClippedShape>;
-  S2ClippedShapeSet shapes_;
+  // The clipped shapes, sorted by shape id.  Normally the cell owns this
+  // array and the edge arrays of its clipped shapes.  If "owns_data_" is
+  // false, then the cell and all of its data were allocated from an arena
+  // owned by MutableS2ShapeIndex, and the cell must not be deleted.
+  // "capacity_" is the allocated length of "shapes_".  The two fields share
+  // a word so that the cell is no larger than a pointer plus 8 bytes.
+  S2ClippedShape* shapes_;
+  int32 num_shapes_;
+  uint32 capacity_ : 31;
+  uint32 owns_data_ : 1;
 
   S2ShapeIndexCell(const S2ShapeIndexCell&) = delete;
   void operator=(const S2ShapeIndexCell&) = delete;
@@ -411,6 +419,11 @@ class S2ShapeIndex {
       return IteratorBase::LocateImpl(target, this);
     }
 
+    // Indicates that the cells previously returned by cell() are no longer
+    // in use (see IteratorBase::ReleaseCells).  Returns false if the
+    // iterator has not been initialized.
+    bool ReleaseCells() { return iter_ != nullptr && iter_->ReleaseCells(); }
+
    private:
     // Although S2ShapeIndex::Iterator can be used to iterate over any
     // index subtype, it is more efficient to use the subtype's iterator when
@@ -506,6 +519,14 @@ class S2ShapeIndex {
     // positioned arbitrarily.
     virtual CellRelation Locate(S2CellId target) = 0;
 
+    // Indicates that the cells previously returned by cell() are no longer
+    // in use, so that an index that decodes cells on demand may free them.
+    // Returns true if such cells may have been freed, in which case any
+    // pointers to them must be discarded.  The iterator remains positioned
+    // at the same cell.  This is useful for iterators that are kept between
+    // queries (see EncodedS2ShapeIndex::CellCacheOptions).
+    virtual bool ReleaseCells() { return false; }
+
    protected:
     IteratorBase() : id_(S2CellId::Sentinel()), cell_(nullptr) {}
 
@@ -22,3 +22,9 @@
 // TODO(ericv): Add tests for S2ShapeIndexCell and S2ClippedShape.
 // (Currently these are tested indirectly by MutableS2ShapeIndex.)
 // Also test the base Iterator type (which wraps another iterator).
+
+TEST(S2ShapeIndexCell, IsCompact) {
+  // The cell consists of a pointer to its clipped shapes, the number of
+  // clipped shapes, and the capacity (which shares a word with a flag).
+  EXPECT_EQ(sizeof(void*) + 8, sizeof(S2ShapeIndexCell));
+}
@@ -0,0 +1,349 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef S2_S2SHAPEUTIL_CLOSEST_EDGE_PAIR_H_
+#define S2_S2SHAPEUTIL_CLOSEST_EDGE_PAIR_H_
+
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "s2/s2cell.h"
+#include "s2/s2cell_id.h"
+#include "s2/s2contains_point_query.h"
+#include "s2/s2shape.h"
+#include "s2/s2shape_index.h"
+#include "s2/s2shapeutil_shape_edge_id.h"
+#include "s2/third_party/absl/container/inlined_vector.h"
+#include "s2/util/gtl/btree_set.h"
+
+namespace s2shapeutil {
+
+// Finds the closest pair of edges (a, b) such that "a" belongs to "a_index"
+// and "b" belongs to "b_index", where "closest" is defined by the Distance
+// type (e.g., S2MinDistance or S2MaxDistance).  If the distance between some
+// pair of edges is less than "min_dist", updates "min_dist", sets "a_edge"
+// and "b_edge" to the corresponding edges, and returns true.  Otherwise
+// returns false.
+//
+// If "include_interiors" is true, the distance is also zero (as defined by
+// DistanceOps::InteriorTestPoint) whenever a polygon of "b_index" contains
+// an edge of "a_index".  In that case "b_edge" is set to the polygon's shape
+// id and an edge id of -1.  Only the "a" cells that the traversal reaches
+// are tested, so polygons far from "a_index" cost nothing.
+//
+// The algorithm walks the cell hierarchies of both indexes at once
+// (a "dual-tree" branch-and-bound search).  Pairs of cells are kept in a
+// priority queue ordered by a lower bound on the distance between them, and
+// the larger cell of each pair is subdivided until both cells are
+// S2ShapeIndexCells, at which point their edges are compared directly.  Each
+// cell is shrunk to the smallest S2CellId that contains all of its index
+// cells, which tightens the lower bounds considerably.
+//
+// If "max_error" is non-zero, the search terminates as soon as the best
+// possible further improvement is less than "max_error".
+//
+// "DistanceOps" must provide the following static methods:
+//
+//   // Returns a lower bound on the distance between the two cells.
+//   static Distance GetDistance(const S2Cell& a, const S2Cell& b);
+//
+//   // If the distance between the two edges is less than "min_dist",
+//   // updates "min_dist" and returns true.  Otherwise returns false.
+//   static bool UpdateEdgePairDistance(const S2Point& a0, const S2Point& a1,
+//                                      const S2Point& b0, const S2Point& b1,
+//                                      Distance* min_dist);
+//
+//   // Returns a point such that the distance to "p" is Distance::Zero() if
+//   // the point is contained by a polygon (e.g., "p" itself for minimum
+//   // distances, or its antipode for maximum distances).
+//   static S2Point InteriorTestPoint(const S2Point& p);
+template <class Distance, class DistanceOps>
+bool FindClosestEdgePair(const S2ShapeIndex& a_index,
+                         const S2ShapeIndex& b_index,
+                         bool include_interiors,
+                         typename Distance::Delta max_error,
+                         Distance* min_dist,
+                         ShapeEdgeId* a_edge, ShapeEdgeId* b_edge);
+
+
+//////////////////   Implementation details follow   ////////////////////
+
+
+namespace internal {
+
+template <class Distance, class DistanceOps>
+class ClosestEdgePairFinder {
+ public:
+  using Delta = typename Distance::Delta;
+
+  ClosestEdgePairFinder(const S2ShapeIndex& a_index,
+                        const S2ShapeIndex& b_index, bool include_interiors,
+                        Delta max_error, Distance* min_dist,
+                        ShapeEdgeId* a_edge, ShapeEdgeId* b_edge)
+      : a_index_(a_index), b_index_(b_index),
+        a_iter_(&a_index, S2ShapeIndex::UNPOSITIONED),
+        b_iter_(&b_index, S2ShapeIndex::UNPOSITIONED),
+        include_interiors_(include_interiors),
+        max_error_(max_error), min_dist_(min_dist),
+        a_edge_(a_edge), b_edge_(b_edge), distance_limit_(*min_dist) {
+    if (include_interiors_) contains_query_.Init(&b_index);
+  }
+
+  bool Run();
+
+ private:
+  // A cell of one of the two indexes.  "index_cell" is non-null if the cell
+  // is an S2ShapeIndexCell, and otherwise the cell contains at least two
+  // S2ShapeIndexCells.
+  struct Node {
+    S2Cell cell;
+    const S2ShapeIndexCell* index_cell;
+  };
+
+  struct QueueEntry {
+    // A lower bound on the distance between "a" and "b".  This is the key of
+    // the priority queue.
+    Distance distance;
+    Node a, b;
+
+    QueueEntry(Distance _distance, const Node& _a, const Node& _b)
+        : distance(_distance), a(_a), b(_b) {
+    }
+    bool operator<(const QueueEntry& other) const {
+      // The priority queue returns the largest elements first, so we want the
+      // "largest" entry to have the smallest distance.
+      return other.distance < distance;
+    }
+  };
+
+  bool MakeNode(S2CellId id, S2ShapeIndex::Iterator* it, Node* node);
+  void GetChildren(const Node& node, S2ShapeIndex::Iterator* it,
+                   absl::InlinedVector<Node, 4>* children);
+  void MaybeEnqueue(const Node& a, const Node& b);
+  void ProcessEdges(const QueueEntry& entry);
+  bool ProcessInteriors(const QueueEntry& entry);
+
+  const S2ShapeIndex& a_index_;
+  const S2ShapeIndex& b_index_;
+  S2ShapeIndex::Iterator a_iter_, b_iter_;
+  bool include_interiors_;
+  Delta max_error_;
+  Distance* min_dist_;
+  ShapeEdgeId* a_edge_;
+  ShapeEdgeId* b_edge_;
+
+  // The distance beyond which cell pairs can be discarded.  Initially this is
+  // "*min_dist", and once a closer edge pair is found it is reduced to that
+  // distance minus "max_error".
+  Distance distance_limit_;
+  bool found_ = false;
+
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>> queue_;
+
+  // The edges of the current "b" index cell (see ProcessEdges).
+  std::vector<std::pair<S2Shape::Edge, ShapeEdgeId>> b_edges_;
+
+  // Used to test whether the polygons of "b_index" contain the edges of the
+  // "a" cells whose ids are in tested_a_cells_ (see ProcessInteriors).
+  S2ContainsPointQuery<S2ShapeIndex> contains_query_;
+  gtl::btree_set<S2CellId> tested_a_cells_;
+};
+
+// Sets "node" to the smallest cell that contains all the index cells
+// descending from "id", and returns false if there are no such cells.
+template <class Distance, class DistanceOps>
+bool ClosestEdgePairFinder<Distance, DistanceOps>::MakeNode(
+    S2CellId id, S2ShapeIndex::Iterator* it, Node* node) {
+  it->Seek(id.range_min());
+  if (it->done() || it->id() > id.range_max()) return false;
+  S2CellId first = it->id();
+  const S2ShapeIndexCell* first_cell = &it->cell();
+  it->Seek(id.range_max().next());
+  it->Prev();
+  if (it->id() == first) {
+    *node = Node{S2Cell(first), first_cell};
+  } else {
+    int level = first.GetCommonAncestorLevel(it->id());
+    *node = Node{S2Cell(first.parent(level)), nullptr};
+  }
+  return true;
+}
+
+template <class Distance, class DistanceOps>
+void ClosestEdgePairFinder<Distance, DistanceOps>::GetChildren(
+    const Node& node, S2ShapeIndex::Iterator* it,
+    absl::InlinedVector<Node, 4>* children) {
+  children->clear();
+  Node child;
+  for (S2CellId id = node.cell.id().child_begin();
+       id != node.cell.id().child_end(); id = id.next()) {
+    if (MakeNode(id, it, &child)) children->push_back(child);
+  }
+}
+
+template <class Distance, class DistanceOps>
+void ClosestEdgePairFinder<Distance, DistanceOps>::MaybeEnqueue(
+    const Node& a, const Node& b) {
+  Distance distance = DistanceOps::GetDistance(a.cell, b.cell);
+  if (distance < distance_limit_) queue_.push(QueueEntry(distance, a, b));
+}
+
+template <class Distance, class DistanceOps>
+bool ClosestEdgePairFinder<Distance, DistanceOps>::Run() {
+  // The top-level nodes of each index (at most one per cube face).
+  absl::InlinedVector<Node, 6> a_top, b_top;
+  Node node;
+  for (int face = 0; face < 6; ++face) {
+    S2CellId id = S2CellId::FromFace(face);
+    if (MakeNode(id, &a_iter_, &node)) a_top.push_back(node);
+    if (MakeNode(id, &b_iter_, &node)) b_top.push_back(node);
+  }
+  for (const Node& a : a_top) {
+    for (const Node& b : b_top) MaybeEnqueue(a, b);
+  }
+  absl::InlinedVector<Node, 4> children;
+  while (!queue_.empty()) {
+    QueueEntry entry = queue_.top();
+    queue_.pop();
+    if (!(entry.distance < distance_limit_)) break;
+    if (entry.a.index_cell && entry.b.index_cell) {
+      ProcessEdges(entry);
+      continue;
+    }
+    // Subdivide whichever cell is larger (or the only one that can be
+    // subdivided) and pair its children with the other cell.
+    bool split_a = (entry.b.index_cell != nullptr ||
+                    (entry.a.index_cell == nullptr &&
+                     entry.a.cell.level() <= entry.b.cell.level()));
+    if (split_a) {
+      GetChildren(entry.a, &a_iter_, &children);
+      for (const Node& child : children) MaybeEnqueue(child, entry.b);
+    } else {
+      GetChildren(entry.b, &b_iter_, &children);
+      for (const Node& child : children) MaybeEnqueue(entry.a, child);
+    }
+  }
+  return found_;
+}
+
+template <class Distance, class DistanceOps>
+void ClosestEdgePairFinder<Distance, DistanceOps>::ProcessEdges(
+    const QueueEntry& entry) {
+  if (include_interiors_ && ProcessInteriors(entry)) return;
+  b_edges_.clear();
+  const S2ShapeIndexCell& b_cell = *entry.b.index_cell;
+  for (int s = 0; s < b_cell.num_clipped(); ++s) {
+    const S2ClippedShape& clipped = b_cell.clipped(s);
+    const S2Shape* shape = b_index_.shape(clipped.shape_id());
+    for (int j = 0; j < clipped.num_edges(); ++j) {
+      int edge_id = clipped.edge(j);
+      b_edges_.push_back(std::make_pair(
+          shape->edge(edge_id), ShapeEdgeId(shape->id(), edge_id)));
+    }
+  }
+  if (b_edges_.empty()) return;
+
+  const S2ShapeIndexCell& a_cell = *entry.a.index_cell;
+  for (int s = 0; s < a_cell.num_clipped(); ++s) {
+    const S2ClippedShape& clipped = a_cell.clipped(s);
+    const S2Shape* shape = a_index_.shape(clipped.shape_id());
+    for (int j = 0; j < clipped.num_edges(); ++j) {
+      int edge_id = clipped.edge(j);
+      S2Shape::Edge a = shape->edge(edge_id);
+      for (const auto& b : b_edges_) {
+        Distance distance = distance_limit_;
+        if (DistanceOps::UpdateEdgePairDistance(a.v0, a.v1, b.first.v0,
+                                                b.first.v1, &distance)) {
+          *min_dist_ = distance;
+          *a_edge_ = ShapeEdgeId(shape->id(), edge_id);
+          *b_edge_ = b.second;
+          found_ = true;
+          distance_limit_ = distance - max_error_;
+          if (distance_limit_ == Distance::Zero()) return;
+        }
+      }
+    }
+  }
+}
+
+// If the "b" cell contains part of a polygon and the edges of the "a" cell
+// have not been tested yet, tests whether any of them is contained by a
+// polygon of b_index_.  Returns true if so, in which case the distance is
+// zero and the search is finished.
+//
+// Every point contained by a polygon belongs to some index cell that
+// contains part of that polygon, so a contained edge is always found once
+// the traversal reaches its cell.  It is sufficient to test one vertex per
+// edge, since edges that are only partly contained cross a polygon edge.
+template <class Distance, class DistanceOps>
+bool ClosestEdgePairFinder<Distance, DistanceOps>::ProcessInteriors(
+    const QueueEntry& entry) {
+  const S2ShapeIndexCell& b_cell = *entry.b.index_cell;
+  bool has_polygon = false;
+  for (int s = 0; s < b_cell.num_clipped(); ++s) {
+    if (b_index_.shape(b_cell.clipped(s).shape_id())->dimension() == 2) {
+      has_polygon = true;
+      break;
+    }
+  }
+  if (!has_polygon || !tested_a_cells_.insert(entry.a.cell.id()).second) {
+    return false;
+  }
+  const S2ShapeIndexCell& a_cell = *entry.a.index_cell;
+  for (int s = 0; s < a_cell.num_clipped(); ++s) {
+    const S2ClippedShape& clipped = a_cell.clipped(s);
+    const S2Shape* shape = a_index_.shape(clipped.shape_id());
+    for (int j = 0; j < clipped.num_edges(); ++j) {
+      int edge_id = clipped.edge(j);
+      S2Point p = DistanceOps::InteriorTestPoint(shape->edge(edge_id).v0);
+      int polygon_id = -1;
+      contains_query_.VisitContainingShapes(
+          p, [&polygon_id](S2Shape* polygon) {
+            polygon_id = polygon->id();
+            return false;
+          });
+      if (polygon_id >= 0) {
+        *min_dist_ = Distance::Zero();
+        *a_edge_ = ShapeEdgeId(shape->id(), edge_id);
+        *b_edge_ = ShapeEdgeId(polygon_id, -1);
+        found_ = true;
+        distance_limit_ = Distance::Zero();
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace internal
+
+template <class Distance, class DistanceOps>
+bool FindClosestEdgePair(const S2ShapeIndex& a_index,
+                         const S2ShapeIndex& b_index,
+                         bool include_interiors,
+                         typename Distance::Delta max_error,
+                         Distance* min_dist,
+                         ShapeEdgeId* a_edge, ShapeEdgeId* b_edge) {
+  if (*min_dist == Distance::Zero()) return false;
+  internal::ClosestEdgePairFinder<Distance, DistanceOps> finder(
+      a_index, b_index, include_interiors, max_error, min_dist, a_edge,
+      b_edge);
+  return finder.Run();
+}
+
+}  // namespace s2shapeutil
+
+#endif  // S2_S2SHAPEUTIL_CLOSEST_EDGE_PAIR_H_
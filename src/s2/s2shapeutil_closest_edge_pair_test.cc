@@ -0,0 +1,237 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/s2shapeutil_closest_edge_pair.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "s2/mutable_s2shape_index.h"
+#include "s2/s1angle.h"
+#include "s2/s1chord_angle.h"
+#include "s2/s2cap.h"
+#include "s2/s2closest_edge_query_testing.h"
+#include "s2/s2edge_distances.h"
+#include "s2/s2max_distance_targets.h"
+#include "s2/s2min_distance_targets.h"
+#include "s2/s2testing.h"
+#include "s2/s2text_format.h"
+
+using s2shapeutil::FindClosestEdgePair;
+using s2shapeutil::ShapeEdgeId;
+using std::vector;
+
+namespace {
+
+struct MinDistanceOps {
+  static S2MinDistance GetDistance(const S2Cell& a, const S2Cell& b) {
+    return S2MinDistance(a.GetDistance(b));
+  }
+  static bool UpdateEdgePairDistance(const S2Point& a0, const S2Point& a1,
+                                     const S2Point& b0, const S2Point& b1,
+                                     S2MinDistance* min_dist) {
+    return S2::UpdateEdgePairMinDistance(a0, a1, b0, b1, min_dist);
+  }
+  static S2Point InteriorTestPoint(const S2Point& p) { return p; }
+};
+
+struct MaxDistanceOps {
+  static S2MaxDistance GetDistance(const S2Cell& a, const S2Cell& b) {
+    return S2MaxDistance(a.GetMaxDistance(b));
+  }
+  static bool UpdateEdgePairDistance(const S2Point& a0, const S2Point& a1,
+                                     const S2Point& b0, const S2Point& b1,
+                                     S2MaxDistance* min_dist) {
+    S1ChordAngle dist(*min_dist);
+    if (!S2::UpdateEdgePairMaxDistance(a0, a1, b0, b1, &dist)) return false;
+    *min_dist = S2MaxDistance(dist);
+    return true;
+  }
+  static S2Point InteriorTestPoint(const S2Point& p) { return -p; }
+};
+
+// Returns the distance between the closest pair of edges by brute force.
+template <class Distance, class DistanceOps>
+Distance GetBruteForceDistance(const S2ShapeIndex& a_index,
+                               const S2ShapeIndex& b_index) {
+  Distance min_dist = Distance::Infinity();
+  for (S2Shape* a_shape : a_index) {
+    for (int i = 0; i < a_shape->num_edges(); ++i) {
+      S2Shape::Edge a = a_shape->edge(i);
+      for (S2Shape* b_shape : b_index) {
+        for (int j = 0; j < b_shape->num_edges(); ++j) {
+          S2Shape::Edge b = b_shape->edge(j);
+          DistanceOps::UpdateEdgePairDistance(a.v0, a.v1, b.v0, b.v1,
+                                              &min_dist);
+        }
+      }
+    }
+  }
+  return min_dist;
+}
+
+// Returns the distance between the two given edges.
+template <class Distance, class DistanceOps>
+Distance GetEdgePairDistance(const S2ShapeIndex& a_index, ShapeEdgeId a_id,
+                             const S2ShapeIndex& b_index, ShapeEdgeId b_id) {
+  S2Shape::Edge a = a_index.shape(a_id.shape_id)->edge(a_id.edge_id);
+  S2Shape::Edge b = b_index.shape(b_id.shape_id)->edge(b_id.edge_id);
+  Distance dist = Distance::Infinity();
+  DistanceOps::UpdateEdgePairDistance(a.v0, a.v1, b.v0, b.v1, &dist);
+  return dist;
+}
+
+// Builds pairs of nearby indexes using the given factory and verifies that
+// FindClosestEdgePair() agrees with the brute force algorithm.
+template <class Distance, class DistanceOps>
+void TestWithIndexFactory(const s2testing::ShapeIndexFactory& factory,
+                          int num_edges, int num_iterations) {
+  const S1Angle kRadius = S2Testing::KmToAngle(10);
+  for (int iter = 0; iter < num_iterations; ++iter) {
+    S2Testing::rnd.Reset(FLAGS_s2_random_seed + iter);
+    S2Point center = S2Testing::RandomPoint();
+    MutableS2ShapeIndex a_index, b_index;
+    factory.AddEdges(S2Cap(center, kRadius), num_edges, &a_index);
+    factory.AddEdges(S2Cap(S2Testing::SamplePoint(S2Cap(center, 3 * kRadius)),
+                           kRadius), num_edges, &b_index);
+    Distance expected = GetBruteForceDistance<Distance, DistanceOps>(
+        a_index, b_index);
+
+    Distance min_dist = Distance::Infinity();
+    ShapeEdgeId a_edge, b_edge;
+    ASSERT_TRUE((FindClosestEdgePair<Distance, DistanceOps>(
+        a_index, b_index, false, S1ChordAngle::Zero(), &min_dist, &a_edge,
+        &b_edge)));
+    EXPECT_EQ(expected, min_dist) << iter;
+    EXPECT_EQ(min_dist, (GetEdgePairDistance<Distance, DistanceOps>(
+        a_index, a_edge, b_index, b_edge)));
+
+    // No pair of edges is closer than the exact distance.
+    Distance limit = min_dist;
+    EXPECT_FALSE((FindClosestEdgePair<Distance, DistanceOps>(
+        a_index, b_index, false, S1ChordAngle::Zero(), &limit, &a_edge,
+        &b_edge)));
+
+    // The result is within "max_error" of the exact distance.
+    S1ChordAngle max_error(0.1 * kRadius);
+    Distance approx = Distance::Infinity();
+    ASSERT_TRUE((FindClosestEdgePair<Distance, DistanceOps>(
+        a_index, b_index, false, max_error, &approx, &a_edge, &b_edge)));
+    EXPECT_FALSE(approx < expected);
+    EXPECT_FALSE(expected < approx - max_error);
+  }
+}
+
+TEST(FindClosestEdgePair, EmptyIndex) {
+  MutableS2ShapeIndex empty_index;
+  auto index = s2textformat::MakeIndexOrDie("0:0 | 1:1 # 2:2, 3:3 #");
+  S2MinDistance min_dist = S2MinDistance::Infinity();
+  ShapeEdgeId a_edge, b_edge;
+  EXPECT_FALSE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      empty_index, *index, false, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_FALSE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      *index, empty_index, false, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_EQ(S2MinDistance::Infinity(), min_dist);
+}
+
+TEST(FindClosestEdgePair, CrossingEdges) {
+  auto a_index = s2textformat::MakeIndexOrDie("# 0:0, 2:2 #");
+  auto b_index = s2textformat::MakeIndexOrDie("5:5 # 0:2, 2:0 #");
+  S2MinDistance min_dist = S2MinDistance::Infinity();
+  ShapeEdgeId a_edge, b_edge;
+  EXPECT_TRUE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      *a_index, *b_index, false, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_EQ(S2MinDistance::Zero(), min_dist);
+  EXPECT_EQ(ShapeEdgeId(0, 0), a_edge);
+  EXPECT_EQ(ShapeEdgeId(1, 0), b_edge);
+}
+
+TEST(FindClosestEdgePair, MinDistanceFractalEdges) {
+  TestWithIndexFactory<S2MinDistance, MinDistanceOps>(
+      s2testing::FractalLoopShapeIndexFactory(), 200, 10);
+}
+
+TEST(FindClosestEdgePair, MinDistancePointCloudEdges) {
+  TestWithIndexFactory<S2MinDistance, MinDistanceOps>(
+      s2testing::PointCloudShapeIndexFactory(), 200, 10);
+}
+
+TEST(FindClosestEdgePair, MaxDistanceFractalEdges) {
+  TestWithIndexFactory<S2MaxDistance, MaxDistanceOps>(
+      s2testing::FractalLoopShapeIndexFactory(), 200, 10);
+}
+
+TEST(FindClosestEdgePair, MaxDistancePointCloudEdges) {
+  TestWithIndexFactory<S2MaxDistance, MaxDistanceOps>(
+      s2testing::PointCloudShapeIndexFactory(), 200, 10);
+}
+
+TEST(FindClosestEdgePair, PolygonContainsEdge) {
+  auto a_index = s2textformat::MakeIndexOrDie("# 0:0, 0:1 | 10:10, 10:11 #");
+  auto b_index = s2textformat::MakeIndexOrDie("# # 9:9, 9:12, 12:12, 12:9");
+  S2MinDistance min_dist = S2MinDistance::Infinity();
+  ShapeEdgeId a_edge, b_edge;
+  EXPECT_TRUE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      *a_index, *b_index, true, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_EQ(S2MinDistance::Zero(), min_dist);
+  EXPECT_EQ(ShapeEdgeId(1, 0), a_edge);
+  EXPECT_EQ(ShapeEdgeId(0, -1), b_edge);
+
+  // Without interiors, only the polygon edges are considered.
+  min_dist = S2MinDistance::Infinity();
+  EXPECT_TRUE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      *a_index, *b_index, false, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_LT(S2MinDistance::Zero(), min_dist);
+
+  // The antipodal reflection of the edges is not contained.
+  S2MaxDistance max_dist = S2MaxDistance::Infinity();
+  EXPECT_TRUE((FindClosestEdgePair<S2MaxDistance, MaxDistanceOps>(
+      *a_index, *b_index, true, S1ChordAngle::Zero(), &max_dist, &a_edge,
+      &b_edge)));
+  EXPECT_LT(S2MaxDistance::Zero(), max_dist);
+}
+
+TEST(FindClosestEdgePair, PolygonContainsReflectedEdge) {
+  auto a_index = s2textformat::MakeIndexOrDie("# -10:-170, -10:-169 #");
+  auto b_index = s2textformat::MakeIndexOrDie("# # 9:9, 9:12, 12:12, 12:9");
+  S2MaxDistance max_dist = S2MaxDistance::Infinity();
+  ShapeEdgeId a_edge, b_edge;
+  EXPECT_TRUE((FindClosestEdgePair<S2MaxDistance, MaxDistanceOps>(
+      *a_index, *b_index, true, S1ChordAngle::Zero(), &max_dist, &a_edge,
+      &b_edge)));
+  EXPECT_EQ(S2MaxDistance::Zero(), max_dist);
+  EXPECT_EQ(ShapeEdgeId(0, 0), a_edge);
+  EXPECT_EQ(ShapeEdgeId(0, -1), b_edge);
+}
+
+TEST(FindClosestEdgePair, PolygonContainsPoint) {
+  // Points are degenerate edges, so they are tested as well.
+  auto a_index = s2textformat::MakeIndexOrDie("10:10 # #");
+  auto b_index = s2textformat::MakeIndexOrDie("# 0:0, 1:1 # 9:9, 9:12, 12:12");
+  S2MinDistance min_dist = S2MinDistance::Infinity();
+  ShapeEdgeId a_edge, b_edge;
+  EXPECT_TRUE((FindClosestEdgePair<S2MinDistance, MinDistanceOps>(
+      *a_index, *b_index, true, S1ChordAngle::Zero(), &min_dist, &a_edge,
+      &b_edge)));
+  EXPECT_EQ(S2MinDistance::Zero(), min_dist);
+  EXPECT_EQ(ShapeEdgeId(1, -1), b_edge);
+}
+
+}  // namespace
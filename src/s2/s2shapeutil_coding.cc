@@ -69,7 +69,10 @@ bool FastEncodeShape(const S2Shape& shape, Encoder* encoder) {
   }
 }
 
-bool CompactEncodeShape(const S2Shape& shape, Encoder* encoder) {
+// Encodes the standard S2Shape types, using "hint" for the vertices of
+// polylines and polygons.
+static bool CompactEncodeShapeWithHint(const S2Shape& shape, CodingHint hint,
+                                       Encoder* encoder) {
   switch (shape.type_tag()) {
     case S2Polygon::Shape::kTypeTag: {
       down_cast<const S2Polygon::Shape*>(&shape)->Encode(encoder);
@@ -81,13 +84,11 @@ bool CompactEncodeShape(const S2Shape& shape, Encoder* encoder) {
       return true;
     }
     case S2LaxPolylineShape::kTypeTag: {
-      down_cast<const S2LaxPolylineShape*>(&shape)->Encode(
-          encoder, CodingHint::COMPACT);
+      down_cast<const S2LaxPolylineShape*>(&shape)->Encode(encoder, hint);
       return true;
     }
     case S2LaxPolygonShape::kTypeTag: {
-      down_cast<const S2LaxPolygonShape*>(&shape)->Encode(
-          encoder, CodingHint::COMPACT);
+      down_cast<const S2LaxPolygonShape*>(&shape)->Encode(encoder, hint);
       return true;
     }
     default: {
@@ -96,6 +97,15 @@ bool CompactEncodeShape(const S2Shape& shape, Encoder* encoder) {
   }
 }
 
+bool CompactEncodeShape(const S2Shape& shape, Encoder* encoder) {
+  return CompactEncodeShapeWithHint(shape, CodingHint::COMPACT, encoder);
+}
+
+bool CompactDeltaEncodeShape(const S2Shape& shape, Encoder* encoder) {
+  return CompactEncodeShapeWithHint(shape, CodingHint::COMPACT_DELTAS,
+                                    encoder);
+}
+
 // A ShapeDecoder that fully decodes an S2Shape of the given type.  After this
 // function returns, the underlying Decoder data is no longer needed.
 unique_ptr<S2Shape> FullDecodeShape(S2Shape::TypeTag tag, Decoder* decoder) {
@@ -184,6 +194,11 @@ bool CompactEncodeTaggedShapes(const S2ShapeIndex& index, Encoder* encoder) {
   return EncodeTaggedShapes(index, CompactEncodeShape, encoder);
 }
 
+bool CompactDeltaEncodeTaggedShapes(const S2ShapeIndex& index,
+                                    Encoder* encoder) {
+  return EncodeTaggedShapes(index, CompactDeltaEncodeShape, encoder);
+}
+
 TaggedShapeFactory::TaggedShapeFactory(const ShapeDecoder& shape_decoder,
                                        Decoder* decoder)
     : shape_decoder_(shape_decoder) {
@@ -83,6 +83,16 @@ bool FastEncodeShape(const S2Shape& shape, Encoder* encoder);
 //           can be enlarged as necessary by calling Ensure(int).
 bool CompactEncodeShape(const S2Shape& shape, Encoder* encoder);
 
+// Like CompactEncodeShape, except that the vertices of polylines and polygons
+// may also be encoded as differences between consecutive vertices (see
+// s2coding::CodingHint::COMPACT_DELTAS).  This is often much smaller for
+// shapes whose vertices are spatially adjacent, at the cost of slower
+// random access to the vertices of lazily decoded shapes.
+//
+// REQUIRES: "encoder" uses the default constructor, so that its buffer
+//           can be enlarged as necessary by calling Ensure(int).
+bool CompactDeltaEncodeShape(const S2Shape& shape, Encoder* encoder);
+
 // A function that decodes an S2Shape of the given type, consuming data from
 // the given Decoder.  Returns nullptr on errors.
 using ShapeDecoder =
@@ -134,6 +144,14 @@ bool FastEncodeTaggedShapes(const S2ShapeIndex& index, Encoder* encoder);
 //           can be enlarged as necessary by calling Ensure(int).
 bool CompactEncodeTaggedShapes(const S2ShapeIndex& index, Encoder* encoder);
 
+// Convenience function that calls EncodeTaggedShapes using
+// CompactDeltaEncodeShape as the ShapeEncoder.
+//
+// REQUIRES: "encoder" uses the default constructor, so that its buffer
+//           can be enlarged as necessary by calling Ensure(int).
+bool CompactDeltaEncodeTaggedShapes(const S2ShapeIndex& index,
+                                    Encoder* encoder);
+
 // A ShapeFactory that decodes a vector generated by EncodeTaggedShapes()
 // above.  Example usage:
 //
@@ -19,7 +19,10 @@
 
 #include <gtest/gtest.h>
 #include "s2/util/coding/coder.h"
+#include "s2/encoded_s2shape_index.h"
+#include "s2/s2lax_polyline_shape.h"
 #include "s2/s2polygon.h"
+#include "s2/s2testing.h"
 #include "s2/s2text_format.h"
 
 using absl::make_unique;
@@ -51,4 +54,29 @@ TEST(FastEncodeTaggedShapes, MixedShapes) {
             s2textformat::ToString(decoded_index));
 }
 
+TEST(CompactDeltaEncodeTaggedShapes, MixedShapes) {
+  auto index = s2textformat::MakeIndexOrDie(
+      "0:0 | 0:1 # 1:1, 1:2, 1:3 # 2:2; 2:3, 2:4, 3:3");
+  // Add a polyline with many nearby vertices, which benefits from encoding
+  // each vertex as the difference from the previous one.
+  std::vector<S2Point> vertices;
+  for (int i = 0; i < 1000; ++i) {
+    S2Point p = S2LatLng::FromDegrees(10 + 2e-5 * i, 20 + 2e-5 * (i % 7))
+                    .ToPoint();
+    vertices.push_back(S2CellId(p).parent(22).ToPoint());
+  }
+  index->Add(make_unique<S2LaxPolylineShape>(vertices));
+
+  Encoder compact_encoder, encoder;
+  CompactEncodeTaggedShapes(*index, &compact_encoder);
+  CompactDeltaEncodeTaggedShapes(*index, &encoder);
+  EXPECT_LT(encoder.length(), compact_encoder.length());
+  index->Encode(&encoder);
+  Decoder decoder(encoder.base(), encoder.length());
+  EncodedS2ShapeIndex decoded_index;
+  ASSERT_TRUE(decoded_index.Init(&decoder, LazyDecodeShapeFactory(&decoder)));
+  EXPECT_EQ(s2textformat::ToString(*index),
+            s2textformat::ToString(decoded_index));
+}
+
 }  // namespace s2shapeutil
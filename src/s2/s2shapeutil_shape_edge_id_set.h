@@ -0,0 +1,184 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef S2_S2SHAPEUTIL_SHAPE_EDGE_ID_SET_H_
+#define S2_S2SHAPEUTIL_SHAPE_EDGE_ID_SET_H_
+
+#include <vector>
+
+#include "s2/base/integral_types.h"
+#include "s2/s2shapeutil_shape_edge_id.h"
+
+namespace s2shapeutil {
+
+// A set of ShapeEdgeIds that is designed to be cleared and refilled many
+// times, e.g. to keep track of the edges that have already been tested
+// during each call to S2ClosestEdgeQuery::FindClosestEdges().
+//
+// The set is an open-addressed hash table with linear probing.  Every slot is
+// stamped with the "epoch" in which it was filled, and slots from previous
+// epochs are treated as empty.  This means that Clear() takes constant time,
+// and since the table keeps its capacity from one epoch to the next, it
+// quickly grows to fit the number of ids that are typically inserted and
+// then no further memory allocation is needed.  If a single large epoch is
+// followed by many small ones, the table shrinks again (see Clear).
+class ShapeEdgeIdSet {
+ public:
+  // Constructs an empty set that can hold "expected_size" ids before the
+  // table needs to grow.
+  explicit ShapeEdgeIdSet(int expected_size = 0);
+
+  // Removes all ids from the set.  This takes constant time, except that
+  // every 2**32 calls the epoch stamps of all slots are reset.  In addition,
+  // every kShrinkInterval calls the table is shrunk if it is much larger
+  // than needed for the largest set since the previous check.
+  void Clear();
+
+  // Ensures that the set can hold "expected_size" ids without growing.
+  void Reserve(int expected_size);
+
+  // Inserts "id" and returns true, or returns false if "id" was already
+  // present.
+  bool Insert(ShapeEdgeId id);
+
+  // Returns true if the set contains "id".
+  bool Contains(ShapeEdgeId id) const;
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns the number of slots in the hash table (for testing).
+  int capacity() const { return slots_.size(); }
+
+ private:
+  struct Slot {
+    ShapeEdgeId id;
+    uint32 epoch;
+  };
+
+  // The table is at most half full.
+  static const int kMinCapacity = 16;
+  static const int kMaxLoadFactorInverse = 2;
+
+  // The table is shrunk when it has been at least kShrinkFactor times larger
+  // than necessary for the last kShrinkInterval epochs.
+  static const int kShrinkInterval = 256;
+  static const int kShrinkFactor = 8;
+
+  int Hash(ShapeEdgeId id) const;
+  int MinCapacity(int expected_size) const;
+  void Resize(int new_capacity);
+
+  std::vector<Slot> slots_;
+  int mask_ = 0;     // slots_.size() - 1
+  int shift_ = 64;   // 64 - log2(slots_.size())
+  uint32 epoch_ = 1;
+  int size_ = 0;
+
+  // The largest size of any epoch since the last shrink check, and the number
+  // of epochs until the next check.
+  int recent_max_size_ = 0;
+  int epochs_until_shrink_check_ = kShrinkInterval;
+};
+
+
+//////////////////   Implementation details follow   ////////////////////
+
+
+inline ShapeEdgeIdSet::ShapeEdgeIdSet(int expected_size) {
+  Reserve(expected_size);
+}
+
+inline void ShapeEdgeIdSet::Clear() {
+  if (size_ > recent_max_size_) recent_max_size_ = size_;
+  size_ = 0;
+  if (++epoch_ == 0) {
+    for (Slot& slot : slots_) slot.epoch = 0;
+    epoch_ = 1;
+  }
+  if (--epochs_until_shrink_check_ == 0) {
+    int min_capacity = MinCapacity(recent_max_size_);
+    if (capacity() >= kShrinkFactor * min_capacity) Resize(min_capacity);
+    recent_max_size_ = 0;
+    epochs_until_shrink_check_ = kShrinkInterval;
+  }
+}
+
+inline void ShapeEdgeIdSet::Reserve(int expected_size) {
+  int new_capacity = (capacity() > 0) ? capacity() : kMinCapacity;
+  while (new_capacity < kMaxLoadFactorInverse * expected_size) {
+    new_capacity *= 2;
+  }
+  if (new_capacity > capacity()) Resize(new_capacity);
+}
+
+// Returns the smallest capacity that can hold "expected_size" ids.
+inline int ShapeEdgeIdSet::MinCapacity(int expected_size) const {
+  int capacity = kMinCapacity;
+  while (capacity < kMaxLoadFactorInverse * expected_size) capacity *= 2;
+  return capacity;
+}
+
+inline int ShapeEdgeIdSet::Hash(ShapeEdgeId id) const {
+  // Fibonacci hashing: the high bits of the product depend on all the bits
+  // of both fields.
+  uint64 key = (static_cast<uint64>(static_cast<uint32>(id.shape_id)) << 32 |
+                static_cast<uint32>(id.edge_id));
+  return static_cast<int>((key * 0x9e3779b97f4a7c15ULL) >> shift_);
+}
+
+inline bool ShapeEdgeIdSet::Insert(ShapeEdgeId id) {
+  if (kMaxLoadFactorInverse * (size_ + 1) > capacity()) {
+    Resize((capacity() > 0) ? 2 * capacity() : kMinCapacity);
+  }
+  for (int i = Hash(id);; i = (i + 1) & mask_) {
+    Slot& slot = slots_[i];
+    if (slot.epoch != epoch_) {
+      slot.id = id;
+      slot.epoch = epoch_;
+      ++size_;
+      return true;
+    }
+    if (slot.id == id) return false;
+  }
+}
+
+inline bool ShapeEdgeIdSet::Contains(ShapeEdgeId id) const {
+  if (size_ == 0) return false;
+  for (int i = Hash(id);; i = (i + 1) & mask_) {
+    const Slot& slot = slots_[i];
+    if (slot.epoch != epoch_) return false;
+    if (slot.id == id) return true;
+  }
+}
+
+inline void ShapeEdgeIdSet::Resize(int new_capacity) {
+  std::vector<Slot> old_slots;
+  old_slots.swap(slots_);
+  slots_.assign(new_capacity, Slot{ShapeEdgeId(), 0});
+  mask_ = new_capacity - 1;
+  shift_ = 64;
+  for (int c = new_capacity; c > 1; c >>= 1) --shift_;
+  uint32 old_epoch = epoch_;
+  epoch_ = 1;
+  size_ = 0;
+  for (const Slot& slot : old_slots) {
+    if (slot.epoch == old_epoch) Insert(slot.id);
+  }
+}
+
+}  // namespace s2shapeutil
+
+#endif  // S2_S2SHAPEUTIL_SHAPE_EDGE_ID_SET_H_
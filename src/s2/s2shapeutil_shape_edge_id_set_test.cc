@@ -0,0 +1,111 @@
+// Copyright 2018 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS-IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "s2/s2shapeutil_shape_edge_id_set.h"
+
+#include <set>
+
+#include <gtest/gtest.h>
+#include "s2/s2testing.h"
+
+using s2shapeutil::ShapeEdgeId;
+using s2shapeutil::ShapeEdgeIdSet;
+
+namespace {
+
+TEST(ShapeEdgeIdSet, InsertAndContains) {
+  ShapeEdgeIdSet set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_FALSE(set.Contains(ShapeEdgeId(0, 0)));
+  EXPECT_TRUE(set.Insert(ShapeEdgeId(0, 0)));
+  EXPECT_TRUE(set.Insert(ShapeEdgeId(0, 1)));
+  EXPECT_TRUE(set.Insert(ShapeEdgeId(1, 0)));
+  EXPECT_FALSE(set.Insert(ShapeEdgeId(0, 1)));
+  EXPECT_EQ(3, set.size());
+  EXPECT_TRUE(set.Contains(ShapeEdgeId(1, 0)));
+  EXPECT_FALSE(set.Contains(ShapeEdgeId(1, 1)));
+}
+
+TEST(ShapeEdgeIdSet, ClearKeepsCapacity) {
+  ShapeEdgeIdSet set;
+  for (int i = 0; i < 1000; ++i) set.Insert(ShapeEdgeId(i % 7, i));
+  int capacity = set.capacity();
+  EXPECT_GE(capacity, 2000);
+  set.Clear();
+  EXPECT_TRUE(set.empty());
+  EXPECT_EQ(capacity, set.capacity());
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_FALSE(set.Contains(ShapeEdgeId(i % 7, i)));
+  }
+  EXPECT_TRUE(set.Insert(ShapeEdgeId(0, 0)));
+  EXPECT_EQ(1, set.size());
+}
+
+TEST(ShapeEdgeIdSet, ShrinksAfterManySmallEpochs) {
+  ShapeEdgeIdSet set;
+  for (int i = 0; i < 100000; ++i) set.Insert(ShapeEdgeId(0, i));
+  int large_capacity = set.capacity();
+  EXPECT_GE(large_capacity, 200000);
+  for (int iter = 0; iter < 1000; ++iter) {
+    set.Clear();
+    for (int i = 0; i < 10; ++i) set.Insert(ShapeEdgeId(1, i));
+  }
+  EXPECT_LE(set.capacity(), 64);
+  EXPECT_EQ(10, set.size());
+  for (int i = 0; i < 10; ++i) EXPECT_TRUE(set.Contains(ShapeEdgeId(1, i)));
+  EXPECT_FALSE(set.Contains(ShapeEdgeId(0, 0)));
+
+  // A set that is regularly filled does not shrink.
+  for (int iter = 0; iter < 1000; ++iter) {
+    set.Clear();
+    int n = (iter % 100 == 0) ? 1000 : 10;
+    for (int i = 0; i < n; ++i) set.Insert(ShapeEdgeId(1, i));
+  }
+  EXPECT_GE(set.capacity(), 2000);
+}
+
+TEST(ShapeEdgeIdSet, Reserve) {
+  ShapeEdgeIdSet set(100);
+  int capacity = set.capacity();
+  EXPECT_GE(capacity, 200);
+  for (int i = 0; i < 100; ++i) set.Insert(ShapeEdgeId(0, i));
+  EXPECT_EQ(capacity, set.capacity());
+  set.Reserve(1000);
+  EXPECT_GE(set.capacity(), 2000);
+  EXPECT_EQ(100, set.size());
+  for (int i = 0; i < 100; ++i) EXPECT_TRUE(set.Contains(ShapeEdgeId(0, i)));
+}
+
+TEST(ShapeEdgeIdSet, MatchesStdSet) {
+  // Compares against std::set over many rounds of inserting and clearing,
+  // so that slots from old epochs are frequently encountered.
+  ShapeEdgeIdSet set;
+  for (int iter = 0; iter < 1000; ++iter) {
+    std::set<ShapeEdgeId> expected;
+    set.Clear();
+    int num_inserts = S2Testing::rnd.Uniform(iter % 300 == 0 ? 5000 : 50);
+    for (int i = 0; i < num_inserts; ++i) {
+      ShapeEdgeId id(S2Testing::rnd.Uniform(3), S2Testing::rnd.Uniform(300));
+      EXPECT_EQ(expected.insert(id).second, set.Insert(id));
+      ASSERT_EQ(expected.size(), set.size());
+    }
+    for (int i = 0; i < 300; ++i) {
+      ShapeEdgeId id(S2Testing::rnd.Uniform(3), i);
+      EXPECT_EQ(expected.count(id) > 0, set.Contains(id));
+    }
+  }
+}
+
+}  // namespace
@@ -69,6 +69,11 @@ class Encoder {
   void put_varint32(uint32 v);
   void put_varint32_inline(uint32 v);
   void put_varint64(uint64 v);
+  // Puts v[0..n-1] as consecutive varints.  Requires that the encoder has
+  // room for exactly the encoded bytes, i.e. the sum of varintXX_length()
+  // over all values (n * kVarintMaxXX bytes is always sufficient).
+  void put_varint32_array(const uint32* v, int n);
+  void put_varint64_array(const uint64* v, int n);
   static int varint32_length(uint32 v);  // Length of var encoding of "v"
   static int varint64_length(uint64 v);  // Length of var encoding of "v"
 
@@ -185,6 +190,11 @@ class Decoder {
   // "get_varint" actually checks bounds
   bool get_varint32(uint32* v);
   bool get_varint64(uint64* v);
+  // Gets "n" consecutive varints into v[0..n-1].  This is much faster than
+  // calling get_varintXX() in a loop.  Returns false (leaving the decoder
+  // position unchanged) if fewer than "n" valid varints are available.
+  bool get_varint32_array(uint32* v, int n);
+  bool get_varint64_array(uint64* v, int n);
 
   size_t pos() const;
   // Return number of bytes decoded so far
@@ -286,6 +296,16 @@ inline void Encoder::put_varint64(uint64 v) {
          (Varint::Encode64(reinterpret_cast<char*>(buf_), v));
 }
 
+inline void Encoder::put_varint32_array(const uint32* v, int n) {
+  buf_ = reinterpret_cast<unsigned char*>
+         (Varint::Encode32Array(reinterpret_cast<char*>(buf_), v, n));
+}
+
+inline void Encoder::put_varint64_array(const uint64* v, int n) {
+  buf_ = reinterpret_cast<unsigned char*>
+         (Varint::Encode64Array(reinterpret_cast<char*>(buf_), v, n));
+}
+
 // Copies N bytes from *src to *dst then advances both pointers by N bytes.
 // Template parameter N specifies the number of bytes to copy. Passing
 // constant size results in optimized code from memcpy for the size.
@@ -550,4 +570,30 @@ inline bool Decoder::get_varint64(uint64* v) {
   return true;
 }
 
+inline bool Decoder::get_varint32_array(uint32* v, int n) {
+  if (n == 0) return true;  // The buffer may be nullptr.
+  const char* const r =
+      Varint::Parse32ArrayWithLimit(reinterpret_cast<const char*>(buf_),
+                                    reinterpret_cast<const char*>(limit_),
+                                    v, n);
+  if (r == nullptr) {
+    return false;
+  }
+  buf_ = reinterpret_cast<const unsigned char*>(r);
+  return true;
+}
+
+inline bool Decoder::get_varint64_array(uint64* v, int n) {
+  if (n == 0) return true;  // The buffer may be nullptr.
+  const char* const r =
+      Varint::Parse64ArrayWithLimit(reinterpret_cast<const char*>(buf_),
+                                    reinterpret_cast<const char*>(limit_),
+                                    v, n);
+  if (r == nullptr) {
+    return false;
+  }
+  buf_ = reinterpret_cast<const unsigned char*>(r);
+  return true;
+}
+
 #endif  // S2_UTIL_CODING_CODER_H_
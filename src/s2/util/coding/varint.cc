@@ -19,6 +19,8 @@
 #include <string>
 
 #include "s2/base/integral_types.h"
+#include "s2/util/bits/bits.h"
+#include "s2/util/endian/endian.h"
 
 #ifndef _MSC_VER
 const int Varint::kMax32;
@@ -287,3 +289,109 @@ void Varint::Append64Slow(string* s, uint64 value) {
   s->resize(start + Varint::Length64(value));
   Varint::Encode64(&((*s)[start]), value);
 }
+
+namespace {
+
+const uint64 kContinuationBits = 0x8080808080808080ULL;
+
+// Given the eight bytes starting at a varint of the given length (1 to 8
+// bytes) in little-endian order, returns the value of the varint.  The 7-bit
+// groups are gathered into adjacent bit positions with three shift-and-mask
+// steps rather than one step per byte.
+inline uint64 GatherVarint(uint64 word, int length) {
+  word &= ~uint64{0} >> (64 - 8 * length);
+  word &= ~kContinuationBits;
+  word = ((word & 0x7f007f007f007f00ULL) >> 1) |
+         (word & 0x007f007f007f007fULL);
+  word = ((word & 0x3fff00003fff0000ULL) >> 2) |
+         (word & 0x00003fff00003fffULL);
+  word = ((word & 0x0fffffff00000000ULL) >> 4) |
+         (word & 0x000000000fffffffULL);
+  return word;
+}
+
+const char* ParseWithLimit(const char* p, const char* l, uint32* OUTPUT) {
+  return Varint::Parse32WithLimit(p, l, OUTPUT);
+}
+
+const char* ParseWithLimit(const char* p, const char* l, uint64* OUTPUT) {
+  return Varint::Parse64WithLimit(p, l, OUTPUT);
+}
+
+template <class T>
+const char* ParseArrayWithLimit(const char* p, const char* l, T* OUTPUT,
+                                int n) {
+  // The maximum length of a varint whose value fits in a T.
+  const int kMaxLength = (sizeof(T) == 4) ? Varint::kMax32 : Varint::kMax64;
+  int i = 0;
+  while (i < n && l - p >= 8) {
+    const uint64 word = LittleEndian::Load64(p);
+    const uint64 continuation = word & kContinuationBits;
+    if ((continuation & 0x80) == 0) {
+      // Copy the run of single-byte values at the start of "word".
+      int run = (continuation == 0) ? 8 :
+                Bits::FindLSBSetNonZero64(continuation) >> 3;
+      if (run > n - i) run = n - i;
+      for (int k = 0; k < run; ++k) {
+        OUTPUT[i + k] = static_cast<uint8>(word >> (8 * k));
+      }
+      i += run;
+      p += run;
+      continue;
+    }
+    const uint64 stop = ~word & kContinuationBits;
+    if (stop == 0) {
+      // The varint is longer than eight bytes.
+      if (kMaxLength <= 8) return nullptr;
+      p = ParseWithLimit(p, l, &OUTPUT[i++]);
+      if (p == nullptr) return nullptr;
+      continue;
+    }
+    const int length = (Bits::FindLSBSetNonZero64(stop) >> 3) + 1;
+    const uint64 value = GatherVarint(word, length);
+    if (sizeof(T) == 4 && (length > kMaxLength || (value >> 32) != 0)) {
+      return nullptr;  // Value is too long to be a varint32.
+    }
+    OUTPUT[i++] = static_cast<T>(value);
+    p += length;
+  }
+  for (; i < n; ++i) {
+    p = ParseWithLimit(p, l, &OUTPUT[i]);
+    if (p == nullptr) return nullptr;
+  }
+  return p;
+}
+
+}  // namespace
+
+const char* Varint::Parse32ArrayWithLimit(const char* p, const char* l,
+                                          uint32* OUTPUT, int n) {
+  return ParseArrayWithLimit(p, l, OUTPUT, n);
+}
+
+const char* Varint::Parse64ArrayWithLimit(const char* p, const char* l,
+                                          uint64* OUTPUT, int n) {
+  return ParseArrayWithLimit(p, l, OUTPUT, n);
+}
+
+char* Varint::Encode32Array(char* ptr, const uint32* v, int n) {
+  for (int i = 0; i < n; ++i) {
+    if (v[i] < 128) {
+      *ptr++ = static_cast<char>(v[i]);
+    } else {
+      ptr = Encode32Inline(ptr, v[i]);
+    }
+  }
+  return ptr;
+}
+
+char* Varint::Encode64Array(char* ptr, const uint64* v, int n) {
+  for (int i = 0; i < n; ++i) {
+    if (v[i] < 128) {
+      *ptr++ = static_cast<char>(v[i]);
+    } else {
+      ptr = Encode64(ptr, v[i]);
+    }
+  }
+  return ptr;
+}
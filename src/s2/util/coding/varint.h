@@ -85,6 +85,22 @@ class Varint {
   static const char* Parse64WithLimit(const char* ptr, const char* limit,
                                       uint64* OUTPUT);
 
+  // Attempts to parse "n" consecutive varints from a prefix of the bytes in
+  // [ptr,limit-1] and store them in OUTPUT[0..n-1].  Never reads a character
+  // at or beyond limit.  Returns a pointer just past the last byte of the
+  // last varint, or nullptr if fewer than "n" valid varints were found (in
+  // which case the contents of OUTPUT are unspecified).
+  //
+  // This is much faster than calling ParseXXWithLimit in a loop.  Eight bytes
+  // are examined at a time: runs of single-byte values are copied directly,
+  // and values of up to eight bytes are assembled without per-byte branches
+  // (in the style of Masked VByte).  The scalar routines are used for the
+  // last few bytes of the buffer and for 64-bit values longer than 8 bytes.
+  static const char* Parse32ArrayWithLimit(const char* ptr, const char* limit,
+                                           uint32* OUTPUT, int n);
+  static const char* Parse64ArrayWithLimit(const char* ptr, const char* limit,
+                                           uint64* OUTPUT, int n);
+
   // REQUIRES   "ptr" points to the first byte of a varint-encoded value.
   // EFFECTS     Scans until the end of the varint and returns a pointer just
   //             past the last byte. Returns nullptr if "ptr" does not point to
@@ -114,6 +130,15 @@ class Varint {
   // routines, but its code size is large
   static char* Encode32Inline(char* ptr, uint32 v);
 
+  // REQUIRES   "ptr" points to a buffer whose length is at least the sum of
+  //            LengthXX(v[i]) over all values (n * kMaxXX is always enough)
+  // EFFECTS    Encodes v[0..n-1] as consecutive varints into "ptr" and
+  //            returns a pointer to the byte just past the last encoded byte.
+  //            The result can be decoded by ParseXXArrayWithLimit or by
+  //            calling ParseXX repeatedly.
+  static char* Encode32Array(char* ptr, const uint32* v, int n);
+  static char* Encode64Array(char* ptr, const uint64* v, int n);
+
   // EFFECTS    Returns the encoding length of the specified value.
   static int Length32(uint32 v);
   static int Length64(uint64 v);